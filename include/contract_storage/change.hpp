@@ -20,6 +20,7 @@ namespace contract
 			ContractBalanceChange();
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static ContractBalanceChange from_json(const jsondiff::JsonObject& json_obj);
 		};
 		struct ContractStorageItemChange
@@ -33,6 +34,7 @@ namespace contract
 			std::vector<ContractStorageItemChange> items;
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static ContractStorageChange from_json(const jsondiff::JsonObject& json_obj);
 		};
 		struct ContractEventInfo
@@ -43,6 +45,7 @@ namespace contract
 			std::string event_arg;
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static ContractEventInfo from_json(const jsondiff::JsonObject& json_obj);
 		};
 		struct ContractUpgradeInfo
@@ -52,6 +55,7 @@ namespace contract
 			jsondiff::DiffResultP description_diff;
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static ContractUpgradeInfo from_json(const jsondiff::JsonObject& json_obj);
 		};
 		struct ContractChanges
@@ -64,6 +68,7 @@ namespace contract
 			// TODO: chainsql changes
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static ContractChanges from_json(const jsondiff::JsonObject& json_obj);
 
 			static jsondiff::JsonArray events_to_json(const std::vector<ContractEventInfo>& events);
@@ -73,6 +78,8 @@ namespace contract
 		};
 		typedef std::shared_ptr<ContractChanges> ContractChangesP;
 
+		fcrypto::sha256 ordered_json_digest(const ContractChanges& changes);
+
 #define CONTRACT_INFO_CHANGE_TYPE "contract_info"
 #define CONTRACT_STORAGE_CHANGE_TYPE "storage_change"
 
@@ -15,12 +15,15 @@ namespace contract
 
 		typedef uint64_t AmountType;
 
+		class OrderedJsonDigestEncoder;
+
 		struct ContractBalance
 		{
 			uint32_t asset_id;
 			AmountType amount;
 
 			jsondiff::JsonObject to_json() const;
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static std::shared_ptr<ContractBalance> from_json(const jsondiff::JsonValue& json_value);
 		};
 
@@ -43,11 +46,47 @@ namespace contract
 			std::vector<ContractBalance> balances;
 
 			jsondiff::JsonObject to_json() const;
+			// feeds the same bytes ordered_json_digest(to_json()) hashes
+			void write_digest(OrderedJsonDigestEncoder& encoder) const;
 			static std::shared_ptr<ContractInfo> from_json(const jsondiff::JsonValue& json_value);
 		};
 		typedef std::shared_ptr<ContractInfo> ContractInfoP;
 
+		// hashes json_dumps of json_value with every object turned into an array of [key, value] pairs sorted by key
 		fcrypto::sha256 ordered_json_digest(const jsondiff::JsonValue& json_value);
+		fcrypto::sha256 ordered_json_digest(const ContractInfo& contract_info);
+
+		// streams the canonical json of ordered_json_digest into sha256, so callers can walk their own structures
+		// in sorted key order instead of building a json value and dumping it
+		class OrderedJsonDigestEncoder
+		{
+		public:
+			OrderedJsonDigestEncoder();
+
+			void begin_array();
+			void end_array();
+			// opens the [key, value] pair of an object member, closed by end_array
+			void begin_member(const std::string& key);
+
+			void write_string(const std::string& value);
+			void write_uint(uint64_t value);
+			void write_bool(bool value);
+			void write_value(const jsondiff::JsonValue& value);
+
+			fcrypto::sha256 result();
+
+		private:
+			void write_separator();
+			void write_raw(const char* data, size_t size);
+			void write_object(const fjson::variant_object& obj);
+			void flush();
+
+		private:
+			fcrypto::sha256::encoder _encoder;
+			char _buffer[1024];
+			size_t _buffer_size;
+			bool _need_separator;
+		};
 		
 	}
 }
@@ -13,6 +13,8 @@
 #include <boost/uuid/sha1.hpp>
 #include <exception>
 #include <memory>
+#include <map>
+#include <boost/optional.hpp>
 #include <leveldb/db.h>
 #include <sqlite3.h>
 
@@ -29,18 +31,51 @@ namespace contract
 			uint32_t _magic_number;
 			std::string _storage_db_path;
 			std::string _storage_sql_db_path;
+			bool _overlay_enabled = false;
+			// key => value written while in overlay mode, boost::none for deleted keys
+			std::map<std::string, boost::optional<std::string>> _overlay_kv;
+			// overlay content when the current storage transaction began, restored on rollback
+			std::map<std::string, boost::optional<std::string>> _overlay_kv_before_transaction;
+			bool _read_only = false;
+			// an instance of get_overlay_instance, which never writes to the dbs, even after close and open
+			bool _overlay_only = false;
+			// snapshot all key-value reads of a read-only instance are done at
+			const leveldb::Snapshot* _read_snapshot = nullptr;
+			uint64_t _read_snapshot_version = 0;
+			// whether this read-only snapshot holds a sql read transaction, which needs the sql db in wal mode
+			bool _sql_snapshot_pinned = false;
+			// released_sql_snapshots when this instance last checkpointed the wal of the sql db
+			uint64_t _checkpointed_sql_snapshots = 0;
+			// contract infos parsed by a read-only instance, they can't change under its snapshot
+			mutable std::map<std::string, ContractInfoP> _contract_info_cache;
 		public:
 			// suggest use get_instance
 			ContractStorageService(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path, bool auto_open = true);
 			~ContractStorageService();
 
 			static std::shared_ptr<ContractStorageService> get_instance(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path);
+			// a read-only instance over a leveldb snapshot of the current contract state. it doesn't hold
+			// the lock of get_instance, so it can be used concurrently with the instance of get_instance.
+			// it is always in overlay mode and its sql db is opened read-only, so contract changes can't be committed to it
+			static std::shared_ptr<ContractStorageService> get_read_only_snapshot(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path);
+			// a private instance in overlay mode: changes are applied to an in-memory cache on top of the dbs instead of
+			// being written to them, and are thrown away when it is released. it holds the lock of get_instance until then,
+			// so the state under the overlay doesn't change, but only the overlay instance sees the overlay
+			static std::shared_ptr<ContractStorageService> get_overlay_instance(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path);
+			// whether instances opened from now on switch the sql db to write-ahead logging, which lets read-only
+			// snapshots pin the sql db without blocking commits. the switch is kept in the db file, so it is off by default
+			static void set_sql_wal_enabled(bool enabled);
 			
 			// these apis may throws boost::exception
 			void open();
 			void close();
 			bool is_open() const;
 
+			bool in_overlay() const { return _overlay_enabled; }
+			bool is_read_only_snapshot() const { return _read_only; }
+			// whether nothing was written to the dbs since this read-only snapshot was taken
+			bool is_snapshot_latest() const;
+
 			ContractInfoP get_contract_info(const AddressType& contract_id) const;
 			ContractCommitId save_contract_info(ContractInfoP contract_info);
 			AddressType find_contract_id_by_name(const std::string& name) const;
@@ -80,6 +115,13 @@ namespace contract
 		private:
 			// check db opened? if not, throw boost::exception
 			void check_db() const;
+			void begin_overlay();
+			// drops the overlay. a failing sql rollback is logged and the sql db reopened, as this runs from destructors
+			void end_overlay() noexcept;
+			// key-value db access, going through the in-memory overlay when it is enabled
+			leveldb::Status db_get(const leveldb::ReadOptions& options, const std::string& key, std::string* value) const;
+			leveldb::Status db_put(const leveldb::WriteOptions& options, const std::string& key, const std::string& value);
+			leveldb::Status db_delete(const leveldb::WriteOptions& options, const std::string& key);
 			void begin_sql_transaction();
 			void commit_sql_transaction();
 			void rollback_sql_transaction();
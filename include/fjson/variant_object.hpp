@@ -6,6 +6,7 @@
 namespace fjson
 {
    class mutable_variant_object;
+   class object_key_index;
    
    /**
     *  @ingroup Serializable
@@ -15,8 +16,11 @@ namespace fjson
     *  Keys are kept in the order they are inserted.
     *  This dictionary implements copy-on-write
     *
-    *  @note This class is not optimized for random-access on large
-    *        sets of key-value pairs.
+    *  @note Objects with object_key_index::min_object_size or more keys
+    *        carry a hashed index, so find() on them does not scan the entries.
+    *        The index is shared along with the entries. The one exception is
+    *        an unindexed object whose entries are shared when it is assigned a
+    *        large mutable_variant_object, see operator=( const mutable_variant_object& ).
     */
    class variant_object
    {
@@ -83,10 +87,12 @@ namespace fjson
       variant_object& operator=( const variant_object& );
 
       variant_object& operator=( mutable_variant_object&& );
+      /** Overwrites the entries in place, so every copy sharing them sees the new ones */
       variant_object& operator=( const mutable_variant_object& );
 
    private:
       std::shared_ptr< std::vector< entry > > _key_value;
+      std::shared_ptr< object_key_index >     _index; ///< null while the object is small
       friend class mutable_variant_object;
    };
    /** @ingroup Serializable */
@@ -95,6 +101,34 @@ namespace fjson
    void from_variant( const variant& var,  variant_object& vo );
 
 
+   /**
+    *  @brief Hash index from the keys of an object's entries to the position of
+    *         the first entry holding each key.
+    *
+    *  Slots are open addressed and store positions only, the keys are compared
+    *  against the entries themselves.
+    */
+   class object_key_index
+   {
+   public:
+      /** objects smaller than this are searched linearly */
+      static const size_t min_object_size = 32;
+
+      explicit object_key_index( const std::vector< variant_object::entry >& entries );
+
+      /** indexes entries.back(), which must have just been appended */
+      void add( const std::vector< variant_object::entry >& entries );
+      /** @return the position of the first entry with \a key, or entries.size() */
+      size_t find( const std::vector< variant_object::entry >& entries, const char* key )const;
+
+   private:
+      void insert( const std::vector< variant_object::entry >& entries, size_t pos );
+      void rehash( const std::vector< variant_object::entry >& entries, size_t slot_count );
+
+      std::vector< uint32_t > _slots; ///< entry position + 1, 0 when empty
+      size_t                  _count;
+   };
+
   /**
    *  @ingroup Serializable
    *
@@ -103,8 +137,8 @@ namespace fjson
    *  Keys are kept in the order they are inserted.
    *  This dictionary implements copy-on-write
    *
-   *  @note This class is not optimized for random-access on large
-   *        sets of key-value pairs.
+   *  @note Large objects are indexed the same way as variant_object. Keys
+   *        must not be replaced through the mutable iterators, only values.
    */
    class mutable_variant_object
    {
@@ -213,7 +247,11 @@ namespace fjson
       mutable_variant_object& operator=( const mutable_variant_object& );
       mutable_variant_object& operator=( const variant_object& );
    private:
+      void indexed_back();
+      void reindex();
+
       std::unique_ptr< std::vector< entry > > _key_value;
+      std::unique_ptr< object_key_index >     _index; ///< null while the object is small
       friend class variant_object;
    };
    /** @ingroup Serializable */
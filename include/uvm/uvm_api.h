@@ -424,7 +424,54 @@ typedef struct UvmStorageChangeItem
 
 
 
-typedef std::list<UvmStorageChangeItem> UvmStorageChangeList;
+// storage change history of a lua_State, in change order.
+// also keeps the latest change item of each storage slot(contract, property, fast map key),
+// so reading a property already touched in this execution is a hash lookup instead of a scan of the whole history.
+// the history is only changed through push_back and clear, which keep the latest change items in sync with it
+class UvmStorageChangeList
+{
+public:
+	typedef std::list<UvmStorageChangeItem>::const_iterator const_iterator;
+
+	static std::string slot_key(const std::string& contract_id, const std::string& key, const std::string& fast_map_key, bool is_fast_map)
+	{
+		std::string result;
+		result.reserve(contract_id.size() + key.size() + fast_map_key.size() + 3);
+		result.append(contract_id).push_back('\0');
+		result.append(key).push_back('\0');
+		result.append(fast_map_key).push_back(is_fast_map ? '1' : '0');
+		return result;
+	}
+
+	void push_back(const UvmStorageChangeItem& item)
+	{
+		_items.push_back(item);
+		const auto& added = _items.back();
+		latest_changes[slot_key(added.contract_id, added.key, added.fast_map_key, added.is_fast_map)] = &added;
+	}
+
+	void clear()
+	{
+		_items.clear();
+		latest_changes.clear();
+	}
+
+	const_iterator begin() const { return _items.begin(); }
+	const_iterator end() const { return _items.end(); }
+	size_t size() const { return _items.size(); }
+	bool empty() const { return _items.empty(); }
+
+	// latest change item of the storage slot, nullptr if the slot not changed/read yet
+	const UvmStorageChangeItem* find_latest(const std::string& contract_id, const std::string& key, const std::string& fast_map_key, bool is_fast_map) const
+	{
+		auto found = latest_changes.find(slot_key(contract_id, key, fast_map_key, is_fast_map));
+		return found == latest_changes.end() ? nullptr : found->second;
+	}
+
+private:
+	std::list<UvmStorageChangeItem> _items;
+	std::unordered_map<std::string, const UvmStorageChangeItem*> latest_changes;
+};
 
 typedef std::list<UvmStorageChangeItem> UvmStorageTableReadList;
 
@@ -434,7 +481,7 @@ bool luaL_commit_storage_changes(lua_State *L);
 
 bool lua_push_storage_value(lua_State *L, const UvmStorageValue &value);
 
-UvmStorageValue json_to_uvm_storage_value(lua_State *L, jsondiff::JsonValue json_value);
+UvmStorageValue json_to_uvm_storage_value(lua_State *L, const jsondiff::JsonValue& json_value);
 jsondiff::JsonValue uvm_storage_value_to_json(UvmStorageValue value);
 
 typedef std::unordered_map<std::string, UvmStorageChangeItem> ContractChangesMap;
@@ -0,0 +1,125 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <jsondiff/jsondiff.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+// allocations are only counted on a thread inside an AllocationCountingScope, other
+// benchmarks of bench_bitcoin allocate through malloc as the default operator new does
+static thread_local uint64_t* g_allocation_counter = nullptr;
+
+class AllocationCountingScope
+{
+public:
+    explicit AllocationCountingScope(uint64_t& counter) : m_prev_counter(g_allocation_counter) { g_allocation_counter = &counter; }
+    ~AllocationCountingScope() { g_allocation_counter = m_prev_counter; }
+
+private:
+    uint64_t* m_prev_counter;
+};
+
+void* operator new(std::size_t size)
+{
+    if (g_allocation_counter) {
+        ++*g_allocation_counter;
+    }
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+// runs the benchmark loop and prints the allocations per iteration to stderr, next to the timings on stdout
+template <typename Func>
+static void RunCountingAllocations(benchmark::State& state, Func func)
+{
+    uint64_t allocations = 0;
+    while (state.KeepRunning()) {
+        AllocationCountingScope scope(allocations);
+        func();
+    }
+    std::cerr << state.m_name << ": " << allocations / (state.m_num_evals * state.m_num_iters) << " allocations per iteration" << std::endl;
+}
+
+// a token contract's balances storage: address => amount, with one nested allowance map per holder
+static jsondiff::JsonValue MakeStorageMap(size_t holders)
+{
+    jsondiff::JsonObject users;
+    for (size_t i = 0; i < holders; i++) {
+        jsondiff::JsonObject allowed;
+        allowed["U" + std::to_string(i + 1)] = (int64_t) (i * 7);
+        users["U" + std::to_string(i)] = (int64_t) (1000000 + i);
+        users["A" + std::to_string(i)] = allowed;
+    }
+    return users;
+}
+
+// the storage map after one transfer between two holders
+static jsondiff::JsonValue MakeTransferredStorageMap(const jsondiff::JsonValue& before, size_t holders)
+{
+    jsondiff::JsonObject users(before.get_object());
+    users["U0"] = (int64_t) (1000000 - 50);
+    users["U" + std::to_string(holders - 1)] = (int64_t) (1000000 + holders - 1 + 50);
+    return users;
+}
+
+static void JsonDiffStorageMap(benchmark::State& state)
+{
+    jsondiff::JsonDiff differ;
+    const auto before = MakeStorageMap(1000);
+    const auto after = MakeTransferredStorageMap(before, 1000);
+    RunCountingAllocations(state, [&] {
+        auto diff = differ.diff(before, after);
+        assert(!diff->is_undefined());
+    });
+}
+
+static void JsonDiffIdenticalStorageMap(benchmark::State& state)
+{
+    jsondiff::JsonDiff differ;
+    const auto before = MakeStorageMap(1000);
+    const auto after = MakeStorageMap(1000);
+    RunCountingAllocations(state, [&] {
+        auto diff = differ.diff(before, after);
+        assert(diff->is_undefined());
+    });
+}
+
+static void JsonPatchStorageMap(benchmark::State& state)
+{
+    jsondiff::JsonDiff differ;
+    const auto before = MakeStorageMap(1000);
+    const auto diff = differ.diff(before, MakeTransferredStorageMap(before, 1000));
+    RunCountingAllocations(state, [&] {
+        differ.patch(before, diff);
+    });
+}
+
+static void JsonRollbackStorageMap(benchmark::State& state)
+{
+    jsondiff::JsonDiff differ;
+    const auto before = MakeStorageMap(1000);
+    const auto after = MakeTransferredStorageMap(before, 1000);
+    const auto diff = differ.diff(before, after);
+    RunCountingAllocations(state, [&] {
+        differ.rollback(after, diff);
+    });
+}
+
+BENCHMARK(JsonDiffStorageMap, 2000);
+BENCHMARK(JsonDiffIdenticalStorageMap, 2000);
+BENCHMARK(JsonPatchStorageMap, 8000);
+BENCHMARK(JsonRollbackStorageMap, 8000);
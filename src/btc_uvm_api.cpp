@@ -32,13 +32,12 @@
 #include <fjson/crypto/hex.hpp>
 #include <Keccak.hpp>
 
-extern CChain chainActive;
-
 namespace uvm {
     namespace lua {
         namespace api {
 
-            static int has_error = 0;
+            // per thread, contracts of one block are executed on several threads at once
+            static thread_local int has_error = 0;
 
             /**
             * whether exception happen in L
@@ -102,11 +101,36 @@ namespace uvm {
                 return (::blockchain::contract::PendingState*) uvm::lua::lib::get_lua_state_value(L, "evaluator").pointer_value;
             }
 
+			// the tip the contracts are executed on. it is taken with the storage state, so the
+			// vm doesn't read chainActive, which may have moved on without cs_main
+			static const CBlockIndex* get_chain_tip(lua_State *L)
+			{
+				auto evaluator = get_evaluator(L);
+				assert(evaluator && evaluator->pindexTip);
+				return evaluator->pindexTip;
+			}
+
 			static ::contract::storage::ContractStorageService* get_contract_storage_service(lua_State *L)
 			{
 				return (::contract::storage::ContractStorageService*) uvm::lua::lib::get_lua_state_value(L, "storage_service").pointer_value;
 			}
 
+			// contract info/balance reads are recorded as the contract's empty storage key,
+			// contract name lookups as the name under an empty contract id
+			static void record_contract_info_read(lua_State *L, const std::string& address)
+			{
+				auto evaluator = get_evaluator(L);
+				if (evaluator)
+					evaluator->record_storage_read(address, std::string());
+			}
+
+			static void record_contract_name_read(lua_State *L, const std::string& name)
+			{
+				auto evaluator = get_evaluator(L);
+				if (evaluator)
+					evaluator->record_storage_read(std::string(), name);
+			}
+
             /**
             * check whether the contract apis limit over, in this lua_State
             * @param L the lua stack
@@ -126,6 +150,7 @@ namespace uvm {
             {
                 auto service = get_contract_storage_service(L);
                 FJSON_ASSERT(service != nullptr);
+                record_contract_name_read(L, std::string(name));
                 auto&& addr = service->find_contract_id_by_name(std::string(name));
                 if(addr.empty())
                     return 0;
@@ -169,6 +194,7 @@ namespace uvm {
             {
                 if(!contract_info_ret)
                     return 0;
+                record_contract_info_read(L, std::string(contract_id));
                 auto evaluator = get_evaluator(L);
                 for(const auto &pair : evaluator->pending_contracts_to_create)
                 {
@@ -238,6 +264,7 @@ namespace uvm {
                 auto service = get_contract_storage_service(L);
                 if(!service)
                     return;
+                record_contract_name_read(L, std::string(name));
                 auto&& contract_id = service->find_contract_id_by_name(name);
                 if(contract_id.empty())
                 {
@@ -254,6 +281,7 @@ namespace uvm {
 
             bool BtcUvmChainApi::check_contract_exist_by_address(lua_State *L, const char *address)
             {
+                record_contract_info_read(L, std::string(address));
                 auto evaluator = get_evaluator(L);
                 for(const auto &pair : evaluator->pending_contracts_to_create)
                 {
@@ -276,6 +304,7 @@ namespace uvm {
                 auto service = get_contract_storage_service(L);
                 if(!service)
                     return false;
+                record_contract_name_read(L, std::string(name));
                 auto&& contract_id = service->find_contract_id_by_name(std::string(name));
                 if(contract_id.empty())
                     return false;
@@ -291,6 +320,7 @@ namespace uvm {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
                 auto service = get_contract_storage_service(L);
                 FJSON_ASSERT(service != nullptr);
+                record_contract_name_read(L, std::string(name));
                 auto&& addr = service->find_contract_id_by_name(std::string(name));
                 auto evaluator = get_evaluator(L);
                 for(const auto &pair : evaluator->pending_contracts_to_create)
@@ -340,6 +370,7 @@ namespace uvm {
             std::shared_ptr<UvmModuleByteStream> BtcUvmChainApi::open_contract_by_address(lua_State *L, const char *address)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
+                record_contract_info_read(L, std::string(address));
                 auto evaluator = get_evaluator(L);
                 for(const auto &pair : evaluator->pending_contracts_to_create) {
                     if (pair.first == std::string(address)) {
@@ -389,6 +420,7 @@ namespace uvm {
             {
                 auto service = get_contract_storage_service(L);
                 FJSON_ASSERT(service != nullptr);
+				record_contract_name_read(L, std::string(contract_name));
 				auto&& contract_address = service->find_contract_id_by_name(std::string(contract_name));
                 FJSON_ASSERT(!contract_address.empty());
 				return get_storage_value_from_uvm_by_address(L, contract_address.c_str(), name, flat_map_key, is_flat_map);
@@ -403,6 +435,8 @@ namespace uvm {
                 if(is_flat_map) {
                     storage_key = name + "." + flat_map_key;
                 }
+				if (evaluator)
+					evaluator->record_storage_read(std::string(contract_address), storage_key);
 				auto json_value = storage_service->get_contract_storage(std::string(contract_address), storage_key);
 				UvmStorageValue value = json_to_uvm_storage_value(L, json_value);
                 return value;
@@ -642,6 +676,7 @@ namespace uvm {
                     return 0;
                 if(std::string(asset_symbol) != get_system_asset_symbol(L))
                     return 0;
+                record_contract_info_read(L, std::string(contract_address));
                 const auto& balances = service->get_contract_balances(std::string(contract_address));
                 for(const auto& balance : balances) {
                     if(balance.asset_id==0) {
@@ -661,19 +696,16 @@ namespace uvm {
             uint32_t BtcUvmChainApi::get_chain_now(lua_State *L)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
-                auto bindex = chainActive.Tip();
+                auto bindex = get_chain_tip(L);
                 return bindex->nTime;
             }
 
             uint32_t BtcUvmChainApi::get_chain_random(lua_State *L)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
-                auto bindex = chainActive.Tip();
-                CBlock block;
-                auto res = ReadBlockFromDisk(block, bindex, Params().GetConsensus());
-                if(!res)
-                    return 0;
-				auto hash = block.GetHash();
+                // the hash of the block index is the hash of the block, no need to read it from disk
+                auto bindex = get_chain_tip(L);
+				auto hash = bindex->GetBlockHash();
 				return uint32_t(hash.GetUint64(2)) % ((1 << 31) - 1);
             }
 
@@ -688,14 +720,14 @@ namespace uvm {
             uint32_t BtcUvmChainApi::get_header_block_num(lua_State *L)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
-				auto bindex = chainActive.Tip();
+				auto bindex = get_chain_tip(L);
 				return bindex->nHeight;
             }
 
             uint32_t BtcUvmChainApi::wait_for_future_random(lua_State *L, int next)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
-				auto bindex = chainActive.Tip();
+				auto bindex = get_chain_tip(L);
 				auto target = bindex->nHeight + next;
 				if (target < next)
 					return 0;
@@ -706,22 +738,14 @@ namespace uvm {
             int32_t BtcUvmChainApi::get_waited(lua_State *L, uint32_t num)
             {
                 uvm::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
-				auto bindex = chainActive.Tip();
+				auto bindex = get_chain_tip(L);
 				if (bindex->nHeight < num || num < 1)
 					return 0;
-				CBlockIndex* cur_index = bindex;
-				while (true) {
-					if (!cur_index)
-						return 0;
-					if (cur_index->nHeight == num)
-						break;
-					cur_index = cur_index->pprev;
-				}
-				CBlock block;
-				auto res = ReadBlockFromDisk(block, cur_index, Params().GetConsensus());
-				if (!res)
+				// the ancestors of a block index never change, so they can be read without cs_main
+				const CBlockIndex* cur_index = bindex->GetAncestor(num);
+				if (!cur_index)
 					return 0;
-				auto hash = block.GetHash();
+				auto hash = cur_index->GetBlockHash();
 				return int32_t(hash.GetUint64(2)) % ((1 << 31) - 1);
             }
 
@@ -112,10 +112,55 @@ CBlockIndex* CBlockIndex::GetAncestor(int height)
     return const_cast<CBlockIndex*>(static_cast<const CBlockIndex*>(this)->GetAncestor(height));
 }
 
+const CBlockIndex* CBlockIndex::GetPosAncestor(int nCount) const
+{
+    if (nCount > nChainPosBlocks || nCount < 1) {
+        return nullptr;
+    }
+
+    // the same walk as GetAncestor, over the proof of stake blocks only
+    const CBlockIndex* pindexWalk = pindexLastPos;
+    int countWalk = nChainPosBlocks;
+    while (countWalk > nCount) {
+        int countSkip = GetSkipHeight(countWalk);
+        int countSkipPrev = GetSkipHeight(countWalk - 1);
+        if (pindexWalk->pskipPos != nullptr &&
+            (countSkip == nCount ||
+             (countSkip > nCount && !(countSkipPrev < countSkip - 2 &&
+                                      countSkipPrev >= nCount)))) {
+            pindexWalk = pindexWalk->pskipPos;
+            countWalk = countSkip;
+        } else {
+            assert(pindexWalk->pprev);
+            pindexWalk = pindexWalk->pprev->pindexLastPos;
+            countWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+CBlockIndex* CBlockIndex::GetPosAncestor(int nCount)
+{
+    return const_cast<CBlockIndex*>(static_cast<const CBlockIndex*>(this)->GetPosAncestor(nCount));
+}
+
 void CBlockIndex::BuildSkip()
 {
     if (pprev)
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+
+    CBlockIndex* pindexPrevPos = pprev ? pprev->pindexLastPos : nullptr;
+    if (IsProofOfStake()) {
+        pindexLastPos = this;
+        nChainPosBlocks = (pprev ? pprev->nChainPosBlocks : 0) + 1;
+        nPosBitsRun = (pindexPrevPos && pindexPrevPos->nBits == nBits) ? pindexPrevPos->nPosBitsRun + 1 : 1;
+        pskipPos = pindexPrevPos ? pindexPrevPos->GetPosAncestor(GetSkipHeight(nChainPosBlocks)) : nullptr;
+    } else {
+        pindexLastPos = pindexPrevPos;
+        nChainPosBlocks = pprev ? pprev->nChainPosBlocks : 0;
+        nPosBitsRun = pprev ? pprev->nPosBitsRun : 0;
+        pskipPos = nullptr;
+    }
 }
 
 arith_uint256 GetBlockProof(const CBlockIndex& block)
@@ -143,7 +188,7 @@ int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& fr
         r = from.nChainWork - to.nChainWork;
         sign = -1;
     }
-    r = r * arith_uint256(params.nPowTargetSpacing) / GetBlockProof(tip);
+    r = r * arith_uint256(params.PowTargetSpacingAt(tip.nHeight + 1)) / GetBlockProof(tip);
     if (r.bits() > 63) {
         return sign * std::numeric_limits<int64_t>::max();
     }
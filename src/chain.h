@@ -12,6 +12,7 @@
 #include <tinyformat.h>
 #include <uint256.h>
 
+#include <atomic>
 #include <vector>
 
 /**
@@ -167,6 +168,26 @@ enum BlockStatus: uint32_t {
  * candidates to be the next block. A blockindex may have multiple pprev pointing
  * to it, but at most one of them can be part of the currently active branch.
  */
+/**
+ * The nBits GetNextWorkRequired computed for the proof of work and the proof of stake successors
+ * of a block. Any thread may fill it in, 0 stands for not computed yet. A copy starts empty.
+ */
+class CNextWorkCache
+{
+private:
+    std::atomic<uint32_t> nPowBits;
+    std::atomic<uint32_t> nPosBits;
+
+public:
+    CNextWorkCache() : nPowBits(0), nPosBits(0) {}
+    CNextWorkCache(const CNextWorkCache&) : CNextWorkCache() {}
+    CNextWorkCache& operator=(const CNextWorkCache&) { Clear(); return *this; }
+
+    uint32_t Get(bool fProofOfStake) const { return (fProofOfStake ? nPosBits : nPowBits).load(std::memory_order_relaxed); }
+    void Set(bool fProofOfStake, uint32_t nBits) { (fProofOfStake ? nPosBits : nPowBits).store(nBits, std::memory_order_relaxed); }
+    void Clear() { nPowBits.store(0, std::memory_order_relaxed); nPosBits.store(0, std::memory_order_relaxed); }
+};
+
 class CBlockIndex
 {
 public:
@@ -219,6 +240,21 @@ public:
     //! (memory only) Maximum nTime in the chain up to and including this block.
     unsigned int nTimeMax;
 
+    //! (memory only) The last proof of stake block in the chain up to and including this block
+    CBlockIndex* pindexLastPos;
+
+    //! (memory only) Number of proof of stake blocks in the chain up to and including this block
+    int nChainPosBlocks;
+
+    //! (memory only) Number of proof of stake blocks in a row, ending at pindexLastPos, with the nBits of pindexLastPos
+    int nPosBitsRun;
+
+    //! (memory only) pointer to some further proof of stake predecessor, like pskip but counted in proof of stake blocks
+    CBlockIndex* pskipPos;
+
+    //! (memory only) nBits required of the blocks building on this one, see GetNextWorkRequired
+    mutable CNextWorkCache nextWork;
+
     void SetNull()
     {
         phashBlock = nullptr;
@@ -234,6 +270,11 @@ public:
         nStatus = 0;
         nSequenceId = 0;
         nTimeMax = 0;
+        pindexLastPos = nullptr;
+        nChainPosBlocks = 0;
+        nPosBitsRun = 0;
+        pskipPos = nullptr;
+        nextWork.Clear();
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -359,12 +400,16 @@ public:
         return false;
     }
 
-    //! Build the skiplist pointer for this entry.
+    //! Build the skiplist pointers and the proof of stake summary for this entry, pprev's must be built.
     void BuildSkip();
 
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
+
+    //! Efficiently find the proof of stake ancestor of this block that was the nCount'th one in its chain.
+    CBlockIndex* GetPosAncestor(int nCount);
+    const CBlockIndex* GetPosAncestor(int nCount) const;
 };
 
 arith_uint256 GetBlockProof(const CBlockIndex& block);
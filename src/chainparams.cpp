@@ -11,6 +11,7 @@
 #include <utilstrencodings.h>
 
 #include <assert.h>
+#include <limits>
 
 #include <chainparamsseeds.h>
 #include <chain.h>
@@ -128,6 +129,7 @@ public:
 
 	    consensus.ForkV3Height = 783300;
 	    consensus.SCANBADTX_Height = 788000;
+	    consensus.NATIVE_TOKEN_Height = std::numeric_limits<int>::max(); // not scheduled yet
 	    consensus.ForkV4Height = 813500;
 	    UB_FORK4_BLOCK_NUM = consensus.ForkV4Height;
 
@@ -145,8 +147,8 @@ public:
         consensus.nPowTargetSpacing = 10 * 60;
         consensus.fPowAllowMinDifficultyBlocks = false;
         consensus.fPowNoRetargeting = false;
-        consensus.nRuleChangeActivationThreshold = 1916; // 95% of 2016
-        consensus.nMinerConfirmationWindow = 2016; // nPowTargetTimespan / nPowTargetSpacing
+        consensus.nRuleChangeActivationThreshold = 190; // 95% of 200
+        consensus.nMinerConfirmationWindow = 200; // the difficulty adjustment interval after the UBC fork's initial blocks
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].bit = 28;
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].nStartTime = 1199145601; // January 1, 2008
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].nTimeout = 1230767999; // December 31, 2008
@@ -264,6 +266,7 @@ public:
         consensus.UBCInitBlockCount = 0; // 500
         consensus.UBCONTRACT_Height = 100;
         consensus.SCANBADTX_Height = 100;
+        consensus.NATIVE_TOKEN_Height = std::numeric_limits<int>::max(); // not scheduled yet
 	    // Fork to adjust block interval (ForkV1)
     	consensus.ForkV1Height = 50;
     	UB_FORK1_BLOCK_NUM = consensus.ForkV1Height;
@@ -288,8 +291,8 @@ public:
         consensus.nPowTargetSpacing = 1;
         consensus.fPowAllowMinDifficultyBlocks = true;
         consensus.fPowNoRetargeting = false;
-        consensus.nRuleChangeActivationThreshold = 1512; // 75% for testchains
-        consensus.nMinerConfirmationWindow = 2016; // nPowTargetTimespan / nPowTargetSpacing
+        consensus.nRuleChangeActivationThreshold = 190; // 95% of 200, as on mainnet
+        consensus.nMinerConfirmationWindow = 200; // the difficulty adjustment interval after the UBC fork's initial blocks
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].bit = 28;
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].nStartTime = 0;
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].nTimeout = Consensus::BIP9Deployment::NO_TIMEOUT;
@@ -367,6 +370,7 @@ public:
         consensus.is_regtest_net = true;
 
         consensus.nSubsidyHalvingInterval = 150;
+        consensus.nStakeMinConfirmations = 10;
         consensus.BIP16Height = 0; // always enforce P2SH BIP16 on regtest
         consensus.BIP34Height = 100000000; // BIP34 has not activated on regtest (far in the future so block v1 are not rejected in tests)
         consensus.BIP34Hash = uint256();
@@ -382,6 +386,7 @@ public:
         consensus.UBCInitBlockCount = 0; // 500
         consensus.UBCONTRACT_Height = 1500;
         consensus.SCANBADTX_Height = 1500;
+        consensus.NATIVE_TOKEN_Height = 1500;
     	// Fork to adjust block interval (ForkV1)
     	consensus.ForkV1Height = 1400;
     	UB_FORK1_BLOCK_NUM = consensus.ForkV1Height;
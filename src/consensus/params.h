@@ -84,11 +84,14 @@ struct Params {
 
     int UBCONTRACT_Height;
     int SCANBADTX_Height;
+    /** Block height from which the native token contract template can be used */
+    int NATIVE_TOKEN_Height;
 	
     /**
-     * Minimum blocks including miner confirmation of the total of 2016 blocks in a retargeting period,
-     * (nPowTargetTimespan / nPowTargetSpacing) which is also used for BIP9 deployments.
-     * Examples: 1916 for 95%, 1512 for testchains.
+     * Minimum blocks including miner confirmation of the total of nMinerConfirmationWindow blocks,
+     * which is used for BIP9 deployments. Mainnet and testnet keep the 200 block window the
+     * difficulty adjustment used after the UBC fork's initial blocks for the whole chain.
+     * Examples: 190 for 95%, 108 for regtest.
      */
     uint32_t nRuleChangeActivationThreshold;
     uint32_t nMinerConfirmationWindow;
@@ -104,11 +107,39 @@ struct Params {
 	uint256 posLimit;
 	
     int64_t DifficultyAdjustmentInterval() const { return nPowTargetTimespan / nPowTargetSpacing; }
-    void UpdateDifficultyAdjustmentIntervalForkV1() {nPowTargetTimespan = 10*1*60;nPowTargetSpacing= 1*60;nRuleChangeActivationThreshold=190;nMinerConfirmationWindow=200;}
-    void UpdateDifficultyAdjustmentIntervalForkV2() {nPowTargetTimespan = 10*2*60;nPowTargetSpacing= 2*60;nRuleChangeActivationThreshold=190;nMinerConfirmationWindow=200;}
-
-    void UpdateDifficultyAdjustmentInterval() {nPowTargetTimespan = 200*10*60;nRuleChangeActivationThreshold=190;nMinerConfirmationWindow=200;}
-    void UpdateOldDifficultyAdjustmentInterval() {nPowTargetTimespan = 14*24*60*60;nRuleChangeActivationThreshold=1916;nMinerConfirmationWindow=2016;}
+    /**
+     * A copy of these params as they apply to the block at nHeight. The difficulty adjustment
+     * window was changed after the UBC fork's initial blocks, at ForkV1 and at UBCONTRACT.
+     * Regtest keeps its own throughout.
+     */
+    Params ForHeight(int nHeight) const
+    {
+        Params params = *this;
+        if (is_regtest_net)
+            return params;
+        params.nPowTargetSpacing = PowTargetSpacingAt(nHeight);
+        if (nHeight >= UBCONTRACT_Height) {
+            params.nPowTargetTimespan = 10*2*60;
+        } else if (nHeight >= ForkV1Height) {
+            params.nPowTargetTimespan = 10*1*60;
+        } else if (nHeight >= UBCHeight + UBCInitBlockCount) {
+            params.nPowTargetTimespan = 200*10*60;
+        } else {
+            params.nPowTargetTimespan = 14*24*60*60;
+        }
+        return params;
+    }
+    /** nPowTargetSpacing of ForHeight(nHeight), without copying the params */
+    int64_t PowTargetSpacingAt(int nHeight) const
+    {
+        if (is_regtest_net)
+            return nPowTargetSpacing;
+        if (nHeight >= UBCONTRACT_Height)
+            return 2*60;
+        if (nHeight >= ForkV1Height)
+            return 1*60;
+        return nPowTargetSpacing;
+    }
     uint256 nMinimumChainWork;
     uint256 defaultAssumeValid;
 };
@@ -257,7 +257,7 @@ bool Consensus::CheckTxInputs(const CTransaction& tx, CValidationState& state, c
         }
     }
 	if (tx.HasOpDepositToContract() || tx.HasOpSpend()) {
-		ContractTxConverter converter(tx, nullptr, nullptr);
+		ContractTxConverter converter(tx, nullptr, nSpendHeight, nullptr);
 		ExtractContractTX resultConvertContractTx;
 		std::string error_ret;
 		if (!converter.extractionContractTransactions(resultConvertContractTx, error_ret)) {
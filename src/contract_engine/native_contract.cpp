@@ -5,24 +5,33 @@
 #include <memory>
 #include <cstdio>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <uvm/exceptions.h>
 
 namespace blockchain {
     namespace contract {
 #define THROW_CONTRACT_ERROR(...) FJSON_ASSERT(false, __VA_ARGS__)
 
-        bool native_contract_finder::has_native_contract_with_key(const std::string& key)
+        bool native_contract_finder::has_native_contract_with_key(const std::string& key, int nHeight)
         {
-			std::vector<std::string> native_contract_keys = {
-					dgp_native_contract::native_contract_key()
-            };
-            return std::find(native_contract_keys.begin(), native_contract_keys.end(), key) != native_contract_keys.end();
+			if (key == dgp_native_contract::native_contract_key())
+				return true;
+			if (key == token_native_contract::native_contract_key())
+				return nHeight >= Params().GetConsensus().NATIVE_TOKEN_Height;
+			return false;
         }
         std::shared_ptr<abstract_native_contract> native_contract_finder::create_native_contract_by_key(
 			blockchain::contract::PendingState* pending_state, const std::string& key, const std::string& contract_address, const native_contract_sender& sender)
         {
+			// sender.block_number is the tip the contract transaction is applied on
+			if (!has_native_contract_with_key(key, sender.block_number + 1))
+				return nullptr;
             if (key == dgp_native_contract::native_contract_key()) {
 				return std::make_shared<dgp_native_contract>(pending_state, contract_address, sender);
 			}
+			else if (key == token_native_contract::native_contract_key()) {
+				return std::make_shared<token_native_contract>(pending_state, contract_address, sender);
+			}
             else
             {
                 return nullptr;
@@ -38,34 +47,22 @@ namespace blockchain {
 				_contract_storage_changes[contract_address] = std::map<std::string, StorageDataChangeType>();
             }
             auto& storage_changes = _contract_storage_changes[contract_address];
-            if (storage_changes.find(storage_name) == storage_changes.end())
+            auto it = storage_changes.find(storage_name);
+            if (it == storage_changes.end())
             {
                 StorageDataChangeType change;
+				change.before = _pending_state->storage_service->get_contract_storage(contract_address, storage_name);
                 change.after = value;
-				const auto &before = _pending_state->storage_service->get_contract_storage(contract_address, storage_name);
-                jsondiff::JsonDiff differ;
-				const auto& before_json_str = jsondiff::json_dumps(before);
-				const auto& after_json_str = jsondiff::json_dumps(change.after);
-				auto diff = differ.diff(before, change.after);
-                change.storage_diff = diff->value();
-				change.before = before;
                 storage_changes[storage_name] = change;
             }
             else
             {
-                auto& change = storage_changes[storage_name];
-                auto before = change.before;
-                auto after = value;
-                change.after = after;
-                jsondiff::JsonDiff differ;
-				const auto& before_json_str = json_dumps(before);
-                auto after_json_str = jsondiff::json_dumps(after);
-				auto diff = differ.diff(before, after);
-                change.storage_diff = diff->value();
+                it->second.after = value;
             }
         }
 		JsonValue abstract_native_contract::get_contract_storage(const std::string& contract_address, const std::string& storage_name)
         {
+			_pending_state->record_storage_read(contract_address, storage_name);
             if (_contract_storage_changes.find(contract_address) == _contract_storage_changes.end())
             {
                 return _pending_state->storage_service->get_contract_storage(contract_address, storage_name);
@@ -96,10 +93,11 @@ namespace blockchain {
 					continue;
 				}
 				JsonObject diff_json;
+				jsondiff::JsonDiff differ;
 				for (const auto& p2 : p.second) {
 					const auto& key = p2.first;
 					const auto& change = p2.second;
-					diff_json[key] = change.storage_diff;
+					diff_json[key] = differ.diff(change.before, change.after)->value();
 				}
 				_contract_exec_result.contract_storage_changes.push_back(std::make_pair(contract_id, std::make_shared<DiffResult>(diff_json)));
 			}
@@ -437,11 +435,13 @@ namespace blockchain {
 
 		std::string dgp_native_contract::get_dgp_param_json_string(const std::string& param_name)
 		{
-			const auto& dgp_params = get_contract_storage(contract_id, "dgp_params").as<jsondiff::JsonObject>();
-			if (dgp_params.find(param_name) == dgp_params.end())
+			const auto& dgp_params_json = get_contract_storage(contract_id, "dgp_params");
+			const auto& dgp_params = dgp_params_json.get_object();
+			auto it = dgp_params.find(param_name);
+			if (it == dgp_params.end())
 				return jsondiff::json_dumps(jsondiff::JsonValue());
 			else
-				return jsondiff::json_dumps(dgp_params[param_name]);
+				return jsondiff::json_dumps(it->value());
 		}
 
 		static const std::map<std::string, DgpChangeIntParamType> dgp_params_int_mapping = {
@@ -576,28 +576,34 @@ namespace blockchain {
 			return "";
 		}
 
+		const std::map<std::string, dgp_native_contract::api_method>& dgp_native_contract::api_methods() {
+			static const std::map<std::string, api_method> methods = {
+				{ "init", &dgp_native_contract::init_api },
+				{ "admins", &dgp_native_contract::admins_api },
+				{ "create_change_admin_proposal", &dgp_native_contract::create_change_admin_proposal_api },
+				{ "vote_admin", &dgp_native_contract::vote_admin_api },
+				{ "current_change_admin_proposal", &dgp_native_contract::current_change_admin_proposal_api },
+				{ "current_change_params_proposal", &dgp_native_contract::current_change_params_proposal_api },
+				{ "cancel_change_admin_proposal", &dgp_native_contract::cancel_change_admin_proposal_api },
+				{ "vote_change_param", &dgp_native_contract::vote_change_param_api },
+				{ "min_gas_price", &dgp_native_contract::min_gas_price_api },
+				{ "set_min_gas_price", &dgp_native_contract::set_min_gas_price_api },
+				{ "block_gas_limit", &dgp_native_contract::block_gas_limit_api },
+				{ "set_block_gas_limit", &dgp_native_contract::set_block_gas_limit_api },
+				{ "min_gas_count", &dgp_native_contract::min_gas_count_api },
+				{ "set_min_gas_count", &dgp_native_contract::set_min_gas_count_api },
+				{ "max_contract_bytecode_store_fee_gas_count", &dgp_native_contract::max_contract_bytecode_store_fee_gas_count_api },
+				{ "set_max_contract_bytecode_store_fee_gas_count", &dgp_native_contract::set_max_contract_bytecode_store_fee_gas_count_api }
+			};
+			return methods;
+		}
+
 		ContractExecResult dgp_native_contract::invoke(const std::string& api_name, const std::string& api_arg) {
 			ContractExecResult result;
-			std::map<std::string, std::function<std::string (const std::string&, const std::string&)> > apis_mapping = {
-				{ "init", std::bind(&dgp_native_contract::init_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "admins", std::bind(&dgp_native_contract::admins_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "create_change_admin_proposal", std::bind(&dgp_native_contract::create_change_admin_proposal_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "vote_admin", std::bind(&dgp_native_contract::vote_admin_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "current_change_admin_proposal", std::bind(&dgp_native_contract::current_change_admin_proposal_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "current_change_params_proposal", std::bind(&dgp_native_contract::current_change_params_proposal_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "cancel_change_admin_proposal", std::bind(&dgp_native_contract::cancel_change_admin_proposal_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "vote_change_param", std::bind(&dgp_native_contract::vote_change_param_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "min_gas_price", std::bind(&dgp_native_contract::min_gas_price_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "set_min_gas_price", std::bind(&dgp_native_contract::set_min_gas_price_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "block_gas_limit", std::bind(&dgp_native_contract::block_gas_limit_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "set_block_gas_limit", std::bind(&dgp_native_contract::set_block_gas_limit_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "min_gas_count", std::bind(&dgp_native_contract::min_gas_count_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "set_min_gas_count", std::bind(&dgp_native_contract::set_min_gas_count_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "max_contract_bytecode_store_fee_gas_count", std::bind(&dgp_native_contract::max_contract_bytecode_store_fee_gas_count_api, this, std::placeholders::_1, std::placeholders::_2) },
-				{ "set_max_contract_bytecode_store_fee_gas_count", std::bind(&dgp_native_contract::set_max_contract_bytecode_store_fee_gas_count_api, this, std::placeholders::_1, std::placeholders::_2) }
-			};
-			if (apis_mapping.find(api_name) != apis_mapping.end()) {
-				result.api_result = apis_mapping[api_name](api_name, api_arg);
+			const auto& methods = api_methods();
+			auto method = methods.find(api_name);
+			if (method != methods.end()) {
+				result.api_result = (this->*(method->second))(api_name, api_arg);
 			} else {
 				result.exit_code = 1;
 				result.error_message = std::string("Can't find dgp api ") + api_name;
@@ -609,5 +615,245 @@ namespace blockchain {
 			return result;
 		}
 
+		// token native contract
+		static const std::string token_state_not_inited = "NOT_INITED";
+		static const std::string token_state_common = "COMMON";
+
+		token_native_contract::token_native_contract(blockchain::contract::PendingState* pending_state, const std::string& _contract_id, const native_contract_sender& _sender)
+			: abstract_native_contract(pending_state, _contract_id, _sender),
+			_owner(this, "owner"), _state(this, "state", token_state_not_inited), _name(this, "name"), _symbol(this, "symbol"),
+			_supply(this, "supply"), _precision(this, "precision"),
+			_balances(this, "balances/"), _allowances(this, "allowances/")
+		{
+		}
+
+		std::string token_native_contract::contract_key() const
+		{
+			return token_native_contract::native_contract_key();
+		}
+		std::string token_native_contract::contract_address() const {
+			return contract_id;
+		}
+		std::set<std::string> token_native_contract::apis() const {
+			return { "init", "init_token", "transfer", "approve", "transferFrom",
+				"balanceOf", "allowance", "totalSupply", "precision", "tokenName", "tokenSymbol", "state" };
+		}
+		std::set<std::string> token_native_contract::offline_apis() const {
+			return { "balanceOf", "allowance", "totalSupply", "precision", "tokenName", "tokenSymbol", "state" };
+		}
+		std::set<std::string> token_native_contract::events() const {
+			return { "Inited", "Transfer", "Approved" };
+		}
+
+		CAmount token_native_contract::gas_count_for_api_invoke(const std::string& api_name) const
+		{
+			// fixed schedule, by the storage slots each api may write
+			if (api_name == "init" || api_name == "init_token")
+				return 500;
+			if (api_name == "transfer")
+				return 200;
+			if (api_name == "transferFrom")
+				return 300;
+			if (api_name == "approve")
+				return 100;
+			return DEFAULT_MIN_GAS_COUNT;
+		}
+
+		static std::vector<std::string> split_token_api_arg(const std::string& api_arg)
+		{
+			std::vector<std::string> parsed_args;
+			boost::split(parsed_args, api_arg, boost::is_any_of(","));
+			return parsed_args;
+		}
+
+		// a positive decimal amount without sign or leading zeros
+		static uint64_t parse_token_amount(const std::string& amount_str)
+		{
+			if (amount_str.empty() || amount_str.size() > 19 || amount_str[0] == '0'
+				|| amount_str.find_first_not_of("0123456789") != std::string::npos)
+				throw uvm::core::UvmException("amount must be a positive integer");
+			return boost::lexical_cast<uint64_t>(amount_str);
+		}
+
+		static void check_token_address(const std::string& addr)
+		{
+			if (!IsValidDestinationString(addr))
+				throw uvm::core::UvmException("invalid address");
+		}
+
+		void token_native_contract::check_common_state() const
+		{
+			if (_state.get() != token_state_common)
+				throw uvm::core::UvmException("token not inited");
+		}
+
+		void token_native_contract::move_balance(const std::string& from, const std::string& to, uint64_t amount)
+		{
+			auto from_balance = _balances.get(from);
+			if (from_balance < amount)
+				throw uvm::core::UvmException("balance not enough");
+			if (from == to)
+				return;
+			_balances.set(from, from_balance - amount);
+			_balances.set(to, _balances.get(to) + amount);
+			jsondiff::JsonObject event_arg;
+			event_arg["from"] = from;
+			event_arg["to"] = to;
+			event_arg["amount"] = amount;
+			emit_event(contract_id, "Transfer", jsondiff::json_dumps(event_arg));
+		}
+
+		std::string token_native_contract::init_api(const std::string& api_name, const std::string& api_arg)
+		{
+			_owner.set(sender.caller_address);
+			_state.set(token_state_not_inited);
+			return "";
+		}
+
+		std::string token_native_contract::init_token_api(const std::string& api_name, const std::string& api_arg)
+		{
+			// api_arg: name,symbol,supply,precision
+			if (sender.caller_address != _owner.get())
+				throw uvm::core::UvmException("only owner can init token");
+			if (_state.get() != token_state_not_inited)
+				throw uvm::core::UvmException("token inited before");
+			const auto& parsed_args = split_token_api_arg(api_arg);
+			if (parsed_args.size() != 4 || parsed_args[0].empty() || parsed_args[1].empty())
+				throw uvm::core::UvmException("argument format error, need format: name,symbol,supply,precision");
+			auto supply = parse_token_amount(parsed_args[2]);
+			auto precision = parse_token_amount(parsed_args[3]);
+			_name.set(parsed_args[0]);
+			_symbol.set(parsed_args[1]);
+			_supply.set(supply);
+			_precision.set(precision);
+			_balances.set(sender.caller_address, supply);
+			_state.set(token_state_common);
+			emit_event(contract_id, "Inited", parsed_args[2]);
+			return "";
+		}
+
+		std::string token_native_contract::transfer_api(const std::string& api_name, const std::string& api_arg)
+		{
+			// api_arg: to_address,amount
+			check_common_state();
+			const auto& parsed_args = split_token_api_arg(api_arg);
+			if (parsed_args.size() != 2)
+				throw uvm::core::UvmException("argument format error, need format: to_address,amount");
+			check_token_address(parsed_args[0]);
+			move_balance(sender.caller_address, parsed_args[0], parse_token_amount(parsed_args[1]));
+			return "";
+		}
+
+		std::string token_native_contract::approve_api(const std::string& api_name, const std::string& api_arg)
+		{
+			// api_arg: spender_address,amount. an amount of 0 revokes the approval
+			check_common_state();
+			const auto& parsed_args = split_token_api_arg(api_arg);
+			if (parsed_args.size() != 2)
+				throw uvm::core::UvmException("argument format error, need format: spender_address,amount");
+			check_token_address(parsed_args[0]);
+			auto amount = parsed_args[1] == "0" ? 0 : parse_token_amount(parsed_args[1]);
+			_allowances.set(sender.caller_address + "," + parsed_args[0], amount);
+			jsondiff::JsonObject event_arg;
+			event_arg["from"] = sender.caller_address;
+			event_arg["spender"] = parsed_args[0];
+			event_arg["amount"] = amount;
+			emit_event(contract_id, "Approved", jsondiff::json_dumps(event_arg));
+			return "";
+		}
+
+		std::string token_native_contract::transfer_from_api(const std::string& api_name, const std::string& api_arg)
+		{
+			// api_arg: from_address,to_address,amount
+			check_common_state();
+			const auto& parsed_args = split_token_api_arg(api_arg);
+			if (parsed_args.size() != 3)
+				throw uvm::core::UvmException("argument format error, need format: from_address,to_address,amount");
+			const auto& from = parsed_args[0];
+			check_token_address(from);
+			check_token_address(parsed_args[1]);
+			auto amount = parse_token_amount(parsed_args[2]);
+			const auto& allowance_key = from + "," + sender.caller_address;
+			auto allowance = _allowances.get(allowance_key);
+			if (allowance < amount)
+				throw uvm::core::UvmException("approved balance not enough");
+			_allowances.set(allowance_key, allowance - amount);
+			move_balance(from, parsed_args[1], amount);
+			return "";
+		}
+
+		std::string token_native_contract::balance_of_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return std::to_string(_balances.get(api_arg));
+		}
+
+		std::string token_native_contract::allowance_api(const std::string& api_name, const std::string& api_arg)
+		{
+			// api_arg: from_address,spender_address
+			const auto& parsed_args = split_token_api_arg(api_arg);
+			if (parsed_args.size() != 2)
+				throw uvm::core::UvmException("argument format error, need format: from_address,spender_address");
+			return std::to_string(_allowances.get(parsed_args[0] + "," + parsed_args[1]));
+		}
+
+		std::string token_native_contract::total_supply_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return std::to_string(_supply.get());
+		}
+
+		std::string token_native_contract::precision_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return std::to_string(_precision.get());
+		}
+
+		std::string token_native_contract::token_name_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return _name.get();
+		}
+
+		std::string token_native_contract::token_symbol_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return _symbol.get();
+		}
+
+		std::string token_native_contract::state_api(const std::string& api_name, const std::string& api_arg)
+		{
+			return _state.get();
+		}
+
+		const std::map<std::string, token_native_contract::api_method>& token_native_contract::api_methods() {
+			static const std::map<std::string, api_method> methods = {
+				{ "init", &token_native_contract::init_api },
+				{ "init_token", &token_native_contract::init_token_api },
+				{ "transfer", &token_native_contract::transfer_api },
+				{ "approve", &token_native_contract::approve_api },
+				{ "transferFrom", &token_native_contract::transfer_from_api },
+				{ "balanceOf", &token_native_contract::balance_of_api },
+				{ "allowance", &token_native_contract::allowance_api },
+				{ "totalSupply", &token_native_contract::total_supply_api },
+				{ "precision", &token_native_contract::precision_api },
+				{ "tokenName", &token_native_contract::token_name_api },
+				{ "tokenSymbol", &token_native_contract::token_symbol_api },
+				{ "state", &token_native_contract::state_api }
+			};
+			return methods;
+		}
+
+		// failed calls throw UvmException, which fails the contract transaction
+		ContractExecResult token_native_contract::invoke(const std::string& api_name, const std::string& api_arg) {
+			const auto& methods = api_methods();
+			auto method = methods.find(api_name);
+			if (method == methods.end()) {
+				auto error_str = std::string("Can't find token api ") + api_name;
+				throw uvm::core::UvmException(error_str.c_str());
+			}
+			ContractExecResult result;
+			result.api_result = (this->*(method->second))(api_name, api_arg);
+			merge_storage_changes_to_exec_result();
+			result.contract_storage_changes = _contract_exec_result.contract_storage_changes;
+			result.events = _contract_exec_result.events;
+			return result;
+		}
+
     }
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <map>
 #include <validation.h>
 #include <amount.h>
+#include <policy/policy.h>
 #include <contract_engine/pending_state.hpp>
 #include <uvm/uvm_api.h>
 #include <uvm/uvm_lib.h>
@@ -15,9 +16,10 @@ namespace blockchain {
 
 		using namespace jsondiff;
 
+		// value of a storage slot before the native contract call and the latest value it set.
+		// the diff between them is taken once, when the call's storage changes are merged
 		struct StorageDataChangeType
 		{
-			JsonValue storage_diff;
 			JsonValue before;
 			JsonValue after;
 		};
@@ -52,7 +54,7 @@ namespace blockchain {
 
             virtual CAmount gas_count_for_api_invoke(const std::string& api_name) const
             {
-                return 100; // now all native api call requires 100 gas count
+                return DEFAULT_MIN_GAS_COUNT; // native api calls are charged a fixed gas count
             }
             bool has_api(const std::string& api_name);
 
@@ -65,10 +67,81 @@ namespace blockchain {
 			void set_error(int32_t error_code, const std::string& error_msg);
         };
 
+		// converts typed storage values of native contracts to and from the json kept by the storage service
+		template <typename T>
+		struct native_storage_codec
+		{
+			static JsonValue to_json(const T& value) { return JsonValue(value); }
+			static T from_json(const JsonValue& json_value) { return json_value.as<T>(); }
+		};
+
+		template <>
+		struct native_storage_codec<JsonValue>
+		{
+			static const JsonValue& to_json(const JsonValue& value) { return value; }
+			static const JsonValue& from_json(const JsonValue& json_value) { return json_value; }
+		};
+
+		// a storage slot of a native contract with a declared value type. a slot never written reads as default_value
+		template <typename T>
+		class native_storage_field
+		{
+		public:
+			native_storage_field(abstract_native_contract* contract, const std::string& name, const T& default_value = T())
+				: _contract(contract), _name(name), _default_value(default_value) {}
+
+			T get() const
+			{
+				const auto& json_value = _contract->get_contract_storage(_contract->contract_address(), _name);
+				if (json_value.is_null())
+					return _default_value;
+				return native_storage_codec<T>::from_json(json_value);
+			}
+			void set(const T& value)
+			{
+				_contract->set_contract_storage(_contract->contract_address(), _name, native_storage_codec<T>::to_json(value));
+			}
+			const std::string& name() const { return _name; }
+
+		private:
+			abstract_native_contract* _contract;
+			std::string _name;
+			T _default_value;
+		};
+
+		// storage slots of one value type keyed by a string, such as per-address balances. each key is its own slot,
+		// so reading or writing one key doesn't load or diff the others
+		template <typename T>
+		class native_storage_map
+		{
+		public:
+			native_storage_map(abstract_native_contract* contract, const std::string& prefix, const T& default_value = T())
+				: _contract(contract), _prefix(prefix), _default_value(default_value) {}
+
+			T get(const std::string& key) const
+			{
+				const auto& json_value = _contract->get_contract_storage(_contract->contract_address(), slot_name(key));
+				if (json_value.is_null())
+					return _default_value;
+				return native_storage_codec<T>::from_json(json_value);
+			}
+			void set(const std::string& key, const T& value)
+			{
+				_contract->set_contract_storage(_contract->contract_address(), slot_name(key), native_storage_codec<T>::to_json(value));
+			}
+			std::string slot_name(const std::string& key) const { return _prefix + key; }
+
+		private:
+			abstract_native_contract* _contract;
+			std::string _prefix;
+			T _default_value;
+		};
+
         class native_contract_finder
         {
         public:
-            static bool has_native_contract_with_key(const std::string& key);
+            // whether a native contract template named key can be registered in a block at nHeight
+            static bool has_native_contract_with_key(const std::string& key, int nHeight);
             static std::shared_ptr<abstract_native_contract> create_native_contract_by_key(
 				blockchain::contract::PendingState* pending_state, const std::string& key, const std::string& contract_address, const native_contract_sender& sender);
         };
@@ -89,6 +162,9 @@ namespace blockchain {
 			virtual ContractExecResult invoke(const std::string& api_name, const std::string& api_arg);
 
 		private:
+			typedef std::string (dgp_native_contract::*api_method)(const std::string& api_name, const std::string& api_arg);
+			static const std::map<std::string, api_method>& api_methods();
+
 			std::string init_api(const std::string& api_name, const std::string& api_arg);
 			std::string admins_api(const std::string& api_name, const std::string& api_arg);
 			std::string create_change_admin_proposal_api(const std::string& api_name, const std::string& api_arg);
@@ -118,5 +194,53 @@ namespace blockchain {
 			bool create_int_param_proposal(const std::string& property_name, const std::string& api_arg, uint32_t admins_count);
 		};
 
+		// fungible token template. balances and allowances are kept one storage slot per address,
+		// so a transfer touches only the slots of its two holders
+		class token_native_contract final : public abstract_native_contract {
+		public:
+			static std::string native_contract_key() { return "token"; }
+
+			token_native_contract(blockchain::contract::PendingState* pending_state, const std::string& _contract_id, const native_contract_sender& _sender);
+			virtual ~token_native_contract() {}
+			virtual std::string contract_key() const;
+			virtual std::string contract_address() const;
+			virtual std::set<std::string> apis() const;
+			virtual std::set<std::string> offline_apis() const;
+			virtual std::set<std::string> events() const;
+
+			virtual ContractExecResult invoke(const std::string& api_name, const std::string& api_arg);
+			virtual CAmount gas_count_for_api_invoke(const std::string& api_name) const;
+
+		private:
+			typedef std::string (token_native_contract::*api_method)(const std::string& api_name, const std::string& api_arg);
+			static const std::map<std::string, api_method>& api_methods();
+
+			std::string init_api(const std::string& api_name, const std::string& api_arg);
+			std::string init_token_api(const std::string& api_name, const std::string& api_arg);
+			std::string transfer_api(const std::string& api_name, const std::string& api_arg);
+			std::string approve_api(const std::string& api_name, const std::string& api_arg);
+			std::string transfer_from_api(const std::string& api_name, const std::string& api_arg);
+			std::string balance_of_api(const std::string& api_name, const std::string& api_arg);
+			std::string allowance_api(const std::string& api_name, const std::string& api_arg);
+			std::string total_supply_api(const std::string& api_name, const std::string& api_arg);
+			std::string precision_api(const std::string& api_name, const std::string& api_arg);
+			std::string token_name_api(const std::string& api_name, const std::string& api_arg);
+			std::string token_symbol_api(const std::string& api_name, const std::string& api_arg);
+			std::string state_api(const std::string& api_name, const std::string& api_arg);
+
+			void check_common_state() const;
+			void move_balance(const std::string& from, const std::string& to, uint64_t amount);
+
+		private:
+			native_storage_field<std::string> _owner;
+			native_storage_field<std::string> _state;
+			native_storage_field<std::string> _name;
+			native_storage_field<std::string> _symbol;
+			native_storage_field<uint64_t> _supply;
+			native_storage_field<uint64_t> _precision;
+			native_storage_map<uint64_t> _balances; // holder address => amount
+			native_storage_map<uint64_t> _allowances; // "holder,spender" => amount spender may transfer from holder
+		};
+
     }
 }
\ No newline at end of file
@@ -36,8 +36,9 @@ namespace blockchain {
             balance_changes.push_back(transfer_info);
         }
 
-		uint64_t PendingState::get_contract_balance(const std::string& address) const
+		uint64_t PendingState::get_contract_balance(const std::string& address)
 		{
+			record_storage_read(address, std::string());
 			const auto& balances = storage_service->get_contract_balances(address);
 			uint64_t balance = 0;
 			for (const auto& p : balances) {
@@ -63,5 +64,10 @@ namespace blockchain {
 			return balance;
 		}
 
+		void PendingState::record_storage_read(const std::string& contract_address, const std::string& storage_key)
+		{
+			storage_reads.insert(std::make_pair(contract_address, storage_key));
+		}
+
     }
 }
\ No newline at end of file
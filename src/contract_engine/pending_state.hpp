@@ -17,6 +17,7 @@ namespace blockchain {
             uint256 tx_id;
             CAmount nTxFee;
 			int origin_opcode;
+			const CBlockIndex* pindexTip = nullptr; // tip the contracts are executed on, read by the chain apis of the vm
 
             std::unordered_map<std::string, ContractInfo> pending_contracts_to_create;
 			std::vector<std::pair<std::string, StorageChanges>> contract_storage_changes; // contract_id => changes
@@ -26,9 +27,13 @@ namespace blockchain {
 
 			std::map<DgpChangeIntParamType, int64_t> dgp_int_params_changes; // changes of dgp params. not all native dgp contracts will change chain's dgp params.
 
+			std::set<ContractStorageSlot> storage_reads; // storage slots read from storage service in this execution
+
             void add_balance_change(const std::string& address, bool is_contract, bool add, uint64_t amount);
 
-			uint64_t get_contract_balance(const std::string& address) const;
+			uint64_t get_contract_balance(const std::string& address);
+
+			void record_storage_read(const std::string& contract_address, const std::string& storage_key);
         };
     }
 }
\ No newline at end of file
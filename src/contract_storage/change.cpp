@@ -20,6 +20,29 @@ namespace contract
 			json_obj["memo"] = memo;
 			return json_obj;
 		}
+		void ContractBalanceChange::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("add");
+			encoder.write_bool(add);
+			encoder.end_array();
+			encoder.begin_member("address");
+			encoder.write_string(address);
+			encoder.end_array();
+			encoder.begin_member("amount");
+			encoder.write_uint(amount);
+			encoder.end_array();
+			encoder.begin_member("asset_id");
+			encoder.write_uint(asset_id);
+			encoder.end_array();
+			encoder.begin_member("is_contract");
+			encoder.write_bool(is_contract);
+			encoder.end_array();
+			encoder.begin_member("memo");
+			encoder.write_string(memo);
+			encoder.end_array();
+			encoder.end_array();
+		}
 		ContractBalanceChange ContractBalanceChange::from_json(const jsondiff::JsonObject& json_obj)
 		{
 			ContractBalanceChange change;
@@ -47,6 +70,29 @@ namespace contract
 			json_obj["items"] = items_array;
 			return json_obj;
 		}
+		void ContractStorageChange::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("contract_id");
+			encoder.write_string(contract_id);
+			encoder.end_array();
+			encoder.begin_member("items");
+			encoder.begin_array();
+			for (const auto &item : items)
+			{
+				encoder.begin_array();
+				encoder.begin_member("diff");
+				encoder.write_value(item.diff->value());
+				encoder.end_array();
+				encoder.begin_member("name");
+				encoder.write_string(item.name);
+				encoder.end_array();
+				encoder.end_array();
+			}
+			encoder.end_array();
+			encoder.end_array();
+			encoder.end_array();
+		}
 		ContractStorageChange ContractStorageChange::from_json(const jsondiff::JsonObject& json_obj)
 		{
 			ContractStorageChange change;
@@ -75,6 +121,23 @@ namespace contract
 			json_obj["arg"] = event_arg;
 			return json_obj;
 		}
+		void ContractEventInfo::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("arg");
+			encoder.write_string(event_arg);
+			encoder.end_array();
+			encoder.begin_member("contract_id");
+			encoder.write_string(contract_id);
+			encoder.end_array();
+			encoder.begin_member("name");
+			encoder.write_string(event_name);
+			encoder.end_array();
+			encoder.begin_member("tx_id");
+			encoder.write_string(transaction_id);
+			encoder.end_array();
+			encoder.end_array();
+		}
 		ContractEventInfo ContractEventInfo::from_json(const jsondiff::JsonObject& json_obj)
 		{
 			ContractEventInfo event_info;
@@ -95,6 +158,26 @@ namespace contract
 				json_obj["description_diff"] = description_diff->value();
 			return json_obj;
 		}
+		void ContractUpgradeInfo::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("contract_id");
+			encoder.write_string(contract_id);
+			encoder.end_array();
+			if (description_diff)
+			{
+				encoder.begin_member("description_diff");
+				encoder.write_value(description_diff->value());
+				encoder.end_array();
+			}
+			if (name_diff)
+			{
+				encoder.begin_member("name_diff");
+				encoder.write_value(name_diff->value());
+				encoder.end_array();
+			}
+			encoder.end_array();
+		}
 		ContractUpgradeInfo ContractUpgradeInfo::from_json(const jsondiff::JsonObject& json_obj)
 		{
 			ContractUpgradeInfo info;
@@ -147,6 +230,36 @@ namespace contract
 			json_obj["upgrade_infos"] = upgrade_infos_array;
 			return json_obj;
 		}
+		// members in the key order of to_json() sorted by compare_key
+		void ContractChanges::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("balance_changes");
+			encoder.begin_array();
+			for (const auto &item : balance_changes)
+				item.write_digest(encoder);
+			encoder.end_array();
+			encoder.end_array();
+			encoder.begin_member("events");
+			encoder.begin_array();
+			for (const auto& event_info : events)
+				event_info.write_digest(encoder);
+			encoder.end_array();
+			encoder.end_array();
+			encoder.begin_member("storage_changes");
+			encoder.begin_array();
+			for (const auto &item : storage_changes)
+				item.write_digest(encoder);
+			encoder.end_array();
+			encoder.end_array();
+			encoder.begin_member("upgrade_infos");
+			encoder.begin_array();
+			for (const auto& info : upgrade_infos)
+				info.write_digest(encoder);
+			encoder.end_array();
+			encoder.end_array();
+			encoder.end_array();
+		}
 
 		bool ContractChanges::empty() const {
 			return balance_changes.empty() && storage_changes.empty() && events.empty() && upgrade_infos.empty();
@@ -180,5 +293,12 @@ namespace contract
 			return changes;
 		}
 
+		fcrypto::sha256 ordered_json_digest(const ContractChanges& changes)
+		{
+			OrderedJsonDigestEncoder encoder;
+			changes.write_digest(encoder);
+			return encoder.result();
+		}
+
 	}
 }
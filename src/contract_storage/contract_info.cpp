@@ -9,6 +9,10 @@
 #include <boost/uuid/sha1.hpp>
 #include <memory>
 #include <list>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
 
 namespace contract
 {
@@ -23,6 +27,17 @@ namespace contract
 			balance_json["amount"] = amount;
 			return balance_json;
 		}
+		void ContractBalance::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			encoder.begin_array();
+			encoder.begin_member("amount");
+			encoder.write_uint(amount);
+			encoder.end_array();
+			encoder.begin_member("asset_id");
+			encoder.write_uint(asset_id);
+			encoder.end_array();
+			encoder.end_array();
+		}
 		std::shared_ptr<ContractBalance> ContractBalance::from_json(const jsondiff::JsonValue& json_value)
 		{
 			if (!json_value.is_object())
@@ -34,6 +49,15 @@ namespace contract
 			return balance;
 		}
 
+		static std::vector<ContractBalance> ordered_contract_balances(const std::vector<ContractBalance>& balances)
+		{
+			std::vector<ContractBalance> ordered_balances(balances.begin(), balances.end());
+			std::sort(ordered_balances.begin(), ordered_balances.end(), [](const ContractBalance& a, const ContractBalance& b) {
+				return a.asset_id - b.asset_id;
+			});
+			return ordered_balances;
+		}
+
 		jsondiff::JsonObject ContractInfo::to_json() const
 		{
 			JsonObject json_obj;
@@ -68,12 +92,8 @@ namespace contract
 			}
 			json_obj["storage_types"] = storages_array;
 
-			std::vector<ContractBalance> ordered_balances(balances.begin(), balances.end());
-			std::sort(ordered_balances.begin(), ordered_balances.end(), [](const ContractBalance& a, const ContractBalance& b) {
-				return a.asset_id - b.asset_id;
-			});
 			JsonArray balances_array;
-			for (const auto &balance : ordered_balances)
+			for (const auto &balance : ordered_contract_balances(balances))
 			{
 				if (balance.amount == 0)
 					continue;
@@ -85,6 +105,91 @@ namespace contract
 			json_obj["bytecode"] = bytecode_base64;
 			return json_obj;
 		}
+		void ContractInfo::write_digest(OrderedJsonDigestEncoder& encoder) const
+		{
+			// members in the key order of to_json() sorted by compare_key
+			encoder.begin_array();
+
+			std::vector<std::string> ordered_apis(apis.begin(), apis.end());
+			std::sort(ordered_apis.begin(), ordered_apis.end(), std::less<std::string>());
+			encoder.begin_member("apis");
+			encoder.begin_array();
+			for (const auto& api : ordered_apis)
+				encoder.write_string(api);
+			encoder.end_array();
+			encoder.end_array();
+
+			encoder.begin_member("balances");
+			encoder.begin_array();
+			for (const auto &balance : ordered_contract_balances(balances))
+			{
+				if (balance.amount == 0)
+					continue;
+				balance.write_digest(encoder);
+			}
+			encoder.end_array();
+			encoder.end_array();
+
+			encoder.begin_member("bytecode");
+			encoder.write_string(fjson::base64_encode(bytecode.data(), bytecode.size()));
+			encoder.end_array();
+
+			encoder.begin_member("contract_template_key");
+			encoder.write_string(contract_template_key);
+			encoder.end_array();
+
+			encoder.begin_member("creator_address");
+			encoder.write_string(creator_address);
+			encoder.end_array();
+
+			encoder.begin_member("description");
+			encoder.write_string(description);
+			encoder.end_array();
+
+			encoder.begin_member("id");
+			encoder.write_string(id);
+			encoder.end_array();
+
+			encoder.begin_member("is_native");
+			encoder.write_bool(is_native);
+			encoder.end_array();
+
+			encoder.begin_member("name");
+			encoder.write_string(name);
+			encoder.end_array();
+
+			std::vector<std::string> ordered_offline_apis(offline_apis.begin(), offline_apis.end());
+			std::sort(ordered_offline_apis.begin(), ordered_offline_apis.end(), std::less<std::string>());
+			encoder.begin_member("offline_apis");
+			encoder.begin_array();
+			for (const auto& api : ordered_offline_apis)
+				encoder.write_string(api);
+			encoder.end_array();
+			encoder.end_array();
+
+			std::map<std::string, uint32_t, std::less<std::string>> ordered_storage_types(storage_types.begin(), storage_types.end());
+			encoder.begin_member("storage_types");
+			encoder.begin_array();
+			for (const auto& p : ordered_storage_types)
+			{
+				encoder.begin_array();
+				encoder.write_string(p.first);
+				encoder.write_uint(p.second);
+				encoder.end_array();
+			}
+			encoder.end_array();
+			encoder.end_array();
+
+			encoder.begin_member("txid");
+			encoder.write_string(txid);
+			encoder.end_array();
+
+			encoder.begin_member("version");
+			encoder.write_uint(version);
+			encoder.end_array();
+
+			encoder.end_array();
+		}
 		std::shared_ptr<ContractInfo> ContractInfo::from_json(const jsondiff::JsonValue& json_value)
 		{
 			if (json_value.is_null())
@@ -168,39 +273,177 @@ namespace contract
 		}
 
 
-		// parse arg to json_array when it's json object. otherwhile return itself. And recursively process child elements
-		static jsondiff::JsonValue nested_json_object_to_array(const jsondiff::JsonValue& json_value)
+		OrderedJsonDigestEncoder::OrderedJsonDigestEncoder()
+			: _buffer_size(0), _need_separator(false)
+		{
+		}
+
+		void OrderedJsonDigestEncoder::flush()
+		{
+			if (_buffer_size > 0)
+				_encoder.write(_buffer, (uint32_t) _buffer_size);
+			_buffer_size = 0;
+		}
+
+		void OrderedJsonDigestEncoder::write_raw(const char* data, size_t size)
 		{
-			if (json_value.is_object())
+			if (_buffer_size + size > sizeof(_buffer))
 			{
-				const auto& obj = json_value.as<jsondiff::JsonObject>();
-				jsondiff::JsonArray json_array;
-				std::list<std::string> keys;
-				for (auto it = obj.begin(); it != obj.end(); it++)
-				{
-					keys.push_back(it->key());
-				}
-				keys.sort(&compare_key);
-				for (const auto& key : keys)
+				flush();
+				if (size > sizeof(_buffer))
 				{
-					jsondiff::JsonArray item_json;
-					item_json.push_back(key);
-					item_json.push_back(nested_json_object_to_array(obj[key]));
-					json_array.push_back(item_json);
+					_encoder.write(data, (uint32_t) size);
+					return;
 				}
-				return json_array;
 			}
-			if (json_value.is_array())
+			memcpy(_buffer + _buffer_size, data, size);
+			_buffer_size += size;
+		}
+
+		void OrderedJsonDigestEncoder::write_separator()
+		{
+			if (_need_separator)
+				write_raw(",", 1);
+			_need_separator = true;
+		}
+
+		void OrderedJsonDigestEncoder::begin_array()
+		{
+			write_separator();
+			write_raw("[", 1);
+			_need_separator = false;
+		}
+
+		void OrderedJsonDigestEncoder::end_array()
+		{
+			write_raw("]", 1);
+			_need_separator = true;
+		}
+
+		void OrderedJsonDigestEncoder::begin_member(const std::string& key)
+		{
+			begin_array();
+			write_string(key);
+		}
+
+		// same escaping as the legacy json generator
+		void OrderedJsonDigestEncoder::write_string(const std::string& value)
+		{
+			write_separator();
+			write_raw("\"", 1);
+			const char* run = value.data();
+			const char* end = value.data() + value.size();
+			for (const char* itr = run; itr != end; ++itr)
 			{
-				const auto& arr = json_value.as<jsondiff::JsonArray>();
-				jsondiff::JsonArray result;
-				for (const auto& item : arr)
+				const char* escaped;
+				switch (*itr)
 				{
-					result.push_back(nested_json_object_to_array(item));
+				case '\t': escaped = "\\t"; break;
+				case '\n': escaped = "\\n"; break;
+				case '\\': escaped = "\\\\"; break;
+				case '\r': escaped = "\\r"; break;
+				case '\a': escaped = "\\a"; break;
+				case '\"': escaped = "\\\""; break;
+				default: continue;
 				}
-				return result;
+				write_raw(run, itr - run);
+				write_raw(escaped, 2);
+				run = itr + 1;
 			}
-			return json_value;
+			write_raw(run, end - run);
+			write_raw("\"", 1);
+		}
+
+		void OrderedJsonDigestEncoder::write_uint(uint64_t value)
+		{
+			char buf[24];
+			int n = snprintf(buf, sizeof(buf), "%" PRIu64, value);
+			write_separator();
+			write_raw(buf, n);
+		}
+
+		void OrderedJsonDigestEncoder::write_bool(bool value)
+		{
+			write_separator();
+			if (value)
+				write_raw("true", 4);
+			else
+				write_raw("false", 5);
+		}
+
+		// objects become arrays of [key, value] pairs sorted by compare_key. a key repeated in one object
+		// is emitted once per occurrence, each with the value of the first one
+		void OrderedJsonDigestEncoder::write_object(const fjson::variant_object& obj)
+		{
+			std::vector<const fjson::variant_object::entry*> entries;
+			entries.reserve(obj.size());
+			for (auto it = obj.begin(); it != obj.end(); it++)
+				entries.push_back(&*it);
+			std::stable_sort(entries.begin(), entries.end(), [](const fjson::variant_object::entry* a, const fjson::variant_object::entry* b) {
+				return compare_key(a->key(), b->key());
+			});
+			begin_array();
+			const fjson::variant_object::entry* first = nullptr;
+			for (const auto* entry : entries)
+			{
+				if (!first || first->key() != entry->key())
+					first = entry;
+				begin_member(entry->key());
+				write_value(first->value());
+				end_array();
+			}
+			end_array();
+		}
+
+		void OrderedJsonDigestEncoder::write_value(const jsondiff::JsonValue& value)
+		{
+			switch (value.get_type())
+			{
+			case fjson::variant::null_type:
+				write_separator();
+				write_raw("null", 4);
+				return;
+			case fjson::variant::int64_type:
+			{
+				char buf[24];
+				int n = snprintf(buf, sizeof(buf), "%" PRId64, value.as_int64());
+				write_separator();
+				write_raw(buf, n);
+				return;
+			}
+			case fjson::variant::uint64_type:
+				write_uint(value.as_uint64());
+				return;
+			case fjson::variant::bool_type:
+				write_bool(value.as_bool());
+				return;
+			case fjson::variant::string_type:
+				write_string(value.get_string());
+				return;
+			case fjson::variant::array_type:
+				begin_array();
+				for (const auto& item : value.get_array())
+					write_value(item);
+				end_array();
+				return;
+			case fjson::variant::object_type:
+				write_object(value.get_object());
+				return;
+			default:
+			{
+				// doubles and blobs, dumped the way the legacy json generator does
+				const auto& dumped = json_dumps(value);
+				write_separator();
+				write_raw(dumped.data(), dumped.size());
+				return;
+			}
+			}
+		}
+
+		fcrypto::sha256 OrderedJsonDigestEncoder::result()
+		{
+			flush();
+			return _encoder.result();
 		}
 
 		static void sha256(char *string, char outputBuffer[65])
@@ -220,9 +463,16 @@ namespace contract
 
 		fcrypto::sha256 ordered_json_digest(const jsondiff::JsonValue& json_value)
 		{
-			const auto& parsed_json = nested_json_object_to_array(json_value);
-			const auto& dumped = json_dumps(parsed_json);
-			return fcrypto::sha256::hash(dumped);
+			OrderedJsonDigestEncoder encoder;
+			encoder.write_value(json_value);
+			return encoder.result();
+		}
+
+		fcrypto::sha256 ordered_json_digest(const ContractInfo& contract_info)
+		{
+			OrderedJsonDigestEncoder encoder;
+			contract_info.write_digest(encoder);
+			return encoder.result();
 		}
 	}
 }
\ No newline at end of file
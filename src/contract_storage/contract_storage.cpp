@@ -4,6 +4,7 @@
 #include <fjson/io/json.hpp>
 #include <fjson/string.hpp>
 #include <fjson/crypto/base64.hpp>
+#include <util.h>
 #include <boost/scope_exit.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -11,6 +12,7 @@
 #include <vector>
 #include <map>
 #include <mutex>
+#include <atomic>
 
 // TODO: use a single embedded document database to store all data
 
@@ -25,6 +27,49 @@ namespace contract
 
 		static std::recursive_mutex storage_mutex;
 
+		// leveldb can be opened only once per process, so the instance of get_instance and the
+		// read-only snapshots share one handle, which is closed when its last user releases it
+		static std::mutex shared_db_mutex;
+		static leveldb::DB* shared_db = nullptr;
+		static size_t shared_db_users = 0;
+		// bumped on every write to the shared leveldb, read-only snapshots compare it to know whether they are outdated
+		static std::atomic<uint64_t> shared_db_version(0);
+		static std::atomic<bool> sql_wal_enabled(false);
+		// bumped when a snapshot releases its sql read transaction, writers then checkpoint the wal on their next commit
+		static std::atomic<uint64_t> released_sql_snapshots(0);
+
+		static leveldb::DB* acquire_shared_db(const std::string& storage_db_path)
+		{
+			std::lock_guard<std::mutex> lock(shared_db_mutex);
+			if (!shared_db)
+			{
+				leveldb::Options options;
+				options.create_if_missing = true;
+				auto status = leveldb::DB::Open(options, storage_db_path, &shared_db);
+				assert(status.ok());
+			}
+			shared_db_users++;
+			return shared_db;
+		}
+
+		static void release_shared_db()
+		{
+			std::lock_guard<std::mutex> lock(shared_db_mutex);
+			assert(shared_db_users > 0);
+			if (--shared_db_users == 0)
+			{
+				delete shared_db;
+				shared_db = nullptr;
+			}
+		}
+
+		static int journal_mode_sql_callback(void *result, int argc, char **argv, char **colNames)
+		{
+			if (argc > 0 && argv[0])
+				*static_cast<std::string*>(result) = argv[0];
+			return 0;
+		}
+
 		static std::string make_contract_info_key(const std::string& contract_id)
 		{
 			return std::string("contract_info_key_") + contract_id;
@@ -70,29 +115,129 @@ namespace contract
 			});
 		}
 
+		std::shared_ptr<ContractStorageService> ContractStorageService::get_read_only_snapshot(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path)
+		{
+			auto service = std::make_shared<ContractStorageService>(magic_number, storage_db_path, storage_sql_db_path, false);
+			service->_read_only = true;
+			service->_overlay_enabled = true;
+			if (sqlite3_open_v2(storage_sql_db_path.c_str(), &service->_sql_db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+			{
+				std::string err_str = std::string("contract sql db open error ") + sqlite3_errmsg(service->_sql_db);
+				BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+			}
+			sqlite3_busy_timeout(service->_sql_db, 1000);
+			{
+				// users of get_instance hold storage_mutex while they write, so the snapshot never sees half a commit
+				std::lock_guard<std::recursive_mutex> lock(storage_mutex);
+				service->_db = acquire_shared_db(storage_db_path);
+				service->_read_snapshot = service->_db->GetSnapshot();
+				service->_read_snapshot_version = shared_db_version.load();
+				// a sql read transaction keeps seeing the sql db as of its first read, so reading here pins
+				// the commit infos at the same point as the leveldb snapshot until the snapshot is closed.
+				// outside wal mode it would hold off every commit, so the snapshot reads the latest commit infos then
+				std::string journal_mode;
+				char *err;
+				if (sqlite3_exec(service->_sql_db, "PRAGMA journal_mode", &journal_mode_sql_callback, &journal_mode, &err) != SQLITE_OK)
+				{
+					std::string err_str = std::string("contract sql db journal mode error ") + err;
+					sqlite3_free(err);
+					BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+				}
+				if (boost::iequals(journal_mode, "wal"))
+				{
+					if (sqlite3_exec(service->_sql_db, "BEGIN; SELECT count(*) FROM sqlite_master", nullptr, nullptr, &err) != SQLITE_OK)
+					{
+						std::string err_str = std::string("contract sql snapshot begin error ") + err;
+						sqlite3_free(err);
+						BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+					}
+					service->_sql_snapshot_pinned = true;
+				}
+			}
+			return service;
+		}
+
+		std::shared_ptr<ContractStorageService> ContractStorageService::get_overlay_instance(uint32_t magic_number, const std::string& storage_db_path, const std::string& storage_sql_db_path)
+		{
+			storage_mutex.lock();
+			std::shared_ptr<ContractStorageService> service;
+			try
+			{
+				service = std::shared_ptr<ContractStorageService>(new ContractStorageService(magic_number, storage_db_path, storage_sql_db_path, false), [](ContractStorageService* ptr) {
+					delete ptr;
+					storage_mutex.unlock();
+				});
+				service->_overlay_only = true;
+				service->open();
+			}
+			catch (...)
+			{
+				// once the instance exists, releasing it unlocks
+				if (!service)
+					storage_mutex.unlock();
+				throw;
+			}
+			return service;
+		}
+
+		void ContractStorageService::set_sql_wal_enabled(bool enabled)
+		{
+			sql_wal_enabled = enabled;
+		}
+
+		bool ContractStorageService::is_snapshot_latest() const
+		{
+			return _read_only && _read_snapshot && _read_snapshot_version == shared_db_version.load();
+		}
+
 		void ContractStorageService::open()
 		{
+			if (_read_only)
+			{
+				// a read-only snapshot is opened when it is created and can't be reopened
+				check_db();
+				return;
+			}
 			if (!_db)
 			{
-				leveldb::Options options;
-				options.create_if_missing = true;
-				auto status = leveldb::DB::Open(options, _storage_db_path, &_db);
-				assert(status.ok());
+				_db = acquire_shared_db(_storage_db_path);
 			}
 			if (!_sql_db)
 			{
 				auto status = sqlite3_open(_storage_sql_db_path.c_str(), &_sql_db);
 				assert(status == SQLITE_OK);
+				// in wal mode the read transactions of read-only snapshots don't block commits
+				char *err;
+				if (sql_wal_enabled && sqlite3_exec(_sql_db, "PRAGMA journal_mode=WAL", nullptr, nullptr, &err) != SQLITE_OK)
+				{
+					std::string err_str = std::string("contract sql db journal mode error ") + err;
+					sqlite3_free(err);
+					BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+				}
+				// outside wal mode the reads of a snapshot briefly lock the sql db, wait for them instead of failing a commit
+				sqlite3_busy_timeout(_sql_db, 1000);
 				// init tables
 				this->init_commits_table();
 			}
+			if (_overlay_only && !_overlay_enabled)
+				begin_overlay();
 		}
 
 		void ContractStorageService::close()
 		{
+			end_overlay();
+			_overlay_enabled = false;
+			_overlay_kv.clear();
+			_overlay_kv_before_transaction.clear();
+			_contract_info_cache.clear();
+			if (_read_snapshot)
+			{
+				_db->ReleaseSnapshot(_read_snapshot);
+				_read_snapshot = nullptr;
+			}
 			if (_db)
 			{
-				delete _db;
+				release_shared_db();
 				_db = nullptr;
 			}
 			if (_sql_db)
@@ -100,6 +245,11 @@ namespace contract
 				sqlite3_close(_sql_db);
 				_sql_db = nullptr;
 			}
+			if (_sql_snapshot_pinned)
+			{
+				_sql_snapshot_pinned = false;
+				released_sql_snapshots++;
+			}
 		}
 
 		bool ContractStorageService::is_open() const
@@ -107,6 +257,95 @@ namespace contract
 			return _db ? true : false;
 		}
 
+		void ContractStorageService::begin_overlay()
+		{
+			check_db();
+			if (_overlay_enabled)
+				BOOST_THROW_EXCEPTION(ContractStorageException("contract storage overlay already enabled"));
+			// commit_info rows of the overlay live in a sql transaction which is never committed
+			char *err;
+			if (sqlite3_exec(_sql_db, "BEGIN", nullptr, nullptr, &err) != SQLITE_OK)
+			{
+				std::string err_str = std::string("contract sql overlay begin error ") + err;
+				sqlite3_free(err);
+				BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+			}
+			_overlay_kv.clear();
+			_overlay_kv_before_transaction.clear();
+			_overlay_enabled = true;
+		}
+
+		void ContractStorageService::end_overlay() noexcept
+		{
+			// a read-only snapshot stays in overlay mode until it is closed, and has no sql transaction
+			if (_read_only || !_overlay_enabled)
+				return;
+			_overlay_enabled = false;
+			_overlay_kv.clear();
+			_overlay_kv_before_transaction.clear();
+			if (!_sql_db)
+				return;
+			char *err = nullptr;
+			if (sqlite3_exec(_sql_db, "ROLLBACK", nullptr, nullptr, &err) != SQLITE_OK)
+			{
+				// closing the connection drops the overlay transaction too
+				LogPrintf("contract sql overlay rollback error %s, reopening the sql db\n", err ? err : "");
+				sqlite3_free(err);
+				sqlite3_close(_sql_db);
+				_sql_db = nullptr;
+				if (sqlite3_open(_storage_sql_db_path.c_str(), &_sql_db) != SQLITE_OK)
+				{
+					LogPrintf("contract sql db reopen error %s\n", sqlite3_errmsg(_sql_db));
+					sqlite3_close(_sql_db);
+					_sql_db = nullptr;
+				}
+			}
+		}
+
+		leveldb::Status ContractStorageService::db_get(const leveldb::ReadOptions& options, const std::string& key, std::string* value) const
+		{
+			if (_overlay_enabled)
+			{
+				auto it = _overlay_kv.find(key);
+				if (it != _overlay_kv.end())
+				{
+					if (!it->second)
+						return leveldb::Status::NotFound(key);
+					*value = *it->second;
+					return leveldb::Status::OK();
+				}
+			}
+			if (_read_snapshot)
+			{
+				leveldb::ReadOptions snapshot_options(options);
+				snapshot_options.snapshot = _read_snapshot;
+				return _db->Get(snapshot_options, key, value);
+			}
+			return _db->Get(options, key, value);
+		}
+
+		leveldb::Status ContractStorageService::db_put(const leveldb::WriteOptions& options, const std::string& key, const std::string& value)
+		{
+			if (_overlay_enabled)
+			{
+				_overlay_kv[key] = value;
+				return leveldb::Status::OK();
+			}
+			shared_db_version++;
+			return _db->Put(options, key, value);
+		}
+
+		leveldb::Status ContractStorageService::db_delete(const leveldb::WriteOptions& options, const std::string& key)
+		{
+			if (_overlay_enabled)
+			{
+				_overlay_kv[key] = boost::none;
+				return leveldb::Status::OK();
+			}
+			shared_db_version++;
+			return _db->Delete(options, key);
+		}
+
 		static int empty_sql_callback(void *notUsed, int argc, char **argv, char **colNames)
 		{
 			return 0;
@@ -190,7 +429,7 @@ namespace contract
 				BOOST_THROW_EXCEPTION(ContractStorageException("insert contract change commit to db error"));
 			}
 			leveldb::WriteOptions write_options;
-			auto save_diff_status = _db->Put(write_options, commit_id, diff_str);
+			auto save_diff_status = db_put(write_options, commit_id, diff_str);
 			if (!save_diff_status.ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("save contract info diff to db error"));
 		}
@@ -200,7 +439,7 @@ namespace contract
 			check_db();
 			leveldb::ReadOptions read_options;
 			std::string value;
-			auto status = _db->Get(read_options, key, &value);
+			auto status = db_get(read_options, key, &value);
 			if (!status.ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException(std::string("Can't find value by key ") + key));
 			return value;
@@ -211,7 +450,7 @@ namespace contract
 			check_db();
 			leveldb::ReadOptions read_options;
 			std::string value;
-			auto status = _db->Get(read_options, key, &value);
+			auto status = db_get(read_options, key, &value);
 			if (!status.ok())
 				return jsondiff::JsonValue();
 			return jsondiff::json_loads(value);
@@ -219,12 +458,12 @@ namespace contract
 
 		fcrypto::sha256 ContractStorageService::hash_new_contract_info_commit(ContractInfoP contract_info) const
 		{
-			return ordered_json_digest(contract_info->to_json());
+			return ordered_json_digest(*contract_info);
 		}
 
 		fcrypto::sha256 ContractStorageService::hash_contract_changes(ContractChangesP changes) const
 		{
-			return ordered_json_digest(changes->to_json());
+			return ordered_json_digest(*changes);
 		}
 
 		void ContractStorageService::check_db() const
@@ -239,6 +478,18 @@ namespace contract
 		{
 			check_db();
 			char *err;
+			// in overlay mode the whole overlay is one sql transaction, so nest a savepoint in it
+			if (_overlay_enabled)
+			{
+				_overlay_kv_before_transaction = _overlay_kv;
+				if (sqlite3_exec(_sql_db, "SAVEPOINT contract_overlay_tx", nullptr, nullptr, &err) != SQLITE_OK)
+				{
+					std::string err_str = std::string("contract sql transaction begin error ") + err;
+					sqlite3_free(err);
+					BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+				}
+				return;
+			}
 			if (sqlite3_exec(_sql_db, "BEGIN", nullptr, nullptr, &err) != SQLITE_OK)
 			{
 				std::string err_str = std::string("contract sql transaction begin error ") + err;
@@ -250,17 +501,45 @@ namespace contract
 		{
 			check_db();
 			char *err;
+			if (_overlay_enabled)
+			{
+				if (sqlite3_exec(_sql_db, "RELEASE contract_overlay_tx", nullptr, nullptr, &err) != SQLITE_OK)
+				{
+					std::string err_str = std::string("contract sql transaction commit error ") + err;
+					sqlite3_free(err);
+					BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+				}
+				return;
+			}
 			if (sqlite3_exec(_sql_db, "COMMIT", nullptr, nullptr, &err) != SQLITE_OK)
 			{
 				std::string err_str = std::string("contract sql transaction commit error ") + err;
 				sqlite3_free(err);
 				BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
 			}
+			// the wal can't be checkpointed past the oldest read transaction of a snapshot, so once one
+			// is released copy what it held back. a passive checkpoint never waits for the other readers
+			const uint64_t released = released_sql_snapshots.load();
+			if (released != _checkpointed_sql_snapshots)
+			{
+				_checkpointed_sql_snapshots = released;
+				sqlite3_wal_checkpoint_v2(_sql_db, nullptr, SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+			}
 		}
 		void ContractStorageService::rollback_sql_transaction()
 		{
 			check_db();
 			char *err;
+			if (_overlay_enabled)
+			{
+				if (sqlite3_exec(_sql_db, "ROLLBACK TO contract_overlay_tx; RELEASE contract_overlay_tx", nullptr, nullptr, &err) != SQLITE_OK)
+				{
+					std::string err_str = std::string("contract sql transaction rollback error ") + err;
+					sqlite3_free(err);
+					BOOST_THROW_EXCEPTION(ContractStorageException(err_str));
+				}
+				return;
+			}
 			if (sqlite3_exec(_sql_db, "ROLLBACK", nullptr, nullptr, &err) != SQLITE_OK)
 			{
 				std::string err_str = std::string("contract sql transaction rollback error ") + err;
@@ -271,7 +550,14 @@ namespace contract
 
 		void ContractStorageService::rollback_leveldb_transaction(const leveldb::Snapshot* snapshot_to_rollback, const std::vector<std::string>& changed_keys)
 		{
+			if (_overlay_enabled)
+			{
+				// nothing was written to leveldb, just restore the overlay
+				_overlay_kv = _overlay_kv_before_transaction;
+				return;
+			}
 			// leveldb rollback using snapshot
+			shared_db_version++;
 			leveldb::WriteOptions write_options;
 			leveldb::ReadOptions read_options_for_snapshot;
 			read_options_for_snapshot.snapshot = snapshot_to_rollback;
@@ -292,10 +578,21 @@ namespace contract
 		ContractInfoP ContractStorageService::get_contract_info(const AddressType& contract_id) const
 		{
 			check_db();
+			const auto& key = make_contract_info_key(contract_id);
+			// a read-only instance only sees its snapshot, unless the key was written to its overlay
+			const bool cacheable = _read_only && _overlay_kv.find(key) == _overlay_kv.end();
+			if (cacheable)
+			{
+				auto it = _contract_info_cache.find(contract_id);
+				if (it != _contract_info_cache.end())
+					return it->second ? std::make_shared<ContractInfo>(*it->second) : nullptr;
+			}
 			leveldb::ReadOptions options;
 			std::string value;
-			auto status = _db->Get(options, make_contract_info_key(contract_id), &value);
+			auto status = db_get(options, key, &value);
 			if (!status.ok()) {
+				if (cacheable)
+					_contract_info_cache[contract_id] = nullptr;
 				return nullptr;
 			}
 			auto json_value = jsondiff::json_loads(value);
@@ -303,6 +600,8 @@ namespace contract
 				BOOST_THROW_EXCEPTION(ContractStorageException("contract info db data error"));
 			auto json_obj = json_value.as<jsondiff::JsonObject>();
 			auto contract_info = ContractInfo::from_json(json_obj);
+			if (cacheable)
+				_contract_info_cache[contract_id] = std::make_shared<ContractInfo>(*contract_info);
 			return contract_info;
 		}
 
@@ -311,7 +610,7 @@ namespace contract
 			check_db();
 			leveldb::ReadOptions options;
 			std::string contract_id;
-			auto status = _db->Get(options, make_contract_name_id_mapping_key(name), &contract_id);
+			auto status = db_get(options, make_contract_name_id_mapping_key(name), &contract_id);
 			if (!status.ok())
 			{
 				return "";
@@ -328,7 +627,7 @@ namespace contract
 			check_db();
 			leveldb::ReadOptions read_options;
 			std::string state_hash;
-			if (!_db->Get(read_options, root_state_hash_key, &state_hash).ok())
+			if (!db_get(read_options, root_state_hash_key, &state_hash).ok())
 				state_hash = EMPTY_COMMIT_ID;
 			return state_hash;
 		}
@@ -359,7 +658,7 @@ namespace contract
 			check_db();
 			leveldb::ReadOptions read_options;
 			std::string state_hash;
-			if (!_db->Get(read_options, top_root_state_hash_key, &state_hash).ok())
+			if (!db_get(read_options, top_root_state_hash_key, &state_hash).ok())
 				state_hash = EMPTY_COMMIT_ID;
 			return state_hash;
 		}
@@ -398,14 +697,14 @@ namespace contract
 			leveldb::ReadOptions read_options;
 			std::string old_value;
 			jsondiff::JsonObject old_json_value;
-			auto read_status = _db->Get(read_options, key, &old_value);
+			auto read_status = db_get(read_options, key, &old_value);
 			if (read_status.ok())
 			{
 				old_json_value = jsondiff::json_loads(old_value).as<jsondiff::JsonObject>();
 			}
 
 			auto json_obj = contract_info->to_json();
-			auto status = _db->Put(write_options, key, jsondiff::json_dumps(json_obj));
+			auto status = db_put(write_options, key, jsondiff::json_dumps(json_obj));
 			if (!status.ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("save contract info to db error"));
 			changed_leveldb_keys.push_back(key);
@@ -419,9 +718,9 @@ namespace contract
 				// check name unique(exist contract with this name's id must be same or empty)
 				const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(contract_info->name);
 				std::string exist_name_id;
-				if (_db->Get(read_options, contract_name_id_mapping_key, &exist_name_id).ok() && exist_name_id != contract_info->id)
+				if (db_get(read_options, contract_name_id_mapping_key, &exist_name_id).ok() && exist_name_id != contract_info->id)
 					BOOST_THROW_EXCEPTION(ContractStorageException(std::string("contract name ") + contract_info->name + " existed before"));
-				if (!_db->Put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
+				if (!db_put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
 					BOOST_THROW_EXCEPTION(ContractStorageException("save contract name => contract id mapping to db error"));
 				changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 			}
@@ -430,10 +729,10 @@ namespace contract
 			const auto& root_state_hash = generate_next_root_hash(old_root_state_hash, hash_new_contract_info_commit(contract_info));
 			ContractCommitId commitId = root_state_hash;
 			add_commit_info(commitId, CONTRACT_INFO_CHANGE_TYPE, contract_info_diff_str, contract_info->id);
-			if (!_db->Put(write_options, root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update root state hash error"));
 			changed_leveldb_keys.push_back(root_state_hash_key);
-			if (!_db->Put(write_options, top_root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, top_root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update top root state hash error"));
 			changed_leveldb_keys.push_back(top_root_state_hash_key);
 			success = true;
@@ -459,7 +758,7 @@ namespace contract
 			leveldb::ReadOptions options;
 			options.snapshot = snapshot;
 			std::string value;
-			auto status = _db->Get(options, key, &value);
+			auto status = db_get(options, key, &value);
 			if (!status.ok())
 				return jsondiff::JsonValue();
 			return jsondiff::json_loads(value);
@@ -475,7 +774,7 @@ namespace contract
 			options.snapshot = snapshot;
 			std::string value;
 			std::vector<ContractBalance> result;
-			auto status = _db->Get(options, make_contract_info_key(contract_id), &value);
+			auto status = db_get(options, make_contract_info_key(contract_id), &value);
 			if (!status.ok()) {
 				return result;
 			}
@@ -509,7 +808,7 @@ namespace contract
 			const auto& commit_events_key = make_commit_events_key(commit_id);
 
 			std::string events_str_value;
-			if (_db->Get(read_options, commit_events_key, &events_str_value).ok()) {
+			if (db_get(read_options, commit_events_key, &events_str_value).ok()) {
 				const auto& json_obj = jsondiff::json_loads(events_str_value);
 				if (json_obj.is_array()) {
 					*events = ContractChanges::events_from_json(json_obj.as<jsondiff::JsonArray>());
@@ -531,7 +830,7 @@ namespace contract
 
 			const auto& tx_events_key = make_transaction_events_key(transaction_id);
 			std::string value;
-			if (_db->Get(read_options, tx_events_key, &value).ok()) {
+			if (db_get(read_options, tx_events_key, &value).ok()) {
 				const auto& events_json = jsondiff::json_loads(value);
 				if (events_json.is_array()) {
 					*events = ContractChanges::events_from_json(events_json.as<jsondiff::JsonArray>());
@@ -620,7 +919,7 @@ namespace contract
 				}
 				std::string value;
 				auto contract_info_key = make_contract_info_key(balance_change.address);
-				auto status = _db->Get(read_options, contract_info_key, &value);
+				auto status = db_get(read_options, contract_info_key, &value);
 				if (!status.ok()) {
 					BOOST_THROW_EXCEPTION(ContractStorageException("contract info not found to transfer balance"));
 				}
@@ -635,7 +934,7 @@ namespace contract
 				}
 				json_obj["balances"] = balances_json_array;
 				const auto& new_contract_info_value = jsondiff::json_dumps(json_obj);
-				auto write_status = _db->Put(write_options, contract_info_key, new_contract_info_value);
+				auto write_status = db_put(write_options, contract_info_key, new_contract_info_value);
 				if(!write_status.ok())
 					BOOST_THROW_EXCEPTION(ContractStorageException("contract info write to db error"));
 				changed_leveldb_keys.push_back(contract_info_key);
@@ -649,7 +948,7 @@ namespace contract
 					const auto& storage_old_value = get_contract_storage(contract_id, storage_change_item.name);
 					const auto& storage_value = differ.patch(storage_old_value, storage_change_item.diff);
 					const auto& key = make_contract_storage_key(contract_id, storage_change_item.name);
-					auto status = _db->Put(write_options, key, jsondiff::json_dumps(storage_value));
+					auto status = db_put(write_options, key, jsondiff::json_dumps(storage_value));
 					if (!status.ok())
 						BOOST_THROW_EXCEPTION(ContractStorageException("contract storage write to db error"));
 					changed_leveldb_keys.push_back(key);
@@ -672,7 +971,7 @@ namespace contract
 			{
 				const auto& commit_events_key = make_commit_events_key(commitId);
 				const auto& events_json = ContractChanges::events_to_json(changes->events);
-				if (!_db->Put(write_options, commit_events_key, jsondiff::json_dumps(events_json)).ok()) {
+				if (!db_put(write_options, commit_events_key, jsondiff::json_dumps(events_json)).ok()) {
 					BOOST_THROW_EXCEPTION(ContractStorageException("commit events save error"));
 				}
 				changed_leveldb_keys.push_back(commit_events_key);
@@ -681,7 +980,7 @@ namespace contract
 			for (const auto& p : *transaction_events) {
 				const auto& tx_events_key = make_transaction_events_key(p.first);
 				const auto& tx_events_json = ContractChanges::events_to_json(p.second);
-				if (!_db->Put(write_options, tx_events_key, jsondiff::json_dumps(tx_events_json)).ok()) {
+				if (!db_put(write_options, tx_events_key, jsondiff::json_dumps(tx_events_json)).ok()) {
 					BOOST_THROW_EXCEPTION(ContractStorageException("commit events save error"));
 				}
 				changed_leveldb_keys.push_back(tx_events_key);
@@ -693,7 +992,7 @@ namespace contract
 				const auto& contract_id = upgrade_info.contract_id;
 				std::string value;
 				auto contract_info_key = make_contract_info_key(contract_id);
-				auto status = _db->Get(read_options, contract_info_key, &value);
+				auto status = db_get(read_options, contract_info_key, &value);
 				if (!status.ok()) {
 					BOOST_THROW_EXCEPTION(ContractStorageException("contract info not found to upgrade"));
 				}
@@ -709,21 +1008,21 @@ namespace contract
 				if(upgrade_info.description_diff)
 					contract_info->description = differ.patch(contract_info->description, upgrade_info.description_diff).as_string();
 				const auto& new_contract_info_value = jsondiff::json_dumps(contract_info->to_json());
-				auto write_status = _db->Put(write_options, contract_info_key, new_contract_info_value);
+				auto write_status = db_put(write_options, contract_info_key, new_contract_info_value);
 				if (!write_status.ok())
 					BOOST_THROW_EXCEPTION(ContractStorageException("contract info write to db error"));
 				changed_leveldb_keys.push_back(contract_info_key);
 
 				if (!old_contract_name.empty()) {
 					const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(old_contract_name);
-					auto delete_status = _db->Delete(write_options, contract_name_id_mapping_key);
+					auto delete_status = db_delete(write_options, contract_name_id_mapping_key);
 					if (!delete_status.ok() && !delete_status.IsNotFound())
 						BOOST_THROW_EXCEPTION(ContractStorageException("contract info write to db error"));
 					changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 				}
 				if (!contract_info->name.empty()) {
 					const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(contract_info->name);
-					if (!_db->Put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
+					if (!db_put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
 						BOOST_THROW_EXCEPTION(ContractStorageException("contract info write to db error"));
 					changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 				}
@@ -733,10 +1032,10 @@ namespace contract
 			const auto& diff_json = changes->to_json();
 			const auto& diff_str = jsondiff::json_dumps(diff_json);
 			add_commit_info(commitId, CONTRACT_STORAGE_CHANGE_TYPE, diff_str, "");
-			if (!_db->Put(write_options, root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update root state hash error"));
 			changed_leveldb_keys.push_back(root_state_hash_key);
-			if (!_db->Put(write_options, top_root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, top_root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update top root state hash error"));
 			changed_leveldb_keys.push_back(top_root_state_hash_key);
 			success = true;
@@ -774,7 +1073,7 @@ namespace contract
 			if (!commit_info && dest_commit_id != EMPTY_COMMIT_ID)
 				BOOST_THROW_EXCEPTION(ContractStorageException(std::string("Can't find commit ") + dest_commit_id));
 			leveldb::WriteOptions write_options;
-			if (!_db->Put(write_options, root_state_hash_key, dest_commit_id).ok())
+			if (!db_put(write_options, root_state_hash_key, dest_commit_id).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update root state hash error"));
 		}
 
@@ -832,7 +1131,7 @@ namespace contract
 					{
 						// delete this contract in db
 						const auto& delete_key = make_contract_info_key(i->contract_id);
-						auto delete_contract_status = _db->Delete(write_options, delete_key);
+						auto delete_contract_status = db_delete(write_options, delete_key);
 						if (!delete_contract_status.ok())
 							BOOST_THROW_EXCEPTION(ContractStorageException("delete contract info from db error"));
 						changed_leveldb_keys.push_back(delete_key);
@@ -841,7 +1140,7 @@ namespace contract
 					{
 						// set older data
 						const auto& set_key = make_contract_info_key(i->contract_id);
-						auto update_status = _db->Put(write_options, set_key, jsondiff::json_dumps(rollbakced_contract_info->to_json()));
+						auto update_status = db_put(write_options, set_key, jsondiff::json_dumps(rollbakced_contract_info->to_json()));
 						if (!update_status.ok())
 							BOOST_THROW_EXCEPTION(ContractStorageException("rollback contract info to db error"));
 						changed_leveldb_keys.push_back(set_key);
@@ -853,7 +1152,7 @@ namespace contract
 						{
 							// when not have name before, delete name => id mapping
 							const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(contract_info->name);
-							if (!_db->Delete(write_options, contract_name_id_mapping_key).ok())
+							if (!db_delete(write_options, contract_name_id_mapping_key).ok())
 								BOOST_THROW_EXCEPTION(ContractStorageException("rollback contract info(delete contract name=>id mapping) to db error"));
 							changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 						}
@@ -871,7 +1170,7 @@ namespace contract
 							continue;
 						std::string value;
 						auto contract_info_key = make_contract_info_key(balance_change.address);
-						auto status = _db->Get(read_options, contract_info_key, &value);
+						auto status = db_get(read_options, contract_info_key, &value);
 						if (!status.ok()) {
 							BOOST_THROW_EXCEPTION(ContractStorageException("contract info not found to transfer balance"));
 						}
@@ -899,7 +1198,7 @@ namespace contract
 						}
 						contract_info->balances = balances;
 						auto new_contract_info_value = jsondiff::json_dumps(contract_info->to_json());
-						auto write_status = _db->Put(write_options, contract_info_key, new_contract_info_value);
+						auto write_status = db_put(write_options, contract_info_key, new_contract_info_value);
 						if (!write_status.ok())
 							BOOST_THROW_EXCEPTION(ContractStorageException("contract info write to db error"));
 						changed_leveldb_keys.push_back(contract_info_key);
@@ -913,7 +1212,7 @@ namespace contract
 							auto storage_new_value = get_contract_storage(contract_id, storage_change_item.name);
 							auto storage_value = differ.rollback(storage_new_value, storage_change_item.diff);
 							auto key = make_contract_storage_key(contract_id, storage_change_item.name);
-							auto status = _db->Put(write_options, key, jsondiff::json_dumps(storage_value));
+							auto status = db_put(write_options, key, jsondiff::json_dumps(storage_value));
 							if (!status.ok())
 								BOOST_THROW_EXCEPTION(ContractStorageException("contract storage write to db error"));
 							changed_leveldb_keys.push_back(key);
@@ -924,7 +1223,7 @@ namespace contract
 						const auto& contract_id = upgrade_info.contract_id;
 						std::string value;
 						auto contract_info_key = make_contract_info_key(contract_id);
-						auto status = _db->Get(read_options, contract_info_key, &value);
+						auto status = db_get(read_options, contract_info_key, &value);
 						if (!status.ok()) {
 							BOOST_THROW_EXCEPTION(ContractStorageException("contract info not found to rollback upgrade"));
 						}
@@ -945,21 +1244,21 @@ namespace contract
 						else
 							old_contract_desc = contract_info->description;
 						contract_info->description = old_contract_desc.is_string() ? old_contract_desc.as_string() : "";
-						status = _db->Put(write_options, contract_info_key, jsondiff::json_dumps(contract_info->to_json()));
+						status = db_put(write_options, contract_info_key, jsondiff::json_dumps(contract_info->to_json()));
 						if (!status.ok())
 							BOOST_THROW_EXCEPTION(ContractStorageException("contract upgrade info rollback failed"));
 						changed_leveldb_keys.push_back(contract_info_key);
 						// mapping name=>id
 						if (!now_contract_name.empty()) {
 							const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(now_contract_name);
-							auto delete_status = _db->Delete(write_options, contract_name_id_mapping_key);
+							auto delete_status = db_delete(write_options, contract_name_id_mapping_key);
 							if (!delete_status.ok() && !delete_status.IsNotFound())
 								BOOST_THROW_EXCEPTION(ContractStorageException("contract upgrade info rollback failed"));
 							changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 						}
 						if (!contract_info->name.empty()) {
 							const auto& contract_name_id_mapping_key = make_contract_name_id_mapping_key(contract_info->name);
-							if (!_db->Put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
+							if (!db_put(write_options, contract_name_id_mapping_key, contract_info->id).ok())
 								BOOST_THROW_EXCEPTION(ContractStorageException("contract upgrade info rollback failed"));
 							changed_leveldb_keys.push_back(contract_name_id_mapping_key);
 						}
@@ -974,7 +1273,7 @@ namespace contract
 						// transactionId=>events delete
 						for (const auto& txid : transaction_ids) {
 							const auto& tx_events_key = make_transaction_events_key(txid);
-							auto status = _db->Delete(write_options, tx_events_key);
+							auto status = db_delete(write_options, tx_events_key);
 							if (!status.ok() && !status.IsNotFound()) {
 								BOOST_THROW_EXCEPTION(ContractStorageException("rollback commit events failed"));
 							}
@@ -985,7 +1284,7 @@ namespace contract
 					{
 						// events key delete
 						const auto& commit_events_key = make_commit_events_key(i->commit_id);
-						auto delete_commit_events_key_status = _db->Delete(write_options, commit_events_key);
+						auto delete_commit_events_key_status = db_delete(write_options, commit_events_key);
 						if (!delete_commit_events_key_status.ok() && !delete_commit_events_key_status.IsNotFound()) {
 							BOOST_THROW_EXCEPTION(ContractStorageException("rollback commit events failed"));
 						}
@@ -1010,16 +1309,16 @@ namespace contract
 				}
 
 				// delete the rollbackedCommitId => value in db
-				auto deleteCommitIdValueStatus = _db->Delete(write_options, i->commit_id);
+				auto deleteCommitIdValueStatus = db_delete(write_options, i->commit_id);
 				if (!deleteCommitIdValueStatus.ok())
 					BOOST_THROW_EXCEPTION(ContractStorageException(std::string("delete commit ") + i->commit_id + " error"));
 			}
 
 			const auto& root_state_hash = dest_commit_id;
-			if (!_db->Put(write_options, root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update root state hash error"));
 			changed_leveldb_keys.push_back(root_state_hash_key);
-			if (!_db->Put(write_options, top_root_state_hash_key, root_state_hash).ok())
+			if (!db_put(write_options, top_root_state_hash_key, root_state_hash).ok())
 				BOOST_THROW_EXCEPTION(ContractStorageException("update top root state hash error"));
 			changed_leveldb_keys.push_back(top_root_state_hash_key);
 		}
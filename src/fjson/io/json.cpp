@@ -23,7 +23,7 @@ namespace fjson
     template<typename T, json::parse_type parser_type> variants arrayFromStream( T& in );
     template<typename T, json::parse_type parser_type> variant number_from_stream( T& in );
     template<typename T> variant token_from_stream( T& in );
-    void escape_string( const string& str, ostream& os );
+    template<typename T> void escape_string( const string& str, T& os );
     template<typename T> void to_stream( T& os, const variants& a, json::output_formatting format );
     template<typename T> void to_stream( T& os, const variant_object& o, json::output_formatting format );
     template<typename T> void to_stream( T& os, const variant& v, json::output_formatting format );
@@ -34,6 +34,43 @@ namespace fjson
 
 namespace fjson
 {
+   /**
+    *  In-memory input for the legacy parser. peek() and get() behave like those of the
+    *  std::stringstream it replaces (EOF once exhausted), so parsing results are unchanged,
+    *  but reading a character is a pointer increment instead of a virtual stream call.
+    */
+   class string_reader
+   {
+      public:
+         explicit string_reader( const std::string& str )
+         :_pos(str.data()),_end(str.data() + str.size()){}
+
+         int peek()const { return _pos < _end ? (unsigned char)*_pos : EOF; }
+         int get()       { return _pos < _end ? (unsigned char)*_pos++ : EOF; }
+      private:
+         const char* _pos;
+         const char* _end;
+   };
+
+   /**
+    *  Output for to_string which appends straight into a std::string, writing the same bytes
+    *  as an std::ostream with the default locale would.
+    */
+   class string_writer
+   {
+      public:
+         string_writer& operator<<( char c )               { _str.push_back(c); return *this; }
+         string_writer& operator<<( const char* s )        { _str.append(s); return *this; }
+         string_writer& operator<<( const std::string& s ) { _str.append(s); return *this; }
+         string_writer& operator<<( int64_t i )            { _str.append(std::to_string(i)); return *this; }
+         string_writer& operator<<( uint64_t i )           { _str.append(std::to_string(i)); return *this; }
+         string_writer& write( const char* s, size_t n )   { _str.append(s, n); return *this; }
+
+         std::string& str() { return _str; }
+      private:
+         std::string _str;
+   };
+
    template<typename T>
    char parseEscape( T& in )
    {
@@ -87,7 +124,7 @@ namespace fjson
    template<typename T>
    fjson::string stringFromStream( T& in )
    {
-      fjson::stringstream token;
+      fjson::string token;
       try
       {
          char c = in.peek();
@@ -97,34 +134,34 @@ namespace fjson
                                             "Expected '\"' but read '${char}'",
                                             ("char", string(&c, (&c) + 1) ) );
          in.get();
-         while( true )
+         while( in.peek() != EOF )
          {
 
             switch( c = in.peek() )
             {
                case '\\':
-                  token << parseEscape( in );
+                  token.push_back( parseEscape( in ) );
                   break;
                case 0x04:
                   FJSON_THROW_EXCEPTION( parse_error_exception, "EOF before closing '\"' in string '${token}'",
-                                                   ("token", token.str() ) );
+                                                   ("token", token ) );
                case '"':
                   in.get();
-                  return token.str();
+                  return token;
                default:
-                  token << c;
+                  token.push_back( c );
                   in.get();
             }
          }
          FJSON_THROW_EXCEPTION( parse_error_exception, "EOF before closing '\"' in string '${token}'",
-                                          ("token", token.str() ) );
+                                          ("token", token ) );
        } FJSON_RETHROW_EXCEPTIONS( warn, "while parsing token '${token}'",
-                                          ("token", token.str() ) );
+                                          ("token", token ) );
    }
    template<typename T>
    fjson::string stringFromToken( T& in )
    {
-      fjson::stringstream token;
+      fjson::string token;
       try
       {
          char c = in.peek();
@@ -134,36 +171,36 @@ namespace fjson
             switch( c = in.peek() )
             {
                case '\\':
-                  token << parseEscape( in );
+                  token.push_back( parseEscape( in ) );
                   break;
                case '\t':
                case ' ':
                case '\0':
                case '\n':
                   in.get();
-                  return token.str();
+                  return token;
                default:
                 if( isalnum( c ) || c == '_' || c == '-' || c == '.' || c == ':' || c == '/' )
                 {
-                  token << c;
+                  token.push_back( c );
                   in.get();
                 }
-                else return token.str();
+                else return token;
             }
          }
-         return token.str();
+         return token;
       }
       catch( const fjson::eof_exception& eof )
       {
-         return token.str();
+         return token;
       }
       catch (const std::ios_base::failure&)
       {
-         return token.str();
+         return token;
       }
 
       FJSON_RETHROW_EXCEPTIONS( warn, "while parsing token '${token}'",
-                                          ("token", token.str() ) );
+                                          ("token", token ) );
    }
 
    template<typename T, json::parse_type parser_type>
@@ -252,14 +289,14 @@ namespace fjson
    template<typename T, json::parse_type parser_type>
    variant number_from_stream( T& in )
    {
-      fjson::stringstream ss;
+      fjson::string str;
 
       bool  dot = false;
       bool  neg = false;
       if( in.peek() == '-')
       {
         neg = true;
-        ss.put( in.get() );
+        str.push_back( in.get() );
       }
       bool done = false;
 
@@ -285,12 +322,12 @@ namespace fjson
               case '7':
               case '8':
               case '9':
-                 ss.put( in.get() );
+                 str.push_back( in.get() );
                  break;
               default:
                  if( isalnum( c ) )
                  {
-                    return ss.str() + stringFromToken( in );
+                    return str + stringFromToken( in );
                  }
                 done = true;
                 break;
@@ -303,7 +340,6 @@ namespace fjson
       catch (const std::ios_base::failure&)
       {
       }
-      fjson::string str = ss.str();
       if (str == "-." || str == ".") // check the obviously wrong things we could have encountered
         FJSON_THROW_EXCEPTION(parse_error_exception, "Can't parse token \"${token}\" as a JSON numeric constant", ("token", str));
       if( dot )
@@ -459,14 +495,17 @@ namespace fjson
    { try {
       check_string_depth( utf8_str );
 
+      if( ptype == legacy_parser || ptype == legacy_parser_with_string_doubles )
+      {
+         string_reader reader( utf8_str );
+         if( ptype == legacy_parser )
+            return variant_from_stream<string_reader, legacy_parser>( reader );
+         return variant_from_stream<string_reader, legacy_parser_with_string_doubles>( reader );
+      }
       std::stringstream in( utf8_str );
       //in.exceptions( std::ifstream::eofbit );
       switch( ptype )
       {
-          case legacy_parser:
-              return variant_from_stream<std::stringstream, legacy_parser>( in );
-          case legacy_parser_with_string_doubles:
-              return variant_from_stream<std::stringstream, legacy_parser_with_string_doubles>( in );
           case strict_parser:
               return json_relaxed::variant_from_stream<std::stringstream, true>( in );
           case relaxed_parser:
@@ -509,36 +548,44 @@ namespace fjson
     *
     *  All other characters are printed as UTF8.
     */
-   void escape_string( const string& str, std::ostream& os )
+   template<typename T>
+   void escape_string( const string& str, T& os )
    {
       os << '"';
-      for( auto itr = str.begin(); itr != str.end(); ++itr )
+      // characters which need no escaping are written in runs
+      const char* run = str.data();
+      const char* end = str.data() + str.size();
+      for( const char* itr = run; itr != end; ++itr )
       {
+         const char* escaped;
          switch( *itr )
          {
             case '\t':
-               os << "\\t";
+               escaped = "\\t";
                break;
             case '\n':
-               os << "\\n";
+               escaped = "\\n";
                break;
             case '\\':
-               os << "\\\\";
+               escaped = "\\\\";
                break;
             case '\r':
-               os << "\\r";
+               escaped = "\\r";
                break;
             case '\a':
-               os << "\\a";
+               escaped = "\\a";
                break;
             case '\"':
-               os << "\\\"";
+               escaped = "\\\"";
                break;
             default:
-               os << *itr;
-               //toUTF8( *itr, os );
+               continue;
          }
+         os.write( run, itr - run );
+         os << escaped;
+         run = itr + 1;
       }
+      os.write( run, end - run );
       os << '"';
    }
    ostream& json::to_stream( ostream& out, const fjson::string& str )
@@ -642,9 +689,9 @@ namespace fjson
 
    fjson::string   json::to_string( const variant& v, output_formatting format /* = stringify_large_ints_and_doubles */ )
    {
-	   std::stringstream ss;
-      fjson::to_stream( ss, v, format );
-      return ss.str();
+      string_writer out;
+      fjson::to_stream( out, v, format );
+      return std::move(out.str());
    }
 
 
@@ -1,6 +1,7 @@
 #include <fjson/variant_object.hpp>
 #include <fjson/exception/exception.hpp>
 #include <assert.h>
+#include <string.h>
 
 
 namespace fjson
@@ -47,6 +48,74 @@ namespace fjson
       fjson_swap( _value, v );
    }
 
+   // ---------------------------------------------------------------
+   // object_key_index
+
+   static size_t hash_key( const char* key, size_t len )
+   {
+      // FNV-1a
+      uint64_t h = 14695981039346656037ULL;
+      for( size_t i = 0; i < len; ++i )
+      {
+         h ^= (unsigned char)key[i];
+         h *= 1099511628211ULL;
+      }
+      return (size_t)h;
+   }
+
+   object_key_index::object_key_index( const std::vector< variant_object::entry >& entries )
+   :_count(0)
+   {
+      rehash( entries, 64 );
+   }
+
+   void object_key_index::rehash( const std::vector< variant_object::entry >& entries, size_t slot_count )
+   {
+      while( slot_count < 2 * entries.size() )
+         slot_count *= 2;
+      _slots.assign( slot_count, 0 );
+      _count = 0;
+      for( size_t pos = 0; pos < entries.size(); ++pos )
+         insert( entries, pos );
+   }
+
+   void object_key_index::insert( const std::vector< variant_object::entry >& entries, size_t pos )
+   {
+      const string& key = entries[pos].key();
+      const size_t mask = _slots.size() - 1;
+      for( size_t slot = hash_key( key.data(), key.size() ) & mask; ; slot = (slot + 1) & mask )
+      {
+         if( _slots[slot] == 0 )
+         {
+            _slots[slot] = (uint32_t)(pos + 1);
+            ++_count;
+            return;
+         }
+         // a repeated key keeps pointing at its first entry
+         if( entries[_slots[slot] - 1].key() == key )
+            return;
+      }
+   }
+
+   void object_key_index::add( const std::vector< variant_object::entry >& entries )
+   {
+      if( 2 * (_count + 1) > _slots.size() )
+         rehash( entries, 2 * _slots.size() );
+      else
+         insert( entries, entries.size() - 1 );
+   }
+
+   size_t object_key_index::find( const std::vector< variant_object::entry >& entries, const char* key )const
+   {
+      const size_t mask = _slots.size() - 1;
+      for( size_t slot = hash_key( key, strlen(key) ) & mask; _slots[slot] != 0; slot = (slot + 1) & mask )
+      {
+         if( entries[_slots[slot] - 1].key() == key )
+            return _slots[slot] - 1;
+      }
+      return entries.size();
+   }
+
    // ---------------------------------------------------------------
    // variant_object
 
@@ -68,6 +137,8 @@ namespace fjson
 
    variant_object::iterator variant_object::find( const char* key )const
    {
+      if( _index )
+         return begin() + _index->find( *_key_value, key );
       for( auto itr = begin(); itr != end(); ++itr )
       {
          if( itr->key() == key )
@@ -108,13 +179,13 @@ namespace fjson
    }
 
    variant_object::variant_object( const variant_object& obj )
-   :_key_value( obj._key_value )
+   :_key_value( obj._key_value ), _index( obj._index )
    {
       assert( _key_value != nullptr );
    }
 
    variant_object::variant_object( variant_object&& obj)
-   : _key_value( fjson::move(obj._key_value) )
+   : _key_value( fjson::move(obj._key_value) ), _index( fjson::move(obj._index) )
    {
       obj._key_value = std::make_shared<std::vector<entry>>();
       assert( _key_value != nullptr );
@@ -123,10 +194,12 @@ namespace fjson
    variant_object::variant_object( const mutable_variant_object& obj )
       : _key_value(std::make_shared<std::vector<entry>>(*obj._key_value))
    {
+      if( obj._index )
+         _index = std::make_shared<object_key_index>( *obj._index );
    }
 
    variant_object::variant_object( mutable_variant_object&& obj )
-   : _key_value(fjson::move(obj._key_value))
+   : _key_value(fjson::move(obj._key_value)), _index(fjson::move(obj._index))
    {
       assert( _key_value != nullptr );
    }
@@ -136,6 +209,7 @@ namespace fjson
       if (this != &obj)
       {
          fjson_swap(_key_value, obj._key_value );
+         fjson_swap(_index, obj._index );
          assert( _key_value != nullptr );
       }
       return *this;
@@ -146,6 +220,7 @@ namespace fjson
       if (this != &obj)
       {
          _key_value = obj._key_value;
+         _index = obj._index;
       }
       return *this;
    }
@@ -153,6 +228,7 @@ namespace fjson
    variant_object& variant_object::operator=( mutable_variant_object&& obj )
    {
       _key_value = fjson::move(obj._key_value);
+      _index = fjson::move(obj._index);
       obj._key_value.reset( new std::vector<entry>() );
       return *this;
    }
@@ -160,6 +236,12 @@ namespace fjson
    variant_object& variant_object::operator=( const mutable_variant_object& obj )
    {
       *_key_value = *obj._key_value;
+      // copies sharing the entries share the index too, so it is rebuilt in place. Copies of an
+      // object without one could not get a new one, so it is only added when nothing shares the entries
+      if( _index )
+         *_index = object_key_index( *_key_value );
+      else if( _key_value->size() >= object_key_index::min_object_size && _key_value.use_count() == 1 )
+         _index = std::make_shared<object_key_index>( *_key_value );
       return *this;
    }
 
@@ -203,6 +285,8 @@ namespace fjson
 
    mutable_variant_object::iterator mutable_variant_object::find( const char* key )const
    {
+      if( _index )
+         return begin() + _index->find( *_key_value, key );
       for( auto itr = begin(); itr != end(); ++itr )
       {
          if( itr->key() == key )
@@ -220,6 +304,8 @@ namespace fjson
 
    mutable_variant_object::iterator mutable_variant_object::find( const char* key )
    {
+      if( _index )
+         return begin() + _index->find( *_key_value, key );
       for( auto itr = begin(); itr != end(); ++itr )
       {
          if( itr->key() == key )
@@ -251,6 +337,7 @@ namespace fjson
       auto itr = find( key );
       if( itr != end() ) return itr->value();
       _key_value->emplace_back(entry(key, variant()));
+      indexed_back();
       return _key_value->back().value();
    }
 
@@ -273,21 +360,26 @@ namespace fjson
    mutable_variant_object::mutable_variant_object( const variant_object& obj )
       : _key_value( new std::vector<entry>(*obj._key_value) )
    {
+      if( obj._index )
+         _index.reset( new object_key_index( *obj._index ) );
    }
 
    mutable_variant_object::mutable_variant_object( const mutable_variant_object& obj )
       : _key_value( new std::vector<entry>(*obj._key_value) )
    {
+      if( obj._index )
+         _index.reset( new object_key_index( *obj._index ) );
    }
 
    mutable_variant_object::mutable_variant_object( mutable_variant_object&& obj )
-      : _key_value(fjson::move(obj._key_value))
+      : _key_value(fjson::move(obj._key_value)), _index(fjson::move(obj._index))
    {
    }
 
    mutable_variant_object& mutable_variant_object::operator=( const variant_object& obj )
    {
       *_key_value = *obj._key_value;
+      _index.reset( obj._index ? new object_key_index( *obj._index ) : nullptr );
       return *this;
    }
 
@@ -296,6 +388,7 @@ namespace fjson
       if (this != &obj)
       {
          _key_value = fjson::move(obj._key_value);
+         _index = fjson::move(obj._index);
       }
       return *this;
    }
@@ -305,10 +398,28 @@ namespace fjson
       if (this != &obj)
       {
          *_key_value = *obj._key_value;
+         _index.reset( obj._index ? new object_key_index( *obj._index ) : nullptr );
       }
       return *this;
    }
 
+   /** indexes the entry just appended, starting the index once the object grows large */
+   void mutable_variant_object::indexed_back()
+   {
+      if( _index )
+         _index->add( *_key_value );
+      else if( _key_value->size() >= object_key_index::min_object_size )
+         _index.reset( new object_key_index( *_key_value ) );
+   }
+
+   void mutable_variant_object::reindex()
+   {
+      if( _key_value->size() >= object_key_index::min_object_size )
+         _index.reset( new object_key_index( *_key_value ) );
+      else
+         _index.reset();
+   }
+
    void mutable_variant_object::reserve( size_t s )
    {
       _key_value->reserve(s);
@@ -321,6 +432,8 @@ namespace fjson
          if( itr->key() == key )
          {
             _key_value->erase(itr);
+            if( _index )
+               reindex();
             return;
          }
       }
@@ -337,6 +450,7 @@ namespace fjson
       else
       {
          _key_value->push_back( entry( fjson::move(key), fjson::move(var) ) );
+         indexed_back();
       }
       return *this;
    }
@@ -347,6 +461,7 @@ namespace fjson
    mutable_variant_object& mutable_variant_object::operator()( string key, variant var )
    {
       _key_value->push_back( entry( fjson::move(key), fjson::move(var) ) );
+      indexed_back();
       return *this;
    }
 
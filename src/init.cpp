@@ -25,6 +25,7 @@
 #include <netbase.h>
 #include <net.h>
 #include <net_processing.h>
+#include <offline_invoke_pool.h>
 #include <policy/feerate.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -35,6 +36,8 @@
 #include <script/standard.h>
 #include <script/sigcache.h>
 #include <scheduler.h>
+#include <stake_agent.h>
+#include <template_builder.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <txmempool.h>
@@ -94,6 +97,7 @@ static CZMQNotificationInterface* pzmqNotificationInterface = nullptr;
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 static void ThreadStakeMiner(CWallet *pwallet);
+static void ThreadRemoteStakeMiner();
 
 
 unsigned int nMinerSleep;
@@ -200,6 +204,9 @@ void Shutdown()
     StopREST();
     StopRPC();
     StopHTTPServer();
+    offlineInvokePool.Stop();
+    stakeServer.Stop();
+    templateBuilder.Stop();
 #ifdef ENABLE_WALLET
     FlushWallets();
 #endif
@@ -520,6 +527,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-speculativetemplates", strprintf(_("Prepare block templates in the background for getblocktemplate and staking (default: %u)"), DEFAULT_SPECULATIVE_TEMPLATES));
+    strUsage += HelpMessageOpt("-stakesocket=<path>", _("Stake the kernels found by stake agents connecting to the Unix socket at <path>, see stake_agent.h for the protocol"));
+    strUsage += HelpMessageOpt("-stakerthreads=<n>", strprintf(_("Set the number of threads searching for proof of stake kernels (0 = auto, <0 = leave that many cores free, default: %d)"), DEFAULT_STAKER_THREADS));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -533,6 +543,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-offlineinvokethreads=<n>", strprintf(_("Set the number of threads serving invokecontractoffline, 0 = use the RPC threads (default: %d)"), DEFAULT_OFFLINE_INVOKE_THREADS));
+    strUsage += HelpMessageOpt("-offlineinvokequeue=<n>", strprintf(_("Set the number of invokecontractoffline calls that can wait for each of these threads (default: %d)"), DEFAULT_OFFLINE_INVOKE_QUEUE));
+    strUsage += HelpMessageOpt("-offlineinvokemaxgas=<n>", strprintf(_("Set the gas limit of invokecontractoffline calls (default: %d)"), DEFAULT_OFFLINE_INVOKE_MAX_GAS));
+    strUsage += HelpMessageOpt("-contractsqlwal", strprintf(_("Switch the contract sql db to write-ahead logging, so contract snapshots don't hold off block connection. The switch can't be undone by restarting without it (default: %u)"), DEFAULT_CONTRACT_SQL_WAL));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
@@ -1297,8 +1311,20 @@ bool AppInitMain()
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadContractTxCheck);
+            threadGroup.create_thread(&ThreadContractExecCheck);
+            threadGroup.create_thread(&ThreadHeaderCheck);
+        }
+    }
+
+    ::contract::storage::ContractStorageService::set_sql_wal_enabled(gArgs.GetBoolArg("-contractsqlwal", DEFAULT_CONTRACT_SQL_WAL));
+
+    int nOfflineInvokeThreads = gArgs.GetArg("-offlineinvokethreads", DEFAULT_OFFLINE_INVOKE_THREADS);
+    if (nOfflineInvokeThreads > 0) {
+        LogPrintf("Using %d threads for offline contract invocations\n", nOfflineInvokeThreads);
+        offlineInvokePool.Start(nOfflineInvokeThreads, gArgs.GetArg("-offlineinvokequeue", DEFAULT_OFFLINE_INVOKE_QUEUE));
     }
 
     // Start the lightweight task scheduler thread
@@ -1816,6 +1842,16 @@ bool AppInitMain()
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
+    if (gArgs.GetBoolArg("-speculativetemplates", DEFAULT_SPECULATIVE_TEMPLATES))
+        templateBuilder.Start();
+
+    if (gArgs.IsArgSet("-stakesocket")) {
+        std::string strError;
+        if (!stakeServer.Start(gArgs.GetArg("-stakesocket", ""), strError))
+            return InitError(strError);
+        threadGroup.create_thread(&ThreadRemoteStakeMiner);
+    }
+
 #ifdef ENABLE_WALLET
     StartWallets(scheduler);
     if (!gArgs.GetBoolArg("-staking", false))
@@ -1828,14 +1864,101 @@ bool AppInitMain()
             posstate.sumOfutxo = 0;
         }
     }
-	else if (!vpwallets.empty())
+	else if (!vpwallets.empty()) {
+		int nStakerThreads = gArgs.GetArg("-stakerthreads", DEFAULT_STAKER_THREADS);
+		if (nStakerThreads <= 0)
+			nStakerThreads += GetNumCores();
+		// the stake miner thread hashes kernels too
+		for (int i = 0; i < nStakerThreads - 1; i++)
+			threadGroup.create_thread(&ThreadStakeKernelCheck);
 		threadGroup.create_thread(boost::bind(&ThreadStakeMiner, vpwallets[0]));
+	}
 #endif
 
     return true;
 }
 
 
+// Sleep until the adjusted time reaches nTime, false if the tip moves away from hashPrevBlock first
+static bool WaitForStakeTime(const uint256& hashPrevBlock, int64_t nTime)
+{
+    while (GetAdjustedTime() < nTime) {
+        if (!fThreadPOSstate)
+            return false;
+        MilliSleep(500);
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() != hashPrevBlock)
+            return false;
+    }
+    return true;
+}
+
+// Build, check and submit the block of a kernel once its time has come, false if it did not make it
+static bool MineStakeKernel(CWallet *pwallet, const StakeKernel& kernel)
+{
+    // a kernel that can't make a block is not waited for, nor one whose time is beyond the next slot
+    if (!CheckStakeKernel(kernel, GetAdjustedTime() + POS_MINER_MAX_TIME)) {
+        LogPrint(BCLog::STAKE, "MineStakeKernel: kernel %s at time %u is not valid on the tip\n", kernel.prevout.ToString(), kernel.nTime);
+        return false;
+    }
+
+    // do not publish a block ahead of its timestamp, it is assembled in the background meanwhile
+    templateBuilder.PreparePosTemplate(pwallet, kernel);
+    if (!WaitForStakeTime(kernel.hashPrevBlock, kernel.nTime)) {
+        // shutting down is not a stale template
+        if (!fThreadPOSstate)
+            return false;
+        RecordStakeTemplateStale();
+        LogPrint(BCLog::STAKE, "MineStakeKernel: tip changed before the kernel's time %u\n", kernel.nTime);
+        return false;
+    }
+
+    //
+    // Create new block
+    //
+    std::unique_ptr<CBlockTemplate> pblocktemplate = templateBuilder.TakePosTemplate(pwallet, kernel);
+    if (!pblocktemplate.get())
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlockPos(pwallet, GetAdjustedTime()+POS_MINER_MAX_TIME, kernel);
+    if (!pblocktemplate.get()) {
+        MilliSleep(500);
+        return false;
+    }
+
+    LogPrintf("ThreadStakeMiner:CreateNewBlockPos success.\n");
+
+    CBlock *pblock = &pblocktemplate->block;
+    if (!CheckStake(pblock)) {
+        MilliSleep(500);
+        return false;
+    }
+
+    LogPrintf("ThreadStakeMiner:CheckStake  success.\n");
+    // Found a solution
+    {
+        LOCK(cs_main);
+        if (pblock->hashPrevBlock != *(pindexBestHeader->phashBlock)) {
+            RecordStakeTemplateStale();
+            LogPrint(BCLog::STAKE, "MineStakeKernel: block %s is stale\n", pblock->GetHash().ToString());
+            MilliSleep(500);
+            return false;
+        }
+    }
+
+    // Process this block the same as if we had received it from another node
+    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
+    bool fAccepted = ProcessNewBlock(Params(), shared_pblock, true, nullptr);
+    RecordStakeBlockSubmitted(fAccepted);
+    if (!fAccepted) {
+        MilliSleep(500);
+        return false;
+    }
+    {
+        LOCK(cs_main);
+        MilliSleep(posSleepTime+500);
+    }
+    return true;
+}
+
 static void ThreadStakeMiner(CWallet *pwallet)
 {
     // Make this thread recognisable as the mining thread
@@ -1896,48 +2019,51 @@ static void ThreadStakeMiner(CWallet *pwallet)
 			}
     
             //
-            // Create new block
+            // Search the next time slots for a kernel, the block is only assembled once one is found
             //
-            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlockPos(pwallet, GetAdjustedTime()+POS_MINER_MAX_TIME));
-            if (!pblocktemplate.get()) {
-    			MilliSleep(posSleepTime+500);
+            StakeKernel kernel;
+            int64_t nTimeEnd = GetAdjustedTime() + POS_MINER_MAX_TIME;
+            if (!FindStakeKernel(pwallet, nTimeEnd, kernel)) {
+                if (kernel.hashPrevBlock.IsNull())
+                    MilliSleep(1000);
+                else
+                    WaitForStakeTime(kernel.hashPrevBlock, nTimeEnd + 1);
                 continue;
             }
+            MineStakeKernel(pwallet, kernel);
+		}
 
-    		LogPrintf("ThreadStakeMiner:CreateNewBlockPos success.\n");
-    		
-            CBlock *pblock = &pblocktemplate->block;
-            if (!CheckStake(pblock)) {
-            	MilliSleep(500);
-    			continue;
-            }
+    }
+}
 
-            LogPrintf("ThreadStakeMiner:CheckStake  success.\n");
-    		// Found a solution
-    	    {
-    	        {
-    	            LOCK(cs_main);
-        	        if (pblock->hashPrevBlock != *(pindexBestHeader->phashBlock))
-        	        	{
-        				MilliSleep(500);
-        				continue;
-        	        	}
-                }
-    
-    	        // Process this block the same as if we had received it from another node
-    	        std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
-    	        if (!ProcessNewBlock(Params(), shared_pblock, true, nullptr))
-    				{
-    	        	MilliSleep(500);
-    				continue;
-    	        	}
-    	    }
-    	    {
-    	        LOCK(cs_main);
-    		    MilliSleep(posSleepTime+500);
-    		}
-		}
+// Hand the stake work of the tip to the stake agents and mine the kernels they find
+static void ThreadRemoteStakeMiner()
+{
+    RenameThread("ubcd-pos-remote");
+    LogPrintf("ThreadRemoteStakeMiner start.\n");
+
+    StakeWork work;
+    bool fHaveWork = false;
+    while (fThreadPOSstate) {
+        uint256 hashTip;
+        {
+            LOCK(cs_main);
+            hashTip = chainActive.Tip()->GetBlockHash();
+        }
+        // new work on every tip, and once the time window of the last one has passed
+        if (!fHaveWork || work.hashPrevBlock != hashTip || GetAdjustedTime() > work.nTimeEnd) {
+            fHaveWork = !IsInitialBlockDownload() && GetStakeWork(GetAdjustedTime() + POS_MINER_MAX_TIME, work);
+            if (!fHaveWork) {
+                MilliSleep(1000);
+                continue;
+            }
+            LogPrint(BCLog::STAKE, "ThreadRemoteStakeMiner: work on %s for %u agents\n", work.hashPrevBlock.ToString(), stakeServer.GetAgentCount());
+            stakeServer.PublishWork(work);
+        }
 
+        StakeKernel kernel;
+        if (stakeServer.WaitForKernel(kernel, 500))
+            MineStakeKernel(nullptr, kernel);
     }
 }
 
@@ -19,6 +19,12 @@ namespace jsondiff
 			_is_undefined = false;
 	}
 
+	DiffResult::DiffResult(JsonValue&& diff_json) :
+		_diff_json(std::move(diff_json))
+	{
+		_is_undefined = _diff_json.is_null();
+	}
+
 	std::shared_ptr<DiffResult> DiffResult::make_undefined_diff_result()
 	{
 		auto result = std::make_shared<DiffResult>();
@@ -41,7 +47,7 @@ namespace jsondiff
 		return _is_undefined;
 	}
 
-	JsonValue DiffResult::value() const
+	const JsonValue& DiffResult::value() const
 	{
 		return _diff_json;
 	}
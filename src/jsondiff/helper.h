@@ -12,10 +12,10 @@ namespace jsondiff
 {
 	namespace utils
 	{
-		bool string_ends_with(std::string str, std::string end);
+		bool string_ends_with(const std::string& str, const std::string& end);
 
 		// ҵһַstrȡ׺extʣַ
-		std::string string_without_ext(std::string str, std::string ext);
+		std::string string_without_ext(const std::string& str, const std::string& ext);
 	}
 }
 
@@ -59,7 +59,35 @@ namespace jsondiff
 	{
 		if (!diff_json.is_object())
 			return false;
-		auto diff_json_obj = diff_json.as<fjson::mutable_variant_object>();
-		return json_has_key(diff_json_obj, JSONDIFF_KEY_OLD_VALUE) && json_has_key(diff_json_obj, JSONDIFF_KEY_NEW_VALUE);
+		const auto& diff_json_obj = diff_json.get_object();
+		return diff_json_obj.contains(JSONDIFF_KEY_OLD_VALUE) && diff_json_obj.contains(JSONDIFF_KEY_NEW_VALUE);
+	}
+
+	static bool is_plain_scalar(const JsonValue& value)
+	{
+		return value.is_null() || value.is_string() || value.is_bool() || value.is_int64() || value.is_uint64();
+	}
+
+	bool json_scalar_equals(const JsonValue& a, const JsonValue& b)
+	{
+		// doubles and blobs keep the textual comparison
+		if (!is_plain_scalar(a) || !is_plain_scalar(b))
+			return json_dumps(a) == json_dumps(b);
+		// integers dump as their decimal value whatever their signedness
+		if ((a.is_int64() || a.is_uint64()) && (b.is_int64() || b.is_uint64()))
+		{
+			if (a.get_type() == b.get_type())
+				return a.is_int64() ? a.as_int64() == b.as_int64() : a.as_uint64() == b.as_uint64();
+			const auto& signed_value = a.is_int64() ? a : b;
+			const auto& unsigned_value = a.is_int64() ? b : a;
+			return signed_value.as_int64() >= 0 && (uint64_t) signed_value.as_int64() == unsigned_value.as_uint64();
+		}
+		if (a.get_type() != b.get_type())
+			return false;
+		if (a.is_string())
+			return a.get_string() == b.get_string();
+		if (a.is_bool())
+			return a.as_bool() == b.as_bool();
+		return true; // both null
 	}
 }
@@ -43,6 +43,9 @@ namespace jsondiff
 
 	JsonValue json_deep_clone(const JsonValue& json_value);
 
+	// same result as comparing json_dumps of two values of the same JsonValueType, without serializing them
+	bool json_scalar_equals(const JsonValue& a, const JsonValue& b);
+
 	bool json_has_key(const JsonObject& json_value, std::string key);
 
 	bool is_scalar_value_diff_format(const JsonValue& diff_json);
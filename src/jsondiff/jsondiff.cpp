@@ -8,8 +8,44 @@
 #include <fjson/variant.hpp>
 #include <fjson/variant_object.hpp>
 
+#include <cstring>
+#include <boost/optional.hpp>
+
 namespace jsondiff
 {
+	// find key in obj, trying position hint first because the two objects of a diff usually share their key order.
+	// like obj.find, returns the first entry with the key when the key is duplicated
+	static fjson::variant_object::iterator find_key_with_hint(const fjson::variant_object& obj, size_t hint, const std::string& key)
+	{
+		if (hint < obj.size())
+		{
+			auto it = obj.begin() + hint;
+			if (strcmp(it->key().c_str(), key.c_str()) == 0)
+			{
+				// large objects are indexed by the position of each key's first entry
+				if (obj.size() >= fjson::object_key_index::min_object_size)
+					return obj.find(key);
+				for (auto prev = obj.begin(); prev != it; prev++)
+				{
+					if (strcmp(prev->key().c_str(), key.c_str()) == 0)
+						return prev;
+				}
+				return it;
+			}
+		}
+		return obj.find(key);
+	}
+
+	static JsonValue make_array_item_diff(const char* op, size_t pos, const JsonValue& item)
+	{
+		fjson::variants item_diff;
+		item_diff.reserve(3);
+		item_diff.push_back(op);
+		item_diff.push_back((int)pos);
+		item_diff.push_back(item);
+		return JsonValue(std::move(item_diff));
+	}
+
 	JsonDiff::JsonDiff()
 	{
 
@@ -26,6 +62,14 @@ namespace jsondiff
 	}
 
 	DiffResultP JsonDiff::diff(const JsonValue& old_json, const JsonValue& new_json)
+	{
+		JsonValue diff_json;
+		if (!diff_value(old_json, new_json, diff_json))
+			return DiffResult::make_undefined_diff_result();
+		return std::make_shared<DiffResult>(std::move(diff_json));
+	}
+
+	bool JsonDiff::diff_value(const JsonValue& old_json, const JsonValue& new_json, JsonValue& diff_json)
 	{
 		auto old_json_type = guess_json_value_type(old_json);
 		auto new_json_type = guess_json_value_type(new_json);
@@ -36,18 +80,16 @@ namespace jsondiff
 			// should return undefined for two identical values
 			// should return { __old: <old value>, __new : <new value> } object for two different numbers
 
-			if (old_json_type != new_json_type || json_dumps(old_json) != json_dumps(new_json))
-			{
-				fjson::mutable_variant_object result_json;
-				result_json[JSONDIFF_KEY_OLD_VALUE] = old_json;
-				result_json[JSONDIFF_KEY_NEW_VALUE] = new_json;
-				return std::make_shared<DiffResult>(result_json);
-			}
-			else
+			if (old_json_type == new_json_type && json_scalar_equals(old_json, new_json))
 			{
 				// identical scalar values
-				return DiffResult::make_undefined_diff_result();
+				return false;
 			}
+			fjson::mutable_variant_object result_json;
+			result_json[JSONDIFF_KEY_OLD_VALUE] = old_json;
+			result_json[JSONDIFF_KEY_NEW_VALUE] = new_json;
+			diff_json = std::move(result_json);
+			return true;
 		}
 		else if (old_json_type == JsonValueType::JVT_OBJECT)
 		{
@@ -58,41 +100,50 @@ namespace jsondiff
 			// should return { <key>__added: <new value> } when the first object is missing a key
 			// should return { <key>: { __old: <old value>, __new : <new value> } } for two objects with diffent scalar values for a key
 			// should return { <key>: <diff> } with a recursive diff for two objects with diffent values for a key
-			auto a_obj = old_json.as<fjson::mutable_variant_object>();
-			auto b_obj = new_json.as<fjson::mutable_variant_object>();
-			bool same = false;
-			fjson::mutable_variant_object diff_json;
-			for (auto i = a_obj.begin(); i != a_obj.end(); i++)
+			const auto& a_obj = old_json.get_object();
+			const auto& b_obj = new_json.get_object();
+			// created on the first difference, identical sub objects then cost no allocation
+			boost::optional<fjson::mutable_variant_object> diff_obj;
+			size_t pos = 0;
+			for (auto i = a_obj.begin(); i != a_obj.end(); i++, pos++)
 			{
-				auto a_i_value = i->value();
-				auto a_i_key = i->key();
-				if (b_obj.find(a_i_key) == b_obj.end())
+				const auto& a_i_key = i->key();
+				auto b_i = find_key_with_hint(b_obj, pos, a_i_key);
+				if (b_i == b_obj.end())
 				{
 					// 存在于old不存在于new
-					diff_json[a_i_key + JSONDIFF_KEY_DELETED_POSTFIX] = a_i_value;
+					if (!diff_obj)
+						diff_obj = fjson::mutable_variant_object();
+					(*diff_obj)[a_i_key + JSONDIFF_KEY_DELETED_POSTFIX] = i->value();
 				}
 				else
 				{
 					// old和new中都有这个key
-					auto sub_diff_value = diff(a_i_value, b_obj[a_i_key]);
-					if (sub_diff_value->is_undefined()) // same elements
+					JsonValue sub_diff_value;
+					if (!diff_value(i->value(), b_i->value(), sub_diff_value)) // same elements
 						continue;
 					// 修改
-					diff_json[a_i_key] = sub_diff_value->value();
+					if (!diff_obj)
+						diff_obj = fjson::mutable_variant_object();
+					(*diff_obj)[a_i_key] = std::move(sub_diff_value);
 				}
 			}
-			for (auto j = b_obj.begin(); j != b_obj.end(); j++)
+			pos = 0;
+			for (auto j = b_obj.begin(); j != b_obj.end(); j++, pos++)
 			{
-				auto key = j->key();
-				if (a_obj.find(key) == a_obj.end())
+				const auto& key = j->key();
+				if (find_key_with_hint(a_obj, pos, key) == a_obj.end())
 				{
 					// 不存在于old但是存在于new
-					diff_json[key + JSONDIFF_KEY_ADDED_POSTFIX] = j->value();
+					if (!diff_obj)
+						diff_obj = fjson::mutable_variant_object();
+					(*diff_obj)[key + JSONDIFF_KEY_ADDED_POSTFIX] = j->value();
 				}
 			}
-			if (diff_json.size() < 1)
-				return DiffResult::make_undefined_diff_result();
-			return std::make_shared<DiffResult>(diff_json);
+			if (!diff_obj || diff_obj->size() < 1)
+				return false;
+			diff_json = std::move(*diff_obj);
+			return true;
 		}
 		else if (old_json_type == JsonValueType::JVT_ARRAY)
 		{
@@ -108,52 +159,39 @@ namespace jsondiff
 			//   should return[..., ['+', insert_position_index, <added item>], ...] for two arrays when the second array has an extra value
 			//   should return[..., ['~', position_index, <diff>], ...] for two arrays when an item has been modified(note: involves a crazy heuristic)
 
-			auto a_array = old_json.as<fjson::variants>();
-			auto b_array = new_json.as<fjson::variants>();
+			const auto& a_array = old_json.get_array();
+			const auto& b_array = new_json.get_array();
 
 			// TODO: 当两个array的大部分元素相同时，但是可能前方插入部分元素，这时候应该尽量减少diff大小
 
 			// 一个array有多项变化的时候， diff里的索引是用原始对象的index
 
-			fjson::variants diff_json;
+			fjson::variants diff_array;
 			for (size_t i = 0; i < a_array.size(); i++)
 			{
 				if (i >= b_array.size())
 				{
 					// 删除元素
-					fjson::variants item_diff;
-					item_diff.push_back("-");
-					item_diff.push_back((int)i);
-					item_diff.push_back(a_array[i]);
-					diff_json.push_back(item_diff);
+					diff_array.push_back(make_array_item_diff("-", i, a_array[i]));
 				}
 				else
 				{
-					auto item_value_diff = diff(a_array[i], b_array[i]);
-					if (item_value_diff->is_undefined()) // 没有发生改变
+					JsonValue item_value_diff;
+					if (!diff_value(a_array[i], b_array[i], item_value_diff)) // 没有发生改变
 						continue;
 					// 修改元素
-					fjson::variants item_diff;
-					item_diff.push_back("~");
-					item_diff.push_back((int)i);
-					item_diff.push_back(item_value_diff->value());
-					diff_json.push_back(item_diff);
+					diff_array.push_back(make_array_item_diff("~", i, item_value_diff));
 				}
 			}
 			for (size_t i = a_array.size(); i < b_array.size(); i++)
 			{
 				// 不存在于old但是存在于new中
-				fjson::variants item_diff;
-				item_diff.push_back("+");
-				item_diff.push_back((int)i);
-				item_diff.push_back(b_array[i]);
-				diff_json.push_back(item_diff);
+				diff_array.push_back(make_array_item_diff("+", i, b_array[i]));
 			}
-			if (diff_json.size() < 1)
-			{
-				return DiffResult::make_undefined_diff_result();
-			}
-			return std::make_shared<DiffResult>(diff_json);
+			if (diff_array.size() < 1)
+				return false;
+			diff_json = std::move(diff_array);
+			return true;
 		}
 		else
 		{
@@ -167,31 +205,32 @@ namespace jsondiff
 	}
 
 	JsonValue JsonDiff::patch(const JsonValue& old_json, const DiffResultP& diff_info)
+	{
+		return patch_value(old_json, diff_info->value());
+	}
+
+	JsonValue JsonDiff::patch_value(const JsonValue& old_json, const JsonValue& diff_json)
 	{
 		auto old_json_type = guess_json_value_type(old_json);
-		auto diff_json = diff_info->value();
-		auto result = json_deep_clone(old_json);
-		if (diff_info->is_undefined() || diff_json.is_null())
-			return result;
-		
-		auto old_json_str = json_dumps(old_json);
-		auto diff_json_str = json_dumps(diff_json);
-		
+		// nothing to apply. variant objects are immutable and shared, so no deep clone is needed
+		if (diff_json.is_null())
+			return old_json;
+
 		if (is_scalar_json_value_type(old_json_type) || is_scalar_value_diff_format(diff_json))
 		{ // TODO: 这个判断要修改得简单准确一点，修改diffjson格式，区分{__old: ..., __new: ...}和普通object diff
 			if (!diff_json.is_object())
 				throw JsonDiffException("wrong format of diffjson of scalar json value");
-			result = diff_json[JSONDIFF_KEY_NEW_VALUE];
+			return diff_json[JSONDIFF_KEY_NEW_VALUE];
 		}
 		else if (old_json_type == JsonValueType::JVT_OBJECT)
 		{
-			auto old_json_obj = old_json.as<fjson::mutable_variant_object>();
-			auto diff_json_obj = diff_json.as<fjson::mutable_variant_object>();
-			auto result_obj = result.as<fjson::mutable_variant_object>();
+			const auto& old_json_obj = old_json.get_object();
+			const auto& diff_json_obj = diff_json.get_object();
+			fjson::mutable_variant_object result_obj(old_json_obj);
 			for (auto i = diff_json_obj.begin(); i != diff_json_obj.end(); i++)
 			{
-				auto key = i->key();
-				auto diff_item = i->value();
+				const auto& key = i->key();
+				const auto& diff_item = i->value();
 				// 如果key是 <key>__deleted 或者 <key>__added，则是删除或者添加，否则是修改现有key的值
 				if (utils::string_ends_with(key, JSONDIFF_KEY_DELETED_POSTFIX) && key.size() > strlen(JSONDIFF_KEY_DELETED_POSTFIX))
 				{
@@ -211,57 +250,55 @@ namespace jsondiff
 					continue;
 				}
 				// 可能是修改现有key的值
-				if (old_json_obj.find(key) == old_json_obj.end())
+				auto old_item = old_json_obj.find(key);
+				if (old_item == old_json_obj.end())
 					throw JsonDiffException("wrong format of diffjson of this old version json");
-				auto sub_item_new = patch(old_json_obj[key], std::make_shared<DiffResult>(diff_item));
-				result_obj[key] = sub_item_new;
+				result_obj[key] = patch_value(old_item->value(), diff_item);
 			}
-			return result_obj;
+			return JsonValue(std::move(result_obj));
 		}
 		else if (old_json_type == JsonValueType::JVT_ARRAY)
 		{
-			auto old_json_array = old_json.as<fjson::variants>();
-			auto diff_json_array = diff_json.as<fjson::variants>();
-			auto result_array = result.as<fjson::variants>();
+			const auto& old_json_array = old_json.get_array();
+			const auto& diff_json_array = diff_json.get_array();
+			fjson::variants result_array(old_json_array);
 			for (size_t i = 0; i < diff_json_array.size(); i++)
 			{
 				if (!diff_json_array[i].is_array())
 					throw JsonDiffException("diffjson format error for array diff");
-				auto diff_item = diff_json_array[i].as<fjson::variants>();
+				const auto& diff_item = diff_json_array[i].get_array();
 				if (diff_item.size() != 3)
 					throw JsonDiffException("diffjson format error for array diff");
-				auto op_item = diff_item[0].as_string();
+				const auto& op_item = diff_item[0].as_string();
 				auto pos = diff_item[1].as_uint64();
-				auto inner_diff_json = diff_item[2];
+				const auto& inner_diff_json = diff_item[2];
 				// FIXME； 一个array有多项变化的时候， diff里的索引是用原始对象的index，所以这里应该找出 pos => old_json中同值的pos
-				if (op_item == std::string("+"))
+				if (op_item == "+")
 				{
 					// 添加元素
 					result_array.insert(result_array.begin() + pos, inner_diff_json);
 				}
-				else if (op_item == std::string("-"))
+				else if (op_item == "-")
 				{
 					// 删除元素
 					result_array.erase(result_array.begin() + pos);
 				}
-				else if (op_item == std::string("~"))
+				else if (op_item == "~")
 				{
 					// 修改元素
-					auto sub_item_new = patch(old_json_array[i], std::make_shared<DiffResult>(inner_diff_json));
-					result_array[pos] = sub_item_new;
+					result_array[pos] = patch_value(old_json_array[i], inner_diff_json);
 				}
 				else
 				{
 					throw JsonDiffException(std::string("not supported diff array op now: ") + op_item);
 				}
 			}
-			return result_array;
+			return JsonValue(std::move(result_array));
 		}
 		else
 		{
 			throw JsonDiffException(std::string("not supported json value type to merge patch ") + json_dumps(old_json));
 		}
-		return result;
 	}
 
 	JsonValue JsonDiff::rollback_by_string(const std::string& new_json_value, DiffResultP diff_info)
@@ -271,30 +308,30 @@ namespace jsondiff
 
 	JsonValue JsonDiff::rollback(const JsonValue& new_json, DiffResultP diff_info)
 	{
-		auto new_json_type = guess_json_value_type(new_json);
-		auto diff_json = diff_info->value();
-		auto result = json_deep_clone(new_json);
-		if (diff_info->is_undefined() || diff_json.is_null())
-			return result;
+		return rollback_value(new_json, diff_info->value());
+	}
 
-		auto new_json_str = json_dumps(new_json);
-		auto diff_json_str = json_dumps(diff_json);
+	JsonValue JsonDiff::rollback_value(const JsonValue& new_json, const JsonValue& diff_json)
+	{
+		auto new_json_type = guess_json_value_type(new_json);
+		if (diff_json.is_null())
+			return new_json;
 
 		if (is_scalar_json_value_type(new_json_type) || is_scalar_value_diff_format(diff_json))
 		{ // TODO: 这个判断要修改得简单准确一点，修改diffjson格式，区分{__old: ..., __new: ...}和普通object diff
 			if (!diff_json.is_object())
 				throw JsonDiffException("wrong format of diffjson of scalar json value");
-			result = diff_json[JSONDIFF_KEY_OLD_VALUE];
+			return diff_json[JSONDIFF_KEY_OLD_VALUE];
 		}
 		else if (new_json_type == JsonValueType::JVT_OBJECT)
 		{
-			auto new_json_obj = new_json.as<fjson::mutable_variant_object>();
-			auto diff_json_obj = diff_json.as<fjson::mutable_variant_object>();
-			auto result_obj = result.as<fjson::mutable_variant_object>();
+			const auto& new_json_obj = new_json.get_object();
+			const auto& diff_json_obj = diff_json.get_object();
+			fjson::mutable_variant_object result_obj(new_json_obj);
 			for (auto i = diff_json_obj.begin(); i != diff_json_obj.end(); i++)
 			{
-				auto key = i->key();
-				auto diff_item = i->value();
+				const auto& key = i->key();
+				const auto& diff_item = i->value();
 				// 如果key是 <key>__deleted 或者 <key>__added，则是删除或者添加，否则是修改现有key的值
 				if (utils::string_ends_with(key, JSONDIFF_KEY_ADDED_POSTFIX) && key.size() > strlen(JSONDIFF_KEY_ADDED_POSTFIX))
 				{
@@ -314,56 +351,54 @@ namespace jsondiff
 					continue;
 				}
 				// 可能是修改现有key的值
-				if (new_json_obj.find(key) == new_json_obj.end())
+				auto new_item = new_json_obj.find(key);
+				if (new_item == new_json_obj.end())
 					throw JsonDiffException("wrong format of diffjson of this old version json");
-				auto sub_item_new = rollback(new_json_obj[key], std::make_shared<DiffResult>(diff_item));
-				result_obj[key] = sub_item_new;
+				result_obj[key] = rollback_value(new_item->value(), diff_item);
 			}
-			return result_obj;
+			return JsonValue(std::move(result_obj));
 		}
 		else if (new_json_type == JsonValueType::JVT_ARRAY)
 		{
-			auto new_json_array = new_json.as<fjson::variants>();
-			auto diff_json_array = diff_json.as<fjson::variants>();
-			auto result_array = result.as<fjson::variants>();
+			const auto& new_json_array = new_json.get_array();
+			const auto& diff_json_array = diff_json.get_array();
+			fjson::variants result_array(new_json_array);
 			for (size_t i = 0; i < diff_json_array.size(); i++)
 			{
 				if (!diff_json_array[i].is_array())
 					throw JsonDiffException("diffjson format error for array diff");
-				auto diff_item = diff_json_array[i].as<fjson::variants>();
+				const auto& diff_item = diff_json_array[i].get_array();
 				if (diff_item.size() != 3)
 					throw JsonDiffException("diffjson format error for array diff");
-				auto op_item = diff_item[0].as_string();
+				const auto& op_item = diff_item[0].as_string();
 				auto pos = diff_item[1].as_uint64(); // pos是old的pos， FIXME： 新旧对象的pos不一定一样
-				auto inner_diff_json = diff_item[2];
+				const auto& inner_diff_json = diff_item[2];
 				// FIXME； 一个array有多项变化的时候， diff里的索引是用原始对象的index，所以这里应该找出 pos => old_json中同值的pos
-				if (op_item == std::string("-"))
+				if (op_item == "-")
 				{
 					// 删除元素，需要回滚
 					result_array.insert(result_array.begin() + pos, inner_diff_json);
 				}
-				else if (op_item == std::string("+"))
+				else if (op_item == "+")
 				{
 					// 添加元素，需要回滚
 					result_array.erase(result_array.begin() + pos);
 				}
-				else if (op_item == std::string("~"))
+				else if (op_item == "~")
 				{
 					// 修改元素
-					auto sub_item_new = rollback(new_json_array[i], std::make_shared<DiffResult>(inner_diff_json));
-					result_array[pos] = sub_item_new;
+					result_array[pos] = rollback_value(new_json_array[i], inner_diff_json);
 				}
 				else
 				{
 					throw JsonDiffException(std::string("not supported diff array op now: ") + op_item);
 				}
 			}
-			return result_array;
+			return JsonValue(std::move(result_array));
 		}
 		else
 		{
 			throw JsonDiffException(std::string("not supported json value type to rollback diff from ") + json_dumps(new_json));
 		}
-		return result;
 	}
 }
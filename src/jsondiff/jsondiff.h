@@ -19,6 +19,10 @@ namespace jsondiff
 	class JsonDiff
 	{
 	private:
+		// diff by reference into diff_json, returns false when the two values are identical
+		bool diff_value(const JsonValue& old_json, const JsonValue& new_json, JsonValue& diff_json);
+		JsonValue patch_value(const JsonValue& old_json, const JsonValue& diff_json);
+		JsonValue rollback_value(const JsonValue& new_json, const JsonValue& diff_json);
 
 	public:
 		JsonDiff();
@@ -6,13 +6,16 @@
 #include <miner.h>
 
 #include <amount.h>
+#include <arith_uint256.h>
 #include <chain.h>
 #include <chainparams.h>
+#include <checkqueue.h>
 #include <coins.h>
 #include <consensus/consensus.h>
 #include <consensus/tx_verify.h>
 #include <consensus/merkle.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
 #include <hash.h>
 #include <validation.h>
 #include <net.h>
@@ -35,6 +38,8 @@
 #include <core_io.h>
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
 #include <queue>
 #include <utility>
 
@@ -64,11 +69,67 @@ int64_t posSleepTime = 0;
 
 posState posstate;
 
+static CCriticalSection cs_stakeMinerStats;
+static CStakeMinerStats stakeMinerStats;
+
+void CTimingHistogram::Add(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < BUCKETS - 1 && nMicros >= (int64_t) 1000 << nBucket)
+        nBucket++;
+    vBuckets[nBucket]++;
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+}
+
+CStakeMinerStats GetStakeMinerStats()
+{
+    LOCK(cs_stakeMinerStats);
+    return stakeMinerStats;
+}
+
+static void RecordStakeKernelSearch(size_t nCoins, uint32_t nSlots, uint64_t nHashes, int64_t nMicros, bool fFound)
+{
+    LOCK(cs_stakeMinerStats);
+    stakeMinerStats.nKernelSearches++;
+    if (fFound)
+        stakeMinerStats.nKernelsFound++;
+    stakeMinerStats.nCoinsScanned += nCoins;
+    stakeMinerStats.nKernelHashes += nHashes;
+    stakeMinerStats.nLastCoins = nCoins;
+    stakeMinerStats.nLastSlots = nSlots;
+    stakeMinerStats.kernelSearchTime.Add(nMicros);
+}
+
+static void RecordStakeTemplate(int64_t nBuildMicros, int64_t nContractMicros)
+{
+    LOCK(cs_stakeMinerStats);
+    stakeMinerStats.nTemplatesBuilt++;
+    stakeMinerStats.templateBuildTime.Add(nBuildMicros);
+    stakeMinerStats.templateContractTime.Add(nContractMicros);
+}
+
+void RecordStakeTemplateStale()
+{
+    LOCK(cs_stakeMinerStats);
+    stakeMinerStats.nTemplatesStale++;
+}
+
+void RecordStakeBlockSubmitted(bool fAccepted)
+{
+    LOCK(cs_stakeMinerStats);
+    stakeMinerStats.nBlocksSubmitted++;
+    if (fAccepted)
+        stakeMinerStats.nBlocksAccepted++;
+}
+
 extern CAmount nMinimumInputValue;
 extern CAmount nReserveBalance;
 //extern int nStakeMinConfirmations;
 
 static bool CheckKernel(CBlock* pblock, const COutPoint& prevout, CAmount amount,int nHeight);
+static bool IsSupportedKernelType(txnouttype whichType);
 //static bool CheckKernel(CBlock* pblock, const COutPoint& prevout, CAmount amount, int32_t utxoDepth);
 
 
@@ -129,6 +190,8 @@ BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(para
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
+    blockContractWriteSet.clear();
+    nContractExecMicros = 0;
 
     // Reserve space for coinbase tx
     nBlockSize = 1000;
@@ -235,8 +298,24 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     };
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    if(nHeight != Params().GetConsensus().ForkV4Height)
-        addPackageTxs(nPackagesSelected, nDescendantsUpdated, minGasPrice, allow_contract);
+    bool fExtended = false;
+    if(nHeight != Params().GetConsensus().ForkV4Height) {
+        if (pprevTemplate && CanExtendTemplate(*pprevTemplate, pindexPrev)) {
+            fExtended = addTemplateTxs(*pprevTemplate);
+            if (!fExtended) {
+                resetBlockTxs();
+                if (allow_contract) {
+                    service->open();
+                    service->rollback_contract_state(old_root_state_hash);
+                    service->close();
+                }
+            }
+        }
+        if (fExtended)
+            addPackageTxs(nPackagesSelected, nDescendantsUpdated, minGasPrice, allow_contract, COutPoint(), psetNewTx);
+        else
+            addPackageTxs(nPackagesSelected, nDescendantsUpdated, minGasPrice, allow_contract);
+    }
 
 	if(allow_contract)
 		service->open();
@@ -313,14 +392,69 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants%s), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, fExtended ? ", extended" : "", 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pwallet, int32_t nTimeLimit, bool fMineWitnessTx)
+std::unique_ptr<CBlockTemplate> BlockAssembler::UpdateNewBlock(const CBlockTemplate& prevTemplate, const std::set<uint256>& setNewTx, const CScript& scriptPubKeyIn, bool fMineWitnessTx)
 {
-    //int64_t nTimeStart = GetTimeMicros();
+    pprevTemplate = &prevTemplate;
+    psetNewTx = &setNewTx;
+    BOOST_SCOPE_EXIT_ALL(this) {
+        pprevTemplate = nullptr;
+        psetNewTx = nullptr;
+    };
+    return CreateNewBlock(scriptPubKeyIn, fMineWitnessTx);
+}
+
+bool BlockAssembler::CanExtendTemplate(const CBlockTemplate& prevTemplate, const CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(mempool.cs);
+    // a fuller template might have taken better paying new transactions instead of some of its own
+    if (prevTemplate.fFull || prevTemplate.block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return false;
+    CTxMemPool::setEntries entries;
+    for (size_t i = 1; i < prevTemplate.block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(prevTemplate.block.vtx[i]->GetHash());
+        if (it == mempool.mapTx.end())
+            return false;
+        entries.insert(it);
+    }
+    return TestPackageTransactions(entries);
+}
+
+bool BlockAssembler::addTemplateTxs(const CBlockTemplate& prevTemplate)
+{
+    // parents come before their children in the template, so the order is kept as it is
+    for (size_t i = 1; i < prevTemplate.block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(prevTemplate.block.vtx[i]->GetHash());
+        if (it->GetTx().HasContractOp()) {
+            if (!AttemptToAddContractToBlock(it, minGasPrice))
+                return false;
+        } else {
+            AddToBlock(it);
+        }
+    }
+    return true;
+}
+
+void BlockAssembler::resetBlockTxs()
+{
+    bool fIncludeWitnessKept = fIncludeWitness;
+    resetBlock();
+    fIncludeWitness = fIncludeWitnessKept;
+    bceResult.clear();
+    pblock->vtx.resize(1);
+    pblock->vtx[0] = MakeTransactionRef(originalRewardTx);
+    pblocktemplate->vTxFees.resize(1);
+    pblocktemplate->vTxSigOpsCost.resize(1);
+    pblocktemplate->fFull = false;
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pwallet, int32_t nTimeLimit, const StakeKernel& kernel, bool fMineWitnessTx)
+{
+    int64_t nTimeStart = GetTimeMicros();
 
     resetBlock();
 
@@ -340,7 +474,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
 
     LOCK2(cs_main, mempool.cs);
 
-    if (!EnsureWalletIsAvailable(pwallet, true))
+    // a kernel found by a stake agent comes without a wallet
+    if (pwallet && !EnsureWalletIsAvailable(pwallet, true))
         return nullptr;
 
     if(chainActive.Height()+1 <(Params().GetConsensus().UBCONTRACT_Height))
@@ -357,6 +492,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
     nHeight = pindexPrev->nHeight + 1;
     if(nHeight == Params().GetConsensus().ForkV4Height)
         return nullptr;
+    if (pindexPrev->GetBlockHash() != kernel.hashPrevBlock)
+        return nullptr;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus(), MINING_TYPE_POS);
     // -regtest only: allow overriding block.nVersion with
@@ -364,7 +501,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
     if (chainparams.MineBlocksOnDemand())
         pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
 
-    pblock->nTime = GetAdjustedTime();
+    // the kernel hash commits to the block time, it must not be moved
+    pblock->nTime = kernel.nTime;
     const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
 
     nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
@@ -393,9 +531,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
 
     // Fill in header
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
+    if (pblock->nBits != kernel.nBits)
+        return nullptr;
 
 	// Create coin stake
 	CTransaction txCoinStake;
@@ -405,108 +544,47 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
     CScript scriptEmpty;
     scriptEmpty.clear();
     //txCoinStake.vout.push_back(CTxOut(0, scriptEmpty));
-    posstate.numOfUtxo = 0;
-    posstate.sumOfutxo = 0;
+	int64_t nCredit = 0;
+	CScript scriptPubKeyKernel;
 
-	// Choose coins to use
-    CAmount nBalance = pwallet->GetBalance();
-    if (nBalance <= nReserveBalance) {
-    	//LogPrintf("CreateNewBlockPos(): nBalance not enough for POS, less than nReserveBalance\n");
+	// Check the kernel again with the consensus code before building on it
+	Coin coinStake;
+	if (!pcoinsTip->GetCoin(kernel.prevout, coinStake) || coinStake.out.nValue != kernel.nValue)
+		return nullptr;
+	if (!CheckKernel(pblock, kernel.prevout, kernel.nValue, nHeight)) {
+		LogPrintf("CreateNewBlockPos(): kernel %s does not meet the target\n", kernel.prevout.ToString());
+		return nullptr;
+	}
+	LogPrintf("CreateCoinStake : kernel found\n");
+
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    CScript scriptPubKeyOut;
+    scriptPubKeyKernel = coinStake.out.scriptPubKey;
+    if (!Solver(scriptPubKeyKernel, whichType, vSolutions))  {
+        LogPrintf("CreateNewBlockPos(): failed to parse kernel\n");
         return nullptr;
     }
-
-    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
-    int64_t nValueIn = 0;
-
-    // Select coins with suitable depth
-    if (!pwallet->SelectCoinsForStaking(nBalance - nReserveBalance, setCoins, nValueIn))
-        return nullptr;
-
-    posstate.numOfUtxo = setCoins.size();
-    posstate.sumOfutxo = nValueIn;
-
-    if (setCoins.empty())
+    LogPrintf("CreateNewBlockPos(): parsed kernel type=%d\n", whichType);
+    if (!IsSupportedKernelType(whichType)) {
+        LogPrintf("CreateNewBlockPos(): no support for kernel type=%d\n", whichType);
         return nullptr;
+    }
+	// use the same script pubkey
+    scriptPubKeyOut = scriptPubKeyKernel;
 
-	int64_t nCredit = 0;
-	bool fKernelFound = false;
-	CScript scriptPubKeyKernel;
-	COutPoint prevoutFound;
-    int64_t startTime=0;
-    int64_t endTime=0;
-    startTime = GetTimeMillis();
+	// push empty vin
+    txCoinStake.vin.push_back(CTxIn(kernel.prevout));
+    nCredit += kernel.nValue;
+	// push empty vout
+	CTxOut empty_txout = CTxOut();
+	empty_txout.SetEmpty();
+	txCoinStake.vout.push_back(empty_txout);
+    txCoinStake.vout.push_back(CTxOut(nCredit, scriptPubKeyOut));
 
-	for (const auto& pcoin: setCoins) {
-		COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+    LogPrintf("CreateNewBlockPos(): added kernel type=%d\n", whichType);
 
-		Coin coinStake;
-		if (!pcoinsTip->GetCoin(prevoutStake, coinStake)) {
-			//return nullptr;
-			continue;
-		}	
-
-		//CTxOut vout = pcoin.first->tx->vout[pcoin.second];
-		//int nDepth = pcoin.first->GetDepthInMainChain();
-
-		//if (CheckKernel(pblock, prevoutStake, vout.nValue, nDepth)) {
-		if (CheckKernel(pblock, prevoutStake, coinStake.out.nValue,nHeight)) {
-            // Found a kernel
-            LogPrintf("CreateCoinStake : kernel found\n");
-
-			// Set prevoutFound
-			prevoutFound = prevoutStake;
-		
-            std::vector<std::vector<unsigned char> > vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-			//scriptPubKeyKernel = vout.scriptPubKey;
-            scriptPubKeyKernel = coinStake.out.scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions))  {
-                LogPrintf("CreateNewBlockPos(): failed to parse kernel\n");
-                break;
-            }
-            LogPrintf("CreateNewBlockPos(): parsed kernel type=%d\n", whichType);
-            if (whichType != TX_SCRIPTHASH  && 
-				whichType != TX_MULTISIG  &&
-				whichType != TX_PUBKEYHASH && 
-				whichType != TX_PUBKEY && 
-				whichType != TX_WITNESS_V0_SCRIPTHASH &&
-				whichType != TX_WITNESS_V0_KEYHASH) {
-                LogPrintf("CreateNewBlockPos(): no support for kernel type=%d\n", whichType);
-                break;  
-            }
-            if (whichType == TX_SCRIPTHASH || 
-				whichType == TX_MULTISIG || 
-				whichType == TX_PUBKEYHASH || 
-				whichType == TX_PUBKEY || 
-				whichType == TX_WITNESS_V0_SCRIPTHASH || 
-				whichType == TX_WITNESS_V0_KEYHASH) {
-				// use the same script pubkey
-                scriptPubKeyOut = scriptPubKeyKernel;
-            }
-
-			// push empty vin
-            txCoinStake.vin.push_back(CTxIn(prevoutStake));
-            nCredit += coinStake.out.nValue;
-            //nCredit += vout.nValue;
-			// push empty vout
-			CTxOut empty_txout = CTxOut();
-			empty_txout.SetEmpty();
-			txCoinStake.vout.push_back(empty_txout);
-            txCoinStake.vout.push_back(CTxOut(nCredit, scriptPubKeyOut));
-
-            LogPrintf("CreateNewBlockPos(): added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
-        }
-	}
-    endTime  = GetTimeMillis();
-    posSleepTime = endTime - startTime;
-
-	if (!fKernelFound)
-		return nullptr;
-
-    if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
+    if (nCredit == 0 || (pwallet && nReserveBalance > 0 && nCredit > pwallet->GetBalance() - nReserveBalance))
         return nullptr;
 	txCoinStake.hash = txCoinStake.ComputeHash();
 
@@ -558,7 +636,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
 
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, minGasPrice, allow_contract, prevoutFound);
+    addPackageTxs(nPackagesSelected, nDescendantsUpdated, minGasPrice, allow_contract, kernel.prevout);
 
     if(allow_contract)
         service->open();
@@ -600,6 +678,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlockPos(CWalletRef& pw
 		throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
 	}
 
+    int64_t nBuildMicros = GetTimeMicros() - nTimeStart;
+    RecordStakeTemplate(nBuildMicros, nContractExecMicros);
+    LogPrint(BCLog::STAKE, "CreateNewBlockPos(): %u txs in %.2fms, contracts %.2fms\n", nBlockTx, 0.001 * nBuildMicros, 0.001 * nContractExecMicros);
+
     return std::move(pblocktemplate);
 }
 
@@ -656,11 +738,29 @@ bool BlockAssembler::AttemptToAddContractToBlock(CTxMemPool::txiter iter, uint64
     if (nTimeLimit != 0 && GetAdjustedTime() >= nTimeLimit - BYTECODE_TIME_BUFFER) {
         return false;
     }
+    const int64_t nTimeStart = GetTimeMicros();
+    BOOST_SCOPE_EXIT_ALL(&) {
+        nContractExecMicros += GetTimeMicros() - nTimeStart;
+    };
+    // the outcome of the last execution on this tip still holds when the contract txs selected
+    // before did not write any of the slots it read or wrote
+    const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    std::shared_ptr<const ContractExecResult> outcome = iter->GetContractExecResult();
+    if (outcome && iter->GetContractExecTip() != hashTip) {
+        // executed on an earlier tip, it can't be reused anymore
+        mempool.UpdateContractExecResult(iter, nullptr, uint256());
+        outcome.reset();
+    }
+    const bool fReuseOutcome = outcome && !outcome->conflicts_with(blockContractWriteSet);
+    if (fReuseOutcome && bceResult.usedGas + outcome->usedGas > softBlockGasLimit) {
+        pblocktemplate->fFull = true;
+        return false;
+    }
     // operate on local vars first, then later apply to `this`
     uint64_t nBlockWeight = this->nBlockWeight;
     uint64_t nBlockSize = this->nBlockSize;
     uint64_t nBlockSigOpsCost = this->nBlockSigOpsCost;
-    ContractTxConverter convert(iter->GetTx(), nullptr, &pblock->vtx);
+    ContractTxConverter convert(iter->GetTx(), nullptr, nHeight, &pblock->vtx);
     ExtractContractTX resultConverter;
     std::string error_ret;
     if (!convert.extractionContractTransactions(resultConverter, error_ret)) {
@@ -702,14 +802,16 @@ bool BlockAssembler::AttemptToAddContractToBlock(CTxMemPool::txiter iter, uint64
 	}
 
 	const auto& old_root_state_hash = service->current_root_state_hash();
-    ContractExec exec(service.get(), *pblock, contractTransactions, hardBlockGasLimit, nTxFee);
+    ContractExec exec(service.get(), chainActive.Tip(), *pblock, contractTransactions, hardBlockGasLimit, nTxFee);
 	bool success = false;
 	BOOST_SCOPE_EXIT_ALL(&service, &success, &old_root_state_hash) {
 		if(!success)
 			service->rollback_contract_state(old_root_state_hash);
 	};
 
-    if (!exec.performByteCode()) {
+    if (fReuseOutcome) {
+        exec.pending_contract_exec_result = *outcome;
+    } else if (!exec.performByteCode()) {
         //error, don't add contract
         return false;
     }
@@ -717,8 +819,13 @@ bool BlockAssembler::AttemptToAddContractToBlock(CTxMemPool::txiter iter, uint64
     if (!exec.processingResults(testExecResult)) {
         return false;
     }
+    if (!fReuseOutcome && !testExecResult.conflicts_with(blockContractWriteSet)) {
+        // the same as running on the tip's contract state, later templates can reuse it
+        mempool.UpdateContractExecResult(iter, std::make_shared<const ContractExecResult>(testExecResult), hashTip);
+    }
     if (bceResult.usedGas + testExecResult.usedGas > softBlockGasLimit) {
         //if this transaction could cause block gas limit to be exceeded, then don't add it
+        pblocktemplate->fFull = true;
         return false;
     }
     // check withdraw-from-info correct
@@ -747,11 +854,13 @@ bool BlockAssembler::AttemptToAddContractToBlock(CTxMemPool::txiter iter, uint64
     if (nBlockSigOpsCost * WITNESS_SCALE_FACTOR > (uint64_t)MAX_BLOCK_SIGOPS_COST ||
         nBlockSize > MaxBlockSerSize) {
         //contract will not be added to block
+        pblocktemplate->fFull = true;
         return false;
     }
     //block is not too big, so apply the contract execution and it's results to the actual block
     //apply local bytecode to global bytecode state
     bceResult.usedGas += testExecResult.usedGas;
+    blockContractWriteSet.insert(testExecResult.storage_write_set.begin(), testExecResult.storage_write_set.end());
     pblock->vtx.emplace_back(iter->GetSharedTx());
     pblocktemplate->vTxFees.push_back(iter->GetFee());
     pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
@@ -855,7 +964,7 @@ void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemP
 // mapModifiedTxs with the next transaction in the mempool to decide what
 // transaction package to work on next.
 
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, uint64_t minGasPrice, bool allow_contract, const COutPoint& outpointPos)
+void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, uint64_t minGasPrice, bool allow_contract, const COutPoint& outpointPos, const std::set<uint256>* psetCandidates)
 {
     // mapModifiedTx will store sorted packages after they are modified
     // because some of their txs are already in the block
@@ -866,6 +975,15 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     // Start by adding all descendants of previously added txs to mapModifiedTx
     // and modifying them for their already included ancestors
     UpdatePackagesForAdded(inBlock, mapModifiedTx);
+    if (psetCandidates) {
+        // the other descendants were already considered for the template being extended
+        for (modtxiter mit = mapModifiedTx.begin(); mit != mapModifiedTx.end(); ) {
+            if (psetCandidates->count(mit->iter->GetTx().GetHash()))
+                ++mit;
+            else
+                mit = mapModifiedTx.erase(mit);
+        }
+    }
 
     auto mi = mempool.mapTx.get<ancestor_score_or_gas_price>().begin();
     CTxMemPool::txiter iter;
@@ -884,7 +1002,8 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
         // First try to find a new transaction in mapTx to evaluate.
         if (mi != mempool.mapTx.get<ancestor_score_or_gas_price>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+                (SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx) ||
+                 (psetCandidates && !psetCandidates->count(mi->GetTx().GetHash())))) {
             ++mi;
             continue;
         }
@@ -940,6 +1059,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
+            pblocktemplate->fFull = true;
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -1070,6 +1190,258 @@ bool CheckKernel(CBlock* pblock, const COutPoint& prevout, CAmount amount,int nH
 }
 
 
+// The kernel script types CreateNewBlockPos can pay the stake back to
+static bool IsSupportedKernelType(txnouttype whichType)
+{
+    return whichType == TX_SCRIPTHASH ||
+        whichType == TX_MULTISIG ||
+        whichType == TX_PUBKEYHASH ||
+        whichType == TX_PUBKEY ||
+        whichType == TX_WITNESS_V0_SCRIPTHASH ||
+        whichType == TX_WITNESS_V0_KEYHASH;
+}
+
+bool CheckStakeKernel(const StakeKernel& kernel, int64_t nTimeMax)
+{
+    LOCK(cs_main);
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pindexPrev->GetBlockHash() != kernel.hashPrevBlock)
+        return false;
+    if ((int64_t)kernel.nTime <= pindexPrev->GetMedianTimePast() || (int64_t)kernel.nTime > nTimeMax)
+        return false;
+
+    Coin coinStake;
+    if (!pcoinsTip->GetCoin(kernel.prevout, coinStake) || coinStake.out.nValue != kernel.nValue)
+        return false;
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(coinStake.out.scriptPubKey, whichType, vSolutions) || !IsSupportedKernelType(whichType))
+        return false;
+
+    CBlock block;
+    block.nVersion = ComputeBlockVersion(pindexPrev, consensusParams, MINING_TYPE_POS);
+    block.hashPrevBlock = kernel.hashPrevBlock;
+    block.nTime = kernel.nTime;
+    block.nBits = GetNextWorkRequired(pindexPrev, &block, consensusParams);
+    if (block.nBits != kernel.nBits)
+        return false;
+    return CheckKernel(&block, kernel.prevout, kernel.nValue, pindexPrev->nHeight + 1);
+}
+
+// A staking coin with the part of its proof of stake hash input that does not depend on the block time
+struct StakeKernelCoin
+{
+    COutPoint prevout;
+    CAmount nValue;
+    // serialized as in CheckProofOfStake, the leading nTime is filled in for each time slot
+    unsigned char vchHashInput[72];
+    unsigned int nHashInputSize;
+    // hash / amount <= target exactly when hash < (target + 1) * amount, which saves a division per hash
+    arith_uint256 bnHashLimit;
+    bool fAnyHash;
+};
+
+/** Hash one staking coin at the time slots that come before the earliest kernel found so far */
+class CStakeKernelCheck
+{
+private:
+    const std::vector<StakeKernelCoin>* pcoins;
+    size_t nCoin;
+    uint32_t nTimeStart;
+    uint32_t nSlots;
+    // slot * coins + coin of the earliest kernel found, ties go to the first coin selected
+    std::atomic<uint64_t>* pnBest;
+    std::atomic<uint64_t>* pnHashes;
+
+public:
+    CStakeKernelCheck(): pcoins(nullptr), nCoin(0), nTimeStart(0), nSlots(0), pnBest(nullptr), pnHashes(nullptr) {}
+    CStakeKernelCheck(const std::vector<StakeKernelCoin>& coinsIn, size_t nCoinIn, uint32_t nTimeStartIn, uint32_t nSlotsIn, std::atomic<uint64_t>* pnBestIn, std::atomic<uint64_t>* pnHashesIn) :
+        pcoins(&coinsIn), nCoin(nCoinIn), nTimeStart(nTimeStartIn), nSlots(nSlotsIn), pnBest(pnBestIn), pnHashes(pnHashesIn) {}
+
+    bool operator()();
+
+    void swap(CStakeKernelCheck &check) {
+        std::swap(pcoins, check.pcoins);
+        std::swap(nCoin, check.nCoin);
+        std::swap(nTimeStart, check.nTimeStart);
+        std::swap(nSlots, check.nSlots);
+        std::swap(pnBest, check.pnBest);
+        std::swap(pnHashes, check.pnHashes);
+    }
+};
+
+bool CStakeKernelCheck::operator()()
+{
+    const StakeKernelCoin& coin = (*pcoins)[nCoin];
+    unsigned char vchHashInput[sizeof(coin.vchHashInput)];
+    memcpy(vchHashInput, coin.vchHashInput, coin.nHashInputSize);
+    uint32_t nSlot = 0;
+    for (; nSlot < nSlots; nSlot++) {
+        uint64_t nKey = (uint64_t) nSlot * pcoins->size() + nCoin;
+        uint64_t nBest = pnBest->load(std::memory_order_relaxed);
+        if (nKey >= nBest)
+            break;
+        WriteLE32(vchHashInput, nTimeStart + nSlot);
+        if (!coin.fAnyHash && UintToArith256(Hash(vchHashInput, vchHashInput + coin.nHashInputSize)) >= coin.bnHashLimit)
+            continue;
+        while (nKey < nBest && !pnBest->compare_exchange_weak(nBest, nKey)) {}
+        nSlot++;
+        break;
+    }
+    pnHashes->fetch_add(nSlot, std::memory_order_relaxed);
+    return true;
+}
+
+static CCheckQueue<CStakeKernelCheck> stakekernelcheckqueue(128);
+
+void ThreadStakeKernelCheck() {
+    RenameThread("ubcd-pos-kernel");
+    stakekernelcheckqueue.Thread();
+}
+
+bool GetStakeWork(int64_t nTimeEnd, StakeWork& work)
+{
+    LOCK(cs_main);
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    int nHeight = pindexPrev->nHeight + 1;
+    if (nHeight < consensusParams.UBCONTRACT_Height || nHeight == consensusParams.ForkV4Height)
+        return false;
+
+    // the earliest time UpdateTime would give the block, the target does not depend on it
+    work.nTimeStart = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
+    work.nTimeEnd = std::max<int64_t>(nTimeEnd, 0);
+    CBlockHeader header;
+    header.nVersion = ComputeBlockVersion(pindexPrev, consensusParams, MINING_TYPE_POS);
+    header.hashPrevBlock = pindexPrev->GetBlockHash();
+    header.nTime = work.nTimeStart;
+    work.hashPrevBlock = header.hashPrevBlock;
+    work.nHeight = nHeight;
+    work.nBits = GetNextWorkRequired(pindexPrev, &header, consensusParams);
+    work.fHashPrev10Block = nHeight >= consensusParams.ForkV3Height;
+    work.hashPrev10Block = work.fHashPrev10Block ? pindexPrev->GetAncestor(pindexPrev->nHeight / 10 * 10)->GetBlockHash() : uint256();
+    return true;
+}
+
+bool SearchStakeKernel(const StakeWork& work, const std::vector<std::pair<COutPoint, CAmount> >& vStakeCoins, StakeKernel& kernel)
+{
+    kernel.hashPrevBlock = work.hashPrevBlock;
+    kernel.nBits = work.nBits;
+    if (vStakeCoins.empty() || work.nTimeEnd < work.nTimeStart)
+        return false;
+
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(work.nBits);
+    const arith_uint256 bnTargetNext = bnTarget + 1;
+
+    std::vector<StakeKernelCoin> vCoins;
+    vCoins.reserve(vStakeCoins.size());
+    for (const auto& stakeCoin : vStakeCoins) {
+        StakeKernelCoin coin;
+        coin.prevout = stakeCoin.first;
+        coin.nValue = stakeCoin.second;
+
+        CDataStream ss(SER_GETHASH, 0);
+        ss << work.nTimeStart << coin.prevout.hash << coin.prevout.n;
+        if (work.fHashPrev10Block)
+            ss << work.hashPrev10Block;
+        assert(ss.size() <= sizeof(coin.vchHashInput));
+        memcpy(coin.vchHashInput, ss.data(), ss.size());
+        coin.nHashInputSize = ss.size();
+
+        const arith_uint256 bnAmount((uint64_t) coin.nValue);
+        coin.fAnyHash = bnTargetNext == 0;
+        if (!coin.fAnyHash) {
+            coin.bnHashLimit = bnTargetNext * bnAmount;
+            coin.fAnyHash = coin.bnHashLimit / bnAmount != bnTargetNext;
+        }
+        vCoins.push_back(coin);
+    }
+
+    int64_t nStart = GetTimeMicros();
+    const uint32_t nSlots = work.nTimeEnd - work.nTimeStart + 1;
+    std::atomic<uint64_t> nBest(std::numeric_limits<uint64_t>::max());
+    std::atomic<uint64_t> nHashes(0);
+    std::vector<CStakeKernelCheck> vChecks;
+    vChecks.reserve(vCoins.size());
+    for (size_t i = 0; i < vCoins.size(); i++)
+        vChecks.emplace_back(vCoins, i, work.nTimeStart, nSlots, &nBest, &nHashes);
+    CCheckQueueControl<CStakeKernelCheck> control(&stakekernelcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    int64_t nMicros = GetTimeMicros() - nStart;
+    posSleepTime = nMicros / 1000;
+
+    const bool fFound = nBest != std::numeric_limits<uint64_t>::max();
+    RecordStakeKernelSearch(vCoins.size(), nSlots, nHashes, nMicros, fFound);
+    LogPrint(BCLog::STAKE, "SearchStakeKernel(): %u coins, %u time slots, %u hashes: %.2fms%s\n", vCoins.size(), nSlots, nHashes.load(), 0.001 * nMicros, fFound ? ", found" : "");
+
+    if (!fFound)
+        return false;
+
+    const StakeKernelCoin& coin = vCoins[nBest % vCoins.size()];
+    kernel.nTime = work.nTimeStart + nBest / vCoins.size();
+    kernel.prevout = coin.prevout;
+    kernel.nValue = coin.nValue;
+    return true;
+}
+
+bool FindStakeKernel(CWalletRef& pwallet, int64_t nTimeEnd, StakeKernel& kernel)
+{
+    kernel = StakeKernel();
+    posstate.numOfUtxo = 0;
+    posstate.sumOfutxo = 0;
+
+    if (!EnsureWalletIsAvailable(pwallet, true))
+        return false;
+
+	// Choose coins to use, the balance is only needed to keep the reserve out of staking
+    CAmount nTargetValue = MAX_MONEY;
+    if (nReserveBalance > 0) {
+        CAmount nBalance = pwallet->GetBalance();
+        if (nBalance <= nReserveBalance) {
+            //LogPrintf("FindStakeKernel(): nBalance not enough for POS, less than nReserveBalance\n");
+            return false;
+        }
+        nTargetValue = nBalance - nReserveBalance;
+    }
+
+    StakeWork work;
+    std::vector<std::pair<COutPoint, CAmount> > vCoins;
+    {
+        LOCK(cs_main);
+        if (!GetStakeWork(nTimeEnd, work))
+            return false;
+        kernel.hashPrevBlock = work.hashPrevBlock;
+
+        std::vector<std::pair<COutPoint, CStakeCandidate> > vSelected;
+        CAmount nValueIn = 0;
+
+        // Select coins with suitable depth
+        if (!pwallet->SelectCoinsForStaking(nTargetValue, vSelected, nValueIn))
+            return false;
+
+        posstate.numOfUtxo = vSelected.size();
+        posstate.sumOfutxo = nValueIn;
+
+        vCoins.reserve(vSelected.size());
+        for (const auto& pcoin: vSelected) {
+            if (IsSupportedKernelType(pcoin.second.type))
+                vCoins.emplace_back(pcoin.first, pcoin.second.nValue);
+        }
+    }
+
+    if (vCoins.empty() || work.nTimeEnd < work.nTimeStart)
+        return false;
+    posstate.ifPos = 2;
+
+    return SearchStakeKernel(work, vCoins, kernel);
+}
+
+
 bool CheckProofOfStake(CBlock* pblock, const COutPoint& prevout,  CAmount amount, int coinAge)
 {
     int nHeight = 0;
@@ -1098,16 +1470,10 @@ bool CheckProofOfStake(CBlock* pblock, const COutPoint& prevout,  CAmount amount
 	{
 	    uint256 hashPrev10Block = pblock->hashPrevBlock;
         CBlockIndex* pblockindex = mapBlockIndex[hashPrev10Block];
-        while(pblockindex)
-        {        
-            if(pblockindex->nHeight == nHeightPre10Blcok)
-            {
-                hashPrev10Block = pblockindex->GetBlockHash();
-                break;
-            }
-            else
-                pblockindex = pblockindex->pprev;
-        }
+        if (pblockindex)
+            pblockindex = pblockindex->GetAncestor(nHeightPre10Blcok);
+        if (pblockindex)
+            hashPrev10Block = pblockindex->GetBlockHash();
 	    ss << pblock->nTime << prevout.hash << prevout.n << hashPrev10Block;
 	}
 	uint256	hashProofOfStake = Hash(ss.begin(), ss.end());
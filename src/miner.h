@@ -30,6 +30,8 @@ static const int32_t BYTECODE_TIME_BUFFER = 6;
 //How much time to spend trying to process transactions when using the generate RPC call
 static const int32_t POW_MINER_MAX_TIME = 60;
 static const int32_t POS_MINER_MAX_TIME = 60;
+/** Default for -stakerthreads, the number of threads hashing stake kernels (0 = auto) */
+static const int DEFAULT_STAKER_THREADS = 0;
 
 struct posState
 {
@@ -38,6 +40,58 @@ struct posState
     uint64_t sumOfutxo;
 };
 
+/** Durations counted in power of two millisecond buckets, the last bucket also holds anything longer */
+struct CTimingHistogram
+{
+    static const int BUCKETS = 14;
+    uint64_t nCount = 0;
+    int64_t nTotalMicros = 0;
+    int64_t nMaxMicros = 0;
+    // bucket i counts the durations shorter than 2^i ms
+    uint64_t vBuckets[BUCKETS] = {};
+
+    void Add(int64_t nMicros);
+};
+
+/** Counters of the stake miner, reported by getstakinginfo */
+struct CStakeMinerStats
+{
+    // kernel searches by FindStakeKernel
+    uint64_t nKernelSearches = 0;
+    uint64_t nKernelsFound = 0;
+    uint64_t nCoinsScanned = 0;
+    uint64_t nKernelHashes = 0;
+    size_t nLastCoins = 0;
+    uint32_t nLastSlots = 0;
+    CTimingHistogram kernelSearchTime;
+    // proof of stake templates assembled for the kernels found
+    uint64_t nTemplatesBuilt = 0;
+    CTimingHistogram templateBuildTime;
+    CTimingHistogram templateContractTime;
+    // blocks of those templates
+    uint64_t nTemplatesStale = 0;
+    uint64_t nBlocksSubmitted = 0;
+    uint64_t nBlocksAccepted = 0;
+};
+
+CStakeMinerStats GetStakeMinerStats();
+/** A template that was built for a kernel but not submitted, because the tip moved first */
+void RecordStakeTemplateStale();
+/** A staked block handed to ProcessNewBlock */
+void RecordStakeBlockSubmitted(bool fAccepted);
+
+/** A staking coin whose proof of stake hash meets the target at block time nTime */
+struct StakeKernel
+{
+    uint256 hashPrevBlock;
+    unsigned int nBits;
+    uint32_t nTime;
+    COutPoint prevout;
+    CAmount nValue;
+
+    StakeKernel() : nBits(0), nTime(0), nValue(0) {}
+};
+
 struct CBlockTemplate
 {
     CBlock block;
@@ -45,6 +99,8 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
     std::vector<unsigned char> vchCoinbaseRootStateHash;
+    // whether transactions were left out for the block's weight, sigops or gas limits
+    bool fFull = false;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -223,6 +279,8 @@ private:
     const CChainParams& chainparams;
 
     ContractExecResult bceResult; // block contracts exec result
+    std::set<ContractStorageSlot> blockContractWriteSet; // storage slots written by the contract txs in the block
+    int64_t nContractExecMicros; // time spent in AttemptToAddContractToBlock
     uint64_t minGasPrice = 1;
     uint64_t hardBlockGasLimit;
     uint64_t softBlockGasLimit;
@@ -233,6 +291,10 @@ private:
     //When GetAdjustedTime() exceeds this, no more transactions will attempt to be added
     int32_t nTimeLimit;
 
+    // Template extended by UpdateNewBlock and the transactions to consider on top of it
+    const CBlockTemplate* pprevTemplate = nullptr;
+    const std::set<uint256>* psetNewTx = nullptr;
+
 public:
     struct Options {
         Options();
@@ -245,7 +307,16 @@ public:
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true, int64_t* pTotalFees = 0, int32_t nTime=0, int32_t nTimeLimit=0); // TODO: change the callee
-	std::unique_ptr<CBlockTemplate> CreateNewBlockPos(CWalletRef& pwallet, int32_t nTimeLimit, bool fMineWitnessTx=true);
+    /**
+     * Construct a new block template which keeps the transactions of prevTemplate and only
+     * selects among setNewTx, the transactions added to the mempool since it was built, for the
+     * rest of the block. The contract transactions kept are replayed from the contract exec result
+     * cache. Everything is selected again, as by CreateNewBlock, when the tip changed, one of the
+     * kept transactions left the mempool or prevTemplate was full.
+     */
+    std::unique_ptr<CBlockTemplate> UpdateNewBlock(const CBlockTemplate& prevTemplate, const std::set<uint256>& setNewTx, const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+	/** Construct a proof of stake block template on the kernel found by FindStakeKernel, pwallet is null for the kernels of stake agents */
+	std::unique_ptr<CBlockTemplate> CreateNewBlockPos(CWalletRef& pwallet, int32_t nTimeLimit, const StakeKernel& kernel, bool fMineWitnessTx=true);
 
 private:
     // utility functions
@@ -260,7 +331,13 @@ private:
     /** Add transactions based on feerate including unconfirmed ancestors
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, uint64_t minGasPrice, bool allow_contract, const COutPoint& outpointPos=COutPoint());
+    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, uint64_t minGasPrice, bool allow_contract, const COutPoint& outpointPos=COutPoint(), const std::set<uint256>* psetCandidates=nullptr);
+    /** Whether the transactions of a template built on pindexPrev can be kept in this block */
+    bool CanExtendTemplate(const CBlockTemplate& prevTemplate, const CBlockIndex* pindexPrev);
+    /** Add the transactions of a previous template in the same order, false if one of them fails */
+    bool addTemplateTxs(const CBlockTemplate& prevTemplate);
+    /** Remove all transactions but the coinbase from the block, keeping its chain context */
+    void resetBlockTxs();
 
 	/** Rebuild the coinbase/coinstake transaction to account for new gas refunds **/
 
@@ -292,6 +369,41 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 bool CheckStake(CBlock* pblock);
 bool CheckProofOfStake(CBlock* pblock, const COutPoint& prevout,  CAmount amount, int coinAge);
+/** The proof of stake parameters of the next block, all a kernel search needs besides the coins */
+struct StakeWork
+{
+    uint256 hashPrevBlock;
+    int nHeight = 0;
+    unsigned int nBits = 0;
+    // from ForkV3Height on the kernel hash also commits to the last block at a multiple of ten
+    bool fHashPrev10Block = false;
+    uint256 hashPrev10Block;
+    // block times to search, both included
+    uint32_t nTimeStart = 0;
+    uint32_t nTimeEnd = 0;
+};
+
+/** The stake work on the current tip for the block times up to nTimeEnd, false if no proof of stake block can follow it */
+bool GetStakeWork(int64_t nTimeEnd, StakeWork& work);
+/**
+ * Search coins, given as outpoint and amount, for the earliest block time of work at which one
+ * of them meets the proof of stake target. The hashes of all coins and time slots are computed
+ * on the stake kernel check threads. Neither the coins nor the chain are looked up.
+ */
+bool SearchStakeKernel(const StakeWork& work, const std::vector<std::pair<COutPoint, CAmount> >& vCoins, StakeKernel& kernel);
+/**
+ * Search the staking coins of a wallet for the earliest block time up to nTimeEnd at which one
+ * of them meets the proof of stake target on the current tip, without holding cs_main while
+ * hashing. The tip searched on is returned in kernel.hashPrevBlock even when no kernel is found.
+ */
+bool FindStakeKernel(CWalletRef& pwallet, int64_t nTimeEnd, StakeKernel& kernel);
+/**
+ * Whether a kernel, found by this node or handed in by a stake agent, still builds on the tip with
+ * an unspent coin that meets the target at its time, and that time is not past nTimeMax
+ */
+bool CheckStakeKernel(const StakeKernel& kernel, int64_t nTimeMax);
+/** Run instances of this in threads to hash stake kernels in parallel */
+void ThreadStakeKernelCheck();
 int GetHolyCoin(std::map<COutPoint, CAmount>& coins);
 int GetBadUTXO(std::vector<std::pair<COutPoint, CTxOut>>& outputs);
 int CreateHolyTransactions(std::vector<std::pair<COutPoint, CTxOut>>& outputs,std::vector<CTransactionRef>& vtx);
@@ -0,0 +1,147 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <offline_invoke_pool.h>
+
+#include <util.h>
+
+#include <contract_storage/contract_storage.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+COfflineInvokePool offlineInvokePool;
+
+uint64_t GetOfflineInvokeMaxGas()
+{
+    return std::max<int64_t>(gArgs.GetArg("-offlineinvokemaxgas", DEFAULT_OFFLINE_INVOKE_MAX_GAS), 0);
+}
+
+OfflineInvokeResult InvokeContractOffline(::contract::storage::ContractStorageService* service, const CBlockIndex* pindexTip, const OfflineInvokeRequest& request)
+{
+    OfflineInvokeResult result;
+    if (!service->get_contract_info(request.contract_address)) {
+        result.status = OfflineInvokeStatus::CONTRACT_NOT_FOUND;
+        result.error = "Address does not exist";
+        return result;
+    }
+
+    CBlock block;
+    CMutableTransaction tx;
+    uint64_t gas_limit = request.gas_limit;
+    uint64_t gas_price = 40;
+
+    valtype version;
+    version.push_back(0x01);
+    tx.vout.push_back(CTxOut(0, CScript() << version << ToByteVector(request.api_arg) << ToByteVector(request.api_name) << ToByteVector(request.contract_address) << ToByteVector(request.caller_address) << gas_limit << gas_price << OP_CALL));
+    block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
+
+    std::vector<ContractTransaction> contractTransactions;
+    ContractTransaction contract_tx;
+    contract_tx.opcode = OP_CALL;
+    contract_tx.params.caller_address = request.caller_address;
+    contract_tx.params.caller = "";
+    contract_tx.params.api_name = request.api_name;
+    contract_tx.params.api_arg = request.api_arg;
+    contract_tx.params.contract_address = request.contract_address;
+    contract_tx.params.gasPrice = gas_price;
+    contract_tx.params.gasLimit = gas_limit;
+    contract_tx.params.version = CONTRACT_MAJOR_VERSION;
+    contractTransactions.push_back(contract_tx);
+
+    ContractExec exec(service, pindexTip, block, contractTransactions, gas_limit, 0);
+    if (!exec.performByteCode()) {
+        result.error = exec.pending_contract_exec_result.error_message;
+        return result;
+    }
+    if (!exec.processingResults(result.exec_result)) {
+        result.error = "process exec result error";
+        return result;
+    }
+    result.status = OfflineInvokeStatus::OK;
+    return result;
+}
+
+void COfflineInvokePool::Start(int nThreads, int nMaxQueueIn)
+{
+    assert(workers.empty());
+    fStopping = false;
+    nMaxQueue = std::max(nMaxQueueIn, 1);
+    for (int i = 0; i < nThreads; i++)
+        workers.emplace_back(new Worker());
+    for (auto& worker : workers) {
+        Worker* pworker = worker.get();
+        pworker->thread = std::thread([this, pworker] {
+            RenameThread("bitcoin-offlineinvoke");
+            Loop(*pworker);
+        });
+    }
+}
+
+void COfflineInvokePool::Stop()
+{
+    for (auto& worker : workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        fStopping = true;
+        worker->cond.notify_all();
+    }
+    for (auto& worker : workers) {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+    workers.clear();
+}
+
+bool COfflineInvokePool::Submit(const OfflineInvokeRequest& request, std::future<OfflineInvokeResult>& result)
+{
+    if (workers.empty())
+        return false;
+    Worker& worker = *workers[std::hash<std::string>()(request.contract_address) % workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (fStopping || worker.queue.size() >= nMaxQueue)
+        return false;
+    Task task;
+    task.request = request;
+    result = task.result.get_future();
+    worker.queue.push_back(std::move(task));
+    worker.cond.notify_one();
+    return true;
+}
+
+void COfflineInvokePool::Loop(Worker& worker)
+{
+    // the snapshot is reused until something is written to the contract storage
+    std::shared_ptr<::contract::storage::ContractStorageService> service;
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            while (!fStopping && worker.queue.empty()) {
+                // an outdated snapshot keeps old versions of the contract dbs alive, don't hold on to it while idle
+                if (service && !service->is_snapshot_latest())
+                    service.reset();
+                worker.cond.wait_for(lock, std::chrono::seconds(1));
+            }
+            if (worker.queue.empty())
+                return;
+            task = std::move(worker.queue.front());
+            worker.queue.pop_front();
+        }
+        try {
+            // a snapshot still latest under cs_main has the contract state of the current tip
+            const CBlockIndex* pindexTip;
+            {
+                LOCK(cs_main);
+                pindexTip = chainActive.Tip();
+                if (!service || !service->is_snapshot_latest())
+                    service = get_read_only_contract_storage_service();
+            }
+            task.result.set_value(InvokeContractOffline(service.get(), pindexTip, task.request));
+        } catch (...) {
+            // drop the snapshot, an exception may have left its overlay half written
+            service.reset();
+            task.result.set_exception(std::current_exception());
+        }
+    }
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_OFFLINE_INVOKE_POOL_H
+#define BITCOIN_OFFLINE_INVOKE_POOL_H
+
+#include <validation.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Default for -offlineinvokethreads, 0 runs offline invocations on the rpc threads */
+static const int DEFAULT_OFFLINE_INVOKE_THREADS = 2;
+/** Default for -offlineinvokequeue, the number of requests that can wait for each offline invoke thread */
+static const int DEFAULT_OFFLINE_INVOKE_QUEUE = 64;
+/** Default for -offlineinvokemaxgas */
+static const int64_t DEFAULT_OFFLINE_INVOKE_MAX_GAS = 100000000;
+
+struct OfflineInvokeRequest
+{
+    std::string caller_address;
+    std::string contract_address;
+    std::string api_name;
+    std::string api_arg;
+    uint64_t gas_limit = DEFAULT_OFFLINE_INVOKE_MAX_GAS;
+};
+
+enum class OfflineInvokeStatus
+{
+    OK,
+    CONTRACT_NOT_FOUND,
+    EXEC_FAILED,
+};
+
+struct OfflineInvokeResult
+{
+    OfflineInvokeStatus status = OfflineInvokeStatus::EXEC_FAILED;
+    std::string error;
+    ContractExecResult exec_result;
+};
+
+/** The gas limit of offline invocations, -offlineinvokemaxgas clamped to be non-negative */
+uint64_t GetOfflineInvokeMaxGas();
+
+/** Call a contract api against a read-only contract storage snapshot taken at pindexTip, nothing is committed */
+OfflineInvokeResult InvokeContractOffline(::contract::storage::ContractStorageService* service, const CBlockIndex* pindexTip, const OfflineInvokeRequest& request);
+
+/**
+ * Threads serving offline contract invocations. Requests are dispatched by contract address, so
+ * the calls to one contract always go to the same thread and reuse its snapshot and the contract
+ * infos parsed in it. A thread keeps its snapshot until the contract storage is written to.
+ */
+class COfflineInvokePool
+{
+private:
+    struct Task
+    {
+        OfflineInvokeRequest request;
+        std::promise<OfflineInvokeResult> result;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Task> queue;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t nMaxQueue = 0;
+    std::atomic<bool> fStopping{false};
+
+    void Loop(Worker& worker);
+
+public:
+    ~COfflineInvokePool() { Stop(); }
+
+    void Start(int nThreads, int nMaxQueueIn);
+    /** Finish the queued requests and join the threads */
+    void Stop();
+    bool IsRunning() const { return !workers.empty(); }
+
+    /** Queue a request on the thread of its contract, false if that thread's queue is full */
+    bool Submit(const OfflineInvokeRequest& request, std::future<OfflineInvokeResult>& result);
+};
+
+extern COfflineInvokePool offlineInvokePool;
+
+#endif // BITCOIN_OFFLINE_INVOKE_POOL_H
@@ -20,6 +20,16 @@ extern BlockMap& mapBlockIndex;
 
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake, const Consensus::Params& params)
 {
+    if (fProofOfStake && pindex && pindex->pprev && !pindex->IsProofOfStake())
+    {
+        // the walk below, with the last proof of stake block cached in the index: it gives up at
+        // the first other block at or below UBCONTRACT_Height, and stops at the genesis block
+        const CBlockIndex* pindexPos = pindex->pindexLastPos;
+        if ((pindexPos ? pindexPos->nHeight + 1 : 1) <= params.UBCONTRACT_Height)
+            return NULL;
+        return pindexPos ? pindexPos : pindex->GetAncestor(0);
+    }
+
     while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
     {
     	if(fProofOfStake)
@@ -33,9 +43,9 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
 }
 
 
-unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock,const Consensus::Params& params)
+/** GetNextWorkRequired with the params of the new block's height */
+static unsigned int ComputeNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
-    assert(pindexLast != nullptr);
     unsigned int nProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
 
     if ((pindexLast->nHeight+1)== Params().GetConsensus().UBCHeight)  
@@ -60,27 +70,7 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
         
         return bnNew.GetCompact();
     }
-	
-    Consensus::Params * temp_params = (Consensus::Params *)&params;
 
-    if(!params.is_regtest_net) {
-        if ((pindexLast->nHeight+1) >= Params().GetConsensus().UBCONTRACT_Height)
-        {
-        	temp_params->UpdateDifficultyAdjustmentIntervalForkV2();
-    	}
-    	else if ((pindexLast->nHeight+1) >= Params().GetConsensus().ForkV1Height)
-    	{
-    		temp_params->UpdateDifficultyAdjustmentIntervalForkV1();
-    	}
-   	else if((pindexLast->nHeight+1) >= Params().GetConsensus().UBCHeight + Params().GetConsensus().UBCInitBlockCount)
-    	{
-			temp_params->UpdateDifficultyAdjustmentInterval();
-    	}
-    	else
-    	{
-		temp_params->UpdateOldDifficultyAdjustmentInterval();
-    	}
-    }
     // Only change once per difficulty adjustment interval
     if ((((pindexLast->nHeight+1) % params.DifficultyAdjustmentInterval() != 0)) &&((pindexLast->nHeight+1) < params.UBCONTRACT_Height) )
     {
@@ -129,6 +119,27 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     return CalculateNextWorkRequired(pindexLast, pindexFirst->GetBlockTime(), params);
 }
 
+unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+    assert(pindexLast != nullptr);
+    const int nHeight = pindexLast->nHeight + 1;
+    const bool fProofOfStake = pblock->IsProofOfStake();
+
+    // Except for testnet's minimum difficulty rule, which looks at the new block's time, the
+    // result only depends on pindexLast and the kind of block, so it is kept in pindexLast.
+    const bool fCache = !params.fPowAllowMinDifficultyBlocks || nHeight >= params.UBCONTRACT_Height;
+    if (fCache) {
+        unsigned int nBits = pindexLast->nextWork.Get(fProofOfStake);
+        if (nBits != 0)
+            return nBits;
+    }
+
+    unsigned int nBits = ComputeNextWorkRequired(pindexLast, pblock, params.ForHeight(nHeight));
+    if (fCache)
+        pindexLast->nextWork.Set(fProofOfStake, nBits);
+    return nBits;
+}
+
 unsigned int PosGetNextTargetRequired(const CBlockIndex* pindexLast,  const CBlockHeader *pblock, const Consensus::Params& params)
 {
 	bool fProofOfStake = pblock->IsProofOfStake();
@@ -148,18 +159,11 @@ unsigned int PosGetNextTargetRequired(const CBlockIndex* pindexLast,  const CBlo
 	{
 	    nLastPosBits = pindexPrev->nBits;
 	    nLastPosTime = pindexPrev->GetBlockTime();
+	    // pblock builds on pindexLast, no need to look its previous block up
 	    if(pindexPrev->nHeight >= params.UBCONTRACT_Height && pindexPrev->nHeight < params.ForkV2Height)
 	    {
-    	    uint256 hashPrevBlock = pblock->hashPrevBlock;
-        	if (hashPrevBlock != uint256()) 
-        	{
-        		auto iter = mapBlockIndex.find(hashPrevBlock);
-        		if (iter != mapBlockIndex.end()) 
-        		{
-        		    if(iter->second->nHeight >= params.ForkV2Height - 1)
-        		        return bnTargetLimitnBits;
-        		}
-            }
+	        if(pindexLast->nHeight >= params.ForkV2Height - 1)
+	            return bnTargetLimitnBits;
         }
 	}
 	    
@@ -173,33 +177,23 @@ unsigned int PosGetNextTargetRequired(const CBlockIndex* pindexLast,  const CBlo
         //return bnTargetLimit.GetCompact(); // second block
         return bnTargetLimitnBits;
 
-    std::vector<unsigned int> tNbits;
-    int64_t nFirstBlockTime=0;
-    const CBlockIndex* tIndexLast = pindexLast;
-    while (tIndexLast && tIndexLast->pprev)
-    {
-        if(tNbits.size() == (params.nPowTargetTimespan / params.nPowTargetSpacing) || tIndexLast->nHeight <=params.UBCONTRACT_Height)
-            break;
-		if(tIndexLast->IsProofOfStake())
-		{
-		    nFirstBlockTime = tIndexLast->GetBlockTime();
-		    tNbits.push_back(tIndexLast->nBits);
-        }
-        tIndexLast = tIndexLast->pprev;
-    }
+    // The window is the last nPowTargetTimespan / nPowTargetSpacing proof of stake blocks above
+    // UBCONTRACT_Height. Their count, whether they all have the same nBits and the first of them
+    // come from the proof of stake summary in the block index instead of walking back over them.
+    const int64_t nWindow = params.nPowTargetTimespan / params.nPowTargetSpacing;
+    int nPosBlocks = 0;
+    if (pindexLast->nHeight > params.UBCONTRACT_Height)
+        nPosBlocks = pindexLast->nChainPosBlocks - pindexLast->GetAncestor(params.UBCONTRACT_Height)->nChainPosBlocks;
 
-    if(tNbits.size() < (params.nPowTargetTimespan / params.nPowTargetSpacing))
+    if(nPosBlocks < nWindow)
         return bnTargetLimitnBits;
-    
-    std::set<unsigned int> tmpBits;
 
-    for(int i = 0;i < tNbits.size();i++)
+    if(pindexLast->nPosBitsRun >= nWindow)
     {
-        tmpBits.insert(tNbits[i]);
-    }
+        const CBlockIndex* pindexFirst = pindexLast->GetPosAncestor(pindexLast->nChainPosBlocks - nWindow + 1);
+        assert(pindexFirst);
+        int64_t nFirstBlockTime = pindexFirst->GetBlockTime();
 
-    if(tmpBits.size() == 1)
-    {
         // Limit adjustment step
         int64_t nActualTimespan = nLastPosTime - nFirstBlockTime;
         if (nActualTimespan < params.nPowTargetTimespan/4)
@@ -335,27 +329,19 @@ unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nF
     return bnNew.GetCompact();
 }
 
-bool CheckProofOfWork(uint256 hash, uint256 prevHash, unsigned int nBits, const Consensus::Params& params, int blockHeight)
+bool IsProofOfWorkExempt(int nHeight, const Consensus::Params& params)
+{
+    if (nHeight == params.ForkV4Height)
+        return true;
+    return nHeight >= params.UBCHeight && nHeight < params.UBCHeight + params.UBCInitBlockCount;
+}
+
+bool CheckProofOfWorkTarget(const uint256& hash, unsigned int nBits, const Consensus::Params& params)
 {
     bool fNegative;
     bool fOverflow;
     arith_uint256 bnTarget;
 
-	if (blockHeight != -1) {
-		if ((blockHeight >= Params().GetConsensus().UBCHeight) 
-			&& (blockHeight < (Params().GetConsensus().UBCHeight + Params().GetConsensus().UBCInitBlockCount)))
-			return true;
-	}
-
-	auto iter = mapBlockIndex.find(prevHash);
-	if (iter != mapBlockIndex.end()) {
-	    if(iter->second->nHeight == Params().GetConsensus().ForkV4Height-1)
-	        return true;
-		if ((iter->second->nHeight >= Params().GetConsensus().UBCHeight -1) 
-			&& (iter->second->nHeight < (Params().GetConsensus().UBCHeight + Params().GetConsensus().UBCInitBlockCount -1)))
-			return true;	
-	}
-
     bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
     // Check range
     if (fNegative || bnTarget == 0 || fOverflow || bnTarget > UintToArith256(params.powLimit))
@@ -367,3 +353,16 @@ bool CheckProofOfWork(uint256 hash, uint256 prevHash, unsigned int nBits, const
 
     return true;
 }
+
+bool CheckProofOfWork(uint256 hash, uint256 prevHash, unsigned int nBits, const Consensus::Params& params, int blockHeight)
+{
+    if (blockHeight == -1) {
+        auto iter = mapBlockIndex.find(prevHash);
+        if (iter != mapBlockIndex.end())
+            blockHeight = iter->second->nHeight + 1;
+    }
+    if (blockHeight != -1 && IsProofOfWorkExempt(blockHeight, params))
+        return true;
+
+    return CheckProofOfWorkTarget(hash, nBits, params);
+}
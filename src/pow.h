@@ -14,14 +14,26 @@ class CBlockHeader;
 class CBlockIndex;
 class uint256;
 
+/**
+ * nBits required of pblock, which builds on pindexLast. params are resolved for the block's
+ * height, they are not changed, and the result is cached in pindexLast for every thread.
+ */
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
 unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params&);
+/** Retargeting of the blocks from UBCONTRACT_Height on, params have to be resolved for the block's height */
 unsigned int PosGetNextTargetRequired(const CBlockIndex* pindexLast,  const CBlockHeader *pblock, const Consensus::Params& params);
 unsigned int PowGetNextTargetRequired(const CBlockIndex* pindexLast,  const CBlockHeader *pblock, const Consensus::Params& params);
 
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake, const Consensus::Params& params);
 
-/** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
+/** Whether the block at nHeight needs no proof of work: the blocks starting the UBC fork and ForkV4 */
+bool IsProofOfWorkExempt(int nHeight, const Consensus::Params&);
+/** Check whether a block hash satisfies the proof-of-work requirement specified by nBits, leaving out the exemptions */
+bool CheckProofOfWorkTarget(const uint256& hash, unsigned int nBits, const Consensus::Params&);
+/**
+ * Check whether a block hash satisfies the proof-of-work requirement specified by nBits. The
+ * block's height decides the exemptions, when it is not given it is looked up from prevHash.
+ */
 bool CheckProofOfWork(uint256 hash, uint256 prevHash, unsigned int nBits, const Consensus::Params&, int blockHeight = -1);
 
 #endif // BITCOIN_POW_H
@@ -27,6 +27,7 @@
 #include <hash.h>
 #include <validationinterface.h>
 #include <warnings.h>
+#include <offline_invoke_pool.h>
 
 #include <stdint.h>
 
@@ -1871,11 +1872,12 @@ UniValue getsimplecontractinfo(const JSONRPCRequest& request)
                         "1. \"addressOrName\"          (string, required) The contract address or contract name\n"
         );
 
-    LOCK(cs_main);
-
     std::string strAddr = request.params[0].get_str();
-    auto service = get_contract_storage_service();
-    service->open();
+    std::shared_ptr<::contract::storage::ContractStorageService> service;
+    {
+        LOCK(cs_main);
+        service = get_read_only_contract_storage_service();
+    }
 	::contract::storage::ContractInfoP contract_info;
 	if (ContractHelper::is_valid_contract_address_format(strAddr)) {
 		contract_info = service->get_contract_info(strAddr);
@@ -1951,11 +1953,12 @@ UniValue getcontractinfo(const JSONRPCRequest& request)
                         "1. \"addressOrName\"          (string, required) The contract address or name\n"
         );
 
-    LOCK(cs_main);
-
     std::string strAddr = request.params[0].get_str();
-    auto service = get_contract_storage_service();
-    service->open();
+    std::shared_ptr<::contract::storage::ContractStorageService> service;
+    {
+        LOCK(cs_main);
+        service = get_read_only_contract_storage_service();
+    }
 	::contract::storage::ContractInfoP contract_info;
 	if (ContractHelper::is_valid_contract_address_format(strAddr)) {
 		contract_info = service->get_contract_info(strAddr);
@@ -2201,7 +2204,6 @@ UniValue getcontractstorage(const JSONRPCRequest& request)
                 "2. \"storage_name\"              (string, required) The storage name to query\n"
         );
 
-    LOCK(cs_main);
     const auto& contract_address = request.params[0].get_str();
     const auto& storage_name = request.params[1].get_str();
     if(!ContractHelper::is_valid_contract_address_format(contract_address)) {
@@ -2210,7 +2212,11 @@ UniValue getcontractstorage(const JSONRPCRequest& request)
     if (storage_name.empty())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid storage name");
 
-    auto service = get_contract_storage_service();
+    std::shared_ptr<::contract::storage::ContractStorageService> service;
+    {
+        LOCK(cs_main);
+        service = get_read_only_contract_storage_service();
+    }
     const auto& storage_value = service->get_contract_storage(contract_address, storage_name);
     const auto& storage_value_json = jsondiff::json_dumps(storage_value);
     UniValue result(UniValue::VOBJ);
@@ -2263,7 +2269,7 @@ UniValue getcreatecontractaddress(const JSONRPCRequest& request)
         CBlock block;
         block.vtx.push_back(MakeTransactionRef(txConst));
         CCoinsViewCache &view = *pcoinsTip;
-        ContractTxConverter converter(txConst, &view, &block.vtx, true);
+        ContractTxConverter converter(txConst, &view, chainActive.Height() + 1, &block.vtx, true);
         ExtractContractTX resultConvertContractTx;
         std::string error_ret;
         if (!converter.extractionContractTransactions(resultConvertContractTx, error_ret)) {
@@ -2314,7 +2320,6 @@ UniValue invokecontractoffline(const JSONRPCRequest& request)
 			"4. \"api_arg\" (string, required) The contract api argument\n"
 		);
 
-	LOCK(cs_main);
 	std::string caller_address = request.params[0].get_str();
 	if (caller_address.length()<20) // FIXME
 		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect address");
@@ -2327,53 +2332,37 @@ UniValue invokecontractoffline(const JSONRPCRequest& request)
 		throw JSONRPCError(RPC_INVALID_PARAMETER, "Incorrect contract api name");
 	std::string api_arg = request.params[3].get_str();
 
-    auto service = get_contract_storage_service();
-	service->open();
-
-	const auto& old_root_state_hash = service->current_root_state_hash();
-
-	auto contract_info = service->get_contract_info(contract_address);
-	if (!contract_info)
-		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Address does not exist");
-
-	BOOST_SCOPE_EXIT_ALL(&service, old_root_state_hash) {
-		service->open();
-		service->rollback_contract_state(old_root_state_hash);
-		service->close();
-	};
-
-	CBlock block;
-	CMutableTransaction tx;
-	uint64_t gas_limit = testing_invoke_contract_gas_limit;
-	uint64_t gas_price = 40;
-
-	valtype version;
-	version.push_back(0x01);
-	tx.vout.push_back(CTxOut(0, CScript() << version << ToByteVector(api_arg) << ToByteVector(api_name) << ToByteVector(contract_address) << ToByteVector(caller_address) << gas_limit << gas_price << OP_CALL));
-	block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
-
-	std::vector<ContractTransaction> contractTransactions;
-	ContractTransaction contract_tx;
-	contract_tx.opcode = OP_CALL;
-	contract_tx.params.caller_address = caller_address;
-	contract_tx.params.caller = "";
-	contract_tx.params.api_name = api_name;
-	contract_tx.params.api_arg = api_arg;
-	contract_tx.params.contract_address = contract_address;
-	contract_tx.params.gasPrice = gas_price;
-	contract_tx.params.gasLimit = gas_limit;
-	contract_tx.params.version = CONTRACT_MAJOR_VERSION;
-	contractTransactions.push_back(contract_tx);
-
-	ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
-	if (!exec.performByteCode()) {
-		//error, don't add contract
-        throw JSONRPCError(RPC_INTERNAL_ERROR, exec.pending_contract_exec_result.error_message);
-	}
-	ContractExecResult execResult;
-	if (!exec.processingResults(execResult)) {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "process exec result error");
+	OfflineInvokeRequest invoke_request;
+	invoke_request.caller_address = caller_address;
+	invoke_request.contract_address = contract_address;
+	invoke_request.api_name = api_name;
+	invoke_request.api_arg = api_arg;
+	invoke_request.gas_limit = GetOfflineInvokeMaxGas();
+
+	// runs against a snapshot of the contract state without cs_main, whatever the
+	// invocation changes stays in the snapshot's memory and is dropped with it
+	OfflineInvokeResult invoke_result;
+	if (offlineInvokePool.IsRunning()) {
+		std::future<OfflineInvokeResult> pending_result;
+		if (!offlineInvokePool.Submit(invoke_request, pending_result))
+			throw JSONRPCError(RPC_MISC_ERROR, "Too many offline invocations of this contract in progress");
+		invoke_result = pending_result.get();
+	} else {
+		// the tip the vm reads is taken with the snapshot, the chain may move on while the call runs
+		const CBlockIndex* pindexTip;
+		std::shared_ptr<::contract::storage::ContractStorageService> service;
+		{
+			LOCK(cs_main);
+			pindexTip = chainActive.Tip();
+			service = get_read_only_contract_storage_service();
+		}
+		invoke_result = InvokeContractOffline(service.get(), pindexTip, invoke_request);
 	}
+	if (invoke_result.status == OfflineInvokeStatus::CONTRACT_NOT_FOUND)
+		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, invoke_result.error);
+	if (invoke_result.status != OfflineInvokeStatus::OK)
+		throw JSONRPCError(RPC_INTERNAL_ERROR, invoke_result.error);
+	const ContractExecResult& execResult = invoke_result.exec_result;
 
 	UniValue result(UniValue::VOBJ);
 	result.push_back(Pair("result", execResult.api_result));
@@ -2449,7 +2438,7 @@ UniValue registercontracttesting(const JSONRPCRequest& request)
     contract_tx.params.version = CONTRACT_MAJOR_VERSION;
     contractTransactions.push_back(contract_tx);
 
-    ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
+    ContractExec exec(service.get(), chainActive.Tip(), block, contractTransactions, gas_limit, 0);
     if (!exec.performByteCode()) {
         //error, don't add contract
         return false;
@@ -2492,7 +2481,7 @@ UniValue registernativecontracttesting(const JSONRPCRequest& request)
 		throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect address");
 	// TODO: check whether has secret of caller_address
 	const auto& template_name = request.params[1].get_str();
-	if(!blockchain::contract::native_contract_finder::has_native_contract_with_key(template_name))
+	if(!blockchain::contract::native_contract_finder::has_native_contract_with_key(template_name, chainActive.Height() + 1))
 		throw JSONRPCError(RPC_INVALID_PARAMETER, "Incorrect native contract template name");
 
 	auto service = get_contract_storage_service();
@@ -2532,7 +2521,7 @@ UniValue registernativecontracttesting(const JSONRPCRequest& request)
 	contract_tx.params.version = CONTRACT_MAJOR_VERSION;
 	contractTransactions.push_back(contract_tx);
 
-	ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
+	ContractExec exec(service.get(), chainActive.Tip(), block, contractTransactions, gas_limit, 0);
 	if (!exec.performByteCode()) {
 		//error, don't add contract
 		return false;
@@ -2621,7 +2610,7 @@ UniValue upgradecontracttesting(const JSONRPCRequest& request)
     contract_tx.params.version = CONTRACT_MAJOR_VERSION;
     contractTransactions.push_back(contract_tx);
 
-    ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
+    ContractExec exec(service.get(), chainActive.Tip(), block, contractTransactions, gas_limit, 0);
     if (!exec.performByteCode()) {
         //error, don't add contract
         return false;
@@ -2708,7 +2697,7 @@ UniValue deposittocontracttesting(const JSONRPCRequest& request)
     contract_tx.params.version = CONTRACT_MAJOR_VERSION;
     contractTransactions.push_back(contract_tx);
 
-    ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
+    ContractExec exec(service.get(), chainActive.Tip(), block, contractTransactions, gas_limit, 0);
     if (!exec.performByteCode()) {
         //error, don't add contract
         return false;
@@ -2836,7 +2825,7 @@ UniValue getchaintxstats(const JSONRPCRequest& request)
         );
 
     const CBlockIndex* pindex;
-    int blockcount = 30 * 24 * 60 * 60 / Params().GetConsensus().nPowTargetSpacing; // By default: 1 month
+    int blockcount;
 
     bool havehash = !request.params[1].isNull();
     uint256 hash;
@@ -2863,6 +2852,7 @@ UniValue getchaintxstats(const JSONRPCRequest& request)
     assert(pindex != nullptr);
 
     if (request.params[0].isNull()) {
+        blockcount = 30 * 24 * 60 * 60 / Params().GetConsensus().PowTargetSpacingAt(pindex->nHeight); // By default: 1 month
         blockcount = std::max(0, std::min(blockcount, pindex->nHeight - 1));
     } else {
         blockcount = request.params[0].get_int();
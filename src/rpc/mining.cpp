@@ -21,6 +21,7 @@
 #include <rpc/blockchain.h>
 #include <rpc/mining.h>
 #include <rpc/server.h>
+#include <template_builder.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
@@ -60,7 +61,7 @@ UniValue GetNetworkHashPS(int lookup, int height) {
 
     // If lookup is -1, then use blocks since last difficulty change.
     if (lookup <= 0)
-        lookup = pb->nHeight % Params().GetConsensus().DifficultyAdjustmentInterval() + 1;
+        lookup = pb->nHeight % Params().GetConsensus().ForHeight(pb->nHeight).DifficultyAdjustmentInterval() + 1;
 
     // If lookup is larger than chain, then set it to chain length.
     if (lookup > pb->nHeight)
@@ -144,7 +145,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetHash(), pblock->hashPrevBlock, pblock->nBits, Params().GetConsensus())) {
+        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetHash(), pblock->hashPrevBlock, pblock->nBits, Params().GetConsensus(), nHeight + 1)) {
             ++pblock->nNonce;
             --nMaxTries;
         }
@@ -321,6 +322,95 @@ UniValue getposstate(const JSONRPCRequest& request)
     return currentposstate;
 }
 
+static UniValue TimingHistogramToJSON(const CTimingHistogram& histogram)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("count", histogram.nCount));
+    result.push_back(Pair("total_ms", 0.001 * histogram.nTotalMicros));
+    result.push_back(Pair("avg_ms", histogram.nCount ? 0.001 * histogram.nTotalMicros / histogram.nCount : 0.0));
+    result.push_back(Pair("max_ms", 0.001 * histogram.nMaxMicros));
+    UniValue buckets(UniValue::VARR);
+    for (int i = 0; i < CTimingHistogram::BUCKETS; i++)
+        buckets.push_back(histogram.vBuckets[i]);
+    result.push_back(Pair("buckets", buckets));
+    return result;
+}
+
+UniValue getstakinginfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getstakinginfo\n"
+            "\nReturns the state of pos mining and the counters of the stake miner since startup.\n"
+            "Times are given as histograms {\"count\", \"total_ms\", \"avg_ms\", \"max_ms\", \"buckets\"},\n"
+            "where buckets[i] counts the durations shorter than 2^i ms and the last bucket also the longer ones.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"ifpos\": n,                 (numeric) 0: pos disabled, 1: pos thread started but not mining, 2: pos mining\n"
+            "  \"numofutxo\": n,             (numeric) The number of utxo staking in the last kernel search\n"
+            "  \"weight\": \"x.xxx\",          (string) The sum of those utxo\n"
+            "  \"kernelsearch\": {\n"
+            "    \"searches\": n,            (numeric) Kernel searches run\n"
+            "    \"found\": n,               (numeric) Searches which found a kernel\n"
+            "    \"coinsscanned\": n,        (numeric) Coins hashed over all searches\n"
+            "    \"lastcoins\": n,           (numeric) Coins hashed in the last search\n"
+            "    \"lastslots\": n,           (numeric) Time slots searched in the last search\n"
+            "    \"hashes\": n,              (numeric) Kernel hashes evaluated\n"
+            "    \"hashespersec\": x.xxx,    (numeric) Kernel hashes per second of search time\n"
+            "    \"time\": {...}             (object) Search time histogram\n"
+            "  },\n"
+            "  \"templates\": {\n"
+            "    \"built\": n,               (numeric) Proof of stake templates assembled\n"
+            "    \"buildtime\": {...},       (object) Assembly time histogram\n"
+            "    \"contracttime\": {...}     (object) Histogram of the time spent executing contracts in each template\n"
+            "  },\n"
+            "  \"blocks\": {\n"
+            "    \"submitted\": n,           (numeric) Staked blocks passed to block processing\n"
+            "    \"accepted\": n,            (numeric) Of which were accepted\n"
+            "    \"stale\": n,               (numeric) Kernels whose block was dropped because the tip changed first\n"
+            "    \"stalerate\": x.xxx        (numeric) stale / (stale + submitted)\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getstakinginfo", "")
+            + HelpExampleRpc("getstakinginfo", "")
+        );
+
+    const CStakeMinerStats stats = GetStakeMinerStats();
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("ifpos", (uint64_t)posstate.ifPos));
+    result.push_back(Pair("numofutxo", (uint64_t)posstate.numOfUtxo));
+    result.push_back(Pair("weight", FormatMoney(posstate.sumOfutxo)));
+
+    UniValue kernelsearch(UniValue::VOBJ);
+    kernelsearch.push_back(Pair("searches", stats.nKernelSearches));
+    kernelsearch.push_back(Pair("found", stats.nKernelsFound));
+    kernelsearch.push_back(Pair("coinsscanned", stats.nCoinsScanned));
+    kernelsearch.push_back(Pair("lastcoins", (uint64_t)stats.nLastCoins));
+    kernelsearch.push_back(Pair("lastslots", (uint64_t)stats.nLastSlots));
+    kernelsearch.push_back(Pair("hashes", stats.nKernelHashes));
+    kernelsearch.push_back(Pair("hashespersec", stats.kernelSearchTime.nTotalMicros ? 1000000.0 * stats.nKernelHashes / stats.kernelSearchTime.nTotalMicros : 0.0));
+    kernelsearch.push_back(Pair("time", TimingHistogramToJSON(stats.kernelSearchTime)));
+    result.push_back(Pair("kernelsearch", kernelsearch));
+
+    UniValue templates(UniValue::VOBJ);
+    templates.push_back(Pair("built", stats.nTemplatesBuilt));
+    templates.push_back(Pair("buildtime", TimingHistogramToJSON(stats.templateBuildTime)));
+    templates.push_back(Pair("contracttime", TimingHistogramToJSON(stats.templateContractTime)));
+    result.push_back(Pair("templates", templates));
+
+    UniValue blocks(UniValue::VOBJ);
+    blocks.push_back(Pair("submitted", stats.nBlocksSubmitted));
+    blocks.push_back(Pair("accepted", stats.nBlocksAccepted));
+    blocks.push_back(Pair("stale", stats.nTemplatesStale));
+    const uint64_t nTries = stats.nTemplatesStale + stats.nBlocksSubmitted;
+    blocks.push_back(Pair("stalerate", nTries ? (double)stats.nTemplatesStale / nTries : 0.0));
+    result.push_back(Pair("blocks", blocks));
+
+    return result;
+}
+
 
 // NOTE: Unlike wallet RPC (which use BTC values), mining RPCs follow GBT (BIP 22) in using satoshi amounts
 UniValue prioritisetransaction(const JSONRPCRequest& request)
@@ -614,9 +704,12 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         nStart = GetTime();
         fLastTemplateSupportsSegwit = fSupportsSegwit;
 
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        // Take the block the template builder prepared on this tip, or create a new one
+        pblocktemplate = templateBuilder.GetPowTemplate(pindexPrevNew, fSupportsSegwit, nTransactionsUpdatedLast, nStart);
+        if (!pblocktemplate) {
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        }
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -1094,6 +1187,7 @@ static const CRPCCommand commands[] =
     { "mining",             "getblocktemplate",       &getblocktemplate,       {"template_request"} },
     { "mining",             "getcoinbase",       &getcoinbase,       {"scriptpubkey"} },
     { "mining",             "getposstate",       &getposstate,       {} },
+    { "mining",             "getstakinginfo",    &getstakinginfo,    {} },
     { "mining",             "submitblock",            &submitblock,            {"hexdata","dummy"} },
 
 
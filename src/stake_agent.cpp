@@ -0,0 +1,452 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <stake_agent.h>
+
+#include <compat.h>
+#include <util.h>
+#include <utilstrencodings.h>
+
+#include <univalue.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+CStakeServer stakeServer;
+
+/** Kernels kept for the stake miner to pick up, the agents of one work rarely find more */
+static const size_t MAX_QUEUED_STAKE_KERNELS = 64;
+
+static bool ParseHash(const UniValue& value, uint256& hash)
+{
+    if (!value.isStr() || value.get_str().size() != 64 || !IsHex(value.get_str()))
+        return false;
+    hash.SetHex(value.get_str());
+    return true;
+}
+
+static bool ParseUInt32(const UniValue& value, uint32_t& n)
+{
+    if (!value.isNum())
+        return false;
+    int64_t nValue = value.get_int64();
+    if (nValue < 0 || nValue > std::numeric_limits<uint32_t>::max())
+        return false;
+    n = nValue;
+    return true;
+}
+
+UniValue StakeWorkToJSON(const StakeWork& work)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("type", "work"));
+    result.push_back(Pair("hashprevblock", work.hashPrevBlock.GetHex()));
+    result.push_back(Pair("height", work.nHeight));
+    result.push_back(Pair("bits", (uint64_t)work.nBits));
+    if (work.fHashPrev10Block)
+        result.push_back(Pair("hashprev10block", work.hashPrev10Block.GetHex()));
+    else
+        result.push_back(Pair("hashprev10block", NullUniValue));
+    result.push_back(Pair("timestart", (uint64_t)work.nTimeStart));
+    result.push_back(Pair("timeend", (uint64_t)work.nTimeEnd));
+    return result;
+}
+
+bool StakeWorkFromJSON(const UniValue& value, StakeWork& work)
+{
+    if (!value.isObject() || find_value(value, "type").getValStr() != "work")
+        return false;
+    const UniValue& height = find_value(value, "height");
+    const UniValue& hashPrev10Block = find_value(value, "hashprev10block");
+    if (!ParseHash(find_value(value, "hashprevblock"), work.hashPrevBlock) || !height.isNum() ||
+        !ParseUInt32(find_value(value, "bits"), work.nBits) ||
+        !ParseUInt32(find_value(value, "timestart"), work.nTimeStart) ||
+        !ParseUInt32(find_value(value, "timeend"), work.nTimeEnd))
+        return false;
+    work.nHeight = height.get_int();
+    work.fHashPrev10Block = !hashPrev10Block.isNull();
+    work.hashPrev10Block.SetNull();
+    return !work.fHashPrev10Block || ParseHash(hashPrev10Block, work.hashPrev10Block);
+}
+
+UniValue StakeKernelToJSON(const StakeKernel& kernel)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("type", "kernel"));
+    result.push_back(Pair("hashprevblock", kernel.hashPrevBlock.GetHex()));
+    result.push_back(Pair("time", (uint64_t)kernel.nTime));
+    result.push_back(Pair("txid", kernel.prevout.hash.GetHex()));
+    result.push_back(Pair("vout", (uint64_t)kernel.prevout.n));
+    result.push_back(Pair("amount", kernel.nValue));
+    return result;
+}
+
+bool StakeKernelFromJSON(const UniValue& value, StakeKernel& kernel)
+{
+    if (!value.isObject() || find_value(value, "type").getValStr() != "kernel")
+        return false;
+    const UniValue& amount = find_value(value, "amount");
+    if (!ParseHash(find_value(value, "hashprevblock"), kernel.hashPrevBlock) ||
+        !ParseUInt32(find_value(value, "time"), kernel.nTime) ||
+        !ParseHash(find_value(value, "txid"), kernel.prevout.hash) ||
+        !ParseUInt32(find_value(value, "vout"), kernel.prevout.n) || !amount.isNum())
+        return false;
+    kernel.nValue = amount.get_int64();
+    kernel.nBits = 0;
+    return MoneyRange(kernel.nValue) && kernel.nValue > 0;
+}
+
+#ifndef WIN32
+
+static bool SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool MakeUnixAddress(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+bool CStakeServer::Start(const std::string& path, std::string& strError)
+{
+    assert(listenFd == -1);
+    sockaddr_un addr;
+    if (!MakeUnixAddress(path, addr)) {
+        strError = strprintf("Invalid stake socket path %s", path);
+        return false;
+    }
+    if (pipe(wakeFds) != 0) {
+        strError = strprintf("Cannot create the stake server's wakeup pipe: %s", strerror(errno));
+        return false;
+    }
+    SetNonBlocking(wakeFds[0]);
+    SetNonBlocking(wakeFds[1]);
+
+    // a socket left behind by an earlier run would make bind fail, anything else at the path is not ours to remove.
+    // only a socket nobody listens on anymore refuses the connection, one of a running node is left alone
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            strError = strprintf("Cannot listen on stake socket %s: the path exists and is not a socket", path);
+            Stop();
+            return false;
+        }
+        int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        int nProbeError = errno;
+        if (probeFd != -1) {
+            nProbeError = connect(probeFd, (sockaddr*)&addr, sizeof(addr)) == 0 ? EADDRINUSE : errno;
+            close(probeFd);
+        }
+        if (nProbeError != ECONNREFUSED) {
+            strError = strprintf("Cannot listen on stake socket %s: %s", path,
+                nProbeError == EADDRINUSE ? "another process is listening on it" : strerror(nProbeError));
+            Stop();
+            return false;
+        }
+        unlink(path.c_str());
+    }
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // no other user may connect in the window between bind and chmod
+    mode_t nOldMask = umask(077);
+    bool fBound = listenFd != -1 && bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(nOldMask);
+    if (!fBound || chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listenFd, 8) != 0 || !SetNonBlocking(listenFd)) {
+        strError = strprintf("Cannot listen on stake socket %s: %s", path, strerror(errno));
+        Stop();
+        return false;
+    }
+    strPath = path;
+    fStopping = false;
+    thread = std::thread([this] {
+        RenameThread("ubcd-stake-server");
+        Loop();
+    });
+    return true;
+}
+
+void CStakeServer::Stop()
+{
+    fStopping = true;
+    Wake();
+    if (thread.joinable())
+        thread.join();
+    cond.notify_all();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Client& client : clients)
+        close(client.fd);
+    clients.clear();
+    if (listenFd != -1) {
+        close(listenFd);
+        listenFd = -1;
+        unlink(strPath.c_str());
+    }
+    for (int& fd : wakeFds) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+    fHaveWork = false;
+    kernels.clear();
+}
+
+void CStakeServer::Wake()
+{
+    if (wakeFds[1] != -1) {
+        char c = 0;
+        if (write(wakeFds[1], &c, 1) < 0) {
+            // the pipe is full, the loop wakes up anyway
+        }
+    }
+}
+
+void CStakeServer::Loop()
+{
+    std::vector<pollfd> fds;
+    while (!fStopping) {
+        fds.clear();
+        fds.push_back({wakeFds[0], POLLIN, 0});
+        fds.push_back({listenFd, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const Client& client : clients)
+                fds.push_back({client.fd, (short)(POLLIN | (client.strSend.empty() ? 0 : POLLOUT)), 0});
+        }
+        if (poll(fds.data(), fds.size(), 1000) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wakeFds[0], buf, sizeof(buf)) > 0) {}
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // clients are only added and removed on this thread, so they still line up with fds
+        std::vector<bool> vDrop(clients.size(), false);
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client& client = clients[i];
+            short revents = fds[i + 2].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buf[4096];
+                ssize_t nRead = recv(client.fd, buf, sizeof(buf), 0);
+                if (nRead == 0 || (nRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    vDrop[i] = true;
+                    continue;
+                }
+                if (nRead > 0)
+                    client.strRecv.append(buf, nRead);
+                size_t nEnd;
+                while ((nEnd = client.strRecv.find('\n')) != std::string::npos) {
+                    ProcessMessage(client.strRecv.substr(0, nEnd));
+                    client.strRecv.erase(0, nEnd + 1);
+                }
+                if (client.strRecv.size() > MAX_STAKE_AGENT_MESSAGE) {
+                    LogPrint(BCLog::STAKE, "CStakeServer: dropping an agent sending an oversized message\n");
+                    vDrop[i] = true;
+                    continue;
+                }
+            }
+            if ((revents & POLLOUT) && !client.strSend.empty()) {
+                ssize_t nSent = send(client.fd, client.strSend.data(), client.strSend.size(), MSG_NOSIGNAL);
+                if (nSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    vDrop[i] = true;
+                else if (nSent > 0)
+                    client.strSend.erase(0, nSent);
+            }
+        }
+        for (size_t i = clients.size(); i-- > 0; ) {
+            if (vDrop[i]) {
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+                LogPrint(BCLog::STAKE, "CStakeServer: agent disconnected, %u left\n", clients.size());
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listenFd, nullptr, nullptr)) != -1) {
+                if (!SetNonBlocking(fd)) {
+                    close(fd);
+                    continue;
+                }
+                Client client;
+                client.fd = fd;
+                if (fHaveWork)
+                    client.strSend = StakeWorkToJSON(work).write() + "\n";
+                clients.push_back(std::move(client));
+                LogPrint(BCLog::STAKE, "CStakeServer: agent connected, %u in total\n", clients.size());
+            }
+        }
+    }
+}
+
+void CStakeServer::ProcessMessage(const std::string& strMessage)
+{
+    UniValue value;
+    StakeKernel kernel;
+    if (!value.read(strMessage) || !StakeKernelFromJSON(value, kernel)) {
+        LogPrint(BCLog::STAKE, "CStakeServer: ignoring an invalid message from an agent\n");
+        return;
+    }
+    // the kernels of an older tip or outside the time window are of no use any more
+    if (!fHaveWork || kernel.hashPrevBlock != work.hashPrevBlock || kernel.nTime < work.nTimeStart || kernel.nTime > work.nTimeEnd)
+        return;
+    if (kernels.size() >= MAX_QUEUED_STAKE_KERNELS)
+        return;
+    kernel.nBits = work.nBits;
+    kernels.push_back(kernel);
+    cond.notify_all();
+}
+
+#else
+
+bool CStakeServer::Start(const std::string& path, std::string& strError)
+{
+    strError = "Stake agents are not supported on this platform";
+    return false;
+}
+
+void CStakeServer::Stop()
+{
+}
+
+void CStakeServer::Wake()
+{
+}
+
+#endif // WIN32
+
+size_t CStakeServer::GetAgentCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return clients.size();
+}
+
+void CStakeServer::PublishWork(const StakeWork& workIn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        work = workIn;
+        fHaveWork = true;
+        kernels.clear();
+        const std::string strMessage = StakeWorkToJSON(work).write() + "\n";
+        for (Client& client : clients)
+            client.strSend += strMessage;
+    }
+    Wake();
+}
+
+bool CStakeServer::WaitForKernel(StakeKernel& kernel, int64_t nTimeoutMillis)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::milliseconds(nTimeoutMillis), [this] { return fStopping || !kernels.empty(); });
+    if (kernels.empty())
+        return false;
+    kernel = kernels.front();
+    kernels.pop_front();
+    return true;
+}
+
+#ifndef WIN32
+
+bool CStakeAgent::Start(const std::string& path, const std::vector<std::pair<COutPoint, CAmount> >& vCoinsIn)
+{
+    assert(fd == -1);
+    sockaddr_un addr;
+    if (!MakeUnixAddress(path, addr))
+        return false;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return false;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    vCoins = vCoinsIn;
+    fStopping = false;
+    thread = std::thread([this] {
+        RenameThread("ubcd-stake-agent");
+        Loop();
+    });
+    return true;
+}
+
+void CStakeAgent::Stop()
+{
+    fStopping = true;
+    if (thread.joinable())
+        thread.join();
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void CStakeAgent::Loop()
+{
+    std::string strRecv;
+    while (!fStopping) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        char buf[4096];
+        ssize_t nRead = recv(fd, buf, sizeof(buf), 0);
+        if (nRead <= 0)
+            return;
+        strRecv.append(buf, nRead);
+        size_t nEnd;
+        while ((nEnd = strRecv.find('\n')) != std::string::npos) {
+            UniValue value;
+            StakeWork work;
+            StakeKernel kernel;
+            if (value.read(strRecv.substr(0, nEnd)) && StakeWorkFromJSON(value, work) &&
+                SearchStakeKernel(work, vCoins, kernel)) {
+                const std::string strMessage = StakeKernelToJSON(kernel).write() + "\n";
+                size_t nSent = 0;
+                while (nSent < strMessage.size()) {
+                    ssize_t n = send(fd, strMessage.data() + nSent, strMessage.size() - nSent, MSG_NOSIGNAL);
+                    if (n <= 0)
+                        return;
+                    nSent += n;
+                }
+            }
+            strRecv.erase(0, nEnd + 1);
+        }
+        if (strRecv.size() > MAX_STAKE_AGENT_MESSAGE)
+            return;
+    }
+}
+
+#else
+
+bool CStakeAgent::Start(const std::string& path, const std::vector<std::pair<COutPoint, CAmount> >& vCoinsIn)
+{
+    return false;
+}
+
+void CStakeAgent::Stop()
+{
+}
+
+#endif // WIN32
@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STAKE_AGENT_H
+#define BITCOIN_STAKE_AGENT_H
+
+#include <miner.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class UniValue;
+
+/**
+ * Staking through stake agents: processes which search the proof of stake kernels of their own
+ * coins, so the wallets holding them never have to be loaded into the node.
+ *
+ * The node listens on a local socket (-stakesocket) and sends every connected agent the stake
+ * work of the current tip, again whenever the tip changes or the time window has passed. An
+ * agent answers with the kernels it finds. Each message is one JSON object on one line:
+ *
+ *   node -> agent  {"type": "work", "hashprevblock": hex, "height": n, "bits": n,
+ *                   "hashprev10block": hex or null, "timestart": n, "timeend": n}
+ *   agent -> node  {"type": "kernel", "hashprevblock": hex, "time": n, "txid": hex, "vout": n,
+ *                   "amount": n}
+ *
+ * The coinstake spends the kernel back to its own script and carries no signature under this
+ * chain's consensus, so the node builds it from the kernel and no key leaves the agent.
+ */
+
+/** Longest message accepted from the other side, longer lines drop the connection */
+static const size_t MAX_STAKE_AGENT_MESSAGE = 4096;
+
+UniValue StakeWorkToJSON(const StakeWork& work);
+bool StakeWorkFromJSON(const UniValue& value, StakeWork& work);
+UniValue StakeKernelToJSON(const StakeKernel& kernel);
+/** The kernel of a message, nBits is left for the node to fill in from its own work */
+bool StakeKernelFromJSON(const UniValue& value, StakeKernel& kernel);
+
+/** The node's end: publishes stake work to the agents connected to a Unix socket and queues the kernels they find */
+class CStakeServer
+{
+private:
+    struct Client
+    {
+        int fd;
+        std::string strRecv;
+        std::string strSend;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    std::atomic<bool> fStopping{false};
+    std::string strPath;
+    int listenFd = -1;
+    // woken up through this pipe when there is work to send or the server stops
+    int wakeFds[2] = {-1, -1};
+    std::vector<Client> clients;
+
+    bool fHaveWork = false;
+    StakeWork work;
+    std::deque<StakeKernel> kernels;
+
+    void Loop();
+    void Wake();
+    void ProcessMessage(const std::string& strMessage);
+
+public:
+    ~CStakeServer() { Stop(); }
+
+    /** Listen on the Unix socket at path, replacing a stale one */
+    bool Start(const std::string& path, std::string& strError);
+    void Stop();
+    bool IsRunning() const { return listenFd != -1; }
+    size_t GetAgentCount();
+
+    /** Send work to all agents, including the ones connecting later, and drop the kernels of older work */
+    void PublishWork(const StakeWork& workIn);
+    /** Wait up to nTimeoutMillis for a kernel found on the published work */
+    bool WaitForKernel(StakeKernel& kernel, int64_t nTimeoutMillis);
+};
+
+/**
+ * A stand-in stake agent, searching a fixed list of coins with SearchStakeKernel. It runs in
+ * the node's process for tests; an agent of a cold wallet implements the same protocol.
+ */
+class CStakeAgent
+{
+private:
+    std::thread thread;
+    std::atomic<bool> fStopping{false};
+    int fd = -1;
+    std::vector<std::pair<COutPoint, CAmount> > vCoins;
+
+    void Loop();
+
+public:
+    ~CStakeAgent() { Stop(); }
+
+    bool Start(const std::string& path, const std::vector<std::pair<COutPoint, CAmount> >& vCoinsIn);
+    void Stop();
+};
+
+extern CStakeServer stakeServer;
+
+#endif // BITCOIN_STAKE_AGENT_H
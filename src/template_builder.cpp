@@ -0,0 +1,274 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <template_builder.h>
+
+#include <chainparams.h>
+#include <timedata.h>
+#include <txmempool.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include <boost/bind.hpp>
+
+CTemplateBuilder templateBuilder;
+
+static bool SameKernel(const StakeKernel& a, const StakeKernel& b)
+{
+    return a.hashPrevBlock == b.hashPrevBlock && a.nTime == b.nTime && a.prevout == b.prevout;
+}
+
+void CTemplateBuilder::Start()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        assert(!fRunning);
+        fRunning = true;
+        fStopping = false;
+    }
+    thread = std::thread([this] {
+        RenameThread("bitcoin-template");
+        Loop();
+    });
+    RegisterValidationInterface(this);
+    mempool.NotifyEntryAdded.connect(boost::bind(&CTemplateBuilder::MempoolEntryAdded, this, _1));
+}
+
+void CTemplateBuilder::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStopping = true;
+        cond.notify_all();
+    }
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CTemplateBuilder::MempoolEntryAdded, this, _1));
+    UnregisterValidationInterface(this);
+    if (thread.joinable())
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    fRunning = false;
+    powTemplate.reset();
+    mapPosSlots.clear();
+}
+
+void CTemplateBuilder::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload)
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    fTipChanged = true;
+    cond.notify_all();
+}
+
+void CTemplateBuilder::MempoolEntryAdded(CTransactionRef ptx)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fMempoolChanged = true;
+    for (auto& entry : mapPosSlots)
+        entry.second.fMempoolChanged = true;
+    if (fPowWanted) {
+        setPowNewTx.insert(ptx->GetHash());
+        cond.notify_all();
+    }
+}
+
+// Stop preparing proof of work templates nobody asks for, the mutex must be held
+void CTemplateBuilder::ExpireIdlePow()
+{
+    if (!fPowWanted || GetTime() - nPowLastWanted <= SPECULATIVE_TEMPLATE_IDLE)
+        return;
+    fPowWanted = false;
+    fTipChanged = false;
+    fMempoolChanged = false;
+    setPowNewTx.clear();
+    powTemplate.reset();
+}
+
+void CTemplateBuilder::Loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!fStopping) {
+        ExpireIdlePow();
+
+        const int64_t nAdjustedTime = GetAdjustedTime();
+        int64_t nPosRefreshTime = 0;
+        CWallet* pwalletRequest = nullptr;
+        PosSlot* pslotRequest = nullptr;
+        for (auto& entry : mapPosSlots) {
+            PosSlot& slot = entry.second;
+            // assemble the stake block again with the transactions that arrived since it was built
+            if (slot.nRefreshTime != 0 && nAdjustedTime >= slot.nRefreshTime) {
+                slot.nRefreshTime = 0;
+                if (slot.pblocktemplate && !slot.request && slot.fMempoolChanged)
+                    slot.request.reset(new StakeKernel(slot.kernel));
+            }
+            if (slot.nRefreshTime != 0 && (nPosRefreshTime == 0 || slot.nRefreshTime < nPosRefreshTime))
+                nPosRefreshTime = slot.nRefreshTime;
+            if (slot.request && !pslotRequest) {
+                pwalletRequest = entry.first;
+                pslotRequest = &slot;
+            }
+        }
+
+        // a stake miner is waiting for its block, it goes first
+        if (pslotRequest) {
+            // slots are only removed once this thread has stopped
+            std::unique_ptr<StakeKernel> kernel = std::move(pslotRequest->request);
+            pslotRequest->fBuilding = true;
+            lock.unlock();
+            BuildPosTemplate(pwalletRequest, *kernel);
+            lock.lock();
+            pslotRequest->fBuilding = false;
+            cond.notify_all();
+            continue;
+        }
+
+        int64_t nRefreshIn = nPowBuilt + SPECULATIVE_TEMPLATE_REFRESH - GetTime();
+        if (fPowWanted && (fTipChanged || (fMempoolChanged && nRefreshIn <= 0))) {
+            bool fRebuild = fTipChanged;
+            fTipChanged = false;
+            fMempoolChanged = false;
+            lock.unlock();
+            BuildPowTemplate(fRebuild);
+            lock.lock();
+            continue;
+        }
+
+        int64_t nWait = std::numeric_limits<int64_t>::max();
+        if (fPowWanted) {
+            nWait = nPowLastWanted + SPECULATIVE_TEMPLATE_IDLE + 1 - GetTime();
+            if (fMempoolChanged)
+                nWait = std::min(nWait, nRefreshIn);
+        }
+        if (nPosRefreshTime != 0)
+            nWait = std::min(nWait, nPosRefreshTime - nAdjustedTime);
+        if (nWait == std::numeric_limits<int64_t>::max())
+            cond.wait(lock);
+        else
+            cond.wait_for(lock, std::chrono::seconds(std::max<int64_t>(nWait, 1)));
+    }
+}
+
+void CTemplateBuilder::BuildPowTemplate(bool fRebuild)
+{
+    if (IsInitialBlockDownload())
+        return;
+
+    // the new transactions and the counter are taken together, so the counter the template is
+    // stamped with never covers a transaction that is neither in it nor in the next setPowNewTx
+    std::set<uint256> setNewTx;
+    unsigned int nTransactionsUpdated;
+    {
+        LOCK(mempool.cs);
+        std::lock_guard<std::mutex> lock(mutex);
+        setNewTx.swap(setPowNewTx);
+        nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    }
+    int64_t nTime = GetTime();
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        CScript scriptDummy = CScript() << OP_TRUE;
+        // powTemplate is only replaced on this thread, it can be read without the lock here
+        if (fRebuild || !powTemplate)
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, true);
+        else
+            pblocktemplate = BlockAssembler(Params()).UpdateNewBlock(*powTemplate, setNewTx, scriptDummy, true);
+    } catch (const std::exception& e) {
+        LogPrintf("CTemplateBuilder: proof of work template failed: %s\n", e.what());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // nobody asked for it meanwhile
+    if (!fPowWanted)
+        return;
+    powTemplate = std::move(pblocktemplate);
+    nPowTransactionsUpdated = nTransactionsUpdated;
+    nPowBuilt = nTime;
+}
+
+void CTemplateBuilder::BuildPosTemplate(CWallet* pwallet, const StakeKernel& kernel)
+{
+    {
+        // a transaction added from here on is missing from the block, or in it for nothing
+        std::lock_guard<std::mutex> lock(mutex);
+        mapPosSlots[pwallet].fMempoolChanged = false;
+    }
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        pblocktemplate = BlockAssembler(Params()).CreateNewBlockPos(pwallet, GetAdjustedTime()+POS_MINER_MAX_TIME, kernel);
+    } catch (const std::exception& e) {
+        LogPrintf("CTemplateBuilder: proof of stake template failed: %s\n", e.what());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    PosSlot& slot = mapPosSlots[pwallet];
+    // a newer kernel was handed over meanwhile, this block is of no use
+    if (slot.request)
+        return;
+    slot.kernel = kernel;
+    slot.pblocktemplate = std::move(pblocktemplate);
+    // refreshed once, unless the time slot is too close already
+    int64_t nRefreshTime = (int64_t)kernel.nTime - POS_TEMPLATE_REFRESH_LEAD;
+    slot.nRefreshTime = slot.pblocktemplate && nRefreshTime > GetAdjustedTime() ? nRefreshTime : 0;
+}
+
+std::unique_ptr<CBlockTemplate> CTemplateBuilder::GetPowTemplate(const CBlockIndex* pindexPrev, bool fMineWitnessTx, unsigned int& nTransactionsUpdated, int64_t& nTime)
+{
+    // mempool.cs is taken before the builder's mutex, never while holding it
+    unsigned int nMempoolTransactionsUpdated = mempool.GetTransactionsUpdated();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!fRunning)
+        return nullptr;
+    ExpireIdlePow();
+    nPowLastWanted = GetTime();
+    if (!fPowWanted) {
+        // start preparing templates for the next calls
+        fPowWanted = true;
+        fTipChanged = true;
+        cond.notify_all();
+        return nullptr;
+    }
+
+    if (!powTemplate || !fMineWitnessTx || powTemplate->block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return nullptr;
+    if (nMempoolTransactionsUpdated != nPowTransactionsUpdated && GetTime() - nPowBuilt > SPECULATIVE_TEMPLATE_REFRESH)
+        return nullptr;
+
+    nTransactionsUpdated = nPowTransactionsUpdated;
+    nTime = nPowBuilt;
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*powTemplate));
+}
+
+void CTemplateBuilder::PreparePosTemplate(CWallet* pwallet, const StakeKernel& kernel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!fRunning || fStopping)
+        return;
+    PosSlot& slot = mapPosSlots[pwallet];
+    slot.request.reset(new StakeKernel(kernel));
+    slot.pblocktemplate.reset();
+    slot.nRefreshTime = 0;
+    cond.notify_all();
+}
+
+std::unique_ptr<CBlockTemplate> CTemplateBuilder::TakePosTemplate(CWallet* pwallet, const StakeKernel& kernel)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = mapPosSlots.find(pwallet);
+    if (it == mapPosSlots.end())
+        return nullptr;
+    PosSlot& slot = it->second;
+    cond.wait(lock, [this, &slot] { return fStopping || (!slot.request && !slot.fBuilding); });
+    if (fStopping || !slot.pblocktemplate || !SameKernel(slot.kernel, kernel))
+        return nullptr;
+    return std::move(slot.pblocktemplate);
+}
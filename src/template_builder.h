@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEMPLATE_BUILDER_H
+#define BITCOIN_TEMPLATE_BUILDER_H
+
+#include <miner.h>
+#include <validationinterface.h>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/** Default for -speculativetemplates */
+static const bool DEFAULT_SPECULATIVE_TEMPLATES = true;
+/** Seconds a prepared template may miss mempool changes, the same as getblocktemplate's own cache */
+static const int64_t SPECULATIVE_TEMPLATE_REFRESH = 5;
+/** Seconds without a getblocktemplate call after which proof of work templates are no longer prepared */
+static const int64_t SPECULATIVE_TEMPLATE_IDLE = 120;
+/** Seconds before its time slot that a stake block is assembled again if the mempool changed */
+static const int64_t POS_TEMPLATE_REFRESH_LEAD = 2;
+
+/**
+ * Builds block templates in the background so they are ready when they are asked for.
+ *
+ * Once getblocktemplate has been called, a proof of work template is rebuilt on every new tip until
+ * it has not been called for SPECULATIVE_TEMPLATE_IDLE seconds. While transactions arrive, the
+ * template is extended with them at most every SPECULATIVE_TEMPLATE_REFRESH seconds, see
+ * BlockAssembler::UpdateNewBlock. The stake miner hands over each kernel it finds, and its block is
+ * assembled while the miner waits for the kernel's time slot, and again just before the slot if
+ * transactions arrived meanwhile.
+ */
+class CTemplateBuilder final : public CValidationInterface
+{
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    bool fRunning = false;
+    bool fStopping = false;
+
+    // proof of work template, built with getblocktemplate's dummy coinbase script
+    bool fPowWanted = false;
+    bool fTipChanged = false;
+    bool fMempoolChanged = false;
+    // transactions added to the mempool since powTemplate was built, kept up to date under mempool.cs
+    std::set<uint256> setPowNewTx;
+    std::unique_ptr<CBlockTemplate> powTemplate;
+    unsigned int nPowTransactionsUpdated = 0;
+    int64_t nPowBuilt = 0;
+    int64_t nPowLastWanted = 0;
+
+    // proof of stake block of the last kernel a stake miner found
+    struct PosSlot
+    {
+        std::unique_ptr<StakeKernel> request;
+        bool fBuilding = false;
+        StakeKernel kernel;
+        std::unique_ptr<CBlockTemplate> pblocktemplate;
+        bool fMempoolChanged = false;
+        // adjusted time to assemble pblocktemplate again at, 0 if it is not to be
+        int64_t nRefreshTime = 0;
+    };
+    // one for each staking wallet, and the one of nullptr for the kernels of stake agents
+    std::map<CWallet*, PosSlot> mapPosSlots;
+
+    void ExpireIdlePow();
+    void Loop();
+    void BuildPowTemplate(bool fRebuild);
+    void BuildPosTemplate(CWallet* pwallet, const StakeKernel& kernel);
+    /** Called by the mempool with mempool.cs held for every transaction added to it */
+    void MempoolEntryAdded(CTransactionRef ptx);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+public:
+    ~CTemplateBuilder() { Stop(); }
+
+    void Start();
+    void Stop();
+
+    /**
+     * A copy of the proof of work template prepared on pindexPrev, nullptr if there is none or it
+     * is older than getblocktemplate would accept. nTransactionsUpdated and nTime are set to the
+     * mempool counter and the time it was built at.
+     */
+    std::unique_ptr<CBlockTemplate> GetPowTemplate(const CBlockIndex* pindexPrev, bool fMineWitnessTx, unsigned int& nTransactionsUpdated, int64_t& nTime);
+
+    /**
+     * Assemble the block of a kernel in the background, replacing the one prepared before for the
+     * same wallet. pwallet is null for the kernels of stake agents.
+     */
+    void PreparePosTemplate(CWallet* pwallet, const StakeKernel& kernel);
+    /** The block prepared for the kernel, waiting for its assembly to finish; nullptr if there is none */
+    std::unique_ptr<CBlockTemplate> TakePosTemplate(CWallet* pwallet, const StakeKernel& kernel);
+};
+
+extern CTemplateBuilder templateBuilder;
+
+#endif // BITCOIN_TEMPLATE_BUILDER_H
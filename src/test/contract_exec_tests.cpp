@@ -0,0 +1,270 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <base58.h>
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <contract_engine/contract_helper.hpp>
+#include <contract_storage/contract_storage.hpp>
+#include <jsondiff/jsondiff.h>
+#include <memusage.h>
+#include <miner.h>
+#include <pow.h>
+#include <script/interpreter.h>
+#include <test/test_bitcoin.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+static const int64_t TEST_GAS_LIMIT = 10000;
+static const int64_t TEST_GAS_PRICE = 10;
+
+/** A regtest chain grown to the last height before contracts activate, with the contract check threads of init */
+struct ContractExecTestingSetup : public TestChain100Setup {
+    CScript scriptPubKey;
+    std::string caller;
+    std::string alice;
+    std::string bob;
+    size_t nCoinbasesSpent = 0;
+
+    ContractExecTestingSetup()
+    {
+        scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        caller = EncodeDestination(coinbaseKey.GetPubKey().GetID());
+        alice = EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 2))));
+        bob = EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 3))));
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
+            threadGroup.create_thread(&ThreadContractTxCheck);
+            threadGroup.create_thread(&ThreadContractExecCheck);
+        }
+        while (chainActive.Height() < Params().GetConsensus().UBCONTRACT_Height - 1)
+            CreateAndProcessBlock({}, scriptPubKey);
+    }
+
+    /** Spends the next mature coinbase to a tx with the contract output, paying nFee */
+    CMutableTransaction MakeContractTx(const CScript& contract_script, CAmount nFee)
+    {
+        const CTransaction& prev = coinbaseTxns.at(nCoinbasesSpent++);
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prev.GetHash(), 0);
+        tx.vout.push_back(CTxOut(prev.vout[0].nValue - nFee, scriptPubKey));
+        tx.vout.push_back(CTxOut(0, contract_script));
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(prev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+        return tx;
+    }
+
+    CMutableTransaction MakeCreateTokenTx(CAmount nFee)
+    {
+        return MakeContractTx(CScript() << CScriptNum(CONTRACT_MAJOR_VERSION) << ToByteVector(std::string("token"))
+            << ToByteVector(caller) << TEST_GAS_LIMIT << TEST_GAS_PRICE << OP_CREATE_NATIVE, nFee);
+    }
+
+    CMutableTransaction MakeCallTx(const std::string& contract_address, const std::string& api_name, const std::string& api_arg, CAmount nFee)
+    {
+        return MakeContractTx(CScript() << CScriptNum(CONTRACT_MAJOR_VERSION) << ToByteVector(api_arg) << ToByteVector(api_name)
+            << ToByteVector(contract_address) << ToByteVector(caller) << TEST_GAS_LIMIT << TEST_GAS_PRICE << OP_CALL, nFee);
+    }
+
+    bool ToMemPool(const CMutableTransaction& tx)
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), nullptr, nullptr, true, 0);
+    }
+
+    /** A block of the mempool txs on the tip, as the miner builds it with the contract root state hash */
+    CBlock MineBlock()
+    {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+        CBlock block = pblocktemplate->block;
+        unsigned int extraNonce = 0;
+        {
+            LOCK(cs_main);
+            IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+        }
+        while (!CheckProofOfWork(block.GetHash(), block.hashPrevBlock, block.nBits, Params().GetConsensus())) ++block.nNonce;
+        return block;
+    }
+
+    /** The block with its coinbase paying nExtra more than it was built with */
+    CBlock OverpayingCoinbase(const CBlock& block, CAmount nExtra)
+    {
+        CBlock result = block;
+        CMutableTransaction coinbase(*block.vtx[0]);
+        coinbase.vout[0].nValue += nExtra;
+        result.vtx[0] = MakeTransactionRef(std::move(coinbase));
+        result.hashMerkleRoot = BlockMerkleRoot(result);
+        while (!CheckProofOfWork(result.GetHash(), result.hashPrevBlock, result.nBits, Params().GetConsensus())) ++result.nNonce;
+        return result;
+    }
+
+    bool ProcessBlock(const CBlock& block)
+    {
+        ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, nullptr);
+        LOCK(cs_main);
+        return chainActive.Tip()->GetBlockHash() == block.GetHash();
+    }
+
+    std::string RootStateHash()
+    {
+        LOCK(cs_main);
+        return get_contract_storage_service()->current_root_state_hash();
+    }
+
+    std::string TokenBalance(const std::string& contract_address, const std::string& holder)
+    {
+        LOCK(cs_main);
+        return jsondiff::json_dumps(get_contract_storage_service()->get_contract_storage(contract_address, "balances/" + holder));
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(contract_exec_tests, ContractExecTestingSetup)
+
+BOOST_AUTO_TEST_CASE(parallel_block_contract_exec_matches_serial)
+{
+    const int nScriptCheckThreadsBefore = nScriptCheckThreads;
+
+    // two token contracts, created and initialized by the coinbase key
+    CMutableTransaction create_a = MakeCreateTokenTx(3 * TEST_GAS_LIMIT * TEST_GAS_PRICE);
+    CMutableTransaction create_b = MakeCreateTokenTx(2 * TEST_GAS_LIMIT * TEST_GAS_PRICE);
+    const std::string token_a = ContractHelper::generate_contract_address(caller, CTransaction(create_a), 1);
+    const std::string token_b = ContractHelper::generate_contract_address(caller, CTransaction(create_b), 1);
+    BOOST_REQUIRE(ToMemPool(create_a));
+    BOOST_REQUIRE(ToMemPool(create_b));
+    BOOST_REQUIRE(ProcessBlock(MineBlock()));
+    BOOST_REQUIRE(ToMemPool(MakeCallTx(token_a, "init_token", "token a,TKA,1000000,8", 3 * TEST_GAS_LIMIT * TEST_GAS_PRICE)));
+    BOOST_REQUIRE(ToMemPool(MakeCallTx(token_b, "init_token", "token b,TKB,1000000,8", 2 * TEST_GAS_LIMIT * TEST_GAS_PRICE)));
+    BOOST_REQUIRE(ProcessBlock(MineBlock()));
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, caller), "1000000");
+    BOOST_CHECK_EQUAL(TokenBalance(token_b, caller), "1000000");
+
+    // both transfers of token a write the caller's balance, the transfer of token b is independent of them
+    std::vector<CMutableTransaction> txs;
+    txs.push_back(MakeCallTx(token_a, "transfer", alice + ",100", 3 * TEST_GAS_LIMIT * TEST_GAS_PRICE));
+    txs.push_back(MakeCallTx(token_b, "transfer", alice + ",200", 2 * TEST_GAS_LIMIT * TEST_GAS_PRICE));
+    txs.push_back(MakeCallTx(token_a, "transfer", bob + ",50", TEST_GAS_LIMIT * TEST_GAS_PRICE));
+    for (const auto& tx : txs)
+        BOOST_REQUIRE(ToMemPool(tx));
+    const std::string strRootBefore = RootStateHash();
+    const CBlock block = MineBlock();
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), txs.size() + 1);
+
+    // the coinbase claims exactly the fees of the txs, so one paying more is rejected whatever connects it
+    nScriptCheckThreads = 0;
+    BOOST_CHECK(!ProcessBlock(OverpayingCoinbase(block, 1)));
+    BOOST_CHECK_EQUAL(RootStateHash(), strRootBefore);
+    BOOST_REQUIRE(ProcessBlock(block));
+    const std::string strRootSerial = RootStateHash();
+    BOOST_CHECK(strRootSerial != strRootBefore);
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, caller), "999850");
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, alice), "100");
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, bob), "50");
+    BOOST_CHECK_EQUAL(TokenBalance(token_b, caller), "999800");
+    BOOST_CHECK_EQUAL(TokenBalance(token_b, alice), "200");
+
+    // disconnect the block and connect it again, this time executing its contract txs in parallel
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        CValidationState state;
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), pindex));
+        BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    }
+    BOOST_CHECK_EQUAL(RootStateHash(), strRootBefore);
+    nScriptCheckThreads = nScriptCheckThreadsBefore;
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    BOOST_CHECK(!ProcessBlock(OverpayingCoinbase(block, 2)));
+    BOOST_CHECK_EQUAL(RootStateHash(), strRootBefore);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(ResetBlockFailureFlags(pindex));
+    }
+    CValidationState state;
+    BOOST_REQUIRE(ActivateBestChain(state, Params()));
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(chainActive.Tip() == pindex);
+    }
+    BOOST_CHECK_EQUAL(RootStateHash(), strRootSerial);
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, caller), "999850");
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, alice), "100");
+    BOOST_CHECK_EQUAL(TokenBalance(token_a, bob), "50");
+    BOOST_CHECK_EQUAL(TokenBalance(token_b, caller), "999800");
+    BOOST_CHECK_EQUAL(TokenBalance(token_b, alice), "200");
+}
+
+BOOST_AUTO_TEST_CASE(template_reuses_contract_exec_result_of_tip)
+{
+    const CMutableTransaction create = MakeCreateTokenTx(TEST_GAS_LIMIT * TEST_GAS_PRICE);
+    const uint256 hash = create.GetHash();
+    BOOST_REQUIRE(ToMemPool(create));
+
+    std::shared_ptr<const ContractExecResult> result;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+        auto it = mempool.mapTx.find(hash);
+        BOOST_REQUIRE(it != mempool.mapTx.end());
+        result = it->GetContractExecResult();
+        BOOST_REQUIRE(result);
+        BOOST_CHECK(it->GetContractExecTip() == chainActive.Tip()->GetBlockHash());
+        // the kept outcome counts to the memory usage of the mempool
+        BOOST_CHECK_EQUAL(it->DynamicMemoryUsage(), RecursiveDynamicUsage(it->GetSharedTx()) + memusage::MallocUsage(sizeof(ContractExecResult)) + result->DynamicMemoryUsage());
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    // a template on the same tip takes the outcome of the mempool entry instead of executing again
+    CBlock block = MineBlock();
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    {
+        LOCK2(cs_main, mempool.cs);
+        auto it = mempool.mapTx.find(hash);
+        BOOST_CHECK(it->GetContractExecResult() == result);
+        BOOST_CHECK(it->GetContractExecTip() == hashTip);
+    }
+
+    // keep the tx out of the next block, so the tip moves on below it
+    mempool.PrioritiseTransaction(hash, -COIN);
+    CreateAndProcessBlock({}, scriptPubKey);
+    mempool.PrioritiseTransaction(hash, COIN);
+    {
+        LOCK2(cs_main, mempool.cs);
+        BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() != hashTip);
+        BOOST_CHECK(mempool.mapTx.find(hash)->GetContractExecTip() == hashTip);
+    }
+
+    // the outcome on the earlier tip is dropped and the tx executed again on the new one
+    block = MineBlock();
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    {
+        LOCK2(cs_main, mempool.cs);
+        auto it = mempool.mapTx.find(hash);
+        BOOST_CHECK(it->GetContractExecResult() != result);
+        BOOST_CHECK(it->GetContractExecTip() == chainActive.Tip()->GetBlockHash());
+        mempool.check(pcoinsTip.get());
+    }
+    BOOST_REQUIRE(ProcessBlock(block));
+    LOCK(mempool.cs);
+    BOOST_CHECK(mempool.mapTx.find(hash) == mempool.mapTx.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
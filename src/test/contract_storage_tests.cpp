@@ -0,0 +1,271 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <contract_storage/change.hpp>
+#include <contract_storage/contract_storage.hpp>
+#include <fs.h>
+#include <jsondiff/helper.h>
+#include <test/test_bitcoin.h>
+
+#include <stdexcept>
+
+#include <sqlite3.h>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace contract::storage;
+
+namespace {
+
+static const uint32_t TEST_MAGIC_NUMBER = 34125;
+
+/** Contract storage dbs in a fresh temporary directory, removed afterwards */
+struct ContractStorageTestingSetup : public BasicTestingSetup {
+    fs::path path_root;
+    std::string db_path;
+    std::string sql_db_path;
+
+    ContractStorageTestingSetup()
+    {
+        path_root = fs::temp_directory_path() / "test_contract_storage" / fs::unique_path();
+        fs::create_directories(path_root);
+        db_path = (path_root / "contract_storage.db").string();
+        sql_db_path = (path_root / "contract_storage_sql.db").string();
+    }
+    ~ContractStorageTestingSetup()
+    {
+        fs::remove_all(path_root);
+    }
+};
+
+/** Instances opened in its scope switch the sql db to wal mode */
+struct SqlWalScope {
+    SqlWalScope() { ContractStorageService::set_sql_wal_enabled(true); }
+    ~SqlWalScope() { ContractStorageService::set_sql_wal_enabled(false); }
+};
+
+std::string JournalMode(const std::string& sql_db_path)
+{
+    sqlite3* db;
+    BOOST_REQUIRE(sqlite3_open_v2(sql_db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK);
+    sqlite3_stmt* stmt;
+    std::string mode;
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            mode = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return mode;
+}
+
+ContractInfoP MakeContractInfo(const std::string& id)
+{
+    auto contract_info = std::make_shared<ContractInfo>();
+    contract_info->id = id;
+    contract_info->creator_address = "1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5";
+    contract_info->txid = "3a1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e";
+    contract_info->version = 1;
+    contract_info->apis = {"init", "transfer"};
+    contract_info->bytecode = {0x1b, 0x4c, 0x75, 0x61};
+    return contract_info;
+}
+
+struct DigestVector {
+    const char* json; //!< to_json() as stored in the contract storage dbs
+    const char* digest;
+};
+
+/**
+ * Contract infos and contract changes with the digests that hashing
+ * json_dumps of their ordered to_json() gave, before the digests were streamed.
+ */
+static const DigestVector contract_info_vectors[] = {
+    // uvm token contract
+    {"{\"version\":1,\"id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"creator_address\":\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\",\"name\":\"mytoken\",\"description\":\"demo token\",\"txid\":\"5f1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e\",\"is_native\":false,\"contract_template_key\":\"\",\"apis\":[\"balanceOf\",\"init\",\"init_token\",\"on_deposit\",\"on_destroy\",\"transfer\"],\"offline_apis\":[\"balanceOf\",\"precision\",\"tokenName\"],\"storage_types\":[[\"admin\",2],[\"allowed\",7],[\"name\",2],[\"precision\",1],[\"state\",2],[\"supply\",1],[\"symbol\",2],[\"users\",7]],\"balances\":[{\"asset_id\":0,\"amount\":100000000}],\"bytecode\":\"G1V2bQAB/4AiXA==\"}",
+     "1278f23aca225661c1ca56b963445c0f18587b584819177064034d3cd841a206"},
+    // native token contract
+    {"{\"version\":1,\"id\":\"CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh\",\"creator_address\":\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2\",\"name\":\"\",\"description\":\"\",\"txid\":\"0c8d2a6b9e7f1a3c5d4e6f8091a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4\",\"is_native\":true,\"contract_template_key\":\"token\",\"apis\":[\"allowance\",\"approve\",\"balanceOf\",\"init\",\"init_token\",\"totalSupply\",\"transfer\",\"transferFrom\"],\"offline_apis\":[\"allowance\",\"balanceOf\",\"totalSupply\"],\"storage_types\":[[\"allowed\",7],[\"name\",2],[\"supply\",1],[\"users\",7]],\"balances\":[],\"bytecode\":\"\"}",
+     "708ecaa6a0ad472cc060ea753ce3625435e24299f534b1d3a33db61a0dbc282c"},
+    // upgraded contract with escapes, non-ascii and repeated entries
+    {"{\"version\":2,\"id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"creator_address\":\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\",\"name\":\"upgraded\\t\\\"name\\\"\",\"description\":\"caf\xc3\xa9 \xe4\xb8\xad\\\\n\",\"txid\":\"5f1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e\",\"is_native\":false,\"contract_template_key\":\"\",\"apis\":[\"init\",\"init\",\"on_upgrade\"],\"offline_apis\":[],\"storage_types\":[],\"balances\":[{\"asset_id\":0,\"amount\":5},{\"asset_id\":0,\"amount\":18446744073709551615}],\"bytecode\":\"G1U=\"}",
+     "3fce6979d39be9383108b46105b0e6d8eec1a755f094455ebe285a48354fc3a5"}
+};
+
+static const DigestVector contract_changes_vectors[] = {
+    // token transfer
+    {"{\"balance_changes\":[],\"storage_changes\":[{\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"items\":[{\"name\":\"users\",\"diff\":{\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\":{\"__old\":100000000,\"__new\":99999000},\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2__added\":1000}},{\"name\":\"supply\",\"diff\":null}]}],\"events\":[{\"tx_id\":\"0c8d2a6b9e7f1a3c5d4e6f8091a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4\",\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"name\":\"Transfer\",\"arg\":\"{\\\"from\\\":\\\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\\\",\\\"to\\\":\\\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2\\\",\\\"amount\\\":1000}\"}],\"upgrade_infos\":[]}",
+     "026aa52e4343930e8d705ea5004f226b9d5c72a969c08dc4683a815c1c9f65cf"},
+    // init and deposit
+    {"{\"balance_changes\":[{\"asset_id\":0,\"address\":\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\",\"amount\":50000,\"add\":false,\"is_contract\":false,\"memo\":\"\"},{\"asset_id\":0,\"address\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"amount\":50000,\"add\":true,\"is_contract\":true,\"memo\":\"deposit \\\"memo\\\"\\n\"}],\"storage_changes\":[{\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"items\":[{\"name\":\"state\",\"diff\":{\"__old\":\"NOT_INITED\",\"__new\":\"COMMON\"}},{\"name\":\"admin\",\"diff\":{\"__old\":\"\",\"__new\":\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\"}}]}],\"events\":[{\"tx_id\":\"5f1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e\",\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"name\":\"Inited\",\"arg\":\"100000000,mytoken,MTK,8\"},{\"tx_id\":\"5f1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e\",\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"name\":\"Deposit\",\"arg\":\"50000\"}],\"upgrade_infos\":[]}",
+     "ba593e6736d9c68389c629a7b4bd88f5005afed29779600b6b0c06f715ab80d4"},
+    // upgrade, approve and storage diffs of two contracts
+    {"{\"balance_changes\":[{\"asset_id\":3,\"address\":\"CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh\",\"amount\":18446744073709551615,\"add\":true,\"is_contract\":true,\"memo\":\"caf\xc3\xa9\"}],\"storage_changes\":[{\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"items\":[{\"name\":\"allowed\",\"diff\":{\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\":{\"__old\":\"{}\",\"__new\":\"{\\\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2\\\":500}\"},\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2__added\":\"{}\"}}]},{\"contract_id\":\"CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh\",\"items\":[{\"name\":\"users\",\"diff\":{\"b\":[[\"~\",1,{\"__old\":2,\"__new\":3}],[\"~\",2,{\"c\":{\"__old\":3,\"__new\":4}}],[\"+\",3,5]],\"a\":{\"__old\":1,\"__new\":2},\"z__deleted\":null,\"y__added\":true}}]}],\"events\":[{\"tx_id\":\"5f1e3e5c5be0f7a1a1d6a3e1b9f5f1d2b0c6c2a8f3e4d5c6b7a8091a2b3c4d5e\",\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"name\":\"Upgraded\",\"arg\":\"mytoken\"},{\"tx_id\":\"0c8d2a6b9e7f1a3c5d4e6f8091a2b3c4d5e6f708192a3b4c5d6e7f8091a2b3c4\",\"contract_id\":\"CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh\",\"name\":\"Approved\",\"arg\":\"{\\\"from\\\":\\\"1Ltbcx6KxgQgeyo3qrCgPYK3Aj9LFG76X5\\\",\\\"spender\\\":\\\"1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2\\\",\\\"amount\\\":500}\"}],\"upgrade_infos\":[{\"contract_id\":\"CONCMYH4NWb6vnG7vUXrKMxJHYDn8B3rFpz3\",\"name_diff\":{\"__old\":\"\",\"__new\":\"mytoken\"},\"description_diff\":{\"__old\":\"demo token\",\"__new\":\"demo token v2\"}}]}",
+     "d15b2c4d4ffe023885ff3a01666f8c37944ee8add1d699f6d70b6f711b02de6a"},
+    // empty changes
+    {"{\"balance_changes\":[],\"storage_changes\":[],\"events\":[],\"upgrade_infos\":[]}",
+     "d526065975e59b544d564197fac16c8a5b08bac10224f5b8183117107dc07d32"}
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(contract_storage_tests, ContractStorageTestingSetup)
+
+BOOST_AUTO_TEST_CASE(overlay_leaves_dbs_untouched)
+{
+    ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    const auto root_hash = service.save_contract_info(MakeContractInfo("CONtractA"));
+    BOOST_CHECK(service.get_commit_info(root_hash));
+
+    ContractCommitId overlay_root_hash;
+    {
+        auto overlay = ContractStorageService::get_overlay_instance(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        BOOST_CHECK(overlay->in_overlay());
+        BOOST_CHECK_EQUAL(overlay->current_root_state_hash(), root_hash);
+        overlay_root_hash = overlay->save_contract_info(MakeContractInfo("CONtractB"));
+        BOOST_CHECK(overlay_root_hash != root_hash);
+        BOOST_CHECK_EQUAL(overlay->current_root_state_hash(), overlay_root_hash);
+        BOOST_CHECK(overlay->get_contract_info("CONtractB"));
+        BOOST_CHECK(overlay->get_commit_info(overlay_root_hash));
+        // closing and reopening keeps it in overlay mode, but drops what was written so far
+        overlay->close();
+        overlay->open();
+        BOOST_CHECK(overlay->in_overlay());
+        BOOST_CHECK_EQUAL(overlay->current_root_state_hash(), root_hash);
+        BOOST_CHECK(overlay->save_contract_info(MakeContractInfo("CONtractB")) == overlay_root_hash);
+    }
+
+    BOOST_CHECK(!service.in_overlay());
+    BOOST_CHECK_EQUAL(service.current_root_state_hash(), root_hash);
+    BOOST_CHECK_EQUAL(service.top_root_state_hash(), root_hash);
+    BOOST_CHECK(!service.get_contract_info("CONtractB"));
+    BOOST_CHECK(!service.get_commit_info(overlay_root_hash));
+
+    // the dbs still take real commits afterwards, and reach the state the overlay had
+    BOOST_CHECK(service.save_contract_info(MakeContractInfo("CONtractB")) == overlay_root_hash);
+}
+
+BOOST_AUTO_TEST_CASE(overlay_dropped_on_failed_validation)
+{
+    ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    const auto root_hash = service.save_contract_info(MakeContractInfo("CONtractA"));
+
+    // as when ConnectBlock(fJustCheck) returns early or throws halfway through a block
+    ContractCommitId overlay_root_hash;
+    try {
+        auto overlay = ContractStorageService::get_overlay_instance(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        overlay_root_hash = overlay->save_contract_info(MakeContractInfo("CONtractB"));
+        overlay->save_contract_info(MakeContractInfo("CONtractC"));
+        throw std::runtime_error("bad-blk-contract");
+    } catch (const std::runtime_error&) {
+    }
+
+    BOOST_CHECK_EQUAL(service.current_root_state_hash(), root_hash);
+    BOOST_CHECK_EQUAL(service.top_root_state_hash(), root_hash);
+    BOOST_CHECK(!service.get_contract_info("CONtractB"));
+    BOOST_CHECK(!service.get_contract_info("CONtractC"));
+    BOOST_CHECK(!overlay_root_hash.empty());
+    BOOST_CHECK(!service.get_commit_info(overlay_root_hash));
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_pins_sql_db)
+{
+    SqlWalScope wal;
+    ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    const auto root_hash = service.save_contract_info(MakeContractInfo("CONtractA"));
+
+    auto snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK(snapshot->is_snapshot_latest());
+    // commits go on while the snapshot is open, and it sees neither their leveldb nor their sql changes
+    const auto new_root_hash = service.save_contract_info(MakeContractInfo("CONtractB"));
+    BOOST_CHECK(!snapshot->is_snapshot_latest());
+    BOOST_CHECK_EQUAL(service.top_commit_id(), new_root_hash);
+    BOOST_CHECK_EQUAL(snapshot->current_root_state_hash(), root_hash);
+    BOOST_CHECK_EQUAL(snapshot->top_commit_id(), root_hash);
+    BOOST_CHECK(snapshot->get_commit_info(root_hash));
+    BOOST_CHECK(!snapshot->get_commit_info(new_root_hash));
+    BOOST_CHECK(!snapshot->get_contract_info("CONtractB"));
+
+    snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK_EQUAL(snapshot->current_root_state_hash(), new_root_hash);
+    BOOST_CHECK_EQUAL(snapshot->top_commit_id(), new_root_hash);
+    BOOST_CHECK(snapshot->get_contract_info("CONtractB"));
+}
+
+BOOST_AUTO_TEST_CASE(sql_wal_only_when_enabled)
+{
+    {
+        ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        const auto root_hash = service.save_contract_info(MakeContractInfo("CONtractA"));
+        BOOST_CHECK_EQUAL(JournalMode(sql_db_path), "delete");
+
+        // without wal a snapshot doesn't hold off commits, it only pins the leveldb then
+        auto snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        const auto new_root_hash = service.save_contract_info(MakeContractInfo("CONtractB"));
+        BOOST_CHECK_EQUAL(service.top_commit_id(), new_root_hash);
+        BOOST_CHECK_EQUAL(snapshot->current_root_state_hash(), root_hash);
+        BOOST_CHECK_EQUAL(snapshot->top_commit_id(), new_root_hash);
+        BOOST_CHECK(!snapshot->get_contract_info("CONtractB"));
+    }
+    {
+        SqlWalScope wal;
+        ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        BOOST_CHECK_EQUAL(JournalMode(sql_db_path), "wal");
+        // commits after a released snapshot checkpoint the wal it held back
+        ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path).reset();
+        service.save_contract_info(MakeContractInfo("CONtractC"));
+    }
+    // the db file keeps the journal mode once switched
+    ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK_EQUAL(JournalMode(sql_db_path), "wal");
+    BOOST_CHECK(service.get_contract_info("CONtractC"));
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_latest_until_db_written)
+{
+    ContractStorageService service(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    service.save_contract_info(MakeContractInfo("CONtractA"));
+    BOOST_CHECK(!service.is_snapshot_latest());
+
+    // reads and writes to overlay instances leave the dbs as they were
+    auto snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK(snapshot->get_contract_info("CONtractA"));
+    BOOST_CHECK(snapshot->is_snapshot_latest());
+    {
+        auto overlay = ContractStorageService::get_overlay_instance(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+        overlay->save_contract_info(MakeContractInfo("CONtractB"));
+    }
+    auto other_snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK(snapshot->is_snapshot_latest());
+    BOOST_CHECK(other_snapshot->is_snapshot_latest());
+    BOOST_CHECK(!other_snapshot->get_contract_info("CONtractB"));
+
+    // any real write outdates every snapshot taken before it
+    service.save_contract_info(MakeContractInfo("CONtractD"));
+    BOOST_CHECK(!snapshot->is_snapshot_latest());
+    BOOST_CHECK(!other_snapshot->is_snapshot_latest());
+    snapshot = ContractStorageService::get_read_only_snapshot(TEST_MAGIC_NUMBER, db_path, sql_db_path);
+    BOOST_CHECK(snapshot->is_snapshot_latest());
+    BOOST_CHECK(snapshot->get_contract_info("CONtractD"));
+}
+
+BOOST_AUTO_TEST_CASE(commit_digests_match_vectors)
+{
+    for (const auto& v : contract_info_vectors) {
+        const auto json = jsondiff::json_loads(v.json);
+        const auto contract_info = ContractInfo::from_json(json);
+        BOOST_CHECK_EQUAL(jsondiff::json_dumps(contract_info->to_json()), v.json);
+        BOOST_CHECK_EQUAL(ordered_json_digest(*contract_info).str(), v.digest);
+        BOOST_CHECK_EQUAL(ordered_json_digest(json).str(), v.digest);
+    }
+    for (const auto& v : contract_changes_vectors) {
+        const auto json = jsondiff::json_loads(v.json);
+        const auto changes = ContractChanges::from_json(json.as<jsondiff::JsonObject>());
+        BOOST_CHECK_EQUAL(jsondiff::json_dumps(changes.to_json()), v.json);
+        BOOST_CHECK_EQUAL(ordered_json_digest(changes).str(), v.digest);
+        BOOST_CHECK_EQUAL(ordered_json_digest(json).str(), v.digest);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,289 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <fjson/exception/exception.hpp>
+#include <fjson/io/json.hpp>
+#include <fjson/variant.hpp>
+#include <fjson/variant_object.hpp>
+#include <test/test_bitcoin.h>
+
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct JsonVector {
+    const char* input;
+    const char* output;        //!< json::to_string, nullptr when parsing throws
+    const char* legacy_output; //!< json::to_string with legacy_generator
+};
+
+/**
+ * Parse and dump results of the legacy parser and generator from before they
+ * read and wrote through in-memory cursors. Unterminated strings are the only
+ * change, they used to loop forever and now fail to parse.
+ */
+static const JsonVector vectors[] = {
+    {"\"plain\"", "\"plain\"", "\"plain\""},
+    {"\"q\\\"b\\\\s\\/f\\b\\f\\n\\r\\t\"", "\"q\\\"b\\\\s/fbf\\n\\r\\t\"", "\"q\\\"b\\\\s/fbf\\n\\r\\t\""},
+    {"\"\\u00e9\\u4e2d\"", "\"u00e9u4e2d\"", "\"u00e9u4e2d\""},
+    {"\"\\x41\\a\\0z\"", "\"x41a0z\"", "\"x41a0z\""},
+    {"\"caf\xc3\xa9 \xe4\xb8\xad \xf0\x9f\x98\x80\"", "\"caf\xc3\xa9 \xe4\xb8\xad \xf0\x9f\x98\x80\"", "\"caf\xc3\xa9 \xe4\xb8\xad \xf0\x9f\x98\x80\""},
+    {"\"ctl\x01\x1f\x7f\"", "\"ctl\x01\x1f\x7f\"", "\"ctl\x01\x1f\x7f\""},
+    {"{\"k\\n\":\"v\\t\",\"\xc3\xa9\":[\"\\u0041\"]}", "{\"k\\n\":\"v\\t\",\"\xc3\xa9\":[\"u0041\"]}", "{\"k\\n\":\"v\\t\",\"\xc3\xa9\":[\"u0041\"]}"},
+    {"9223372036854775807", "\"9223372036854775807\"", "9223372036854775807"},
+    {"-9223372036854775808", "-9223372036854775808", "-9223372036854775808"},
+    {"18446744073709551615", "\"18446744073709551615\"", "18446744073709551615"},
+    {"18446744073709551616", nullptr, nullptr},
+    {"-1", "-1", "-1"},
+    {"4294967296", "\"4294967296\"", "4294967296"},
+    {"[1.5,-0.25,1e3,2E-2,0.1]", "[\"1.50000000000000000\",\"-0.25000000000000000\",\"1e3\",\"2E-2\",\"0.10000000000000001\"]", "[1.50000000000000000,-0.25000000000000000,\"1e3\",\"2E-2\",0.10000000000000001]"},
+    {"{\"i\":9223372036854775807,\"u\":18446744073709551615,\"n\":-9223372036854775808}", "{\"i\":\"9223372036854775807\",\"u\":\"18446744073709551615\",\"n\":-9223372036854775808}", "{\"i\":9223372036854775807,\"u\":18446744073709551615,\"n\":-9223372036854775808}"},
+    {"[true,false,null,[],{}]", "[true,false,null,[],{}]", "[true,false,null,[],{}]"},
+    {"{\"a\":{\"b\":[1,{\"c\":\"d\"}]},\"a\":2}", "{\"a\":{\"b\":[1,{\"c\":\"d\"}]},\"a\":2}", "{\"a\":{\"b\":[1,{\"c\":\"d\"}]},\"a\":2}"},
+    {"  { \"a\" : 1 , \"b\" : [ 2 , 3 ] }  ", "{\"a\":1,\"b\":[2,3]}", "{\"a\":1,\"b\":[2,3]}"},
+    {"[1,2,]", "[1,2]", "[1,2]"},
+    {"{\"a\":1,}", "{\"a\":1}", "{\"a\":1}"},
+    {"{a:1}", nullptr, nullptr},
+    {"abc", nullptr, nullptr},
+    {"12abc", "\"12abc\"", "\"12abc\""},
+    {"", nullptr, nullptr},
+    {"\"unterminated", nullptr, nullptr},
+    {"{", nullptr, nullptr},
+    {"[1,", nullptr, nullptr},
+    {"{\"a\" 1}", nullptr, nullptr},
+    {"{\"a\":}", nullptr, nullptr},
+    {"-", nullptr, nullptr},
+    {".", nullptr, nullptr},
+    {"nul", "\"nul\"", "\"nul\""},
+    {"tru", "\"tru\"", "\"tru\""},
+    {"}", nullptr, nullptr},
+    {"]", nullptr, nullptr},
+    {"[1 2]", "[1,2]", "[1,2]"},
+    {"\"\\", nullptr, nullptr},
+    {"\"\\u12\"", "\"u12\"", "\"u12\""},
+    {"[\"a", nullptr, nullptr},
+    {"{\"a\":\"b", nullptr, nullptr},
+    {"\"abc\\", nullptr, nullptr},
+    {"\"\xff\xfe\"", "\"\xff\xfe\"", "\"\xff\xfe\""}
+};
+
+/** An object with keys k0 ... k<count - 1> holding their number */
+fjson::mutable_variant_object MakeObject(size_t count)
+{
+    fjson::mutable_variant_object obj;
+    for (size_t i = 0; i < count; i++) {
+        obj.set("k" + std::to_string(i), (uint64_t) i);
+    }
+    return obj;
+}
+
+/** Checks find() against a scan of the entries for every key and a missing one */
+template <typename Object>
+void CheckFind(const Object& obj)
+{
+    for (auto it = obj.begin(); it != obj.end(); ++it) {
+        auto first = obj.begin();
+        while (first->key() != it->key()) {
+            ++first;
+        }
+        BOOST_CHECK(obj.find(it->key()) == first);
+    }
+    BOOST_CHECK(obj.find("missing") == obj.end());
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(fjson_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(json_matches_vectors)
+{
+    for (const auto& v : vectors) {
+        const std::string input(v.input);
+        if (!v.output) {
+            BOOST_CHECK_THROW(fjson::json::from_string(input), fjson::exception);
+            std::stringstream in(input);
+            BOOST_CHECK_THROW(fjson::json::from_stream(in), fjson::exception);
+            continue;
+        }
+        const auto value = fjson::json::from_string(input);
+        BOOST_CHECK_EQUAL(fjson::json::to_string(value), v.output);
+        BOOST_CHECK_EQUAL(fjson::json::to_string(value, fjson::json::legacy_generator), v.legacy_output);
+
+        // the stream based parser and generator agree with the string ones
+        std::stringstream in(input);
+        BOOST_CHECK_EQUAL(fjson::json::to_string(fjson::json::from_stream(in)), v.output);
+        std::stringstream out;
+        fjson::json::to_stream(out, value);
+        BOOST_CHECK_EQUAL(out.str(), v.output);
+
+        // dumped json parses back to the same dump
+        BOOST_CHECK_EQUAL(fjson::json::to_string(fjson::json::from_string(v.output)), v.output);
+        BOOST_CHECK_EQUAL(fjson::json::to_string(fjson::json::from_string(v.legacy_output), fjson::json::legacy_generator), v.legacy_output);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_large_integers)
+{
+    // the legacy parser reads non-negative integers as uint64 and negative ones as int64
+    const auto max_int64 = fjson::json::from_string("9223372036854775807");
+    BOOST_CHECK(max_int64.is_uint64());
+    BOOST_CHECK_EQUAL(max_int64.as_int64(), std::numeric_limits<int64_t>::max());
+
+    const auto min_int64 = fjson::json::from_string("-9223372036854775808");
+    BOOST_CHECK(min_int64.is_int64());
+    BOOST_CHECK_EQUAL(min_int64.as_int64(), std::numeric_limits<int64_t>::min());
+
+    const auto above_int64 = fjson::json::from_string("9223372036854775808");
+    BOOST_CHECK(above_int64.is_uint64());
+    BOOST_CHECK_EQUAL(above_int64.as_uint64(), uint64_t(std::numeric_limits<int64_t>::max()) + 1);
+
+    const auto max_uint64 = fjson::json::from_string("18446744073709551615");
+    BOOST_CHECK(max_uint64.is_uint64());
+    BOOST_CHECK_EQUAL(max_uint64.as_uint64(), std::numeric_limits<uint64_t>::max());
+    BOOST_CHECK_EQUAL(fjson::json::to_string(fjson::variant(std::numeric_limits<uint64_t>::max()), fjson::json::legacy_generator), "18446744073709551615");
+    BOOST_CHECK_EQUAL(fjson::json::to_string(fjson::variant(std::numeric_limits<int64_t>::min())), "-9223372036854775808");
+}
+
+BOOST_AUTO_TEST_CASE(object_index_lookup)
+{
+    const size_t count = 4 * fjson::object_key_index::min_object_size;
+    const auto obj = MakeObject(count);
+    for (size_t i = 0; i < count; i++) {
+        BOOST_CHECK_EQUAL(obj["k" + std::to_string(i)].as_uint64(), i);
+    }
+    CheckFind(obj);
+
+    const fjson::variant_object copy(obj);
+    CheckFind(copy);
+    const auto parsed = fjson::json::from_string(fjson::json::to_string(fjson::variant(copy))).get_object();
+    BOOST_CHECK_EQUAL(parsed.size(), count);
+    CheckFind(parsed);
+}
+
+BOOST_AUTO_TEST_CASE(object_index_erase_keeps_order)
+{
+    const size_t count = fjson::object_key_index::min_object_size + 8;
+    auto obj = MakeObject(count);
+    obj.erase("k0");
+    obj.erase("k7");
+    obj.erase("k" + std::to_string(count - 1));
+    obj.set("k7", (uint64_t) 70);
+    obj.set("k3", (uint64_t) 30);
+
+    std::vector<std::string> keys;
+    for (const auto& entry : obj) {
+        keys.push_back(entry.key());
+    }
+    BOOST_CHECK_EQUAL(keys.size(), count - 2);
+    BOOST_CHECK_EQUAL(keys.front(), "k1");
+    BOOST_CHECK_EQUAL(keys[2], "k3");
+    BOOST_CHECK_EQUAL(keys[5], "k6");
+    BOOST_CHECK_EQUAL(keys[6], "k8");
+    BOOST_CHECK_EQUAL(keys.back(), "k7");
+    BOOST_CHECK_EQUAL(obj["k3"].as_uint64(), 30U);
+    BOOST_CHECK_EQUAL(obj["k7"].as_uint64(), 70U);
+    BOOST_CHECK(obj.find("k0") == obj.end());
+    CheckFind(obj);
+    CheckFind(fjson::variant_object(obj));
+}
+
+BOOST_AUTO_TEST_CASE(object_index_duplicate_keys)
+{
+    for (size_t count : {size_t(3), 2 * fjson::object_key_index::min_object_size}) {
+        auto obj = MakeObject(count);
+        obj("k1", fjson::variant("second"))("k1", fjson::variant("third"));
+        BOOST_CHECK_EQUAL(obj.size(), count + 2);
+        BOOST_CHECK_EQUAL(obj["k1"].as_uint64(), 1U);
+        CheckFind(obj);
+
+        // set() replaces the first entry and leaves the duplicates
+        obj.set("k1", "first");
+        BOOST_CHECK_EQUAL(obj["k1"].as_string(), "first");
+        BOOST_CHECK_EQUAL(obj.size(), count + 2);
+
+        fjson::variant_object copy(obj);
+        CheckFind(copy);
+        BOOST_CHECK_EQUAL(copy["k1"].as_string(), "first");
+
+        // erase() drops the first entry, and the next duplicate is found instead
+        obj.erase("k1");
+        BOOST_CHECK_EQUAL(obj.size(), count + 1);
+        BOOST_CHECK_EQUAL(obj["k1"].as_string(), "second");
+        CheckFind(obj);
+    }
+
+    const auto parsed = fjson::json::from_string("{\"a\":1,\"b\":2,\"a\":3}").get_object();
+    BOOST_CHECK_EQUAL(parsed.size(), 3U);
+    BOOST_CHECK_EQUAL(parsed["a"].as_uint64(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(object_index_size_threshold)
+{
+    const size_t threshold = fjson::object_key_index::min_object_size;
+    fjson::mutable_variant_object obj;
+    for (size_t i = 0; i < 2 * threshold; i++) {
+        obj("k" + std::to_string(i), (uint64_t) i);
+        CheckFind(obj);
+        CheckFind(fjson::variant_object(obj));
+    }
+    for (size_t i = 2 * threshold; i-- > threshold / 2;) {
+        obj.erase("k" + std::to_string(i));
+        CheckFind(obj);
+    }
+    BOOST_CHECK_EQUAL(obj.size(), threshold / 2);
+
+    fjson::mutable_variant_object assigned = MakeObject(threshold - 1);
+    assigned = MakeObject(threshold + 1);
+    CheckFind(assigned);
+    assigned = MakeObject(2);
+    CheckFind(assigned);
+}
+
+BOOST_AUTO_TEST_CASE(object_assign_mutable_writes_shared_entries)
+{
+    const size_t large = 2 * fjson::object_key_index::min_object_size;
+
+    // copies share the entries, and see what is assigned to any of them
+    const auto large_object = MakeObject(large);
+    fjson::variant_object small(MakeObject(2));
+    fjson::variant_object small_copy(small);
+    small = large_object;
+    BOOST_CHECK_EQUAL(small.size(), large);
+    BOOST_CHECK_EQUAL(small_copy.size(), large);
+    BOOST_CHECK_EQUAL(small_copy["k40"].as_uint64(), 40U);
+    CheckFind(small);
+    CheckFind(small_copy);
+
+    // the index of a large object is shared and rebuilt along with the entries
+    fjson::variant_object indexed(MakeObject(large));
+    fjson::variant_object indexed_copy(indexed);
+    auto reordered = MakeObject(0);
+    for (size_t i = large; i-- > 0;) {
+        reordered.set("k" + std::to_string(i), (uint64_t) (i + 1));
+    }
+    indexed = reordered;
+    BOOST_CHECK_EQUAL(indexed_copy.begin()->key(), "k" + std::to_string(large - 1));
+    BOOST_CHECK_EQUAL(indexed_copy["k0"].as_uint64(), 1U);
+    CheckFind(indexed);
+    CheckFind(indexed_copy);
+    const auto small_object = MakeObject(3);
+    indexed = small_object;
+    BOOST_CHECK_EQUAL(indexed_copy.size(), 3U);
+    BOOST_CHECK(indexed_copy.find("k3") == indexed_copy.end());
+    CheckFind(indexed_copy);
+
+    // the source is copied, not shared
+    auto source = MakeObject(large);
+    fjson::variant_object target;
+    target = source;
+    source.set("k0", "changed");
+    BOOST_CHECK_EQUAL(target["k0"].as_uint64(), 0U);
+    CheckFind(target);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <jsondiff/helper.h>
+#include <jsondiff/jsondiff.h>
+#include <test/test_bitcoin.h>
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct JsonDiffVector {
+    const char* old_json;
+    const char* new_json;
+    const char* diff;       //!< nullptr when the two values are identical
+    const char* patched;    //!< patch(old, diff), nullptr when it throws
+    const char* rolledback; //!< rollback(new, diff), nullptr when it throws
+};
+
+/**
+ * Diffs, patches and rollbacks produced by JsonDiff before it compared values
+ * structurally, when it still diffed through json strings.
+ * Covers nested objects, arrays, reordered keys, duplicate keys in small and
+ * in indexed objects, escapes and large integers.
+ */
+static const JsonDiffVector vectors[] = {
+    {"{\"a\":{\"b\":1,\"c\":{\"d\":\"x\"}},\"e\":2}",
+     "{\"a\":{\"b\":2,\"c\":{\"d\":\"y\",\"f\":true}},\"e\":2}",
+     "{\"a\":{\"b\":{\"__old\":1,\"__new\":2},\"c\":{\"d\":{\"__old\":\"x\",\"__new\":\"y\"},\"f__added\":true}}}",
+     "{\"a\":{\"b\":2,\"c\":{\"d\":\"y\",\"f\":true}},\"e\":2}",
+     "{\"a\":{\"b\":1,\"c\":{\"d\":\"x\"}},\"e\":2}"},
+    {"{\"arr\":[1,2,3,{\"k\":1}]}",
+     "{\"arr\":[1,3,4,{\"k\":2},5]}",
+     "{\"arr\":[[\"~\",1,{\"__old\":2,\"__new\":3}],[\"~\",2,{\"__old\":3,\"__new\":4}],[\"~\",3,{\"k\":{\"__old\":1,\"__new\":2}}],[\"+\",4,5]]}",
+     nullptr,
+     nullptr},
+    {"[1,\"a\",[2,3],{\"k\":[]}]",
+     "[1,\"b\",[2,3,4],{\"k\":[null]}]",
+     "[[\"~\",1,{\"__old\":\"a\",\"__new\":\"b\"}],[\"~\",2,[[\"+\",2,4]]],[\"~\",3,{\"k\":[[\"+\",0,null]]}]]",
+     nullptr,
+     nullptr},
+    {"{\"a\":1,\"b\":2,\"c\":3}",
+     "{\"c\":3,\"a\":1,\"b\":4}",
+     "{\"b\":{\"__old\":2,\"__new\":4}}",
+     "{\"a\":1,\"b\":4,\"c\":3}",
+     "{\"c\":3,\"a\":1,\"b\":2}"},
+    {"{\"a\":1,\"b\":2}",
+     "{\"b\":2,\"d\":null}",
+     "{\"a__deleted\":1,\"d__added\":null}",
+     "{\"b\":2,\"d\":null}",
+     "{\"b\":2,\"a\":1}"},
+    {"{\"a\":1,\"b\":2,\"a\":3}",
+     "{\"b\":2,\"a\":1}",
+     "{\"a\":{\"__old\":3,\"__new\":1}}",
+     "{\"a\":1,\"b\":2,\"a\":3}",
+     "{\"b\":2,\"a\":3}"},
+    {"{\"x\":0,\"a\":1}",
+     "{\"a\":1,\"a\":2}",
+     "{\"x__deleted\":0}",
+     "{\"a\":1}",
+     "{\"a\":1,\"a\":2,\"x\":0}"},
+    {"{\"a\":1,\"b\":{\"c\":1},\"a\":{\"z\":1}}",
+     "{\"b\":{\"c\":2},\"a\":5,\"a\":{\"z\":2}}",
+     "{\"a\":{\"__old\":{\"z\":1},\"__new\":5},\"b\":{\"c\":{\"__old\":1,\"__new\":2}}}",
+     "{\"a\":5,\"b\":{\"c\":2},\"a\":{\"z\":1}}",
+     "{\"b\":{\"c\":1},\"a\":{\"z\":1},\"a\":{\"z\":2}}"},
+    {"{\"a\":1,\"s\":\"q\\\"\\n\\u00e9\"}",
+     "{\"a\":\"1\",\"s\":\"q\\\"\\n\\u00e8\",\"i\":9223372036854775807,\"u\":18446744073709551615}",
+     "{\"a\":{\"__old\":1,\"__new\":\"1\"},\"s\":{\"__old\":\"q\\\"\\nu00e9\",\"__new\":\"q\\\"\\nu00e8\"},\"i__added\":9223372036854775807,\"u__added\":18446744073709551615}",
+     "{\"a\":\"1\",\"s\":\"q\\\"\\nu00e8\",\"i\":9223372036854775807,\"u\":18446744073709551615}",
+     "{\"a\":1,\"s\":\"q\\\"\\nu00e9\"}"},
+    {"{\"a\":[1,{\"b\":2}]}",
+     "{\"a\":[1,{\"b\":2}]}",
+     nullptr,
+     "{\"a\":[1,{\"b\":2}]}",
+     "{\"a\":[1,{\"b\":2}]}"},
+    {"7",
+     "8",
+     "{\"__old\":7,\"__new\":8}",
+     "8",
+     "7"},
+    {"{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":21,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":28,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":33,\"k34\":34,\"k35\":35,\"k5\":77}",
+     "{\"k35\":350,\"k34\":34,\"k33\":33,\"k32\":32,\"k31\":31,\"k30\":30,\"k29\":29,\"k28\":280,\"k27\":27,\"k26\":26,\"k25\":25,\"k24\":24,\"k23\":23,\"k22\":22,\"k21\":210,\"k20\":20,\"k19\":19,\"k18\":18,\"k17\":17,\"k16\":16,\"k15\":15,\"k14\":140,\"k13\":13,\"k12\":12,\"k11\":11,\"k10\":10,\"k9\":9,\"k8\":8,\"k7\":70,\"k6\":6,\"k5\":5,\"k4\":4,\"k3\":3,\"k2\":2,\"k1\":1,\"k0\":0,\"k3\":99,\"n\":{\"x\":[1,2]}}",
+     "{\"k7\":{\"__old\":7,\"__new\":70},\"k14\":{\"__old\":14,\"__new\":140},\"k21\":{\"__old\":21,\"__new\":210},\"k28\":{\"__old\":28,\"__new\":280},\"k35\":{\"__old\":35,\"__new\":350},\"k5\":{\"__old\":77,\"__new\":5},\"n__added\":{\"x\":[1,2]}}",
+     "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":70,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":140,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":210,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":280,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":33,\"k34\":34,\"k35\":350,\"k5\":77,\"n\":{\"x\":[1,2]}}",
+     "{\"k35\":35,\"k34\":34,\"k33\":33,\"k32\":32,\"k31\":31,\"k30\":30,\"k29\":29,\"k28\":28,\"k27\":27,\"k26\":26,\"k25\":25,\"k24\":24,\"k23\":23,\"k22\":22,\"k21\":21,\"k20\":20,\"k19\":19,\"k18\":18,\"k17\":17,\"k16\":16,\"k15\":15,\"k14\":14,\"k13\":13,\"k12\":12,\"k11\":11,\"k10\":10,\"k9\":9,\"k8\":8,\"k7\":7,\"k6\":6,\"k5\":77,\"k4\":4,\"k3\":3,\"k2\":2,\"k1\":1,\"k0\":0,\"k3\":99}"},
+    {"{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":21,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":28,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":33,\"k3\":3}",
+     "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":21,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":28,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":0,\"k3\":99}",
+     "{\"k33\":{\"__old\":33,\"__new\":0}}",
+     "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":21,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":28,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":0,\"k3\":3}",
+     "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k16\":16,\"k17\":17,\"k18\":18,\"k19\":19,\"k20\":20,\"k21\":21,\"k22\":22,\"k23\":23,\"k24\":24,\"k25\":25,\"k26\":26,\"k27\":27,\"k28\":28,\"k29\":29,\"k30\":30,\"k31\":31,\"k32\":32,\"k33\":33,\"k3\":99}"}
+};
+
+void CheckPatch(jsondiff::JsonDiff& differ, const jsondiff::JsonValue& json, const jsondiff::DiffResultP& diff, const char* expected, bool rollback)
+{
+    std::string result;
+    bool threw = false;
+    try {
+        result = jsondiff::json_dumps(rollback ? differ.rollback(json, diff) : differ.patch(json, diff));
+    } catch (...) {
+        threw = true;
+    }
+    if (expected) {
+        BOOST_CHECK_EQUAL(result, expected);
+    } else {
+        BOOST_CHECK(threw);
+    }
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(jsondiff_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsondiff_matches_vectors)
+{
+    jsondiff::JsonDiff differ;
+    for (const auto& v : vectors) {
+        const auto old_json = jsondiff::json_loads(v.old_json);
+        const auto new_json = jsondiff::json_loads(v.new_json);
+        const auto diff = differ.diff(old_json, new_json);
+        if (v.diff) {
+            BOOST_CHECK_EQUAL(diff->str(), v.diff);
+            BOOST_CHECK_EQUAL(differ.diff_by_string(v.old_json, v.new_json)->str(), v.diff);
+        } else {
+            BOOST_CHECK(diff->is_undefined());
+            BOOST_CHECK(differ.diff_by_string(v.old_json, v.new_json)->is_undefined());
+        }
+        CheckPatch(differ, old_json, diff, v.patched, false);
+        CheckPatch(differ, new_json, diff, v.rolledback, true);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
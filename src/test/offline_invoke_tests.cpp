@@ -0,0 +1,246 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <offline_invoke_pool.h>
+
+#include <base58.h>
+#include <contract_storage/contract_storage.hpp>
+#include <jsondiff/jsondiff.h>
+#include <policy/policy.h>
+#include <test/test_bitcoin.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace contract::storage;
+
+namespace {
+
+static const std::string DGP_CONTRACT_ID = "CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh";
+
+/** A regtest chain whose contract storage has a dgp native contract with one admin */
+struct OfflineInvokeTestingSetup : public TestChain100Setup {
+    std::string admin_address;
+    jsondiff::JsonValue admins;
+
+    OfflineInvokeTestingSetup()
+    {
+        admin_address = EncodeDestination(coinbaseKey.GetPubKey().GetID());
+        auto contract_info = std::make_shared<::contract::storage::ContractInfo>();
+        contract_info->id = DGP_CONTRACT_ID;
+        contract_info->creator_address = admin_address;
+        contract_info->txid = uint256().GetHex();
+        contract_info->version = CONTRACT_MAJOR_VERSION;
+        contract_info->is_native = true;
+        contract_info->contract_template_key = "dgp";
+        contract_info->apis = {"init"};
+        contract_info->offline_apis = {"admins"};
+        OpenContractStorage()->save_contract_info(contract_info);
+
+        jsondiff::JsonArray new_admins;
+        new_admins.push_back(admin_address);
+        SetAdmins(new_admins);
+    }
+
+    std::unique_ptr<ContractStorageService> OpenContractStorage() const
+    {
+        // the contracts aren't active on this chain yet, so nothing else opens the contract storage
+        return std::unique_ptr<ContractStorageService>(new ContractStorageService(CONTRACT_STORAGE_MAGIC_NUMBER,
+            (GetDataDir() / CONTRACT_STORAGE_DB_PATH).string(), (GetDataDir() / CONTRACT_STORAGE_SQL_DB_PATH).string()));
+    }
+
+    /** Commits a change of the contract's admins like a connected block would */
+    void SetAdmins(const jsondiff::JsonArray& new_admins)
+    {
+        ContractStorageItemChange item_change;
+        item_change.name = "admins";
+        item_change.diff = jsondiff::JsonDiff().diff(admins, new_admins);
+        ContractStorageChange change;
+        change.contract_id = DGP_CONTRACT_ID;
+        change.items.push_back(item_change);
+        auto changes = std::make_shared<ContractChanges>();
+        changes->storage_changes.push_back(change);
+        OpenContractStorage()->commit_contract_changes(changes);
+        admins = new_admins;
+    }
+
+    OfflineInvokeRequest MakeRequest() const
+    {
+        OfflineInvokeRequest request;
+        request.caller_address = admin_address;
+        request.contract_address = DGP_CONTRACT_ID;
+        request.api_name = "admins";
+        return request;
+    }
+
+    std::string ExpectedAdmins() const
+    {
+        return jsondiff::json_dumps(admins);
+    }
+
+    OfflineInvokeResult InvokeInline(const OfflineInvokeRequest& request)
+    {
+        const CBlockIndex* pindexTip;
+        std::shared_ptr<ContractStorageService> service;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+            service = get_read_only_contract_storage_service();
+        }
+        return InvokeContractOffline(service.get(), pindexTip, request);
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(offline_invoke_tests, OfflineInvokeTestingSetup)
+
+BOOST_AUTO_TEST_CASE(offline_invokes_while_blocks_connect)
+{
+    COfflineInvokePool pool;
+    pool.Start(2, DEFAULT_OFFLINE_INVOKE_QUEUE);
+
+    std::atomic<bool> fDone(false);
+    std::atomic<int> nInvokes(0);
+    std::atomic<int> nFailures(0);
+    const std::string strExpected = ExpectedAdmins();
+    auto check_result = [&](const OfflineInvokeResult& result) {
+        nInvokes++;
+        if (result.status != OfflineInvokeStatus::OK || result.exec_result.api_result != strExpected)
+            nFailures++;
+    };
+    // the rpc path without invoke threads: the tip and the snapshot are taken together under cs_main
+    std::thread inline_thread([&] {
+        while (!fDone) {
+            try {
+                check_result(InvokeInline(MakeRequest()));
+            } catch (...) {
+                nFailures++;
+            }
+        }
+    });
+    std::thread pool_thread([&] {
+        while (!fDone) {
+            try {
+                std::future<OfflineInvokeResult> result;
+                if (pool.Submit(MakeRequest(), result))
+                    check_result(result.get());
+            } catch (...) {
+                nFailures++;
+            }
+        }
+    });
+
+    const int nHeight = chainActive.Height();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 10; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+    fDone = true;
+    inline_thread.join();
+    pool_thread.join();
+    pool.Stop();
+
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 10);
+    BOOST_CHECK(nInvokes > 0);
+    BOOST_CHECK_EQUAL(nFailures, 0);
+}
+
+BOOST_AUTO_TEST_CASE(pool_snapshot_refreshed_after_commit)
+{
+    COfflineInvokePool pool;
+    pool.Start(1, DEFAULT_OFFLINE_INVOKE_QUEUE);
+    std::future<OfflineInvokeResult> result;
+
+    // the worker keeps its snapshot between these calls, nothing was written in between
+    for (int i = 0; i < 3; i++) {
+        BOOST_REQUIRE(pool.Submit(MakeRequest(), result));
+        auto invoke_result = result.get();
+        BOOST_CHECK(invoke_result.status == OfflineInvokeStatus::OK);
+        BOOST_CHECK_EQUAL(invoke_result.exec_result.api_result, ExpectedAdmins());
+    }
+
+    // a commit bumps the storage version, so the next call sees the new state instead of the kept snapshot
+    const std::string strOldAdmins = ExpectedAdmins();
+    jsondiff::JsonArray new_admins;
+    new_admins.push_back(admin_address);
+    new_admins.push_back(EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1)))));
+    SetAdmins(new_admins);
+    BOOST_CHECK(ExpectedAdmins() != strOldAdmins);
+    BOOST_REQUIRE(pool.Submit(MakeRequest(), result));
+    auto invoke_result = result.get();
+    BOOST_CHECK(invoke_result.status == OfflineInvokeStatus::OK);
+    BOOST_CHECK_EQUAL(invoke_result.exec_result.api_result, ExpectedAdmins());
+    pool.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(pool_rejects_when_queue_full)
+{
+    COfflineInvokePool pool;
+    std::future<OfflineInvokeResult> result;
+    BOOST_CHECK(!pool.IsRunning());
+    BOOST_CHECK(!pool.Submit(MakeRequest(), result));
+
+    pool.Start(1, 1);
+    BOOST_CHECK(pool.IsRunning());
+    std::vector<std::future<OfflineInvokeResult>> results;
+    int nRejected = 0;
+    {
+        // the worker waits for cs_main with the request it took, so the others stay in its queue
+        LOCK(cs_main);
+        for (int i = 0; i < 10; i++) {
+            if (pool.Submit(MakeRequest(), result))
+                results.push_back(std::move(result));
+            else
+                nRejected++;
+            MilliSleep(10);
+        }
+    }
+    // the queue of one, and at most the request the worker took before blocking
+    BOOST_CHECK(results.size() >= 1 && results.size() <= 2);
+    BOOST_CHECK_EQUAL(nRejected, 10 - (int)results.size());
+    for (auto& pending_result : results)
+        BOOST_CHECK(pending_result.get().status == OfflineInvokeStatus::OK);
+
+    // requests queued before Stop are still answered, none are taken afterwards
+    BOOST_CHECK(pool.Submit(MakeRequest(), result));
+    pool.Stop();
+    BOOST_CHECK(result.get().status == OfflineInvokeStatus::OK);
+    BOOST_CHECK(!pool.IsRunning());
+    BOOST_CHECK(!pool.Submit(MakeRequest(), result));
+}
+
+BOOST_AUTO_TEST_CASE(gas_limit_capped_by_arg)
+{
+    BOOST_CHECK_EQUAL(GetOfflineInvokeMaxGas(), (uint64_t)DEFAULT_OFFLINE_INVOKE_MAX_GAS);
+    gArgs.ForceSetArg("-offlineinvokemaxgas", "-5");
+    BOOST_CHECK_EQUAL(GetOfflineInvokeMaxGas(), 0U);
+    gArgs.ForceSetArg("-offlineinvokemaxgas", "1");
+    BOOST_CHECK_EQUAL(GetOfflineInvokeMaxGas(), 1U);
+
+    // below the gas a native api call is charged, the call is refused instead of run
+    OfflineInvokeRequest request = MakeRequest();
+    request.gas_limit = GetOfflineInvokeMaxGas();
+    auto invoke_result = InvokeInline(request);
+    BOOST_CHECK(invoke_result.status == OfflineInvokeStatus::EXEC_FAILED);
+    BOOST_CHECK_EQUAL(invoke_result.error, "too little gas limit");
+
+    gArgs.ForceSetArg("-offlineinvokemaxgas", std::to_string(DEFAULT_MIN_GAS_COUNT));
+    request.gas_limit = GetOfflineInvokeMaxGas();
+    invoke_result = InvokeInline(request);
+    BOOST_CHECK(invoke_result.status == OfflineInvokeStatus::OK);
+    BOOST_CHECK_EQUAL(invoke_result.exec_result.api_result, ExpectedAdmins());
+    gArgs.ForceSetArg("-offlineinvokemaxgas", std::to_string(DEFAULT_OFFLINE_INVOKE_MAX_GAS));
+
+    // unknown contracts are told apart from failed calls
+    request.contract_address = "CONtractUnknown";
+    BOOST_CHECK(InvokeInline(request).status == OfflineInvokeStatus::CONTRACT_NOT_FOUND);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
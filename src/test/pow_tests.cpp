@@ -2,15 +2,28 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <pow.h>
 #include <random.h>
 #include <util.h>
+#include <validation.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
 
+namespace {
+/** The script check threads of the testing setup, with the header check threads of init next to them */
+struct HeaderCheckTestingSetup : public TestingSetup {
+    HeaderCheckTestingSetup()
+    {
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
+    }
+};
+} // namespace
+
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
 
 /* Test calculation of next difficulty target with no constraints applying */
@@ -81,6 +94,124 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
         int64_t tdiff = GetBlockProofEquivalentTime(*p1, *p2, *p3, chainParams->GetConsensus());
         BOOST_CHECK_EQUAL(tdiff, p1->GetBlockTime() - p2->GetBlockTime());
     }
+
+    // past UBCONTRACT a block of the tip's work is worth the 2 minute spacing
+    const Consensus::Params& params = chainParams->GetConsensus();
+    CBlockIndex from, to;
+    from.nHeight = params.UBCONTRACT_Height;
+    from.nBits = 0x207fffff;
+    to.pprev = &from;
+    to.nHeight = from.nHeight + 1;
+    to.nBits = from.nBits;
+    to.nChainWork = GetBlockProof(to);
+    BOOST_CHECK_EQUAL(GetBlockProofEquivalentTime(to, from, to, params), 120);
+    BOOST_CHECK_EQUAL(GetBlockProofEquivalentTime(from, to, to, params), -120);
+}
+
+BOOST_AUTO_TEST_CASE(CheckProofOfWork_exempt_heights)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const uint256 hashHigh = uint256S("0xffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    const uint256 hashLow = uint256S("0x01");
+    const uint256 hashPrevUnknown = uint256S("0x1234");
+
+    BOOST_CHECK(!IsProofOfWorkExempt(params.UBCHeight - 1, params));
+    BOOST_CHECK(IsProofOfWorkExempt(params.UBCHeight, params));
+    BOOST_CHECK(IsProofOfWorkExempt(params.UBCHeight + params.UBCInitBlockCount - 1, params));
+    BOOST_CHECK(!IsProofOfWorkExempt(params.UBCHeight + params.UBCInitBlockCount, params));
+    BOOST_CHECK(IsProofOfWorkExempt(params.ForkV4Height, params));
+    BOOST_CHECK(!IsProofOfWorkExempt(params.ForkV4Height + 1, params));
+
+    BOOST_CHECK(CheckProofOfWorkTarget(hashLow, 0x1d00ffff, params));
+    BOOST_CHECK(!CheckProofOfWorkTarget(hashHigh, 0x1d00ffff, params));
+    // an exempt height needs no lookup of the previous block
+    BOOST_CHECK(CheckProofOfWork(hashHigh, hashPrevUnknown, 0x1d00ffff, params, params.ForkV4Height));
+    BOOST_CHECK(!CheckProofOfWork(hashHigh, hashPrevUnknown, 0x1d00ffff, params, params.ForkV4Height + 1));
+    BOOST_CHECK(!CheckProofOfWork(hashHigh, hashPrevUnknown, 0x1d00ffff, params));
+}
+
+BOOST_AUTO_TEST_CASE(params_for_height)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+
+    BOOST_CHECK_EQUAL(params.ForHeight(params.UBCHeight).DifficultyAdjustmentInterval(), 2016);
+    BOOST_CHECK_EQUAL(params.ForHeight(params.UBCHeight + params.UBCInitBlockCount).DifficultyAdjustmentInterval(), 200);
+    BOOST_CHECK_EQUAL(params.ForHeight(params.ForkV1Height).DifficultyAdjustmentInterval(), 10);
+    BOOST_CHECK_EQUAL(params.ForHeight(params.ForkV1Height).nPowTargetSpacing, 60);
+    BOOST_CHECK_EQUAL(params.ForHeight(params.UBCONTRACT_Height).nPowTargetSpacing, 120);
+    BOOST_CHECK_EQUAL(params.PowTargetSpacingAt(params.UBCONTRACT_Height), 120);
+    BOOST_CHECK_EQUAL(params.PowTargetSpacingAt(params.UBCHeight), 600);
+    // the params themselves are left alone
+    BOOST_CHECK_EQUAL(params.nPowTargetTimespan, 14 * 24 * 60 * 60);
+    BOOST_CHECK_EQUAL(params.nPowTargetSpacing, 600);
+}
+
+BOOST_AUTO_TEST_CASE(get_next_work_cached)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    std::vector<CBlockIndex> blocks(2016);
+    for (int i = 0; i < 2016; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1231006505 + i * 300;
+        blocks[i].nBits = 0x1d00ffff;
+    }
+    CBlockHeader header;
+    header.nVersion = MINING_TYPE_POW;
+
+    // the block at height 2016 retargets, blocks came twice as fast as they should
+    const unsigned int nBits = GetNextWorkRequired(&blocks.back(), &header, params);
+    BOOST_CHECK_EQUAL(nBits, CalculateNextWorkRequired(&blocks.back(), blocks[0].GetBlockTime(), params));
+    BOOST_CHECK_EQUAL(blocks.back().nextWork.Get(false), nBits);
+    BOOST_CHECK_EQUAL(blocks.back().nextWork.Get(true), 0U);
+
+    // later calls take the cached result
+    blocks.back().nTime += 1000000;
+    BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks.back(), &header, params), nBits);
+    blocks.back().nextWork.Clear();
+    BOOST_CHECK(GetNextWorkRequired(&blocks.back(), &header, params) != nBits);
+}
+
+BOOST_FIXTURE_TEST_CASE(precheck_block_headers, HeaderCheckTestingSetup)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const unsigned int nBitsLimit = UintToArith256(params.powLimit).GetCompact();
+
+    // a few batches of pow headers meeting and missing their target, pos headers and headers without a target
+    std::vector<CBlockHeader> headers(3 * 64 + 17);
+    std::vector<bool> vExpected(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        CBlockHeader& header = headers[i];
+        header.nVersion = (i % 4 == 2) ? MINING_TYPE_POS : MINING_TYPE_POW;
+        header.hashPrevBlock = ArithToUint256(arith_uint256(i));
+        header.nTime = 1296688602 + i;
+        header.nBits = (i % 4 == 3) ? 0 : nBitsLimit;
+        const bool fMeetTarget = i % 4 != 1;
+        while (CheckProofOfWorkTarget(header.GetHash(), nBitsLimit, params) != fMeetTarget)
+            ++header.nNonce;
+        vExpected[i] = i % 4 == 0;
+    }
+
+    const int nScriptCheckThreadsBefore = nScriptCheckThreads;
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    const std::vector<BlockHeaderPrecheck> prechecksParallel = PrecheckBlockHeaders(headers, params);
+    nScriptCheckThreads = 0;
+    const std::vector<BlockHeaderPrecheck> prechecksSerial = PrecheckBlockHeaders(headers, params);
+    nScriptCheckThreads = nScriptCheckThreadsBefore;
+
+    BOOST_REQUIRE_EQUAL(prechecksParallel.size(), headers.size());
+    BOOST_REQUIRE_EQUAL(prechecksSerial.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        const uint256 hash = headers[i].GetHash();
+        BOOST_CHECK(prechecksParallel[i].hash == hash);
+        BOOST_CHECK(prechecksSerial[i].hash == hash);
+        BOOST_CHECK_EQUAL(prechecksParallel[i].fPowTarget, vExpected[i]);
+        BOOST_CHECK_EQUAL(prechecksSerial[i].fPowTarget, vExpected[i]);
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -43,6 +43,42 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(skiplist_pos_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+    std::vector<CBlockIndex*> vPos;
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? nullptr : &vIndex[i - 1];
+        if (i > 0 && InsecureRandBool()) {
+            vIndex[i].nVersion = MINING_TYPE_POS;
+            vIndex[i].nBits = InsecureRandRange(2);
+            vPos.push_back(&vIndex[i]);
+        }
+        vIndex[i].BuildSkip();
+
+        BOOST_CHECK(vIndex[i].nChainPosBlocks == (int) vPos.size());
+        BOOST_CHECK(vIndex[i].pindexLastPos == (vPos.empty() ? nullptr : vPos.back()));
+        int nRun = 0;
+        for (auto it = vPos.rbegin(); it != vPos.rend() && (*it)->nBits == vPos.back()->nBits; ++it)
+            nRun++;
+        BOOST_CHECK(vIndex[i].nPosBitsRun == nRun);
+    }
+
+    for (int i=0; i < 1000; i++) {
+        int from = InsecureRandRange(SKIPLIST_LENGTH);
+        int nCount = vIndex[from].nChainPosBlocks;
+        BOOST_CHECK(vIndex[from].GetPosAncestor(nCount + 1) == nullptr);
+        BOOST_CHECK(vIndex[from].GetPosAncestor(0) == nullptr);
+        if (nCount > 0) {
+            int to = 1 + InsecureRandRange(nCount);
+            BOOST_CHECK(vIndex[from].GetPosAncestor(to) == vPos[to - 1]);
+            BOOST_CHECK(vIndex[from].GetPosAncestor(nCount) == vIndex[from].pindexLastPos);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
@@ -0,0 +1,158 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <stake_agent.h>
+#include <fs.h>
+#include <test/test_bitcoin.h>
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+BOOST_FIXTURE_TEST_SUITE(stake_agent_tests, BasicTestingSetup)
+
+static StakeWork TestWork()
+{
+    StakeWork work;
+    work.hashPrevBlock = uint256S("0x1e2f");
+    work.nHeight = 1000;
+    // the easiest target, every time slot of every coin is a kernel
+    work.nBits = 0x207fffff;
+    work.fHashPrev10Block = true;
+    work.hashPrev10Block = uint256S("0x3c4d");
+    work.nTimeStart = 1500000000;
+    work.nTimeEnd = 1500000100;
+    return work;
+}
+
+BOOST_AUTO_TEST_CASE(stake_agent_json)
+{
+    StakeWork work = TestWork();
+    StakeWork workRead;
+    UniValue value;
+    BOOST_CHECK(value.read(StakeWorkToJSON(work).write()));
+    BOOST_CHECK(StakeWorkFromJSON(value, workRead));
+    BOOST_CHECK(workRead.hashPrevBlock == work.hashPrevBlock);
+    BOOST_CHECK_EQUAL(workRead.nHeight, work.nHeight);
+    BOOST_CHECK_EQUAL(workRead.nBits, work.nBits);
+    BOOST_CHECK(workRead.fHashPrev10Block);
+    BOOST_CHECK(workRead.hashPrev10Block == work.hashPrev10Block);
+    BOOST_CHECK_EQUAL(workRead.nTimeStart, work.nTimeStart);
+    BOOST_CHECK_EQUAL(workRead.nTimeEnd, work.nTimeEnd);
+
+    work.fHashPrev10Block = false;
+    work.hashPrev10Block.SetNull();
+    BOOST_CHECK(StakeWorkFromJSON(StakeWorkToJSON(work), workRead));
+    BOOST_CHECK(!workRead.fHashPrev10Block);
+
+    StakeKernel kernel;
+    kernel.hashPrevBlock = work.hashPrevBlock;
+    kernel.nBits = work.nBits;
+    kernel.nTime = work.nTimeStart + 7;
+    kernel.prevout = COutPoint(uint256S("0x5e6f"), 3);
+    kernel.nValue = 25 * COIN;
+    StakeKernel kernelRead;
+    BOOST_CHECK(value.read(StakeKernelToJSON(kernel).write()));
+    BOOST_CHECK(StakeKernelFromJSON(value, kernelRead));
+    BOOST_CHECK(kernelRead.hashPrevBlock == kernel.hashPrevBlock);
+    BOOST_CHECK_EQUAL(kernelRead.nBits, 0U);
+    BOOST_CHECK_EQUAL(kernelRead.nTime, kernel.nTime);
+    BOOST_CHECK(kernelRead.prevout == kernel.prevout);
+    BOOST_CHECK_EQUAL(kernelRead.nValue, kernel.nValue);
+
+    // a message of the other kind or an amount out of range is rejected
+    BOOST_CHECK(!StakeWorkFromJSON(StakeKernelToJSON(kernel), workRead));
+    BOOST_CHECK(!StakeKernelFromJSON(StakeWorkToJSON(work), kernelRead));
+    kernel.nValue = 0;
+    BOOST_CHECK(!StakeKernelFromJSON(StakeKernelToJSON(kernel), kernelRead));
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(stake_agent_socket)
+{
+    std::string strPath = (fs::temp_directory_path() / fs::unique_path()).string();
+    CStakeServer server;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(server.Start(strPath, strError), strError);
+
+    StakeWork work = TestWork();
+    server.PublishWork(work);
+
+    std::vector<std::pair<COutPoint, CAmount> > vCoins;
+    vCoins.emplace_back(COutPoint(uint256S("0x7a8b"), 0), 10 * COIN);
+    vCoins.emplace_back(COutPoint(uint256S("0x9c0d"), 1), 20 * COIN);
+    CStakeAgent agent;
+    BOOST_REQUIRE(agent.Start(strPath, vCoins));
+
+    // the agent connects and gets the work published before it
+    StakeKernel kernel;
+    BOOST_REQUIRE(server.WaitForKernel(kernel, 10000));
+    BOOST_CHECK_EQUAL(server.GetAgentCount(), 1U);
+    BOOST_CHECK(kernel.hashPrevBlock == work.hashPrevBlock);
+    BOOST_CHECK_EQUAL(kernel.nBits, work.nBits);
+    BOOST_CHECK_EQUAL(kernel.nTime, work.nTimeStart);
+    BOOST_CHECK(kernel.prevout == vCoins[0].first);
+    BOOST_CHECK_EQUAL(kernel.nValue, vCoins[0].second);
+
+    // kernels of older work are dropped
+    work.hashPrevBlock = uint256S("0x2f3e");
+    server.PublishWork(work);
+    BOOST_REQUIRE(server.WaitForKernel(kernel, 10000));
+    BOOST_CHECK(kernel.hashPrevBlock == work.hashPrevBlock);
+
+    agent.Stop();
+    server.Stop();
+    BOOST_CHECK(!server.IsRunning());
+    BOOST_CHECK(!fs::exists(strPath));
+}
+
+BOOST_AUTO_TEST_CASE(stake_socket_path_checks)
+{
+    std::string strPath = (fs::temp_directory_path() / fs::unique_path()).string();
+    CStakeServer server;
+    std::string strError;
+
+    // a socket left behind is replaced, and the new one is only open to this user
+    BOOST_REQUIRE_MESSAGE(server.Start(strPath, strError), strError);
+    server.Stop();
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, strPath.c_str(), sizeof(addr.sun_path) - 1);
+    BOOST_REQUIRE(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    close(fd);
+    BOOST_REQUIRE_MESSAGE(server.Start(strPath, strError), strError);
+    struct stat st;
+    BOOST_REQUIRE(lstat(strPath.c_str(), &st) == 0);
+    BOOST_CHECK(S_ISSOCK(st.st_mode));
+    BOOST_CHECK_EQUAL(st.st_mode & (S_IRWXG | S_IRWXO), 0U);
+
+    // the socket of a running server is not taken over
+    CStakeServer other;
+    BOOST_CHECK(!other.Start(strPath, strError));
+    BOOST_CHECK(!other.IsRunning());
+    BOOST_CHECK(server.IsRunning());
+    BOOST_REQUIRE(lstat(strPath.c_str(), &st) == 0);
+    BOOST_CHECK(S_ISSOCK(st.st_mode));
+    server.Stop();
+
+    // anything else at the path is left alone
+    FILE* file = fsbridge::fopen(strPath, "w");
+    BOOST_REQUIRE(file);
+    fputs("not a socket", file);
+    fclose(file);
+    BOOST_CHECK(!server.Start(strPath, strError));
+    BOOST_CHECK(!server.IsRunning());
+    BOOST_CHECK(fs::is_regular_file(strPath));
+    fs::remove(strPath);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
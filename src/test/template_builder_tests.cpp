@@ -0,0 +1,183 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <template_builder.h>
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <script/sign.h>
+#include <test/test_bitcoin.h>
+#include <timedata.h>
+#include <utiltime.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct TemplateBuilderTestingSetup : public TestChain100Setup {
+    CTemplateBuilder builder;
+
+    TemplateBuilderTestingSetup()
+    {
+        // the builder follows the tip through the validation notifications, so deliver them
+        threadGroup.create_thread([this] { scheduler.serviceQueue(); });
+        builder.Start();
+    }
+
+    ~TemplateBuilderTestingSetup()
+    {
+        builder.Stop();
+        SetMockTime(0);
+    }
+
+    std::unique_ptr<CBlockTemplate> GetPowTemplate()
+    {
+        unsigned int nTransactionsUpdated;
+        int64_t nTime;
+        return builder.GetPowTemplate(chainActive.Tip(), true, nTransactionsUpdated, nTime);
+    }
+
+    /** A transaction paying nFee out of a mature coinbase output of the test chain */
+    CMutableTransaction SpendCoinbase(int nCoinbase, CAmount nFee)
+    {
+        CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(coinbaseTxns[nCoinbase].GetHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = coinbaseTxns[nCoinbase].vout[0].nValue - nFee;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << vchSig;
+        return tx;
+    }
+
+    bool ToMemPool(const CMutableTransaction& tx)
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), nullptr, nullptr, true, 0);
+    }
+
+    /** Ask for the proof of work template of the tip until the builder has prepared it */
+    std::unique_ptr<CBlockTemplate> WaitForPowTemplate()
+    {
+        for (int i = 0; i < 1000; i++) {
+            std::unique_ptr<CBlockTemplate> pblocktemplate = GetPowTemplate();
+            if (pblocktemplate)
+                return pblocktemplate;
+            MilliSleep(10);
+        }
+        return nullptr;
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(template_builder_tests, TemplateBuilderTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pow_template_follows_tip)
+{
+    // nothing is prepared before getblocktemplate is first called
+    BOOST_CHECK(!GetPowTemplate());
+    std::unique_ptr<CBlockTemplate> pblocktemplate = WaitForPowTemplate();
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    CreateAndProcessBlock({}, CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG);
+    SyncWithValidationInterfaceQueue();
+    pblocktemplate = WaitForPowTemplate();
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(pow_template_expires_when_unused)
+{
+    GetPowTemplate();
+    BOOST_REQUIRE(WaitForPowTemplate());
+
+    // a caller coming back after a long pause gets a fresh template, not the one kept meanwhile
+    SetMockTime(GetTime() + SPECULATIVE_TEMPLATE_IDLE + 1);
+    BOOST_CHECK(!GetPowTemplate());
+    std::unique_ptr<CBlockTemplate> pblocktemplate = WaitForPowTemplate();
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(extended_template_matches_fresh_one)
+{
+    // the coinbases spent below are all mature on the next block
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 3; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+
+    CScript scriptDummy = CScript() << OP_TRUE;
+    BOOST_REQUIRE(ToMemPool(SpendCoinbase(0, 30000)));
+    std::unique_ptr<CBlockTemplate> pprevTemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, true);
+    BOOST_REQUIRE(pprevTemplate);
+    BOOST_CHECK_EQUAL(pprevTemplate->block.vtx.size(), 2U);
+
+    // the new transactions pay less than the kept one, so a fresh template orders them the same way
+    std::set<uint256> setNewTx;
+    for (int i = 1; i <= 3; i++) {
+        CMutableTransaction tx = SpendCoinbase(i, 30000 - i * 5000);
+        BOOST_REQUIRE(ToMemPool(tx));
+        setNewTx.insert(tx.GetHash());
+    }
+    std::unique_ptr<CBlockTemplate> pextended = BlockAssembler(Params()).UpdateNewBlock(*pprevTemplate, setNewTx, scriptDummy, true);
+    std::unique_ptr<CBlockTemplate> pfresh = BlockAssembler(Params()).CreateNewBlock(scriptDummy, true);
+    BOOST_REQUIRE(pextended && pfresh);
+    BOOST_REQUIRE_EQUAL(pextended->block.vtx.size(), 5U);
+    BOOST_REQUIRE_EQUAL(pextended->block.vtx.size(), pfresh->block.vtx.size());
+    for (size_t i = 0; i < pfresh->block.vtx.size(); i++) {
+        BOOST_CHECK(*pextended->block.vtx[i] == *pfresh->block.vtx[i]);
+        BOOST_CHECK_EQUAL(pextended->vTxFees[i], pfresh->vTxFees[i]);
+        BOOST_CHECK_EQUAL(pextended->vTxSigOpsCost[i], pfresh->vTxSigOpsCost[i]);
+    }
+    BOOST_CHECK(pextended->block.hashPrevBlock == pfresh->block.hashPrevBlock);
+    BOOST_CHECK(pextended->vchCoinbaseCommitment == pfresh->vchCoinbaseCommitment);
+
+    // a kept transaction that left the mempool makes it select everything again
+    mempool.removeRecursive(*pprevTemplate->block.vtx[1]);
+    pextended = BlockAssembler(Params()).UpdateNewBlock(*pprevTemplate, {}, scriptDummy, true);
+    pfresh = BlockAssembler(Params()).CreateNewBlock(scriptDummy, true);
+    BOOST_REQUIRE(pextended && pfresh);
+    BOOST_REQUIRE_EQUAL(pextended->block.vtx.size(), 4U);
+    for (size_t i = 0; i < pfresh->block.vtx.size(); i++)
+        BOOST_CHECK(*pextended->block.vtx[i] == *pfresh->block.vtx[i]);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(pos_template_of_kernel)
+{
+    StakeKernel kernel;
+    kernel.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    kernel.nTime = GetAdjustedTime() + POS_TEMPLATE_REFRESH_LEAD + 2;
+    kernel.nBits = chainActive.Tip()->nBits;
+
+    // the contracts aren't active on this chain, so no stake block can be built, and the miner
+    // waiting for one is told so instead of blocking
+    builder.PreparePosTemplate(nullptr, kernel);
+    BOOST_CHECK(!builder.TakePosTemplate(nullptr, kernel));
+
+    // a template is only handed out for the kernel it was prepared for
+    StakeKernel other = kernel;
+    other.nTime++;
+    builder.PreparePosTemplate(nullptr, kernel);
+    BOOST_CHECK(!builder.TakePosTemplate(nullptr, other));
+
+    // a stopped builder does not keep the miner waiting either
+    builder.PreparePosTemplate(nullptr, kernel);
+    builder.Stop();
+    BOOST_CHECK(!builder.TakePosTemplate(nullptr, kernel));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,206 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <base58.h>
+#include <chainparams.h>
+#include <contract_engine/native_contract.hpp>
+#include <contract_engine/pending_state.hpp>
+#include <contract_storage/contract_storage.hpp>
+#include <fs.h>
+#include <test/test_bitcoin.h>
+#include <uvm/exceptions.h>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace blockchain::contract;
+using namespace contract::storage;
+
+namespace {
+
+static const uint32_t TEST_MAGIC_NUMBER = 34125;
+static const std::string TOKEN_CONTRACT_ID = "CONEAQmG5GQvZ3qA7ZVA6MdxYQ3SXn4SiGEh";
+
+/** A native token contract on contract storage dbs in a fresh temporary directory, on regtest where the token is active */
+struct TokenContractTestingSetup : public BasicTestingSetup {
+    fs::path path_root;
+    std::shared_ptr<ContractStorageService> service;
+    std::string owner;
+    std::string alice;
+    std::string bob;
+
+    TokenContractTestingSetup() : BasicTestingSetup(CBaseChainParams::REGTEST)
+    {
+        path_root = fs::temp_directory_path() / "test_token_native_contract" / fs::unique_path();
+        fs::create_directories(path_root);
+        service = std::make_shared<ContractStorageService>(TEST_MAGIC_NUMBER,
+            (path_root / "contract_storage.db").string(), (path_root / "contract_storage_sql.db").string());
+        owner = EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))));
+        alice = EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 2))));
+        bob = EncodeDestination(CKeyID(uint160(std::vector<unsigned char>(20, 3))));
+    }
+    ~TokenContractTestingSetup()
+    {
+        service.reset();
+        fs::remove_all(path_root);
+    }
+
+    /** Calls api of the token contract as caller, and commits its storage changes like a connected block would */
+    ContractExecResult Invoke(const std::string& caller, const std::string& api_name, const std::string& api_arg)
+    {
+        native_contract_sender sender;
+        sender.caller_address = caller;
+        sender.block_number = Params().GetConsensus().NATIVE_TOKEN_Height;
+        PendingState pending_state(service.get());
+        auto contract = native_contract_finder::create_native_contract_by_key(&pending_state, "token", TOKEN_CONTRACT_ID, sender);
+        BOOST_REQUIRE(contract);
+        auto result = contract->invoke(api_name, api_arg);
+
+        auto changes = std::make_shared<ContractChanges>();
+        for (const auto& p : result.contract_storage_changes) {
+            ContractStorageChange change;
+            change.contract_id = p.first;
+            const auto& items = p.second->value().as<jsondiff::JsonObject>();
+            for (auto it = items.begin(); it != items.end(); it++) {
+                ContractStorageItemChange item_change;
+                item_change.name = it->key();
+                item_change.diff = std::make_shared<jsondiff::DiffResult>(it->value());
+                change.items.push_back(item_change);
+            }
+            changes->storage_changes.push_back(change);
+        }
+        service->commit_contract_changes(changes);
+        return result;
+    }
+
+    std::string Query(const std::string& api_name, const std::string& api_arg = "")
+    {
+        return Invoke(owner, api_name, api_arg).api_result;
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(token_native_contract_tests, TokenContractTestingSetup)
+
+BOOST_AUTO_TEST_CASE(token_template_gated_by_height)
+{
+    const int nTokenHeight = Params().GetConsensus().NATIVE_TOKEN_Height;
+    BOOST_CHECK(native_contract_finder::has_native_contract_with_key("dgp", 0));
+    BOOST_CHECK(!native_contract_finder::has_native_contract_with_key("token", nTokenHeight - 1));
+    BOOST_CHECK(native_contract_finder::has_native_contract_with_key("token", nTokenHeight));
+    BOOST_CHECK(!native_contract_finder::has_native_contract_with_key("unknown", nTokenHeight));
+
+    // the sender's block number is the tip the contract transaction is applied on
+    PendingState pending_state(service.get());
+    native_contract_sender sender;
+    sender.caller_address = owner;
+    sender.block_number = nTokenHeight - 2;
+    BOOST_CHECK(!native_contract_finder::create_native_contract_by_key(&pending_state, "token", TOKEN_CONTRACT_ID, sender));
+    BOOST_CHECK(native_contract_finder::create_native_contract_by_key(&pending_state, "dgp", TOKEN_CONTRACT_ID, sender));
+    sender.block_number = nTokenHeight - 1;
+    BOOST_CHECK(native_contract_finder::create_native_contract_by_key(&pending_state, "token", TOKEN_CONTRACT_ID, sender));
+}
+
+BOOST_AUTO_TEST_CASE(token_init_and_transfer)
+{
+    Invoke(owner, "init", "");
+    BOOST_CHECK_EQUAL(Query("state"), "NOT_INITED");
+
+    auto result = Invoke(owner, "init_token", "test token,TTK,1000000,8");
+    BOOST_CHECK_EQUAL(result.events.size(), 1U);
+    BOOST_CHECK_EQUAL(result.events[0].event_name, "Inited");
+    BOOST_CHECK_EQUAL(Query("state"), "COMMON");
+    BOOST_CHECK_EQUAL(Query("tokenName"), "test token");
+    BOOST_CHECK_EQUAL(Query("tokenSymbol"), "TTK");
+    BOOST_CHECK_EQUAL(Query("totalSupply"), "1000000");
+    BOOST_CHECK_EQUAL(Query("precision"), "8");
+    BOOST_CHECK_EQUAL(Query("balanceOf", owner), "1000000");
+
+    result = Invoke(owner, "transfer", alice + ",300");
+    BOOST_CHECK_EQUAL(result.events.size(), 1U);
+    BOOST_CHECK_EQUAL(result.events[0].event_name, "Transfer");
+    BOOST_CHECK_EQUAL(Query("balanceOf", owner), "999700");
+    BOOST_CHECK_EQUAL(Query("balanceOf", alice), "300");
+
+    // a transfer to oneself changes nothing and emits no event
+    result = Invoke(alice, "transfer", alice + ",100");
+    BOOST_CHECK(result.events.empty());
+    BOOST_CHECK_EQUAL(Query("balanceOf", alice), "300");
+    BOOST_CHECK_EQUAL(Query("totalSupply"), "1000000");
+}
+
+BOOST_AUTO_TEST_CASE(token_approve_and_transfer_from)
+{
+    Invoke(owner, "init", "");
+    Invoke(owner, "init_token", "test token,TTK,1000,2");
+
+    auto result = Invoke(owner, "approve", alice + ",400");
+    BOOST_CHECK_EQUAL(result.events.size(), 1U);
+    BOOST_CHECK_EQUAL(result.events[0].event_name, "Approved");
+    BOOST_CHECK_EQUAL(Query("allowance", owner + "," + alice), "400");
+
+    Invoke(alice, "transferFrom", owner + "," + bob + ",150");
+    BOOST_CHECK_EQUAL(Query("allowance", owner + "," + alice), "250");
+    BOOST_CHECK_EQUAL(Query("balanceOf", owner), "850");
+    BOOST_CHECK_EQUAL(Query("balanceOf", bob), "150");
+    BOOST_CHECK_EQUAL(Query("balanceOf", alice), "0");
+
+    // an approval of 0 revokes it
+    Invoke(owner, "approve", alice + ",0");
+    BOOST_CHECK_EQUAL(Query("allowance", owner + "," + alice), "0");
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", owner + "," + bob + ",1"), uvm::core::UvmException);
+}
+
+BOOST_AUTO_TEST_CASE(token_error_paths)
+{
+    BOOST_CHECK_THROW(Invoke(owner, "transfer", alice + ",1"), uvm::core::UvmException); // not inited
+    BOOST_CHECK_THROW(Invoke(owner, "no_such_api", ""), uvm::core::UvmException);
+
+    Invoke(owner, "init", "");
+    BOOST_CHECK_THROW(Invoke(alice, "init_token", "test token,TTK,1000,2"), uvm::core::UvmException); // not the owner
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", "test token,TTK,1000"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", ",TTK,1000,2"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", "test token,TTK,-1000,2"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", "test token,TTK,0100,2"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", "test token,TTK,99999999999999999999,2"), uvm::core::UvmException);
+    BOOST_CHECK_EQUAL(Query("state"), "NOT_INITED");
+
+    Invoke(owner, "init_token", "test token,TTK,1000,2");
+    BOOST_CHECK_THROW(Invoke(owner, "init_token", "test token,TTK,1000,2"), uvm::core::UvmException); // inited before
+
+    BOOST_CHECK_THROW(Invoke(owner, "transfer", alice), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "transfer", "not an address,1"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "transfer", alice + ",0"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "transfer", alice + ",1001"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "approve", "not an address,1"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(owner, "approve", alice + ",x"), uvm::core::UvmException);
+
+    Invoke(owner, "approve", alice + ",100");
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", owner + "," + bob), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", "not an address," + bob + ",1"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", owner + ",not an address,1"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", owner + "," + bob + ",101"), uvm::core::UvmException);
+    BOOST_CHECK_THROW(Invoke(bob, "transferFrom", owner + "," + bob + ",1"), uvm::core::UvmException); // not approved
+
+    // none of the failed calls changed the balances
+    BOOST_CHECK_EQUAL(Query("balanceOf", owner), "1000");
+    BOOST_CHECK_EQUAL(Query("balanceOf", alice), "0");
+    BOOST_CHECK_EQUAL(Query("balanceOf", bob), "0");
+    BOOST_CHECK_EQUAL(Query("allowance", owner + "," + alice), "100");
+}
+
+BOOST_AUTO_TEST_CASE(token_transfer_from_checks_from_address)
+{
+    // callers aren't checked by the contract, so a token can be issued to an invalid address,
+    // but its balance can't be moved out with transferFrom
+    const std::string invalid_owner = "not an address";
+    Invoke(invalid_owner, "init", "");
+    Invoke(invalid_owner, "init_token", "test token,TTK,1000,2");
+    Invoke(invalid_owner, "approve", alice + ",100");
+    BOOST_CHECK_THROW(Invoke(alice, "transferFrom", invalid_owner + "," + bob + ",1"), uvm::core::UvmException);
+    BOOST_CHECK_EQUAL(Query("balanceOf", invalid_owner), "1000");
+    BOOST_CHECK_EQUAL(Query("balanceOf", bob), "0");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -252,6 +252,7 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
     // on mainnet.
     const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
     const Consensus::Params &mainnetParams = chainParams->GetConsensus();
+    const int nPeriod = mainnetParams.nMinerConfirmationWindow;
 
     // Use the TESTDUMMY deployment for testing purposes.
     int64_t bit = mainnetParams.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].bit;
@@ -271,12 +272,12 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
     // Before MedianTimePast of the chain has crossed nStartTime, the bit
     // should not be set.
     CBlockIndex *lastBlock = nullptr;
-    lastBlock = firstChain.Mine(2016, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    lastBlock = firstChain.Mine(nPeriod, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
     BOOST_CHECK_EQUAL(ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit), 0);
 
-    // Mine 2011 more blocks at the old time, and check that CBV isn't setting the bit yet.
-    for (int i=1; i<2012; i++) {
-        lastBlock = firstChain.Mine(2016+i, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    // Mine all but 5 blocks of the next period at the old time, and check that CBV isn't setting the bit yet.
+    for (int i=1; i<nPeriod-4; i++) {
+        lastBlock = firstChain.Mine(nPeriod+i, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
         // This works because VERSIONBITS_LAST_OLD_BLOCK_VERSION happens
         // to be 4, and the bit we're testing happens to be bit 28.
         BOOST_CHECK_EQUAL(ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit), 0);
@@ -284,13 +285,13 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
     // Now mine 5 more blocks at the start time -- MTP should not have passed yet, so
     // CBV should still not yet set the bit.
     nTime = nStartTime;
-    for (int i=2012; i<=2016; i++) {
-        lastBlock = firstChain.Mine(2016+i, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    for (int i=nPeriod-4; i<=nPeriod; i++) {
+        lastBlock = firstChain.Mine(nPeriod+i, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
         BOOST_CHECK_EQUAL(ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit), 0);
     }
 
     // Advance to the next period and transition to STARTED,
-    lastBlock = firstChain.Mine(6048, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    lastBlock = firstChain.Mine(3*nPeriod, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
     // so ComputeBlockVersion should now set the bit,
     BOOST_CHECK((ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit)) != 0);
     // and should also be using the VERSIONBITS_TOP_BITS.
@@ -298,8 +299,8 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
 
     // Check that ComputeBlockVersion will set the bit until nTimeout
     nTime += 600;
-    int blocksToMine = 4032; // test blocks for up to 2 time periods
-    int nHeight = 6048;
+    int blocksToMine = 2*nPeriod; // test blocks for up to 2 time periods
+    int nHeight = 3*nPeriod;
     // These blocks are all before nTimeout is reached.
     while (nTime < nTimeout && blocksToMine > 0) {
         lastBlock = firstChain.Mine(nHeight+1, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
@@ -313,7 +314,7 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
     nTime = nTimeout;
     // FAILED is only triggered at the end of a period, so CBV should be setting
     // the bit until the period transition.
-    for (int i=0; i<2015; i++) {
+    for (int i=0; i<nPeriod-1; i++) {
         lastBlock = firstChain.Mine(nHeight+1, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
         BOOST_CHECK((ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit)) != 0);
         nHeight += 1;
@@ -329,20 +330,20 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
 
     // Mine one period worth of blocks, and check that the bit will be on for the
     // next period.
-    lastBlock = secondChain.Mine(2016, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    lastBlock = secondChain.Mine(nPeriod, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
     BOOST_CHECK((ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit)) != 0);
 
     // Mine another period worth of blocks, signaling the new bit.
-    lastBlock = secondChain.Mine(4032, nTime, VERSIONBITS_TOP_BITS | (1<<bit)).Tip();
+    lastBlock = secondChain.Mine(2*nPeriod, nTime, VERSIONBITS_TOP_BITS | (1<<bit)).Tip();
     // After one period of setting the bit on each block, it should have locked in.
     // We keep setting the bit for one more period though, until activation.
     BOOST_CHECK((ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit)) != 0);
 
     // Now check that we keep mining the block until the end of this period, and
     // then stop at the beginning of the next period.
-    lastBlock = secondChain.Mine(6047, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    lastBlock = secondChain.Mine(3*nPeriod-1, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
     BOOST_CHECK((ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit)) != 0);
-    lastBlock = secondChain.Mine(6048, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
+    lastBlock = secondChain.Mine(3*nPeriod, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip();
     BOOST_CHECK_EQUAL(ComputeBlockVersion(lastBlock, mainnetParams) & (1<<bit), 0);
 
     // Finally, verify that after a soft fork has activated, CBV no longer uses
@@ -351,4 +352,62 @@ BOOST_AUTO_TEST_CASE(versionbits_computeblockversion)
 }
 
 
+BOOST_AUTO_TEST_CASE(versionbits_deployment_window)
+{
+    // Mainnet and testnet nodes have counted BIP9 signals in 200 block windows since the UBC
+    // fork's initial blocks, so the deployments must keep using that window on the whole chain.
+    const auto mainChainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& mainnetParams = mainChainParams->GetConsensus();
+    const auto testChainParams = CreateChainParams(CBaseChainParams::TESTNET);
+    const Consensus::Params& testnetParams = testChainParams->GetConsensus();
+    for (const Consensus::Params* params : {&mainnetParams, &testnetParams}) {
+        BOOST_CHECK_EQUAL(params->nMinerConfirmationWindow, 200U);
+        BOOST_CHECK_EQUAL(params->nRuleChangeActivationThreshold, 190U);
+        for (int nHeight : {0, params->UBCHeight + params->UBCInitBlockCount, params->ForkV1Height, params->UBCONTRACT_Height}) {
+            BOOST_CHECK_EQUAL(params->ForHeight(nHeight).nMinerConfirmationWindow, 200U);
+            BOOST_CHECK_EQUAL(params->ForHeight(nHeight).nRuleChangeActivationThreshold, 190U);
+        }
+    }
+
+    // mainnet CSV locks in after a window with 190 signalling blocks
+    {
+        VersionBitsCache cache;
+        VersionBitsTester chain;
+        int32_t nTime = mainnetParams.vDeployments[Consensus::DEPLOYMENT_CSV].nStartTime;
+        int32_t nVersion = VERSIONBITS_TOP_BITS | VersionBitsMask(mainnetParams, Consensus::DEPLOYMENT_CSV);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(200, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_STARTED);
+        chain.Mine(390, nTime, nVersion);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(400, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_LOCKED_IN);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(600, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_ACTIVE);
+        BOOST_CHECK_EQUAL(VersionBitsStateSinceHeight(chain.Tip(), mainnetParams, Consensus::DEPLOYMENT_CSV, cache), 600);
+    }
+
+    // mainnet SEGWIT stays started with one signalling block short of the threshold
+    {
+        VersionBitsCache cache;
+        VersionBitsTester chain;
+        int32_t nTime = mainnetParams.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nStartTime;
+        int32_t nVersion = VERSIONBITS_TOP_BITS | VersionBitsMask(mainnetParams, Consensus::DEPLOYMENT_SEGWIT);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(200, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_SEGWIT, cache), THRESHOLD_STARTED);
+        chain.Mine(389, nTime, nVersion);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(400, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_SEGWIT, cache), THRESHOLD_STARTED);
+        chain.Mine(590, nTime, nVersion);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(600, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_SEGWIT, cache), THRESHOLD_LOCKED_IN);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(800, nTime, VERSIONBITS_LAST_OLD_BLOCK_VERSION).Tip(), mainnetParams, Consensus::DEPLOYMENT_SEGWIT, cache), THRESHOLD_ACTIVE);
+    }
+
+    // testnet CSV has no start time, so signalling from genesis activates it at height 600, and SEGWIT is always active
+    {
+        VersionBitsCache cache;
+        VersionBitsTester chain;
+        int32_t nVersion = VERSIONBITS_TOP_BITS | VersionBitsMask(testnetParams, Consensus::DEPLOYMENT_CSV);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(200, TestTime(0), nVersion).Tip(), testnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_STARTED);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(400, TestTime(0), nVersion).Tip(), testnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_LOCKED_IN);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(599, TestTime(0), nVersion).Tip(), testnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_LOCKED_IN);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Mine(600, TestTime(0), nVersion).Tip(), testnetParams, Consensus::DEPLOYMENT_CSV, cache), THRESHOLD_ACTIVE);
+        BOOST_CHECK_EQUAL(VersionBitsStateSinceHeight(chain.Tip(), testnetParams, Consensus::DEPLOYMENT_CSV, cache), 600);
+        BOOST_CHECK_EQUAL(VersionBitsState(chain.Tip(), testnetParams, Consensus::DEPLOYMENT_SEGWIT, cache), THRESHOLD_ACTIVE);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
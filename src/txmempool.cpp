@@ -52,6 +52,19 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
+void CTxMemPoolEntry::UpdateContractExecResult(const std::shared_ptr<const ContractExecResult>& result, const uint256& hashTip)
+{
+    const size_t nResultUsage = result ? memusage::MallocUsage(sizeof(ContractExecResult)) + result->DynamicMemoryUsage() : 0;
+    if (nResultUsage > MAX_CONTRACT_EXEC_RESULT_USAGE) {
+        contractExecResult.reset();
+        hashContractExecTip.SetNull();
+    } else {
+        contractExecResult = result;
+        hashContractExecTip = hashTip;
+    }
+    nUsageSize = RecursiveDynamicUsage(tx) + (contractExecResult ? nResultUsage : 0);
+}
+
 size_t CTxMemPoolEntry::GetTxSize() const
 {
     return GetVirtualTransactionSize(nTxWeight, sigOpCost);
@@ -837,6 +850,14 @@ TxMempoolInfo CTxMemPool::info(const uint256& hash) const
     return GetInfo(i);
 }
 
+void CTxMemPool::UpdateContractExecResult(txiter it, const std::shared_ptr<const ContractExecResult>& result, const uint256& hashTip)
+{
+    AssertLockHeld(cs);
+    cachedInnerUsage -= it->DynamicMemoryUsage();
+    mapTx.modify(it, update_contract_exec_result(result, hashTip));
+    cachedInnerUsage += it->DynamicMemoryUsage();
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeDelta)
 {
     {
@@ -28,6 +28,7 @@
 #include <boost/signals2/signal.hpp>
 
 class CBlockIndex;
+struct ContractExecResult;
 
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
@@ -67,7 +68,7 @@ private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
     size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nUsageSize;         //!< ... and total memory usage
+    size_t nUsageSize;         //!< ... and total memory usage, including contractExecResult
     int64_t nTime;             //!< Local time when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
@@ -75,6 +76,8 @@ private:
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
     CAmount nMinGasPrice;      //!< The minimum gas price among the contract outputs of the tx
+    std::shared_ptr<const ContractExecResult> contractExecResult; //!< Outcome of the contract outputs executed on the contract state of hashContractExecTip
+    uint256 hashContractExecTip;
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -107,6 +110,8 @@ public:
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
     const CAmount& GetMinGasPrice() const { return nMinGasPrice; }
+    const std::shared_ptr<const ContractExecResult>& GetContractExecResult() const { return contractExecResult; }
+    const uint256& GetContractExecTip() const { return hashContractExecTip; }
 
     // Adjusts the descendant state.
     void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
@@ -117,6 +122,8 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Record the outcome of executing the contract outputs on top of hashTip, unless it is too large to keep
+    void UpdateContractExecResult(const std::shared_ptr<const ContractExecResult>& result, const uint256& hashTip);
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -164,6 +171,19 @@ struct update_ancestor_state
         int64_t modifySigOpsCost;
 };
 
+struct update_contract_exec_result
+{
+    update_contract_exec_result(const std::shared_ptr<const ContractExecResult>& _result, const uint256& _hashTip) :
+        result(_result), hashTip(_hashTip)
+    {}
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateContractExecResult(result, hashTip); }
+
+private:
+    std::shared_ptr<const ContractExecResult> result;
+    uint256 hashTip;
+};
+
 struct update_fee_delta
 {
     explicit update_fee_delta(int64_t _feeDelta) : feeDelta(_feeDelta) { }
@@ -611,6 +631,9 @@ public:
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
+    /** Keep the outcome of executing the contract outputs of an entry on top of hashTip, with its memory usage */
+    void UpdateContractExecResult(txiter it, const std::shared_ptr<const ContractExecResult>& result, const uint256& hashTip);
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256& hash, const CAmount& nFeeDelta);
     void ApplyDelta(const uint256 hash, CAmount &nFeeDelta) const;
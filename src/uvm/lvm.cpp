@@ -811,18 +811,27 @@ void luaV_finishOp(lua_State *L) {
 #define vmbreak		break
 
 
+/*
+** raw table lookup used by the table access opcodes. Contract code mostly
+** indexes with constant field names (short strings), so that case goes
+** straight to 'luaH_getshortstr' without the generic key-type dispatch.
+*/
+#define luaH_getbykey(t,k) \
+  (ttisshrstring(k) ? luaH_getshortstr(t, tsvalue(k)) : luaH_get(t, k))
+
+
 /*
 ** copy of 'luaV_gettable', but protecting call to potential metamethod
 ** (which can reallocate the stack)
 */
 #define gettableProtected(L,t,k,v)  { const TValue *aux; \
-  if (luaV_fastget(L,t,k,aux,luaH_get)) { setobj2s(L, v, aux); } \
+  if (luaV_fastget(L,t,k,aux,luaH_getbykey)) { setobj2s(L, v, aux); } \
     else Protect(luaV_finishget(L,t,k,v,aux)); }
 
 
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
-  if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
+  if (!luaV_fastset(L,t,k,slot,luaH_getbykey,v)) \
     Protect(luaV_finishset(L,t,k,v,slot)); }
 // FIXME: end duplicate code in uvm_lib.cpp
 
@@ -1292,8 +1301,18 @@ newframe:  /* reentry point when frame changes (call/return) */
                     vmbreak;
             }
             vmcase(UOP_LT) {
+                TValue *rb = RKB(i);
+                TValue *rc = RKC(i);
+                if (ttisinteger(rb) && ttisinteger(rc)) {
+                    /* integer fast path, no metamethod or stack change possible */
+                    if ((ivalue(rb) < ivalue(rc)) != GETARG_A(i))
+                        ci->u.l.savedpc++;
+                    else
+                        donextjump(ci);
+                    vmbreak;
+                }
                 Protect(
-                    if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
+                    if (luaV_lessthan(L, rb, rc) != GETARG_A(i))
                         ci->u.l.savedpc++;
                     else
                         donextjump(ci);
@@ -1301,8 +1320,17 @@ newframe:  /* reentry point when frame changes (call/return) */
                     vmbreak;
             }
             vmcase(UOP_LE) {
+                TValue *rb = RKB(i);
+                TValue *rc = RKC(i);
+                if (ttisinteger(rb) && ttisinteger(rc)) {
+                    if ((ivalue(rb) <= ivalue(rc)) != GETARG_A(i))
+                        ci->u.l.savedpc++;
+                    else
+                        donextjump(ci);
+                    vmbreak;
+                }
                 Protect(
-                    if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
+                    if (luaV_lessequal(L, rb, rc) != GETARG_A(i))
                         ci->u.l.savedpc++;
                     else
                         donextjump(ci);
@@ -87,18 +87,19 @@ namespace uvm
                 return &states_map;
             }
 
+            // lua states may run on several threads at once (eg. offline contract invokes), the value map
+            // of each state is only used by its own thread but the map of states is shared
             static std::mutex states_map_mutex;
 
             static L_V1 create_value_map_for_lua_state(lua_State *L)
             {
+                std::lock_guard<std::mutex> lock(states_map_mutex);
                 LStatesMap *states_map = get_lua_states_value_hashmap();
                 auto it = states_map->find(L);
                 if (it == states_map->end())
                 {
-                    states_map_mutex.lock();
                     L_V1 map = std::make_shared<L_VM1>();
                     states_map->insert(std::make_pair(L, map));
-                    states_map_mutex.unlock();
                     return map;
                 }
                 else
@@ -1263,6 +1264,7 @@ end
                         lua_free(L, stopped_pointer);
                     }
                     
+                    std::lock_guard<std::mutex> lock(states_map_mutex);
                     states_map->erase(L);
                 }
 
@@ -1274,11 +1276,13 @@ end
             */
             void close_all_lua_state_values()
             {
+                std::lock_guard<std::mutex> lock(states_map_mutex);
                 LStatesMap *states_map = get_lua_states_value_hashmap();
                 states_map->clear();
             }
             void close_lua_state_values(lua_State *L)
             {
+                std::lock_guard<std::mutex> lock(states_map_mutex);
                 LStatesMap *states_map = get_lua_states_value_hashmap();
                 states_map->erase(L);
             }
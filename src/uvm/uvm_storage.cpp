@@ -85,11 +85,9 @@ static struct UvmStorageValue get_last_storage_changed_value(lua_State *L, const
 
 		return value;
 	}
-	for (auto it = list->rbegin(); it != list->rend(); ++it)
-	{
-		if (it->contract_id == std::string(contract_id) && it->key == key && it->fast_map_key==fast_map_key && it->is_fast_map == is_fast_map)
-			return it->after;
-	}
+	const auto *last_change = list->find_latest(contract_id, key, fast_map_key, is_fast_map);
+	if (last_change)
+		return last_change->after;
 	auto value = global_uvm_chain_api->get_storage_value_from_uvm_by_address(L, contract_id, key, fast_map_key, is_fast_map);
 	post_when_read_table(value);
 	return value;
@@ -216,7 +214,7 @@ jsondiff::JsonValue uvm_storage_value_to_json(UvmStorageValue value)
 	}
 }
 
-UvmStorageValue json_to_uvm_storage_value(lua_State *L, jsondiff::JsonValue json_value)
+UvmStorageValue json_to_uvm_storage_value(lua_State *L, const jsondiff::JsonValue& json_value)
 {
 	UvmStorageValue value;
 	if (json_value.is_null())
@@ -251,7 +249,7 @@ UvmStorageValue json_to_uvm_storage_value(lua_State *L, jsondiff::JsonValue json
 	}
 	else if (json_value.is_array())
 	{
-		jsondiff::JsonArray json_array = json_value.as<jsondiff::JsonArray>();
+		const auto& json_array = json_value.get_array();
 		value.value.table_value = uvm::lua::lib::create_managed_lua_table_map(L);
 		if (json_array.empty())
 		{
@@ -292,7 +290,7 @@ UvmStorageValue json_to_uvm_storage_value(lua_State *L, jsondiff::JsonValue json
 	}
 	else if (json_value.is_object())
 	{
-		jsondiff::JsonObject json_map = json_value.as<jsondiff::JsonObject>();
+		const auto& json_map = json_value.get_object();
 		value.value.table_value = uvm::lua::lib::create_managed_lua_table_map(L);
 		if (json_map.size()<1)
 		{
@@ -937,9 +935,10 @@ namespace uvm {
 				if ((!lua_storage_is_table(before.type) || before.value.table_value->size() < 1) && after.value.table_value->size() > 0)
 				{
 					// if before table is empty and after table not empty, search type before
+					const std::string contract_id_str(contract_id);
 					for (auto it = list->begin(); it != list->end(); ++it)
 					{
-						if (it->contract_id == std::string(contract_id) && it->key == std::string(name) && it->fast_map_key==fast_map_key_str && it->is_fast_map==is_fast_map)
+						if (it->contract_id == contract_id_str && it->key == name_str && it->fast_map_key==fast_map_key_str && it->is_fast_map==is_fast_map)
 						{
 							if (lua_storage_is_table(it->after.type) && it->after.value.table_value->size() > 0)
 							{
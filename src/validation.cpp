@@ -18,6 +18,7 @@
 #include <fs.h>
 #include <hash.h>
 #include <init.h>
+#include <memusage.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -53,6 +54,8 @@
 #include <atomic>
 #include <sstream>
 #include <list>
+#include <deque>
+#include <mutex>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -175,7 +178,7 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const BlockHeaderPrecheck* pprecheck=nullptr);
     bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
@@ -200,6 +203,7 @@ public:
 
     void UnloadBlockIndex();
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
+    CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash);
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
@@ -557,11 +561,11 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
-static bool CheckAddContractTxToMempoolAvailable(const CTransaction& tx, CCoinsViewCache& view, CAmount& txMinGasPrice, std::string& error_out, std::string& short_error_out)
+static bool CheckAddContractTxToMempoolAvailable(const CTransaction& tx, CCoinsViewCache& view, CAmount& txMinGasPrice, std::string& error_out, std::string& short_error_out, std::shared_ptr<const ContractExecResult>* pexecResult = nullptr)
 {
 	if (!tx.HasContractOp())
 		return false;
-    ContractTxConverter converter(tx, &view, nullptr);
+    ContractTxConverter converter(tx, &view, chainActive.Height() + 1, nullptr);
     ExtractContractTX resultConvertContractTx;
     std::string error_ret;
     if (!converter.extractionContractTransactions(resultConvertContractTx, error_ret)) {
@@ -616,7 +620,7 @@ static bool CheckAddContractTxToMempoolAvailable(const CTransaction& tx, CCoinsV
     const auto& old_root_state_hash = service->current_root_state_hash();
     CBlock block;
     block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
-    ContractExec exec(service.get(), block, resultConvertContractTx.txs, hardBlockGasLimit, nTxFee);
+    ContractExec exec(service.get(), chainActive.Tip(), block, resultConvertContractTx.txs, hardBlockGasLimit, nTxFee);
     BOOST_SCOPE_EXIT_ALL(&) {
         service->rollback_contract_state(old_root_state_hash);
     };
@@ -658,6 +662,8 @@ static bool CheckAddContractTxToMempoolAvailable(const CTransaction& tx, CCoinsV
         short_error_out = "bad-contracttx-execution";
         return false;
     }
+    if (pexecResult)
+        *pexecResult = std::make_shared<const ContractExecResult>(std::move(testExecResult));
     return true;
 }
 
@@ -810,6 +816,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 
 		CAmount nValueOut = tx.GetValueOut();
 		CAmount txMinGasPrice = 0;
+		std::shared_ptr<const ContractExecResult> contractExecResult;
 
 		bool allow_contract = chainActive.Tip() && ((chainActive.Tip()->nHeight + 1) >= Params().GetConsensus().UBCONTRACT_Height);
 		if(!allow_contract && (tx.HasContractOp() || tx.HasOpSpend()))
@@ -818,7 +825,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 		if (tx.HasContractOp()) {
 			std::string error_out;
 			std::string short_error_out;
-			if (!CheckAddContractTxToMempoolAvailable(tx, view, txMinGasPrice, error_out, short_error_out)) {
+			if (!CheckAddContractTxToMempoolAvailable(tx, view, txMinGasPrice, error_out, short_error_out, &contractExecResult)) {
 				return state.DoS(100, error("AcceptContractTxToMempool(): %s", error_out.c_str()), REJECT_INVALID, short_error_out.c_str());
 			}
 		} else if(tx.HasOpSpend()) {
@@ -843,6 +850,8 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 
         CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
                               fSpendsCoinbase, nSigOpsCost, lp, txMinGasPrice);
+        if (contractExecResult)
+            entry.UpdateContractExecResult(contractExecResult, chainActive.Tip()->GetBlockHash());
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1908,6 +1917,125 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+bool CContractTxCheck::operator()() {
+    ContractTxConverter converter(*ptx, nullptr, nHeight, nullptr);
+    result->parsed = converter.parseContractTransactions(result->contract_tx, result->error);
+    return true;
+}
+
+static CCheckQueue<CContractTxCheck> contracttxcheckqueue(128);
+
+void ThreadContractTxCheck() {
+    RenameThread("bitcoin-contractch");
+    contracttxcheckqueue.Thread();
+}
+
+bool CContractExecCheck::operator()() {
+    for (const auto& item : vTxs) {
+        ContractSpeculativeExec& speculative = *item.second;
+        try {
+            ContractExec exec(snapshot.get(), pindexPrev, *pblock, item.first->txs, UINT64_MAX, speculative.nTxFee);
+            if (exec.performByteCode() && exec.pending_contract_exec_result.exit_code == 0) {
+                speculative.result = exec.pending_contract_exec_result;
+                speculative.fExecuted = true;
+            }
+        } catch (...) {
+            // the execution on the real state reports the error
+        }
+    }
+    return true;
+}
+
+static CCheckQueue<CContractExecCheck> contractexeccheckqueue(128);
+
+void ThreadContractExecCheck() {
+    RenameThread("bitcoin-contractex");
+    contractexeccheckqueue.Thread();
+}
+
+/**
+ * Execute the contract txs of a block in parallel, each on the contract state before the block.
+ * Every script check thread executes its share of the txs in block order on its own read-only
+ * snapshot. A result is only valid for ConnectBlock if no earlier tx of the block wrote a storage
+ * slot the execution read or wrote, which ConnectBlock checks when it reaches the tx.
+ */
+static std::vector<ContractSpeculativeExec> ExecuteBlockContractTxsSpeculatively(const CBlock& block, const CBlockIndex* pindexPrev, CCoinsViewCache& view, const std::vector<ContractTxPrecheck>& contract_prechecks, int nHeight)
+{
+    std::vector<ContractSpeculativeExec> speculative_execs(block.vtx.size());
+    std::vector<unsigned int> vContractTxs;
+    // the fee of a tx may be paid by outputs of earlier txs of the block
+    CCoinsViewCache viewBlock(&view);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const ContractTxPrecheck& precheck = contract_prechecks[i];
+        if (!tx.IsCoinBase() && tx.HasContractOp() && precheck.parsed && viewBlock.HaveInputs(tx)) {
+            CAmount nTxFee = viewBlock.GetValueIn(tx) - tx.GetValueOut();
+            for (const auto& withdrawInfo : precheck.contract_tx.contract_withdraw_infos)
+                nTxFee += withdrawInfo.amount;
+            for (const auto& ctx : precheck.contract_tx.txs)
+                nTxFee -= ctx.params.deposit_amount;
+            speculative_execs[i].nTxFee = nTxFee;
+            vContractTxs.push_back(i);
+        }
+        AddCoins(viewBlock, tx, nHeight, true);
+    }
+    if (vContractTxs.size() < 2)
+        return speculative_execs;
+
+    const size_t nChecks = std::min(vContractTxs.size(), (size_t)nScriptCheckThreads);
+    std::vector<CContractExecCheck> vChecks;
+    try {
+        for (size_t k = 0; k < nChecks; k++)
+            vChecks.emplace_back(block, pindexPrev, get_read_only_contract_storage_service());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: can't snapshot the contract storage: %s\n", __func__, e.what());
+        return speculative_execs;
+    }
+    for (size_t k = 0; k < vContractTxs.size(); k++) {
+        const unsigned int i = vContractTxs[k];
+        vChecks[k % nChecks].Add(&contract_prechecks[i].contract_tx, &speculative_execs[i]);
+    }
+    CCheckQueueControl<CContractExecCheck> control(&contractexeccheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    return speculative_execs;
+}
+
+bool CHeaderCheck::operator()() {
+    for (size_t i = 0; i < nCount; i++) {
+        presults[i].hash = pheaders[i].GetHash();
+        presults[i].fPowTarget = !pheaders[i].IsProofOfStake() && CheckProofOfWorkTarget(presults[i].hash, pheaders[i].nBits, *pparams);
+    }
+    return true;
+}
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(128);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcoin-headerch");
+    headercheckqueue.Thread();
+}
+
+/** Headers hashed by one CHeaderCheck, a headers message is split into a few dozen of them */
+static const size_t HEADER_CHECK_BATCH = 64;
+
+std::vector<BlockHeaderPrecheck> PrecheckBlockHeaders(const std::vector<CBlockHeader>& headers, const Consensus::Params& params)
+{
+    std::vector<BlockHeaderPrecheck> prechecks(headers.size());
+    std::vector<CHeaderCheck> vChecks;
+    for (size_t i = 0; i < headers.size(); i += HEADER_CHECK_BATCH)
+        vChecks.emplace_back(&headers[i], &prechecks[i], std::min(HEADER_CHECK_BATCH, headers.size() - i), params);
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (auto& check : vChecks)
+            check();
+    }
+    return prechecks;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params, uint32_t miningType)
@@ -2098,12 +2226,80 @@ else \
 
 using uvm::lua::api::global_uvm_chain_api;
 
-bool ContractExec::performByteCode()
+namespace {
+
+/**
+ * Results of successful contract executions. A contract transaction is executed when it
+ * enters the mempool, again when the miner adds it to a template, in TestBlockValidity
+ * and in ConnectBlock. Contracts can only read the contract state and the chain tip,
+ * so a result is reused when the same transaction runs on the same contract state root
+ * on top of the same tip.
+ */
+class CContractExecResultCache
 {
-    if(!global_uvm_chain_api)
+private:
+    CCriticalSection cs;
+    std::map<uint256, ContractExecResult> results;
+    std::deque<uint256> insertion_order;
+
+public:
+    bool Get(const uint256& key, ContractExecResult& result)
     {
-        global_uvm_chain_api = new uvm::lua::api::BtcUvmChainApi();
+        LOCK(cs);
+        auto it = results.find(key);
+        if (it == results.end())
+            return false;
+        result = it->second;
+        return true;
     }
+
+    void Put(const uint256& key, const ContractExecResult& result)
+    {
+        LOCK(cs);
+        if (!results.emplace(key, result).second)
+            return;
+        insertion_order.push_back(key);
+        while (insertion_order.size() > MAX_CONTRACT_EXEC_RESULT_CACHE_SIZE) {
+            results.erase(insertion_order.front());
+            insertion_order.pop_front();
+        }
+    }
+};
+
+CContractExecResultCache contractExecResultCache;
+
+} // anon namespace
+
+uint256 ContractExec::exec_result_cache_key() const
+{
+    // offline invocations don't have a transaction to identify them
+    if (txs.empty() || txs[0].tx_id.IsNull() || !storage_service)
+        return uint256();
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txs[0].tx_id << (uint64_t) txs.size() << storage_service->current_root_state_hash() << pindexTip->GetBlockHash() << nTxFee;
+    return ss.GetHash();
+}
+
+bool ContractExec::performByteCode()
+{
+    const uint256 cache_key = exec_result_cache_key();
+    if (!cache_key.IsNull() && contractExecResultCache.Get(cache_key, pending_contract_exec_result))
+        return true;
+    if (!executeByteCode())
+        return false;
+    if (!cache_key.IsNull())
+        contractExecResultCache.Put(cache_key, pending_contract_exec_result);
+    return true;
+}
+
+bool ContractExec::executeByteCode()
+{
+    // contracts run on several threads at once, for the txs of a block and for offline invocations
+    static std::once_flag chain_api_init_flag;
+    std::call_once(chain_api_init_flag, [] {
+        if(!global_uvm_chain_api)
+            global_uvm_chain_api = new uvm::lua::api::BtcUvmChainApi();
+    });
     for(ContractTransaction &tx : txs)
     {
         blockchain::contract_engine::ContractEngineBuilder engine_builder;
@@ -2124,7 +2320,7 @@ bool ContractExec::performByteCode()
 
 		blockchain::contract::native_contract_sender sender;
 		sender.caller_address = caller_address;
-		sender.block_number = chainActive.Height();
+		sender.block_number = pindexTip->nHeight;
 
         engine_builder.set_caller(caller, caller_address);
         auto engine = engine_builder.build();
@@ -2137,6 +2333,7 @@ bool ContractExec::performByteCode()
         pending_state.tx_id = tx.tx_id;
         pending_state.nTxFee = nTxFee;
 		pending_state.origin_opcode = tx.opcode;
+		pending_state.pindexTip = pindexTip;
 		std::shared_ptr<blockchain::contract::abstract_native_contract> native_contract_info;
 
 		if (OP_CREATE == tx.opcode)
@@ -2174,6 +2371,10 @@ bool ContractExec::performByteCode()
 
 		engine->set_state_pointer_value("evaluator", &pending_state);
 		engine->set_state_pointer_value("storage_service", storage_service);
+		if (OP_CREATE != tx.opcode && OP_CREATE_NATIVE != tx.opcode)
+			pending_state.record_storage_read(params.contract_address, std::string());
+		if (OP_UPGRADE == tx.opcode)
+			pending_state.record_storage_read(std::string(), params.contract_name);
 
         if(OP_CREATE == tx.opcode) {
             try {
@@ -2189,7 +2390,7 @@ bool ContractExec::performByteCode()
 		else if (OP_CREATE_NATIVE == tx.opcode) {
 			try {
 				is_native_contract_exec = true;
-				const CAmount gas_needed = DEFAULT_MIN_GAS_COUNT;
+				const CAmount gas_needed = native_contract_info->gas_count_for_api_invoke("init");
 				const auto& exec_result = native_contract_info->invoke("init", params.api_arg);
 				pending_state.contract_storage_changes = exec_result.contract_storage_changes;
 				pending_state.balance_changes = exec_result.balance_changes;
@@ -2230,7 +2431,7 @@ bool ContractExec::performByteCode()
 						auto error_str = std::string("Can't find native contract template ") + contract_info->contract_template_key;
 						throw uvm::core::UvmException(error_str.c_str());
 					}
-					const CAmount gas_needed = DEFAULT_MIN_GAS_COUNT;
+					const CAmount gas_needed = native_contract_info->gas_count_for_api_invoke(params.api_name);
 					const auto& exec_result = native_contract_info->invoke(params.api_name, params.api_arg);
 					pending_state.contract_storage_changes = exec_result.contract_storage_changes;
 					pending_state.balance_changes = exec_result.balance_changes;
@@ -2277,7 +2478,7 @@ bool ContractExec::performByteCode()
 							auto error_str = std::string("Can't find native contract template ") + contract_info->contract_template_key;
 							throw uvm::core::UvmException(error_str.c_str());
 						}
-						const CAmount gas_needed = DEFAULT_MIN_GAS_COUNT;
+						const CAmount gas_needed = native_contract_info->gas_count_for_api_invoke("on_upgrade");
 						const auto& exec_result = native_contract_info->invoke("on_upgrade", params.api_arg);
 						pending_state.contract_storage_changes = exec_result.contract_storage_changes;
 						pending_state.balance_changes = exec_result.balance_changes;
@@ -2319,7 +2520,7 @@ bool ContractExec::performByteCode()
 							auto error_str = std::string("Can't find native contract template ") + contract_info->contract_template_key;
 							throw uvm::core::UvmException(error_str.c_str());
 						}
-						const CAmount gas_needed = DEFAULT_MIN_GAS_COUNT;
+						const CAmount gas_needed = native_contract_info->gas_count_for_api_invoke("on_deposit");
 						const auto& exec_result = native_contract_info->invoke("on_deposit", params.api_arg);
 						pending_state.contract_storage_changes = exec_result.contract_storage_changes;
 						pending_state.balance_changes = exec_result.balance_changes;
@@ -2347,6 +2548,27 @@ bool ContractExec::performByteCode()
         }
 
 		pending_contract_exec_result.contract_storage_changes = pending_state.contract_storage_changes;
+		for (const auto& slot : pending_state.storage_reads)
+			pending_contract_exec_result.storage_read_set.insert(slot);
+		for (const auto& p : pending_state.contract_storage_changes) {
+			if (!p.second || p.second->is_undefined())
+				continue;
+			const auto& changes_json = p.second->value();
+			if (!changes_json.is_object())
+				continue;
+			for (const auto& item : changes_json.as<jsondiff::JsonObject>())
+				pending_contract_exec_result.storage_write_set.insert(std::make_pair(p.first, item.key()));
+		}
+		for (const auto& balance_change : pending_state.balance_changes) {
+			if (balance_change.is_contract)
+				pending_contract_exec_result.storage_write_set.insert(std::make_pair(balance_change.address, std::string()));
+		}
+		for (const auto& upgrade_info : pending_state.contract_upgrade_infos) {
+			pending_contract_exec_result.storage_write_set.insert(std::make_pair(upgrade_info.address, std::string()));
+			pending_contract_exec_result.storage_write_set.insert(std::make_pair(std::string(), upgrade_info.name));
+		}
+		for (const auto& p : pending_state.pending_contracts_to_create)
+			pending_contract_exec_result.storage_write_set.insert(std::make_pair(p.first, std::string()));
         pending_contract_exec_result.balance_changes = pending_state.balance_changes;
         pending_contract_exec_result.contract_upgrade_infos = pending_state.contract_upgrade_infos;
 		pending_contract_exec_result.events = pending_state.events;
@@ -2395,7 +2617,7 @@ bool ContractExec::commit_changes(std::shared_ptr<::contract::storage::ContractS
 		new_contract_info_to_commit->version = con_tx.params.version;
 		::blockchain::contract::native_contract_sender sender;
 		sender.caller_address = con_tx.params.caller_address;
-		sender.block_number = chainActive.Height();
+		sender.block_number = pindexTip->nHeight;
 		if(new_contract_info_to_commit->is_native) {
 		    new_contract_info_to_commit->contract_template_key = con_tx.params.template_name;
 			const auto& native_contract_info = blockchain::contract::native_contract_finder::create_native_contract_by_key(nullptr, con_tx.params.template_name, con_tx.params.contract_address, sender);
@@ -2493,6 +2715,10 @@ bool ContractExec::commit_changes(std::shared_ptr<::contract::storage::ContractS
 }
 
 bool ContractTxConverter::extractionContractTransactions(ExtractContractTX& contractTx, std::string& error_ret) {
+    return parseContractTransactions(contractTx, error_ret) && checkContractCallers(contractTx, error_ret);
+}
+
+bool ContractTxConverter::parseContractTransactions(ExtractContractTX& contractTx, std::string& error_ret) {
     std::vector<ContractTransaction> resultTX;
     std::vector<ContractTransactionParams> resultETP;
     size_t contract_op_count = 0;
@@ -2507,7 +2733,7 @@ bool ContractTxConverter::extractionContractTransactions(ExtractContractTX& cont
             contract_op_count++;
             if(receiveStack(txBitcoin.vout[i].scriptPubKey)){
                 ContractTransactionParams params;
-                if(parseContractTXParams(params, i, error_ret)){
+                if(parseContractTXParams(params, i, contractTx.callers_to_check, error_ret)){
                     resultTX.push_back(createContractTX(params, i));
                     resultETP.push_back(params);
                 }else{
@@ -2524,7 +2750,7 @@ bool ContractTxConverter::extractionContractTransactions(ExtractContractTX& cont
             // get withdraw from contract balance info
             if(receiveStack(txBitcoin.vout[i].scriptPubKey)){
                 ContractTransactionParams params;
-                if(parseContractTXParams(params, i, error_ret)){
+                if(parseContractTXParams(params, i, contractTx.callers_to_check, error_ret)){
                     ContractWithdrawInfo withdrawInfo;
                     withdrawInfo.from_contract_address = params.withdraw_from_contract_address;
                     withdrawInfo.amount = params.withdraw_amount;
@@ -2652,7 +2878,40 @@ bool ContractTransaction::is_params_valid(std::shared_ptr<::contract::storage::C
 	return true;
 }
 
-bool ContractTxConverter::parseContractTXParams(ContractTransactionParams& params, size_t contract_op_vout_index, std::string& error_ret) {
+bool ContractTxConverter::checkContractCallers(const ExtractContractTX& contractTx, std::string& error_ret) {
+    if (contractTx.callers_to_check.empty())
+        return true;
+    // check caller_address in vin owners(signed in tx). must be same with first input's address
+    std::string sender_address;
+    if (view)
+    {
+        Coin first_coin;
+        const auto& first_vin = txBitcoin.vin[0];
+        view->GetCoin(first_vin.prevout, first_coin);
+        const auto& first_coin_script_pub_key = first_coin.out.scriptPubKey;
+        CTxDestination first_vin_address;
+        bool fValidAddress = ExtractDestination(first_coin_script_pub_key, first_vin_address);
+
+        if (!fValidAddress) {
+            error_ret = "invalid first voin address format";
+            return false;
+        }
+        sender_address = EncodeDestination(first_vin_address);
+    }
+    else
+    {
+        sender_address = GetSenderAddress(txBitcoin, view, blockTransactions);
+    }
+    for (const auto& caller_address : contractTx.callers_to_check) {
+        if (sender_address != caller_address) {
+            error_ret = "first vin address not match with contract caller_address";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ContractTxConverter::parseContractTXParams(ContractTransactionParams& params, size_t contract_op_vout_index, std::vector<std::string>& callers_to_check, std::string& error_ret) {
     try{
         uint64_t gasLimit = 0;
         uint64_t gasPrice = 0;
@@ -2826,36 +3085,11 @@ bool ContractTxConverter::parseContractTXParams(ContractTransactionParams& param
             params.withdraw_from_contract_address = ValtypeUtils::vch_to_string(withdraw_from_contract_address);
         }
 
-        // check caller_address in vin owners(signed in tx). must be same with first input's address
+        // the caller_address is checked against the first input's address by checkContractCallers
 		if (txBitcoin.vin.empty())
 			return false;
 		if (!ignore_sender_check)
-		{
-			std::string sender_address;
-			if (view)
-			{
-				Coin first_coin;
-				const auto& first_vin = txBitcoin.vin[0];
-				view->GetCoin(first_vin.prevout, first_coin);
-				const auto& first_coin_script_pub_key = first_coin.out.scriptPubKey;
-				CTxDestination first_vin_address;
-				bool fValidAddress = ExtractDestination(first_coin_script_pub_key, first_vin_address);
-
-				if (!fValidAddress) {
-				    error_ret = "invalid first voin address format";
-                    return false;
-                }
-				sender_address = EncodeDestination(first_vin_address);
-			}
-			else
-			{
-				sender_address = GetSenderAddress(txBitcoin, view, blockTransactions);
-			}
-			if (sender_address != params.caller_address) {
-				error_ret = "first vin address not match with contract caller_address";
-				return false;
-			}
-		}
+			callers_to_check.push_back(params.caller_address);
 
         params.caller = "";
         params.api_name = ValtypeUtils::vch_to_string(api_name);
@@ -2883,7 +3117,7 @@ bool ContractTxConverter::parseContractTXParams(ContractTransactionParams& param
         } else if(template_name.size() > 0 && is_create) {
             params.is_native = true;
             params.template_name = ValtypeUtils::vch_to_string(template_name);
-			if (!blockchain::contract::native_contract_finder::has_native_contract_with_key(params.template_name)) {
+			if (!blockchain::contract::native_contract_finder::has_native_contract_with_key(params.template_name, nHeight)) {
 				error_ret = "invalid contract template";
 				LogPrintf("can't find native contract template %s\n", params.template_name.c_str());
 				return false;
@@ -2963,6 +3197,48 @@ bool ContractExecResult::match_contract_withdraw_infos(const std::vector<Contrac
     return true;
 }
 
+bool ContractExecResult::conflicts_with(const std::set<ContractStorageSlot>& written_slots) const
+{
+	if (written_slots.empty())
+		return false;
+	for (const auto& slot : storage_read_set) {
+		if (written_slots.find(slot) != written_slots.end())
+			return true;
+	}
+	for (const auto& slot : storage_write_set) {
+		if (written_slots.find(slot) != written_slots.end())
+			return true;
+	}
+	return false;
+}
+
+size_t ContractExecResult::DynamicMemoryUsage() const
+{
+	size_t usage = error_message.capacity() + api_result.capacity();
+	usage += memusage::DynamicUsage(contract_storage_changes);
+	for (const auto& changes : contract_storage_changes) {
+		usage += changes.first.capacity();
+		if (changes.second)
+			usage += memusage::DynamicUsage(changes.second) + changes.second->str().size();
+	}
+	usage += memusage::DynamicUsage(balance_changes);
+	for (const auto& transfer : balance_changes)
+		usage += transfer.address.capacity();
+	usage += memusage::DynamicUsage(contract_upgrade_infos);
+	for (const auto& info : contract_upgrade_infos)
+		usage += info.address.capacity() + info.name.capacity() + info.description.capacity();
+	usage += memusage::DynamicUsage(events);
+	for (const auto& event : events)
+		usage += event.transaction_id.capacity() + event.contract_id.capacity() + event.event_name.capacity() + event.event_arg.capacity();
+	usage += memusage::DynamicUsage(dgp_int_params_changes);
+	usage += memusage::DynamicUsage(storage_read_set) + memusage::DynamicUsage(storage_write_set);
+	for (const auto& slot : storage_read_set)
+		usage += slot.first.capacity() + slot.second.capacity();
+	for (const auto& slot : storage_write_set)
+		usage += slot.first.capacity() + slot.second.capacity();
+	return usage;
+}
+
 void ContractExecResult::clear() {
 	*this = ContractExecResult();
 }
@@ -2977,6 +3253,24 @@ std::shared_ptr<::contract::storage::ContractStorageService> get_contract_storag
 	return service;
 }
 
+std::shared_ptr<::contract::storage::ContractStorageService> get_contract_storage_overlay()
+{
+	fs::path storage_db_path = GetDataDir() / CONTRACT_STORAGE_DB_PATH;
+	fs::path storage_sql_db_path = GetDataDir() / CONTRACT_STORAGE_SQL_DB_PATH;
+	auto service = ::contract::storage::ContractStorageService::get_overlay_instance(CONTRACT_STORAGE_MAGIC_NUMBER, storage_db_path.string(), storage_sql_db_path.string());
+	service->set_current_block_height(chainActive.Height());
+	return service;
+}
+
+std::shared_ptr<::contract::storage::ContractStorageService> get_read_only_contract_storage_service()
+{
+    AssertLockHeld(cs_main);
+	fs::path storage_db_path = GetDataDir() / CONTRACT_STORAGE_DB_PATH;
+	fs::path storage_sql_db_path = GetDataDir() / CONTRACT_STORAGE_SQL_DB_PATH;
+	// the block height is only used to hash new commits, which a read-only snapshot can't make
+	return ::contract::storage::ContractStorageService::get_read_only_snapshot(CONTRACT_STORAGE_MAGIC_NUMBER, storage_db_path.string(), storage_sql_db_path.string());
+}
+
 std::shared_ptr<std::string> get_root_state_hash_from_block(const CBlock* block) {
     if(block->vtx.empty())
         return nullptr;
@@ -3150,6 +3444,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
 
     uint64_t blockGasUsed = 0;
+    // storage slots written by contract txs connected so far, a speculative execution
+    // result is only taken when it touched none of them
+    std::set<ContractStorageSlot> block_contract_write_set;
+    unsigned int nContractTxs = 0;
+    unsigned int nSpeculativeContractTxs = 0;
 	CBlockIndex* pindexPrev = chainActive.Tip();
 	auto nHeight = pindexPrev->nHeight + 1;
 
@@ -3159,14 +3458,16 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     std::shared_ptr<::contract::storage::ContractStorageService> service;
     std::string old_root_state_hash_before_connect_block;
     if(allow_contract) {
-        service = get_contract_storage_service();
+        // when only checking the block (TestBlockValidity) contract changes go to a private in-memory
+        // overlay which is dropped with it, so nothing is committed to and rolled back from disk
+        service = fJustCheck ? get_contract_storage_overlay() : get_contract_storage_service();
         service->open();
         old_root_state_hash_before_connect_block = service->current_root_state_hash();
     }
     bool success_connect_block = false;
     bool rollbacked = false;
     BOOST_SCOPE_EXIT_ALL(&) {
-        if(allow_contract && !rollbacked && !success_connect_block) {
+        if(allow_contract && !fJustCheck && !rollbacked && !success_connect_block) {
             service->rollback_contract_state(old_root_state_hash_before_connect_block);
         }
     };
@@ -3236,6 +3537,37 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 	    
 	    
     }
+
+    // Parsing the contract outputs doesn't depend on the coins view or the contract state,
+    // so it is done for all contract txs of the block up front, on the script check threads.
+    // The caller check and the params check still run in order in the loop below.
+    std::vector<ContractTxPrecheck> contract_prechecks;
+    if (allow_contract) {
+        contract_prechecks.resize(block.vtx.size());
+        std::vector<CContractTxCheck> vContractChecks;
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            if (block.vtx[i]->HasContractOp())
+                vContractChecks.emplace_back(*block.vtx[i], pindex->nHeight, &contract_prechecks[i]);
+        }
+        if (nScriptCheckThreads && vContractChecks.size() > 1) {
+            CCheckQueueControl<CContractTxCheck> contract_control(&contracttxcheckqueue);
+            contract_control.Add(vContractChecks);
+            contract_control.Wait();
+        } else {
+            for (auto& check : vContractChecks)
+                check();
+        }
+    }
+
+    // Contract txs are executed up front, in parallel, on the contract state before the block.
+    // The loop below still checks and commits them one by one in block order, and takes a result
+    // only when the tx touched no storage slot an earlier tx of the block wrote, else it executes
+    // the tx again on the current state. A pending reset of the root state hash makes the state
+    // before the block differ from what the first commit sees, so nothing is executed then.
+    std::vector<ContractSpeculativeExec> contract_speculative_execs;
+    if (allow_contract && nScriptCheckThreads && service->is_latest())
+        contract_speculative_execs = ExecuteBlockContractTxsSpeculatively(block, pindexPrev, view, contract_prechecks, pindex->nHeight);
+
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -3307,10 +3639,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         if(allow_contract) {
             uint64_t blockGasLimit = UINT64_MAX;
             if (tx.HasContractOp()) {
-                ContractTxConverter converter(tx, &view, &block.vtx);
-                ExtractContractTX resultConvertContractTx;
-                std::string error_ret;
-                if (!converter.extractionContractTransactions(resultConvertContractTx, error_ret)) {
+                ContractTxConverter converter(tx, &view, pindex->nHeight, &block.vtx);
+                ContractTxPrecheck& precheck = contract_prechecks[i];
+                ExtractContractTX& resultConvertContractTx = precheck.contract_tx;
+                std::string error_ret = precheck.error;
+                if (!precheck.parsed || !converter.checkContractCallers(resultConvertContractTx, error_ret)) {
                     return state.DoS(100, error("ConnectBlock(): Contract transaction of the wrong format %s", error_ret.c_str()),
                                      REJECT_INVALID, "bad-tx-bad-contract-format");
                 }
@@ -3332,14 +3665,23 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                     gasAllTxs += ctx.params.gasLimit;
                 }
 
-                ContractExec exec(service.get(), block, resultConvertContractTx.txs, blockGasLimit, nTxFee);
+                ContractExec exec(service.get(), pindexPrev, block, resultConvertContractTx.txs, blockGasLimit, nTxFee);
                 const auto &old_root_hash = service->current_root_state_hash();
                 bool success = false;
                 BOOST_SCOPE_EXIT_ALL(service, &old_root_hash, &success) {
                     if (!success)
                         service->rollback_contract_state(old_root_hash);
                 };
-                auto execRes = exec.performByteCode();
+                const ContractSpeculativeExec* speculative_exec = contract_speculative_execs.empty() ? nullptr : &contract_speculative_execs[i];
+                bool execRes;
+                if (speculative_exec && speculative_exec->fExecuted && speculative_exec->nTxFee == nTxFee
+                    && !speculative_exec->result.conflicts_with(block_contract_write_set)) {
+                    exec.pending_contract_exec_result = speculative_exec->result;
+                    execRes = true;
+                    nSpeculativeContractTxs++;
+                } else {
+                    execRes = exec.performByteCode();
+                }
                 if (!execRes) {
                     return state.DoS(100,
                                      error("ConnectBlock(): exec bytecode error"),
@@ -3358,6 +3700,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 						REJECT_INVALID, exec.pending_contract_exec_result.error_message);
 				}
 
+                nContractTxs++;
+                block_contract_write_set.insert(contract_exec_result.storage_write_set.begin(), contract_exec_result.storage_write_set.end());
+
                 blockGasUsed += contract_exec_result.usedGas;
                 if (blockGasUsed > blockGasLimit) {
                     return state.DoS(1000, error("ConnectBlock(): Block exceeds gas limit"), REJECT_INVALID,
@@ -3383,6 +3728,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    if (nContractTxs > 0)
+        LogPrint(BCLog::BENCH, "      - Contract txs: %u, results taken from parallel execution: %u\n", nContractTxs, nSpeculativeContractTxs);
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
@@ -4219,9 +4566,13 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
 }
 
 CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
+{
+    return AddToBlockIndex(block, block.GetHash());
+}
+
+CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -4389,14 +4740,16 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, const BlockHeaderPrecheck* pprecheck = nullptr)
 {
     // Check proof of work matches claimed amount
 	if(fCheckPOW)
 	{
 		if (!block.IsProofOfStake()) 
 		{
-            if (!CheckProofOfWork(block.GetHash(), block.hashPrevBlock, block.nBits, consensusParams))
+            // only a header missing its target is looked up, it may be exempt by its height
+            if (!(pprecheck && pprecheck->fPowTarget) &&
+                !CheckProofOfWork(pprecheck ? pprecheck->hash : block.GetHash(), block.hashPrevBlock, block.nBits, consensusParams))
                 return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
         }
 		else 
@@ -4813,11 +5166,11 @@ bool ContextualCheckTransactionForCurrentBlock(
                                       nBlockHeight, nLockTimeCutoff);
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const BlockHeaderPrecheck* pprecheck)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = pprecheck ? pprecheck->hash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -4832,7 +5185,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, pprecheck))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -4862,7 +5215,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -4872,11 +5225,11 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
-bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const BlockHeaderPrecheck* pprecheck)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = pprecheck ? pprecheck->hash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -4891,7 +5244,7 @@ bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, co
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, pprecheck))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -4907,17 +5260,17 @@ bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, co
     }
 
     if (pindex == nullptr)
-        pindex = g_chainstate.AddToBlockIndex(block);
+        pindex = g_chainstate.AddToBlockIndex(block, hash);
     return true;
 }
 
-int GetRightBestHeader(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
+int GetRightBestHeader(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, const std::vector<BlockHeaderPrecheck>* prechecks)
 {
     LOCK(cs_main);
     int i;
     for (i = 0; i < (int)headers.size(); ++i) {
         CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-        if (!TryAcceptBlockHeader(headers[i], state, chainparams, &pindex)) {
+        if (!TryAcceptBlockHeader(headers[i], state, chainparams, &pindex, prechecks ? &(*prechecks)[i] : nullptr)) {
             break;
         }
     }
@@ -4926,14 +5279,15 @@ int GetRightBestHeader(const std::vector<CBlockHeader>& headers, CValidationStat
 
 
 // Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid, const std::vector<BlockHeaderPrecheck>* prechecks)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, prechecks ? &(*prechecks)[i] : nullptr)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
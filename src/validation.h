@@ -52,6 +52,7 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+struct BlockHeaderPrecheck;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -68,6 +69,15 @@ static const uint32_t DEPOSIT_TO_CONTRACT_MEMO_MAX_LENGTH = 128;
 
 static const uint32_t CONTRACT_STORAGE_MAGIC_NUMBER = 34125;
 
+/** Default for -contractsqlwal */
+static const bool DEFAULT_CONTRACT_SQL_WAL = false;
+
+/** Maximum number of successful contract executions kept for reuse between mempool, miner and block validation */
+static const unsigned int MAX_CONTRACT_EXEC_RESULT_CACHE_SIZE = 1000;
+
+/** Maximum memory usage of a contract execution outcome kept with its mempool entry, larger ones are executed again */
+static const size_t MAX_CONTRACT_EXEC_RESULT_USAGE = 100000;
+
 /** Default for -whitelistrelay. */
 static const bool DEFAULT_WHITELISTRELAY = true;
 /** Default for -whitelistforcerelay. */
@@ -273,8 +283,16 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  * @param[in]  chainparams The params for the chain we want to connect to
  * @param[out] ppindex If set, the pointer will be set to point to the last new block index object for the given headers
  * @param[out] first_invalid First header that fails validation, if one exists
+ * @param[in]  prechecks If set, the results of PrecheckBlockHeaders for the headers
+ */
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr, const std::vector<BlockHeaderPrecheck>* prechecks=nullptr);
+
+/**
+ * Hash a batch of headers and check their proof of work targets on the header check threads.
+ * It needs no chain state, so it is done before cs_main is taken; the results can be passed to
+ * GetRightBestHeader and ProcessNewBlockHeaders for the same headers.
  */
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+std::vector<BlockHeaderPrecheck> PrecheckBlockHeaders(const std::vector<CBlockHeader>& headers, const Consensus::Params& params);
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -295,6 +313,12 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the contract transaction parsing thread */
+void ThreadContractTxCheck();
+/** Run an instance of the block contract transaction execution thread */
+void ThreadContractExecCheck();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -305,8 +329,8 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 /** Guess verification progress (as a fraction between 0.0=genesis and 1.0=current tip). */
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex* pindex);
-bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
-int GetRightBestHeader(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex);
+bool TryAcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const BlockHeaderPrecheck* pprecheck=nullptr);
+int GetRightBestHeader(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, const std::vector<BlockHeaderPrecheck>* prechecks=nullptr);
 
 /** Calculate the amount of disk space the block & undo files currently use */
 uint64_t CalculateCurrentUsage();
@@ -629,6 +653,7 @@ struct ExtractContractTX {
     std::vector<ContractTransaction> txs;
     std::vector<ContractTransactionParams> txs_params;
     std::vector<ContractWithdrawInfo> contract_withdraw_infos;
+    std::vector<std::string> callers_to_check; // caller addresses that must be the address of the tx's first input
 };
 
 struct ContractResultTransferInfo {
@@ -640,6 +665,10 @@ struct ContractResultTransferInfo {
 
 typedef jsondiff::DiffResultP StorageChanges;
 
+// (contract_id, storage key) touched by a contract execution.
+// an empty storage key stands for the contract's balance and info
+typedef std::pair<std::string, std::string> ContractStorageSlot;
+
 // FIXME: not use it now
 // contract execute result for uvm
 struct ResultExecute {
@@ -672,42 +701,169 @@ struct ContractExecResult {
 
 	std::map<DgpChangeIntParamType, int64_t> dgp_int_params_changes; // changes of dgp params. not all native dgp contracts will change chain's dgp params.
 
+	std::set<ContractStorageSlot> storage_read_set; // storage slots read from the storage service
+	std::set<ContractStorageSlot> storage_write_set; // storage slots changed by this execution
+
   bool match_contract_withdraw_infos(const std::vector<ContractWithdrawInfo> withdraw_infos) const;
 
+	// whether this execution read or wrote any of the slots in written_slots,
+	// ie. its result may differ if it ran before the executions that wrote them
+	bool conflicts_with(const std::set<ContractStorageSlot>& written_slots) const;
+
+	// estimated heap usage, the storage changes count with the size of their json
+	size_t DynamicMemoryUsage() const;
+
 	void clear();
 };
 
 class ContractTxConverter {
 public:
-    ContractTxConverter(CTransaction tx, CCoinsViewCache *v, const std::vector<CTransactionRef>* blockTxs=nullptr, bool _ignore_sender_check=false)
-            : txBitcoin(tx), view(v), blockTransactions(blockTxs), ignore_sender_check(_ignore_sender_check)
+    // nHeight is the height of the block the transaction is included in
+    ContractTxConverter(CTransaction tx, CCoinsViewCache *v, int nHeightIn, const std::vector<CTransactionRef>* blockTxs=nullptr, bool _ignore_sender_check=false)
+            : txBitcoin(tx), view(v), nHeight(nHeightIn), blockTransactions(blockTxs), ignore_sender_check(_ignore_sender_check)
     {}
     // extract contract tx from bitcoin tx info
     bool extractionContractTransactions(ExtractContractTX& contractTx, std::string& error_ret);
+    // the state independent part of extractionContractTransactions: parse the contract outputs
+    // without looking up the coins view, recording the callers to check in contractTx.callers_to_check
+    bool parseContractTransactions(ExtractContractTX& contractTx, std::string& error_ret);
+    // the coins view dependent part of extractionContractTransactions
+    bool checkContractCallers(const ExtractContractTX& contractTx, std::string& error_ret);
 private:
     bool receiveStack(const CScript& scriptPubKey);
-    bool parseContractTXParams(ContractTransactionParams& params, size_t contract_op_vout_index, std::string& error_ret);
+    bool parseContractTXParams(ContractTransactionParams& params, size_t contract_op_vout_index, std::vector<std::string>& callers_to_check, std::string& error_ret);
     ContractTransaction createContractTX(const ContractTransactionParams& etp, const uint32_t nOut);
 private:
     const CTransaction txBitcoin;
     const CCoinsViewCache *view;
+    const int nHeight;
     std::vector<valtype> stack;
     opcodetype opcode;
     const std::vector<CTransactionRef> *blockTransactions;
 	bool ignore_sender_check;
 };
 
+/** Contract outputs of one block transaction, parsed before the transactions are connected */
+struct ContractTxPrecheck
+{
+    bool parsed = false;
+    std::string error;
+    ExtractContractTX contract_tx;
+};
+
+/**
+ * Closure parsing the contract outputs of one transaction into a ContractTxPrecheck.
+ * It always succeeds, a parse failure is reported through the ContractTxPrecheck.
+ */
+class CContractTxCheck
+{
+private:
+    const CTransaction *ptx;
+    int nHeight;
+    ContractTxPrecheck *result;
+
+public:
+    CContractTxCheck(): ptx(nullptr), nHeight(0), result(nullptr) {}
+    CContractTxCheck(const CTransaction& txIn, int nHeightIn, ContractTxPrecheck* resultIn) : ptx(&txIn), nHeight(nHeightIn), result(resultIn) {}
+
+    bool operator()();
+
+    void swap(CContractTxCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nHeight, check.nHeight);
+        std::swap(result, check.result);
+    }
+};
+
+/** A block contract transaction executed ahead of ConnectBlock's loop, on the contract state before the block */
+struct ContractSpeculativeExec
+{
+    bool fExecuted = false; // executed successfully, result is set
+    CAmount nTxFee = 0; // the fee the execution saw
+    ContractExecResult result;
+};
+
+/**
+ * Closure executing a share of a block's contract transactions, in block order, on its own read-only
+ * snapshot of the contract state before the block. It always succeeds: a transaction that fails or throws
+ * is left unexecuted, and ConnectBlock executes it again on the real state.
+ */
+class CContractExecCheck
+{
+private:
+    const CBlock *pblock;
+    const CBlockIndex *pindexPrev;
+    std::shared_ptr<::contract::storage::ContractStorageService> snapshot;
+    std::vector<std::pair<const ExtractContractTX*, ContractSpeculativeExec*>> vTxs;
+
+public:
+    CContractExecCheck(): pblock(nullptr), pindexPrev(nullptr) {}
+    CContractExecCheck(const CBlock& blockIn, const CBlockIndex* pindexPrevIn, std::shared_ptr<::contract::storage::ContractStorageService> snapshotIn) : pblock(&blockIn), pindexPrev(pindexPrevIn), snapshot(snapshotIn) {}
+
+    void Add(const ExtractContractTX* pcontractTx, ContractSpeculativeExec* pexec) { vTxs.emplace_back(pcontractTx, pexec); }
+
+    bool operator()();
+
+    void swap(CContractExecCheck &check) {
+        std::swap(pblock, check.pblock);
+        std::swap(pindexPrev, check.pindexPrev);
+        snapshot.swap(check.snapshot);
+        vTxs.swap(check.vTxs);
+    }
+};
+
+/** The checks of one block header that need no chain state, see PrecheckBlockHeaders */
+struct BlockHeaderPrecheck
+{
+    uint256 hash;
+    // the hash meets the header's own nBits, whether the header needs to is left to CheckBlockHeader
+    bool fPowTarget = false;
+};
+
+/** Closure hashing a run of headers and checking them against their proof of work targets */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    BlockHeaderPrecheck *presults;
+    size_t nCount;
+    const Consensus::Params *pparams;
+
+public:
+    CHeaderCheck(): pheaders(nullptr), presults(nullptr), nCount(0), pparams(nullptr) {}
+    CHeaderCheck(const CBlockHeader* pheadersIn, BlockHeaderPrecheck* presultsIn, size_t nCountIn, const Consensus::Params& params) :
+        pheaders(pheadersIn), presults(presultsIn), nCount(nCountIn), pparams(&params) {}
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(presults, check.presults);
+        std::swap(nCount, check.nCount);
+        std::swap(pparams, check.pparams);
+    }
+};
+
 class ContractExec {
 public:
-    ContractExec(::contract::storage::ContractStorageService* _storage_service, const CBlock& _block, std::vector<ContractTransaction> _txs, const uint64_t _blockGasLimit, CAmount _nTxFee)
-            : storage_service(_storage_service), block(_block), txs(_txs), blockGasLimit(_blockGasLimit), nTxFee(_nTxFee)
-    {}
+    // pindexTip is the tip the contracts are executed on, it must match the state of _storage_service.
+    // the vm reads the chain from it instead of chainActive, so execution doesn't need cs_main
+    ContractExec(::contract::storage::ContractStorageService* _storage_service, const CBlockIndex* _pindexTip, const CBlock& _block, std::vector<ContractTransaction> _txs, const uint64_t _blockGasLimit, CAmount _nTxFee)
+            : storage_service(_storage_service), pindexTip(_pindexTip), block(_block), txs(_txs), blockGasLimit(_blockGasLimit), nTxFee(_nTxFee)
+    {
+        assert(pindexTip);
+    }
     bool performByteCode();
     bool processingResults(ContractExecResult &result);
     std::vector<ResultExecute>& getResult() {return result;}
     bool commit_changes(std::shared_ptr<::contract::storage::ContractStorageService> service);
+private:
+    bool executeByteCode();
+    // key of this execution in the exec result cache, null if it must not be cached
+    uint256 exec_result_cache_key() const;
 private:
 	::contract::storage::ContractStorageService* storage_service;
+	const CBlockIndex* pindexTip;
 public:
     std::vector<ContractTransaction> txs;
     std::vector<ResultExecute> result;
@@ -718,6 +874,11 @@ public:
 };
 
 std::shared_ptr<::contract::storage::ContractStorageService> get_contract_storage_service();
+// private overlay instance of the contract storage, its changes are dropped with it (see ContractStorageService::get_overlay_instance)
+std::shared_ptr<::contract::storage::ContractStorageService> get_contract_storage_overlay();
+// read-only snapshot of the contract storage (see ContractStorageService::get_read_only_snapshot). it is taken
+// under cs_main, so it is the contract state of chainActive.Tip(), and can be used without cs_main afterwards
+std::shared_ptr<::contract::storage::ContractStorageService> get_read_only_contract_storage_service();
 
 std::shared_ptr<std::string> get_root_state_hash_from_block(const CBlock* block);
 
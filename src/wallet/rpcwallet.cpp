@@ -1432,7 +1432,7 @@ UniValue callcontract(const JSONRPCRequest& request)
 		contract_tx.params.version = CONTRACT_MAJOR_VERSION;
 		contractTransactions.push_back(contract_tx);
 
-		ContractExec exec(service.get(), block, contractTransactions, gas_limit, 0);
+		ContractExec exec(service.get(), chainActive.Tip(), block, contractTransactions, gas_limit, 0);
 		if (!exec.performByteCode()) {
 			//error, don't add contract
 			throw JSONRPCError(RPC_INTERNAL_ERROR, exec.pending_contract_exec_result.error_message);
@@ -4,15 +4,18 @@
 
 #include <wallet/wallet.h>
 
+#include <algorithm>
 #include <set>
 #include <stdint.h>
 #include <utility>
 #include <vector>
 
+#include <chainparams.h>
 #include <consensus/validation.h>
 #include <rpc/server.h>
 #include <test/test_bitcoin.h>
 #include <validation.h>
+#include <validationinterface.h>
 #include <wallet/coincontrol.h>
 #include <wallet/test/wallet_test_fixture.h>
 
@@ -699,4 +702,141 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+class StakeCandidatesTestingSetup : public ListCoinsTestingSetup
+{
+public:
+    StakeCandidatesTestingSetup()
+    {
+        // the staking candidates follow the chain through the validation notifications, so deliver them
+        threadGroup.create_thread([this] { scheduler.serviceQueue(); });
+        RegisterValidationInterface(wallet.get());
+    }
+
+    ~StakeCandidatesTestingSetup()
+    {
+        SyncWithValidationInterfaceQueue();
+        UnregisterValidationInterface(wallet.get());
+    }
+
+    void CreateBlock(const std::vector<CMutableTransaction>& txns = {})
+    {
+        CreateAndProcessBlock(txns, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+        SyncWithValidationInterfaceQueue();
+    }
+
+    // The staking coins as a walk over mapWallet picked them before the wallet kept an index of them
+    std::vector<COutPoint> WalletStakingCoins()
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        std::vector<COutPoint> vCoins;
+        for (const auto& entry : wallet->mapWallet) {
+            const CWalletTx& wtx = entry.second;
+            int nDepth = wtx.GetDepthInMainChain();
+            if (nDepth < 1 || nDepth < Params().GetConsensus().nStakeMinConfirmations || wtx.GetBlocksToMaturity() > 0)
+                continue;
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                if (!wallet->IsSpent(entry.first, i) && wallet->IsMine(wtx.tx->vout[i]) && wtx.tx->vout[i].nValue > 0)
+                    vCoins.push_back(COutPoint(entry.first, i));
+            }
+        }
+        return vCoins;
+    }
+
+    std::vector<COutPoint> IndexedStakingCoins()
+    {
+        std::vector<std::pair<COutPoint, CStakeCandidate> > vCandidates;
+        CAmount nValue;
+        BOOST_CHECK(wallet->SelectCoinsForStaking(MAX_MONEY, vCandidates, nValue));
+        std::vector<COutPoint> vCoins;
+        CAmount nTotal = 0;
+        for (const auto& candidate : vCandidates) {
+            vCoins.push_back(candidate.first);
+            nTotal += candidate.second.nValue;
+        }
+        BOOST_CHECK_EQUAL(nValue, nTotal);
+        return vCoins;
+    }
+
+    std::vector<COutPoint> CheckStakingCoins()
+    {
+        std::vector<COutPoint> vCoins = IndexedStakingCoins();
+        BOOST_CHECK(vCoins == WalletStakingCoins());
+        return vCoins;
+    }
+};
+
+static bool Contains(const std::vector<COutPoint>& vCoins, const COutPoint& outpoint)
+{
+    return std::find(vCoins.begin(), vCoins.end(), outpoint) != vCoins.end();
+}
+
+BOOST_FIXTURE_TEST_CASE(StakeCandidates, StakeCandidatesTestingSetup)
+{
+    // loaded by the first round: only the first coinbase is mature at height 101
+    BOOST_CHECK_EQUAL(CheckStakingCoins().size(), 1);
+
+    // the next coinbase becomes mature as the tip moves, without an update of its own
+    CreateBlock();
+    BOOST_CHECK_EQUAL(CheckStakingCoins().size(), 2);
+
+    // a spend in the mempool takes its coin out of the selection
+    CWalletTx wtx;
+    CReserveKey reservekey(wallet.get());
+    CAmount fee;
+    int changePos = -1;
+    std::string error;
+    CCoinControl dummy;
+    BOOST_REQUIRE(wallet->CreateTransaction({CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false}}, wtx, reservekey, fee, changePos, error, dummy));
+    CValidationState state;
+    BOOST_REQUIRE(wallet->CommitTransaction(wtx, reservekey, nullptr, state));
+    SyncWithValidationInterfaceQueue();
+    BOOST_REQUIRE_NE(changePos, -1);
+    const COutPoint spent = wtx.tx->vin[0].prevout;
+    const COutPoint change(wtx.GetHash(), changePos);
+    std::vector<COutPoint> vCoins = CheckStakingCoins();
+    BOOST_CHECK_EQUAL(vCoins.size(), 1);
+    BOOST_CHECK(!Contains(vCoins, spent));
+
+    // confirmed, the change needs nStakeMinConfirmations before it can stake
+    CreateBlock({CMutableTransaction(*wtx.tx)});
+    CBlockIndex* pindexSpend = chainActive.Tip();
+    const int nChangeMatureHeight = pindexSpend->nHeight + Params().GetConsensus().nStakeMinConfirmations - 1;
+    while (chainActive.Height() < nChangeMatureHeight) {
+        vCoins = CheckStakingCoins();
+        BOOST_CHECK(!Contains(vCoins, spent));
+        BOOST_CHECK(!Contains(vCoins, change));
+        CreateBlock();
+    }
+    vCoins = CheckStakingCoins();
+    BOOST_CHECK(!Contains(vCoins, spent));
+    BOOST_CHECK(Contains(vCoins, change));
+    const std::vector<COutPoint> vCoinsBeforeReorg = vCoins;
+
+    // disconnecting the spend drops its change, and its coin stays out while the spend is back in the mempool
+    {
+        LOCK(cs_main);
+        InvalidateBlock(state, Params(), pindexSpend);
+    }
+    ActivateBestChain(state, Params());
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(chainActive.Height(), pindexSpend->nHeight - 1);
+    vCoins = CheckStakingCoins();
+    BOOST_CHECK_EQUAL(vCoins.size(), 1);
+    BOOST_CHECK(!Contains(vCoins, spent));
+    BOOST_CHECK(!Contains(vCoins, change));
+
+    // a shorter branch without the spend, then a reorg back to the chain with it
+    CreateBlock();
+    CreateBlock();
+    CheckStakingCoins();
+    {
+        LOCK(cs_main);
+        ResetBlockFailureFlags(pindexSpend);
+    }
+    ActivateBestChain(state, Params());
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(chainActive.Height(), nChangeMatureHeight);
+    BOOST_CHECK(CheckStakingCoins() == vCoinsBeforeReorg);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
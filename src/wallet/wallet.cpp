@@ -34,6 +34,7 @@
 
 #include <assert.h>
 #include <future>
+#include <limits>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -1289,6 +1290,8 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
     if (!AddToWalletIfInvolvingMe(ptx, pindex, posInBlock, true))
         return; // Not one of ours
 
+    UpdateStakeCandidates(tx);
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1777,7 +1780,8 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                     break;
                 }
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    if (AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate))
+                        UpdateStakeCandidates(*block.vtx[posInBlock]);
                 }
             } else {
                 ret = pindex;
@@ -4482,72 +4486,99 @@ CTxDestination CWallet::AddAndGetDestinationForScript(const CScript& script, Out
 
 
 
-// Select some coins without random shuffle or best subset approximation
-bool CWallet::SelectCoinsForStaking(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
+void CWallet::LoadStakeCandidates()
 {
-    std::vector<COutput> vCoins;
-    AvailableCoinsForStaking(vCoins);
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    setCoinsRet.clear();
-    nValueRet = 0;
+    mapStakeCandidates.clear();
+    for (const auto& entry : mapWallet)
+        UpdateStakeCandidates(entry.first);
+    fStakeCandidatesLoaded = true;
+}
 
-    for(const COutput& output: vCoins)
-    {
-        const CWalletTx *pcoin = output.tx;
-        int i = output.i;
+void CWallet::UpdateStakeCandidates(const CTransaction& tx)
+{
+    if (!fStakeCandidatesLoaded)
+        return;
 
-        // Stop if we've chosen enough inputs
-        if (nValueRet >= nTargetValue)
-            break;
+    UpdateStakeCandidates(tx.GetHash());
+    // the outputs it spends are no longer candidates once it confirms, and again once it is disconnected
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash))
+            UpdateStakeCandidates(txin.prevout.hash);
+    }
+}
 
-        int64_t n = pcoin->tx->vout[i].nValue;
+void CWallet::UpdateStakeCandidates(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-        std::pair<int64_t,std::pair<const CWalletTx*,unsigned int> > coin = std::make_pair(n,std::make_pair(pcoin, i));
+    auto it = mapWallet.find(hash);
+    if (it == mapWallet.end()) {
+        mapStakeCandidates.erase(mapStakeCandidates.lower_bound(COutPoint(hash, 0)), mapStakeCandidates.upper_bound(COutPoint(hash, std::numeric_limits<uint32_t>::max())));
+        return;
+    }
 
-        if (n >= nTargetValue)
-        {
-            // If input value is greater or equal to target then simply insert
-            //    it into the current subset and exit
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            break;
-        }
-        else if (n < nTargetValue + CENT)
-        {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
+    const CWalletTx& wtx = it->second;
+    int nDepth = wtx.GetDepthInMainChain();
+    int nHeight = chainActive.Height() - nDepth + 1;
+    // nStakeMinConfirmations deep, and past the maturity of coinbase and coinstake outputs
+    int nMatureHeight = nHeight + Params().GetConsensus().nStakeMinConfirmations - 1;
+    if (wtx.IsCoinBase() || wtx.IsCoinStake())
+        nMatureHeight = std::max(nMatureHeight, nHeight + getCoinBaseMaturity(nHeight));
+
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        COutPoint outpoint(hash, i);
+        const CTxOut& txout = wtx.tx->vout[i];
+
+        bool fSpentInMainChain = false;
+        std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+        for (TxSpends::const_iterator spend = range.first; spend != range.second && !fSpentInMainChain; ++spend) {
+            auto mit = mapWallet.find(spend->second);
+            fSpentInMainChain = mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0;
+        }
+
+        if (nDepth <= 0 || fSpentInMainChain || txout.nValue <= 0 || IsMine(txout) == ISMINE_NO) {
+            mapStakeCandidates.erase(outpoint);
+            continue;
         }
-    }
 
-    return true;
+        CStakeCandidate& candidate = mapStakeCandidates[outpoint];
+        candidate.nValue = txout.nValue;
+        candidate.nMatureHeight = nMatureHeight;
+        std::vector<std::vector<unsigned char> > vSolutions;
+        Solver(txout.scriptPubKey, candidate.type, vSolutions);
+    }
 }
 
-
-void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins) const
+// Select some coins without random shuffle or best subset approximation
+bool CWallet::SelectCoinsForStaking(CAmount nTargetValue, std::vector<std::pair<COutPoint, CStakeCandidate> >& vCoinsRet, CAmount& nValueRet)
 {
-    vCoins.clear();
+    LOCK2(cs_main, cs_wallet);
 
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
+    if (!fStakeCandidatesLoaded)
+        LoadStakeCandidates();
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 1)
-                continue;
+    vCoinsRet.clear();
+    nValueRet = 0;
 
-            if (nDepth < Params().GetConsensus().nStakeMinConfirmations)
-                continue;
+    int nHeight = chainActive.Height();
+    for (const auto& entry : mapStakeCandidates)
+    {
+        // Stop if we've chosen enough inputs
+        if (nValueRet >= nTargetValue)
+            break;
 
-            if (pcoin->GetBlocksToMaturity() > 0)
-                continue;
+        if (entry.second.nMatureHeight > nHeight || IsSpent(entry.first.hash, entry.first.n))
+            continue;
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++)
-                if (!IsSpent(it->first, i) && IsMine(pcoin->tx->vout[i]) && pcoin->tx->vout[i].nValue> 0)
-                    vCoins.push_back(COutput(pcoin, i, nDepth, true, true, true));
-        }
+        vCoinsRet.push_back(entry);
+        nValueRet += entry.second.nValue;
     }
+
+    return true;
 }
 
 
@@ -557,6 +557,16 @@ public:
     std::string ToString() const;
 };
 
+/** A confirmed wallet output that can stake once the tip reaches nMatureHeight */
+struct CStakeCandidate
+{
+    CAmount nValue;
+    int nMatureHeight;
+    txnouttype type;
+
+    CStakeCandidate() : nValue(0), nMatureHeight(0), type(TX_NONSTANDARD) {}
+};
+
 
 
 
@@ -721,6 +731,17 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Staking candidates: the confirmed outputs of the wallet that are not spent in the main chain.
+     * Kept up to date from SyncTransaction and rescans once loaded by the first staking round.
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    bool fStakeCandidatesLoaded = false;
+    void LoadStakeCandidates();
+    /* Update the staking candidates of a transaction's outputs and of the outputs it spends. */
+    void UpdateStakeCandidates(const CTransaction& tx);
+    void UpdateStakeCandidates(const uint256& hash);
+
     /* Used by TransactionAddedToMemorypool/BlockConnected/Disconnected.
      * Should be called with pindexBlock and posInBlock if this is for a transaction that is included in a block. */
     void SyncTransaction(const CTransactionRef& tx, const CBlockIndex *pindex = nullptr, int posInBlock = 0);
@@ -1185,8 +1206,8 @@ public:
     CTxDestination AddAndGetDestinationForScript(const CScript& script, OutputType);
     
     // for staking
-    bool SelectCoinsForStaking(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
-    void AvailableCoinsForStaking(std::vector<COutput>& vCoins) const;
+    /** Select the unspent staking candidates that are mature at the current tip, in outpoint order, until their value reaches nTargetValue */
+    bool SelectCoinsForStaking(CAmount nTargetValue, std::vector<std::pair<COutPoint, CStakeCandidate> >& vCoinsRet, CAmount& nValueRet);
     
 };
 